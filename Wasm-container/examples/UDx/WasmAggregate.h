@@ -0,0 +1,43 @@
+/*
+ * Aggregates for the Wasm UDxes, over udx_aggregate_*() (udx_wasm.h).
+ * The accumulator is the function's one VARBINARY intermediate, which
+ * the calls read and write in place.  aggregate() gathers the block's
+ * column (nulls in a ValidityBitmap, see WasmNulls.h) and folds it in
+ * with one udx_aggregate_update_i64(); combine() folds in all of the
+ * other accumulators with one udx_aggregate_combine().
+ */
+#ifndef WasmAggregate_h
+#define WasmAggregate_h
+
+#include "Vertica.h"
+#include <vector>
+#include "WasmNulls.h"
+extern "C" {
+#include "udx_wasm.h"
+}
+
+// The accumulator an intermediate holds; reports an error if it can't
+// be one
+inline char* aggregateState(const Vertica::VString &state,
+                            const struct udx_aggregate &aggregate,
+                            const char* wasm_file)
+{
+    if(state.isNull() || state.length() != aggregate.state_size) {
+        vt_report_error(0, "Intermediate of %zu bytes is not a %zu byte accumulator for %s",
+                        static_cast<size_t>(state.length()), aggregate.state_size, wasm_file);
+    }
+    return const_cast<char*>(state.data());
+}
+
+// Gather one row of an int argument, nulls as 0
+inline void gatherInt(Vertica::BlockReader &argReader,
+                      size_t column,
+                      std::vector<long long> &values,
+                      ValidityBitmap &valid)
+{
+    const bool row_valid = ! argReader.isNull(column);
+    valid.push_back(row_valid);
+    values.push_back(row_valid ? argReader.getIntRef(column) : 0);
+}
+
+#endif // WasmAggregate_h
@@ -0,0 +1,151 @@
+/*
+ * Engine options for the Wasm UDxs, as USING PARAMETERS:
+ *
+ *   SELECT cFibUDx_fibFactory(num USING PARAMETERS compiler='llvm',
+ *          cpu_features='avx2,bmi2', canonicalize_nans=true, simd='on') FROM t5;
+ *
+ * call_budget=N fails any call into Wasm that runs more than about N
+ * Wasm instructions, and is the only way to bound a runaway call by
+ * itself.  Cancelling the query (each function's cancel() calls
+ * udx_interrupt()) fails every later call, but the call that is running
+ * when the query is cancelled keeps going, up to its budget, unless
+ * interruptible=true: then the module is compiled to check for the
+ * interrupt in every loop and call, and that call fails too:
+ *
+ *   SELECT cFibUDx_fibFactory(num USING PARAMETERS call_budget=100000000) FROM t5;
+ *   SELECT cFibUDx_fibFactory(num USING PARAMETERS interruptible=true) FROM t5;
+ *
+ * Anything not given comes from the environment of the Vertica server
+ * (UDX_WASM_COMPILER, UDX_WASM_CPU_FEATURES, UDX_WASM_CANONICALIZE_NANS,
+ * UDX_WASM_SIMD, UDX_WASM_CALL_BUDGET, UDX_WASM_INTERRUPTIBLE; see
+ * udx_wasm.h), and then from the wasmer defaults.
+ */
+#ifndef WasmEngineParameters_h
+#define WasmEngineParameters_h
+
+#include "Vertica.h"
+#include <string>
+extern "C" {
+#include "udx_wasm.h"
+}
+
+#ifdef WASM_EMBEDDED
+// Built with EMBED=wasm or EMBED=aot: the module is linked into this
+// library (wasm_embed.S), and setup reads no files
+extern "C" const char udx_embedded_wasm[];
+extern "C" const unsigned long long udx_embedded_wasm_size;
+#endif
+
+// Cancelling a Wasm function: derive the function class from this,
+// around the Vertica class it would otherwise derive from,
+//     class cFibUDx_fib : public WasmCancelable<ScalarFunction>
+// and get its state with getWasmState() in setup()
+template <class Function>
+class WasmCancelable : public Function
+{
+    // raised by cancel(); part of the function object rather than of the
+    // state, so cancel() is safe even while setup() or destroy() is
+    // creating or freeing the state
+    struct udx_interrupt interrupt = UDX_INTERRUPT_INIT;
+
+    protected:
+    // udx_get_wasm_state(), watching this function's interrupt
+    void* getWasmState()
+    {
+        void* ws = udx_get_wasm_state();
+        udx_watch_interrupt(ws, &interrupt);
+        return ws;
+    }
+
+    public:
+    // Vertica calls this from another thread: every later call into
+    // Wasm fails, and so does the one that is running if the engine is
+    // interruptible; otherwise call_budget bounds it
+    virtual void cancel(Vertica::ServerInterface &srvInterface)
+    {
+        udx_interrupt(&interrupt);
+    }
+};
+
+// For the factory's getParameterType()
+inline void addWasmEngineParameters(Vertica::SizedColumnTypes &parameterTypes)
+{
+    parameterTypes.addVarchar(16, "compiler");
+    parameterTypes.addVarchar(128, "cpu_features");
+    parameterTypes.addBool("canonicalize_nans");
+    parameterTypes.addVarchar(8, "simd");
+    parameterTypes.addInt("call_budget");
+    parameterTypes.addBool("interruptible");
+}
+
+// The engine options from the query's parameters, over the ones from
+// the environment.  options->cpu_features points into *cpu_features,
+// which must outlive its use.  Reports an error (and so doesn't
+// return) on a bad value.
+inline void getWasmEngineOptions(Vertica::ServerInterface &srvInterface,
+                                 struct udx_engine_options* options,
+                                 std::string* cpu_features)
+{
+    if(! udx_default_engine_options(options)) {
+        vt_report_error(0, "UDX_WASM_COMPILER or UDX_WASM_SIMD is set to an unknown value");
+    }
+    Vertica::ParamReader params = srvInterface.getParamReader();
+    if(params.containsParameter("compiler")) {
+        const std::string compiler = params.getStringRef("compiler").str();
+        if(! udx_parse_compiler(compiler.c_str(), &options->compiler)) {
+            vt_report_error(0, "Unknown compiler '%s'; use default, singlepass, cranelift, or llvm",
+                            compiler.c_str());
+        }
+    }
+    if(params.containsParameter("cpu_features")) {
+        *cpu_features = params.getStringRef("cpu_features").str();
+        options->cpu_features = cpu_features->c_str();
+    }
+    if(params.containsParameter("canonicalize_nans")) {
+        options->canonicalize_nans = params.getBoolRef("canonicalize_nans") == Vertica::vbool_true;
+    }
+    if(params.containsParameter("simd")) {
+        const std::string simd = params.getStringRef("simd").str();
+        if(! udx_parse_simd(simd.c_str(), &options->simd)) {
+            vt_report_error(0, "Unknown simd setting '%s'; use auto, on, or off", simd.c_str());
+        }
+    }
+    if(params.containsParameter("call_budget")) {
+        const Vertica::vint budget = params.getIntRef("call_budget");
+        if(budget < 0) {
+            vt_report_error(0, "call_budget must be 0 (no limit) or more, not %lld",
+                            static_cast<long long>(budget));
+        }
+        options->call_budget = static_cast<unsigned long long>(budget);
+    }
+    if(params.containsParameter("interruptible")) {
+        options->interruptible = params.getBoolRef("interruptible") == Vertica::vbool_true;
+    }
+}
+
+// For the function's setup(): udx_setup() with the options from the
+// query's parameters.  Reports an error (and so doesn't return) on failure.
+inline void setupWasmWithParameters(Vertica::ServerInterface &srvInterface,
+                                    const char* wasm_file,
+                                    void* ws,
+                                    const char* func_name)
+{
+    struct udx_engine_options options;
+    // udx_setup_with_options() copies what it needs, so this only has
+    // to outlive the call
+    std::string cpu_features;
+    getWasmEngineOptions(srvInterface, &options, &cpu_features);
+
+    char* error_str;
+#ifdef WASM_EMBEDDED
+    if(! udx_setup_from_memory_with_options(wasm_file, udx_embedded_wasm, udx_embedded_wasm_size,
+                                            ws, func_name, &options, &error_str)) {
+#else
+    if(! udx_setup_with_options(wasm_file, ws, func_name, &options, &error_str)) {
+#endif
+        vt_report_error(0, "Cannot initialize wasm from %s; %s", wasm_file, error_str);
+    }
+    srvInterface.log("%s: %s on %s", wasm_file, func_name, udx_describe_engine(ws));
+}
+
+#endif // WasmEngineParameters_h
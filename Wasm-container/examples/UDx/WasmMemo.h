@@ -0,0 +1,62 @@
+/*
+ * Memoizing the Wasm UDxes whose functions are pure (see udx_memo.hpp):
+ * factories that declare their functions IMMUTABLE take a memo_entries
+ * parameter, and each function object then keeps a cache of that many
+ * results, looked up before every call into Wasm:
+ *
+ *   SELECT rustFibUDx_fib(c1 USING PARAMETERS memo_entries=16384) FROM t3;
+ *
+ * With no memo_entries (or 0) nothing is cached.  The cache is per
+ * function object, so it lasts for one query on one thread, and is
+ * bounded at about memo_entries * 24 bytes for 8-byte keys and
+ * results.  destroy() logs how many lookups hit.
+ */
+#ifndef WasmMemo_h
+#define WasmMemo_h
+
+#include "Vertica.h"
+#include "udx_memo.hpp"
+
+// Enough for any domain worth caching, and still only ~400 MiB
+static const Vertica::vint MEMO_MAX_ENTRIES = 1 << 24;
+
+// For the factory's getParameterType(); only for factories with
+// vol = IMMUTABLE
+inline void addMemoParameters(Vertica::SizedColumnTypes &parameterTypes)
+{
+    parameterTypes.addInt("memo_entries");
+}
+
+// The memo_entries parameter, 0 if it wasn't given.  Reports an error
+// (and so doesn't return) on a bad value.
+inline size_t getMemoEntries(Vertica::ServerInterface &srvInterface)
+{
+    Vertica::ParamReader params = srvInterface.getParamReader();
+    if(! params.containsParameter("memo_entries")) {
+        return 0;
+    }
+    const Vertica::vint entries = params.getIntRef("memo_entries");
+    if(entries < 0 || entries > MEMO_MAX_ENTRIES) {
+        vt_report_error(0, "memo_entries must be from 0 (no cache) to %lld, not %lld",
+                        static_cast<long long>(MEMO_MAX_ENTRIES), static_cast<long long>(entries));
+    }
+    return static_cast<size_t>(entries);
+}
+
+// For the function's destroy(), if it has a cache
+template <typename K, typename V>
+void logMemoStats(Vertica::ServerInterface &srvInterface,
+                  const char* wasm_file,
+                  const udx_wasm::MemoCache<K, V> &memo)
+{
+    if(! memo.enabled()) {
+        return;
+    }
+    const unsigned long long lookups = memo.lookups();
+    srvInterface.log("%s: memo: %llu lookups, %llu hits (%.1f%%), %llu evictions, %zu entries (%zu KiB)",
+                     wasm_file, lookups, memo.hits(),
+                     lookups ? 100.0 * memo.hits() / lookups : 0.0,
+                     memo.evictions(), memo.capacity(), memo.bytes() / 1024);
+}
+
+#endif // WasmMemo_h
@@ -0,0 +1,89 @@
+/*
+ * Nulls for the column-batch Wasm UDxes.  processBlock gathers every
+ * row of the block (nulls as 0) and a validity bitmap in the layout of
+ * udx_call_batch_masked_2i_1i() (udx_wasm.h); chunks without nulls run
+ * the plain batch kernel, and the results go back with the nulls where
+ * they were.  A block with no nulls at all --- the usual case for NOT
+ * NULL columns --- passes no bitmap and writes its results without
+ * testing a row.
+ */
+#ifndef WasmNulls_h
+#define WasmNulls_h
+
+#include "Vertica.h"
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+// One bit per row, set if the row is not null; reused from block to
+// block like the columns
+class ValidityBitmap
+{
+    std::vector<unsigned char> bits;
+    size_t rows;
+    size_t nulls;
+    public:
+    ValidityBitmap() : rows(0), nulls(0) {}
+
+    void clear() {
+        bits.clear();
+        rows = 0;
+        nulls = 0;
+    }
+
+    void push_back(bool valid) {
+        if(rows % 8 == 0) {
+            bits.push_back(0);
+        }
+        bits.back() |= static_cast<unsigned char>(valid) << (rows % 8);
+        nulls += ! valid;
+        ++rows;
+    }
+
+    size_t null_count() const { return nulls; }
+
+    // For udx_call_batch_masked_*: NULL when no row is null
+    const unsigned char* data() const { return nulls ? bits.data() : NULL; }
+
+    unsigned char byte(size_t i) const { return bits[i]; }
+
+    bool valid(size_t row) const { return (bits[row / 8] >> (row % 8)) & 1; }
+};
+
+// Write one result per row, and a null where valid has one.  Bytes of
+// the bitmap with all eight rows valid are written without a test.
+template <typename T>
+void writeIntColumn(Vertica::BlockWriter &resWriter,
+                    const std::vector<T> &results,
+                    const ValidityBitmap &valid)
+{
+    const size_t n = results.size();
+    if(valid.null_count() == 0) {
+        for(size_t row = 0; row < n; ++row) {
+            resWriter.setInt(static_cast<Vertica::vint>(results[row]));
+            resWriter.next();
+        }
+        return;
+    }
+    for(size_t first = 0; first < n; first += 8) {
+        const unsigned char bits = valid.byte(first / 8);
+        const size_t end = std::min(n, first + 8);
+        if(bits == 0xff) {
+            for(size_t row = first; row < end; ++row) {
+                resWriter.setInt(static_cast<Vertica::vint>(results[row]));
+                resWriter.next();
+            }
+            continue;
+        }
+        for(size_t row = first; row < end; ++row) {
+            if((bits >> (row - first)) & 1) {
+                resWriter.setInt(static_cast<Vertica::vint>(results[row]));
+            } else {
+                resWriter.setNull();
+            }
+            resWriter.next();
+        }
+    }
+}
+
+#endif // WasmNulls_h
@@ -0,0 +1,171 @@
+/*
+ * The udx_wasm counters (see struct udx_wasm_stats in udx_wasm.h) for
+ * the Wasm UDxes: each function logs its own at destroy() time, and
+ * every library has a stats table function with the totals of all the
+ * functions that have finished on this node since it was loaded:
+ *
+ *   SELECT cWasmUDx_stats() OVER ();
+ *
+ * and a trace function that turns setup tracing on or off and writes
+ * the trace so far (see udx_trace_dump() in udx_wasm.h) on this node:
+ *
+ *   SELECT cWasmUDx_trace(USING PARAMETERS tracing=true) OVER ();
+ *   ... queries ...
+ *   SELECT cWasmUDx_trace(USING PARAMETERS file='setup.json') OVER ();
+ *
+ * The file is only a name: it goes in the node's UDx log directory, or
+ * in $UDX_WASM_TRACE_DIR if the server's environment sets it, so a
+ * query can't write anywhere else the server may.
+ */
+#ifndef WasmStats_h
+#define WasmStats_h
+
+#include "Vertica.h"
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+extern "C" {
+#include "udx_wasm.h"
+}
+
+// For the function's destroy(), before udx_cleanup()
+inline void logWasmStats(Vertica::ServerInterface &srvInterface,
+                         const char* wasm_file,
+                         void* ws)
+{
+    struct udx_wasm_stats stats;
+    char line[512];
+    udx_get_stats(ws, &stats);
+    udx_format_stats(&stats, line, sizeof(line));
+    srvInterface.log("%s: %s", wasm_file, line);
+}
+
+// One row of counters
+class WasmStats : public Vertica::TransformFunction
+{
+    virtual void processPartition(Vertica::ServerInterface &srvInterface,
+                                  Vertica::PartitionReader &inputReader,
+                                  Vertica::PartitionWriter &outputWriter)
+    {
+        struct udx_wasm_stats stats;
+        udx_get_process_stats(&stats);
+        const unsigned long long values[] = {
+            stats.setups, stats.module_cache_hits, stats.instance_pool_hits, stats.load_ns,
+            stats.compile_ns, stats.instantiate_ns, stats.calls, stats.rows, stats.traps,
+            stats.sampled_calls, stats.call_ns
+        };
+        for(size_t i = 0; i < sizeof(values)/sizeof(values[0]); ++i) {
+            outputWriter.setInt(i, static_cast<Vertica::vint>(values[i]));
+        }
+        outputWriter.next();
+    }
+};
+
+// Each library registers its own subclass, e.g.
+//     class cWasmUDx_statsFactory : public WasmStatsFactory {};
+//     RegisterFactory(cWasmUDx_statsFactory);
+class WasmStatsFactory : public Vertica::TransformFunctionFactory
+{
+    virtual Vertica::TransformFunction *createTransformFunction(Vertica::ServerInterface &interface)
+    { return Vertica::vt_createFuncObject<WasmStats>(interface.allocator); }
+
+    virtual void getPrototype(Vertica::ServerInterface &interface,
+                              Vertica::ColumnTypes &argTypes,
+                              Vertica::ColumnTypes &returnType)
+    {
+        for(int i = 0; i < 11; ++i) {
+            returnType.addInt();
+        }
+    }
+
+    virtual void getReturnType(Vertica::ServerInterface &interface,
+                               const Vertica::SizedColumnTypes &inputTypes,
+                               Vertica::SizedColumnTypes &outputTypes)
+    {
+        outputTypes.addInt("setups");
+        outputTypes.addInt("module_cache_hits");
+        outputTypes.addInt("instance_pool_hits");
+        outputTypes.addInt("load_ns");
+        outputTypes.addInt("compile_ns");
+        outputTypes.addInt("instantiate_ns");
+        outputTypes.addInt("calls");
+        outputTypes.addInt("rows");
+        outputTypes.addInt("traps");
+        outputTypes.addInt("sampled_calls");
+        outputTypes.addInt("call_ns");
+    }
+};
+
+// Where the trace function writes, relative to the working directory
+// Vertica runs UDxes in (the node's catalog directory), unless
+// UDX_WASM_TRACE_DIR says otherwise
+#define WASM_TRACE_DIR "UDxLogs"
+
+// A file in that directory: no "/" to leave it, and no ".."
+inline bool isTraceFileName(const std::string &file)
+{
+    return ! file.empty()
+        && file.find('/') == std::string::npos
+        && file.find("..") == std::string::npos;
+}
+
+// One row: how many trace events were written (0 without file)
+class WasmTrace : public Vertica::TransformFunction
+{
+    virtual void processPartition(Vertica::ServerInterface &srvInterface,
+                                  Vertica::PartitionReader &inputReader,
+                                  Vertica::PartitionWriter &outputWriter)
+    {
+        Vertica::ParamReader params = srvInterface.getParamReader();
+        if(params.containsParameter("tracing")) {
+            udx_trace_enable(params.getBoolRef("tracing") == Vertica::vbool_true);
+        }
+        int events = 0;
+        if(params.containsParameter("file")) {
+            const std::string file = params.getStringRef("file").str();
+            if(! isTraceFileName(file)) {
+                vt_report_error(0, "The trace file must be a file name, without '/' or '..': %s",
+                                file.c_str());
+            }
+            const char* dir = getenv("UDX_WASM_TRACE_DIR");
+            const std::string path = std::string(dir && *dir ? dir : WASM_TRACE_DIR) + "/" + file;
+            events = udx_trace_dump(path.c_str());
+            if(events < 0) {
+                vt_report_error(0, "Cannot write the trace to %s: %s", path.c_str(), strerror(errno));
+            }
+        }
+        outputWriter.setInt(0, events);
+        outputWriter.next();
+    }
+};
+
+// Registered like WasmStatsFactory
+class WasmTraceFactory : public Vertica::TransformFunctionFactory
+{
+    virtual Vertica::TransformFunction *createTransformFunction(Vertica::ServerInterface &interface)
+    { return Vertica::vt_createFuncObject<WasmTrace>(interface.allocator); }
+
+    virtual void getParameterType(Vertica::ServerInterface &interface,
+                                  Vertica::SizedColumnTypes &parameterTypes)
+    {
+        parameterTypes.addVarchar(255, "file");
+        parameterTypes.addBool("tracing");
+    }
+
+    virtual void getPrototype(Vertica::ServerInterface &interface,
+                              Vertica::ColumnTypes &argTypes,
+                              Vertica::ColumnTypes &returnType)
+    {
+        returnType.addInt();
+    }
+
+    virtual void getReturnType(Vertica::ServerInterface &interface,
+                               const Vertica::SizedColumnTypes &inputTypes,
+                               Vertica::SizedColumnTypes &outputTypes)
+    {
+        outputTypes.addInt("events");
+    }
+};
+
+#endif // WasmStats_h
@@ -0,0 +1,123 @@
+/*
+ * String columns for the Wasm UDxes, in the layout of
+ * udx_call_batch_str_str() (udx_wasm.h): processBlock gathers the
+ * block's strings back to back, with their offsets, so each chunk goes
+ * into linear memory with one copy, and the results are copied from
+ * linear memory straight into BlockWriter's strings.  Nulls are kept
+ * in a ValidityBitmap (WasmNulls.h) and go in as empty strings.
+ * Transforms over udx_call_batch_str_rows() gather a batch of a
+ * partition's rows the same way and write the rows that come back with
+ * a RowWriter.
+ */
+#ifndef WasmStrings_h
+#define WasmStrings_h
+
+#include "Vertica.h"
+#include <vector>
+#include "WasmNulls.h"
+
+// Reused from block to block, so it stops allocating once it has grown
+// to the largest block
+class StringColumn
+{
+    std::vector<char> bytes;
+    std::vector<unsigned> offsets_;
+    public:
+    StringColumn() : offsets_(1, 0) {}
+
+    void clear() {
+        bytes.clear();
+        offsets_.resize(1);
+    }
+
+    void push_back(const char* data, size_t length) {
+        bytes.insert(bytes.end(), data, data + length);
+        offsets_.push_back(static_cast<unsigned>(bytes.size()));
+    }
+
+    size_t size() const { return offsets_.size() - 1; }
+    const char* data() const { return bytes.data(); }
+    const unsigned* offsets() const { return offsets_.data(); }
+};
+
+// Gather one row of a string argument
+inline void gatherString(Vertica::BlockReader &argReader,
+                         size_t column,
+                         StringColumn &strings,
+                         ValidityBitmap &valid)
+{
+    const Vertica::VString &s = argReader.getStringRef(column);
+    const bool row_valid = ! s.isNull();
+    valid.push_back(row_valid);
+    if(row_valid) {
+        strings.push_back(s.data(), s.length());
+    } else {
+        strings.push_back(NULL, 0);
+    }
+}
+
+// The sink for udx_call_batch_str_str(): writes each chunk's results
+// to the block, with the nulls where they were
+class StringWriter
+{
+    Vertica::BlockWriter &resWriter;
+    const ValidityBitmap &valid;
+    size_t row;
+    public:
+    StringWriter(Vertica::BlockWriter &resWriter, const ValidityBitmap &valid)
+        : resWriter(resWriter), valid(valid), row(0) {}
+
+    static void sink(void* context, const char* data, const unsigned* offsets, size_t rows) {
+        StringWriter* writer = static_cast<StringWriter*>(context);
+        const bool any_nulls = writer->valid.null_count() != 0;
+        for(size_t i = 0; i < rows; ++i, ++writer->row) {
+            if(any_nulls && ! writer->valid.valid(writer->row)) {
+                writer->resWriter.setNull();
+            } else {
+                writer->resWriter.getStringRef().copy(data + offsets[i], offsets[i + 1] - offsets[i]);
+            }
+            writer->resWriter.next();
+        }
+    }
+};
+
+// The sink for udx_call_batch_str_rows(): writes each output row to
+// the partition as its input row's key (column 0, null where keys_valid
+// has one), the int columns and then the string
+class RowWriter
+{
+    Vertica::PartitionWriter &outputWriter;
+    const std::vector<Vertica::vint> &keys;
+    const ValidityBitmap &keys_valid;
+    const size_t int_columns;
+    public:
+    RowWriter(Vertica::PartitionWriter &outputWriter,
+              const std::vector<Vertica::vint> &keys,
+              const ValidityBitmap &keys_valid,
+              size_t int_columns)
+        : outputWriter(outputWriter), keys(keys), keys_valid(keys_valid),
+          int_columns(int_columns) {}
+
+    static void sink(void* context, size_t first_row, const unsigned* source,
+                     const long long* ints, const char* data, const unsigned* offsets,
+                     size_t rows) {
+        RowWriter* writer = static_cast<RowWriter*>(context);
+        Vertica::PartitionWriter &out = writer->outputWriter;
+        const size_t k = writer->int_columns;
+        for(size_t i = 0; i < rows; ++i) {
+            const size_t row = first_row + source[i];
+            if(writer->keys_valid.valid(row)) {
+                out.setInt(0, writer->keys[row]);
+            } else {
+                out.setNull(0);
+            }
+            for(size_t j = 0; j < k; ++j) {
+                out.setInt(1 + j, static_cast<Vertica::vint>(ints[i * k + j]));
+            }
+            out.getStringRef(1 + k).copy(data + offsets[i], offsets[i + 1] - offsets[i]);
+            out.next();
+        }
+    }
+};
+
+#endif // WasmStrings_h
@@ -0,0 +1,173 @@
+/*
+ * aggregate function for benchmarks, int input, int output: an
+ * approximate count of distinct values (a HyperLogLog sketch) in Wasm,
+ * with the sketch as the intermediate and a block of rows per call
+ */
+#include "Vertica.h"
+#include <vector>
+#include "WasmAggregate.h"
+#include "WasmEngineParameters.h"
+#include "WasmStats.h"
+
+using namespace Vertica;
+
+// The size of distinct.c's registers, which Vertica needs before
+// setup() has loaded the module
+static const size_t DISTINCT_STATE_SIZE = 4096;
+
+class cDistinctUDx_distinct : public WasmCancelable<AggregateFunction>
+{
+    void* ws = NULL;
+    const char* wasm_file;
+    struct udx_aggregate distinct;
+    // reused from block to block
+    std::vector<long long> values;
+    ValidityBitmap valid;
+    std::vector<const void*> others;
+    public:
+    virtual void setup(ServerInterface &srvInterface, const SizedColumnTypes &argtypes) {
+        // WASMFILE is passed as -DWASMFILE=\"absolute-path-of-distinct.c.wasm\"
+        // when compiling
+        wasm_file = WASMFILE;
+        ws = getWasmState();
+        setupWasmWithParameters(srvInterface, wasm_file, ws, "distinct_update");
+        char* error_str;
+        if(! udx_aggregate_lookup(ws, "distinct", &distinct, &error_str)) {
+            vt_report_error(0, "No distinct aggregate in %s; %s", wasm_file, error_str);
+        }
+        if(distinct.state_size != DISTINCT_STATE_SIZE) {
+            vt_report_error(0, "distinct in %s keeps %zu bytes, not %zu",
+                            wasm_file, distinct.state_size, DISTINCT_STATE_SIZE);
+        }
+    }
+
+    virtual void destroy(ServerInterface &srvInterface, const SizedColumnTypes &argtypes) {
+        logWasmStats(srvInterface, wasm_file, ws);
+        udx_cleanup(ws);
+    }
+
+    virtual void initAggregate(ServerInterface &srvInterface, IntermediateAggs &aggs)
+    {
+        VString &state = aggs.getStringRef(0);
+        char *error_str;
+        if(! udx_aggregate_init(&distinct, state.data(), ws, &error_str)) {
+            if(isCanceled()) {
+                return;
+            }
+            vt_report_error(0, "wasm aggregate init in %s failed: %s", wasm_file, error_str);
+        }
+        state.setLen(distinct.state_size);
+    }
+
+    virtual void aggregate(ServerInterface &srvInterface,
+                           BlockReader &argReader,
+                           IntermediateAggs &aggs)
+    {
+        try {
+            values.clear();
+            valid.clear();
+            do {
+                gatherInt(argReader, 0, values, valid);
+            } while (argReader.next());
+
+            char *state = aggregateState(aggs.getStringRef(0), distinct, wasm_file);
+            char *error_str;
+            if(! udx_aggregate_update_i64(&distinct, state, values.data(), valid.data(),
+                                          values.size(), ws, &error_str)) {
+                if(isCanceled()) {
+                    return;
+                }
+                vt_report_error(0, "wasm aggregate call to %s failed: %s", wasm_file, error_str);
+            }
+        } catch(std::exception& e) {
+            // Standard exception. Quit.
+            vt_report_error(0, "Exception while processing block: [%s]", e.what());
+        }
+    }
+
+    virtual void combine(ServerInterface &srvInterface,
+                         IntermediateAggs &aggs,
+                         MultipleIntermediateAggs &aggsOther)
+    {
+        others.clear();
+        do {
+            others.push_back(aggregateState(aggsOther.getStringRef(0), distinct, wasm_file));
+        } while (aggsOther.next());
+
+        char *state = aggregateState(aggs.getStringRef(0), distinct, wasm_file);
+        char *error_str;
+        if(! udx_aggregate_combine(&distinct, state, others.data(), others.size(), ws, &error_str)) {
+            if(isCanceled()) {
+                return;
+            }
+            vt_report_error(0, "wasm aggregate combine in %s failed: %s", wasm_file, error_str);
+        }
+    }
+
+    virtual void terminate(ServerInterface &srvInterface,
+                           BlockWriter &resWriter,
+                           IntermediateAggs &aggs)
+    {
+        const char *state = aggregateState(aggs.getStringRef(0), distinct, wasm_file);
+        long long result;
+        char *error_str;
+        if(! udx_aggregate_terminate_i64(&distinct, state, &result, ws, &error_str)) {
+            if(isCanceled()) {
+                return;
+            }
+            vt_report_error(0, "wasm aggregate terminate in %s failed: %s", wasm_file, error_str);
+        }
+        resWriter.setInt(static_cast<vint>(result));
+    }
+
+    InlineAggregate()
+};
+
+class cDistinctUDx_distinctFactory : public AggregateFunctionFactory
+{
+    virtual AggregateFunction *createAggregateFunction(ServerInterface &interface)
+    { return vt_createFuncObject<cDistinctUDx_distinct>(interface.allocator); }
+
+    // compiler, cpu_features, canonicalize_nans, simd,
+    // call_budget, interruptible; see WasmEngineParameters.h
+    virtual void getParameterType(ServerInterface &interface,
+                                  SizedColumnTypes &parameterTypes)
+    {
+        addWasmEngineParameters(parameterTypes);
+    }
+
+    virtual void getPrototype(ServerInterface &interface,
+                              ColumnTypes &argTypes,
+                              ColumnTypes &returnType)
+    {
+        argTypes.addInt();
+        returnType.addInt();
+    }
+
+    virtual void getReturnType(ServerInterface &interface,
+                               const SizedColumnTypes &inputTypes,
+                               SizedColumnTypes &outputTypes)
+    {
+        outputTypes.addInt();
+    }
+
+    // the sketch's registers
+    virtual void getIntermediateTypes(ServerInterface &interface,
+                                      const SizedColumnTypes &inputTypes,
+                                      SizedColumnTypes &intermediateTypeMetaData)
+    {
+        intermediateTypeMetaData.addVarbinary(DISTINCT_STATE_SIZE);
+    }
+};
+
+RegisterFactory(cDistinctUDx_distinctFactory);
+
+// cDistinctUDx_stats() OVER (): the counters of this library's functions,
+// and cDistinctUDx_trace() OVER (): its setup trace; see WasmStats.h
+class cDistinctUDx_statsFactory : public WasmStatsFactory {};
+
+RegisterFactory(cDistinctUDx_statsFactory);
+
+class cDistinctUDx_traceFactory : public WasmTraceFactory {};
+
+RegisterFactory(cDistinctUDx_traceFactory);
@@ -3,32 +3,41 @@
  */
 #include "Vertica.h"
 #include <sstream>
-extern "C" {
-#include "udx_wasm.h"
-}
+#include <vector>
+#include "WasmEngineParameters.h"
+#include "WasmMemo.h"
+#include "WasmNulls.h"
+#include "WasmStats.h"
+#include "udx_wasm.hpp"
 
 using namespace Vertica;
-class cFibUDx_fib : public ScalarFunction
+class cFibUDx_fib : public WasmCancelable<ScalarFunction>
 {
-    void* ws;
+    void* ws = NULL;
     const char* wasm_file;
+    // checked against the export once, in setup()
+    udx_wasm::WasmFunction<unsigned long long(unsigned long long)> fib;
+    // fib is pure, so with memo_entries set repeated arguments skip
+    // the call; see WasmMemo.h
+    udx_wasm::MemoCache<unsigned long long, unsigned long long> memo;
     public:
     virtual void setup(ServerInterface &srvInterface, const SizedColumnTypes &argtypes) {
-        char* error_str;
         // WASMFILE is passed as -DWASMFILE=\"absolute-path-of-fib.c.wsm\"
         // when compiling
         wasm_file = WASMFILE;
-        ws = udx_get_wasm_state();
+        ws = getWasmState();
         // Identify the function to load from the module
-        if(! udx_setup(wasm_file, ws, "fib", &error_str)) {
-            vt_report_error(0,
-                            "Cannot initialize wasm from %s; %s",
-                            wasm_file,
-                            error_str);
+        setupWasmWithParameters(srvInterface, wasm_file, ws, "fib");
+        char* error_str;
+        if(! fib.bind(ws, &error_str)) {
+            vt_report_error(0, "Wrong signature for fib in %s; %s", wasm_file, error_str);
         }
+        memo.reset(getMemoEntries(srvInterface));
     }
 
     virtual void destroy(ServerInterface &srvInterface, const SizedColumnTypes &argtypes) {
+        logWasmStats(srvInterface, wasm_file, ws);
+        logMemoStats(srvInterface, wasm_file, memo);
         udx_cleanup(ws);
     }
    /*
@@ -50,12 +59,18 @@ class cFibUDx_fib : public ScalarFunction
                     char *error_str;
                     unsigned long long result = 0;
                     const unsigned long long a = static_cast<unsigned long long>(argReader.getIntRef(0));
-                    // Function takes 2 ints, returns 1 int
-                    if(! udx_call_func_ull_ull(a, &result, ws, &error_str)) {
-                        vt_report_error(0,
-                                        "wasm_function_call to %s failed: %s",
-                                        wasm_file,
-                                        error_str);
+                    // Function takes 1 int, returns 1 int
+                    if(! memo.find(a, &result)) {
+                        if(! fib.call(a, &result, &error_str)) {
+                            if(isCanceled()) {
+                                return;
+                            }
+                            vt_report_error(0,
+                                            "wasm_function_call to %s failed: %s",
+                                            wasm_file,
+                                            error_str);
+                        }
+                        memo.insert(a, result);
                     }
                     resWriter.setInt(static_cast<vint>(result & 0xffffffff));
                 }
@@ -70,10 +85,25 @@ class cFibUDx_fib : public ScalarFunction
 
 class cFibUDx_fibFactory : public ScalarFunctionFactory
 {
+    public:
+    // fib depends on nothing but its argument
+    cFibUDx_fibFactory() { vol = IMMUTABLE; }
+
+    private:
     // return an instance of Add2Ints to perform the actual addition.
     virtual ScalarFunction *createScalarFunction(ServerInterface &interface)
     { return vt_createFuncObject<cFibUDx_fib>(interface.allocator); }
 
+    // compiler, cpu_features, canonicalize_nans, simd,
+    // call_budget, interruptible; see WasmEngineParameters.h; and memo_entries; see
+    // WasmMemo.h
+    virtual void getParameterType(ServerInterface &interface,
+                                  SizedColumnTypes &parameterTypes)
+    {
+        addWasmEngineParameters(parameterTypes);
+        addMemoParameters(parameterTypes);
+    }
+
     // This function returns the description of the input and outputs of the
     // Add2Ints class's processBlock function.  It stores this information in
     // two ColumnTypes objects, one for the input parameters, and one for
@@ -90,3 +120,107 @@ class cFibUDx_fibFactory : public ScalarFunctionFactory
 };
 
 RegisterFactory(cFibUDx_fibFactory);
+
+// The same fib, but processBlock gathers the whole block into a column
+// and crosses into Wasm once (fib_batch) instead of once per row.  Nulls
+// go along as a validity bitmap (see WasmNulls.h).
+class cFibUDx_fib_batch : public WasmCancelable<ScalarFunction>
+{
+    void* ws = NULL;
+    const char* wasm_file;
+    // reused from block to block, so they stop allocating once they
+    // have grown to the block size
+    std::vector<unsigned long long> a_col;
+    std::vector<unsigned long long> result_col;
+    ValidityBitmap valid;
+    // fib_batch_masked, for chunks with nulls; see WasmNulls.h
+    int batch_masked;
+    public:
+    virtual void setup(ServerInterface &srvInterface, const SizedColumnTypes &argtypes) {
+        wasm_file = WASMFILE;
+        ws = getWasmState();
+        setupWasmWithParameters(srvInterface, wasm_file, ws, "fib_batch");
+        char* error_str;
+        if(! udx_lookup_function(ws, "fib_batch_masked", &batch_masked, &error_str)) {
+            // null rows are 0, so the plain kernel can run over them
+            batch_masked = UDX_NO_FUNCTION;
+        }
+    }
+
+    virtual void destroy(ServerInterface &srvInterface, const SizedColumnTypes &argtypes) {
+        logWasmStats(srvInterface, wasm_file, ws);
+        udx_cleanup(ws);
+    }
+
+    virtual void processBlock(ServerInterface &srvInterface,
+                              BlockReader &argReader,
+                              BlockWriter &resWriter)
+    {
+        try {
+            a_col.clear();
+            valid.clear();
+            // gather every row, nulls as 0, and which rows are null
+            do {
+                const bool row_valid = ! argReader.isNull(0);
+                valid.push_back(row_valid);
+                a_col.push_back(row_valid ? static_cast<unsigned long long>(argReader.getIntRef(0)) : 0);
+            } while (argReader.next());
+
+            result_col.resize(a_col.size());
+            char *error_str;
+            if(! udx_call_batch_masked_ull_ull(UDX_SETUP_FUNCTION, batch_masked,
+                                               a_col.data(), valid.data(), result_col.data(),
+                                               a_col.size(), ws, &error_str)) {
+                if(isCanceled()) {
+                    return;
+                }
+                vt_report_error(0,
+                                "wasm batch call to %s failed: %s",
+                                wasm_file,
+                                error_str);
+            }
+
+            for (size_t row = 0; row < result_col.size(); ++row) {
+                result_col[row] &= 0xffffffff;
+            }
+            writeIntColumn(resWriter, result_col, valid);
+        } catch(std::exception& e) {
+            // Standard exception. Quit.
+            vt_report_error(0, "Exception while processing block: [%s]", e.what());
+        }
+    }
+};
+
+class cFibUDx_fib_batchFactory : public ScalarFunctionFactory
+{
+    virtual ScalarFunction *createScalarFunction(ServerInterface &interface)
+    { return vt_createFuncObject<cFibUDx_fib_batch>(interface.allocator); }
+
+    // compiler, cpu_features, canonicalize_nans, simd,
+    // call_budget, interruptible; see WasmEngineParameters.h
+    virtual void getParameterType(ServerInterface &interface,
+                                  SizedColumnTypes &parameterTypes)
+    {
+        addWasmEngineParameters(parameterTypes);
+    }
+
+    virtual void getPrototype(ServerInterface &interface,
+                              ColumnTypes &argTypes,
+                              ColumnTypes &returnType)
+    {
+        argTypes.addInt();
+        returnType.addInt();
+    }
+};
+
+RegisterFactory(cFibUDx_fib_batchFactory);
+
+// cFibUDx_stats() OVER (): the counters of this library's functions,
+// and cFibUDx_trace() OVER (): its setup trace; see WasmStats.h
+class cFibUDx_statsFactory : public WasmStatsFactory {};
+
+RegisterFactory(cFibUDx_statsFactory);
+
+class cFibUDx_traceFactory : public WasmTraceFactory {};
+
+RegisterFactory(cFibUDx_traceFactory);
@@ -0,0 +1,231 @@
+#!/usr/bin/env python
+"""
+python distinct_timing_loop.py
+
+The aggregate counterpart of timing_loop.py: times an approximate count
+of the distinct values of c0 in the 10M-row table t3 with a HyperLogLog sketch in Wasm (cDistinctUDx,
+rustDistinctUDx, which fold in a block of rows per call with
+udx_aggregate_update_i64 and keep the sketch as the intermediate),
+natively (nonDistinctUDx), and with the built-in
+APPROXIMATE_COUNT_DISTINCT and COUNT(DISTINCT).  Make the table with
+
+    python load_column_data.py -c 2 -r 10000000 -n t3
+
+Probably should drive this from a JSON file, but right now what I do
+is define three lists of commands:
+
+ - prologue --- list of commands to run to set things up
+ - timed_commands --- list of commands to run in a loop, timing each
+        command.  It is expected that you run each of these commands
+        repeatedly, which suits my purpose, but may not be ideal for
+        others
+ - epilogue --- cleanup commands
+
+Note that there is also a loop_count variable for how many times each 
+command is to be executed. 
+
+Concludes by printing (min, max, mean, command) of times for each command
+"""
+
+import argparse
+import collections
+import statistics
+import time
+import os
+import vertica_python
+
+CWD = os.getcwd()
+
+class TimerError(Exception):
+    """A custom exception used to report errors in use of Timer class"""
+
+class Timer:
+    def __init__(self):
+        self._start_time = None
+        self._elapsed_time = 0
+
+    def start(self):
+        """Start a new timer"""
+        if self._start_time is not None:
+            raise TimerError(f"Timer is running. Use .stop() to stop it")
+        self._start_time = time.perf_counter()
+
+    def stop(self):
+        """Stop the timer, and report the elapsed time"""
+        if self._start_time is None:
+            raise TimerError(f"Timer is not running. Use .start() to start it")
+        _elapsed_time = time.perf_counter() - self._start_time
+        self._start_time = None
+        return _elapsed_time
+
+    def print(self, operation=None):
+        if operation:
+            print(f"{operation} took: {elapsed_time:0.4f} seconds")
+        else:
+            print(f"Elapsed time: {elapsed_time:0.4f} seconds")
+
+conn_info = {'host': '127.0.0.1',
+             'port': 7132,
+             'user': 'dbadmin',
+             # 'password': 'some_password',
+             'database': 'vwasmsdk', 
+             # autogenerated session label by default,
+             # 'session_label': 'some_label',
+             # default throw error on invalid UTF-8 results
+             'unicode_error': 'strict',
+             # SSL is disabled by default
+             'ssl': False,
+             # autocommit is off by default
+             'autocommit': True,
+             # using server-side prepared statements is disabled by default
+             'use_prepared_statements': True,
+             # connection timeout is not enabled by default
+             # 5 seconds timeout for a socket operation (Establishing a TCP connection or read/write operation)
+             # 'connection_timeout': 60
+             }
+
+
+cdistinctlib = f"'{CWD}/build/cDistinctUDx.so'"
+nondistinctlib = f"'{CWD}/build/nonDistinctUDx.so'"
+rustdistinctlib = f"'{CWD}/build/rustDistinctUDx.so'"
+
+prologue = [
+    f"CREATE OR REPLACE LIBRARY cdistinctudx AS {cdistinctlib} LANGUAGE 'C++'",
+    f"CREATE OR REPLACE LIBRARY nondistinctudx AS {nondistinctlib} LANGUAGE 'C++'",
+    f"CREATE OR REPLACE LIBRARY rustdistinctudx AS {rustdistinctlib} LANGUAGE 'C++'",
+    f"CREATE OR REPLACE AGGREGATE FUNCTION nonDistinctUDx_distinct AS LANGUAGE 'C++' NAME 'nonDistinctUDx_distinctFactory' LIBRARY nondistinctudx NOT FENCED",
+    f"CREATE OR REPLACE AGGREGATE FUNCTION rustDistinctUDx_distinct AS LANGUAGE 'C++' NAME 'rustDistinctUDx_distinctFactory' LIBRARY rustdistinctudx NOT FENCED",
+    f"CREATE OR REPLACE AGGREGATE FUNCTION cDistinctUDx_distinct AS LANGUAGE 'C++' NAME 'cDistinctUDx_distinctFactory' LIBRARY cdistinctudx NOT FENCED",
+    f"CREATE OR REPLACE TRANSFORM FUNCTION rustDistinctUDx_stats AS LANGUAGE 'C++' NAME 'rustDistinctUDx_statsFactory' LIBRARY rustdistinctudx NOT FENCED",
+    f"CREATE OR REPLACE TRANSFORM FUNCTION cDistinctUDx_stats AS LANGUAGE 'C++' NAME 'cDistinctUDx_statsFactory' LIBRARY cdistinctudx NOT FENCED",
+    f'DROP TABLE IF EXISTS cdt3',
+    f'DROP TABLE IF EXISTS rdt3',
+    f'DROP TABLE IF EXISTS ndt3',
+    f'DROP TABLE IF EXISTS adt3',
+    f'DROP TABLE IF EXISTS edt3',
+    f"select start_session_trace('distinct', 1, 10)",
+]
+
+Command = collections.namedtuple('Command', ['label', 'command', 'cleanup'])
+
+timed_commands = [
+    Command('cDistinctUDx_distinct 10M rows',
+            f"CREATE TABLE cdt3 AS SELECT cDistinctUDx_distinct(c0) FROM t3",
+            "DROP TABLE cdt3 CASCADE"),
+    Command('rustDistinctUDx_distinct 10M rows',
+            f"CREATE TABLE rdt3 AS SELECT rustDistinctUDx_distinct(c0) FROM t3",
+            "DROP TABLE rdt3 CASCADE"),
+    Command('nonDistinctUDx_distinct 10M rows',
+            f"CREATE TABLE ndt3 AS SELECT nonDistinctUDx_distinct(c0) FROM t3",
+            "DROP TABLE ndt3 CASCADE"),
+    Command('select approximate_count_distinct(c0)',
+            f"CREATE TABLE adt3 AS SELECT APPROXIMATE_COUNT_DISTINCT(c0) FROM t3",
+            "DROP TABLE adt3 CASCADE"),
+    Command('select count(distinct c0)',
+            f"CREATE TABLE edt3 AS SELECT COUNT(DISTINCT c0) FROM t3",
+            "DROP TABLE edt3 CASCADE"),
+]
+
+epilogue = [
+    f'select stop_session_trace()',
+]
+
+# Where the Wasm UDxes' time went, from their own counters (see
+# WasmStats.h): totals for everything run since the libraries were loaded
+stats_queries = [
+    ('cDistinctUDx', "SELECT * FROM (SELECT cDistinctUDx_stats() OVER ()) s"),
+    ('rustDistinctUDx', "SELECT * FROM (SELECT rustDistinctUDx_stats() OVER ()) s"),
+]
+
+loop_count = 30
+
+def report(cmd, timings):
+    s = ('|'
+         + '| '.join([f"{min(timings):0.4f}",
+                   f"{max(timings):0.4f}",
+                   f"{statistics.median(timings):0.4f}",
+                   f"{statistics.stdev(timings):0.4f}",
+                   f"{statistics.mean(timings):0.4f}",
+                   f"{cmd}"])
+         + '|')
+    print(s)
+
+def is_select(cmd):
+    return "select" in cmd.lower()
+
+def select_one(cur):
+    """
+    Force synchronization with the server by sending a pretty vacuous
+    command and retrieving the result.
+
+    If we don't do this, aren't we just measuring the time it takes to
+    *send* a command to the server, not the time it takes for the
+    server to execute the command?
+    """
+    cur.execute("SELECT 1")
+    cur.fetchall()
+
+def main():
+    timings = {}
+
+    with vertica_python.connect(**conn_info) as conn:
+        cur = conn.cursor()
+        for cmd in prologue:
+            try:
+                cur.execute(cmd)
+                select_one(cur)
+            except vertica_python.errors.QueryError as e:
+                print(f"{cmd} got error")
+                print(f"{e}")
+
+        # This looks ugly in output, but it works great with org-mode buffers
+        print("| min |    max |    median | std |    mean |   command|")
+        print("|-+-+-+-+-+-|")
+        for cmd in timed_commands:
+            timings[cmd.label] = []
+            for loop in range(loop_count):
+                t = Timer()
+                t.start()
+                try:
+                    cur.execute(cmd.command)
+                    if is_select(cmd.command):
+                        # if the command has "select" in it, read all the
+                        # output --- this forces us to wait for the server
+                        # to complete its task, so that we measure the
+                        # time the task takes.
+                        cur.fetchall()
+                    else:
+                        # force synchronization with the server (see
+                        # select_one explanatory comment)
+                        select_one(cur)
+                    timings[cmd.label].append(t.stop())
+                except vertica_python.errors.QueryError as e:
+                    print(f"test {cmd.command} got error")
+                    print(f"{e}")
+                try:
+                    cur.execute(cmd.cleanup)
+                except vertica_python.errors.QueryError as e:
+                    print(f"cleanup {cmd.cleanup} got error")
+                    print(f"{e}")
+                    
+            report(cmd.label, timings[cmd.label])
+        for cmd in epilogue:
+            try:
+                cur.execute(cmd)
+            except vertica_python.errors.QueryError as e:
+                print(f"{cmd} got error")
+                print(f"{e}")
+        for label, query in stats_queries:
+            try:
+                cur.execute(query)
+                columns = [d.name for d in cur.description]
+                for row in cur.fetchall():
+                    print(f"{label}: " + ", ".join(f"{c}={v}" for c, v in zip(columns, row)))
+            except vertica_python.errors.QueryError as e:
+                print(f"{query} got error")
+                print(f"{e}")
+            
+if __name__ == '__main__':
+    main()
+
+    
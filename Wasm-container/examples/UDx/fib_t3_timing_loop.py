@@ -87,6 +87,8 @@ prologue = [
     f"CREATE OR REPLACE FUNCTION nonFibUDx_fibFactory AS LANGUAGE 'C++' NAME 'nonFibUDx_fibFactory' LIBRARY nonfibudx NOT FENCED",
     f"CREATE OR REPLACE FUNCTION rustFibUDx_fibFactory AS LANGUAGE 'C++' NAME 'rustFibUDx_fibFactory' LIBRARY rustfibudx NOT FENCED",
     f"CREATE OR REPLACE FUNCTION cFibUDx_fibFactory AS LANGUAGE 'C++' NAME 'cFibUDx_fibFactory' LIBRARY cfibudx NOT FENCED",
+    f"CREATE OR REPLACE FUNCTION rustFibUDx_fib_batch AS LANGUAGE 'C++' NAME 'rustFibUDx_fib_batchFactory' LIBRARY rustfibudx NOT FENCED",
+    f"CREATE OR REPLACE FUNCTION cFibUDx_fib_batch AS LANGUAGE 'C++' NAME 'cFibUDx_fib_batchFactory' LIBRARY cfibudx NOT FENCED",
     f'DROP TABLE IF EXISTS ct4', 
     f'DROP TABLE IF EXISTS rt4',
     f'DROP TABLE IF EXISTS nt4',
@@ -102,9 +104,21 @@ timed_commands = [
     Command('rustFibUDx_from t3 fib 10M rows',
             f"CREATE TABLE rt5 AS SELECT rustFibUDx_fib(c1) FROM t3",
             "DROP TABLE rt5 CASCADE"),
+    Command('cFibUDx_fib_batch from t3 10M rows',
+            f"CREATE TABLE cbt5 AS SELECT cFibUDx_fib_batch(c1) FROM t3",
+            "DROP TABLE cbt5 CASCADE"),
+    Command('rustFibUDx_fib_batch from t3 10M rows',
+            f"CREATE TABLE rbt5 AS SELECT rustFibUDx_fib_batch(c1) FROM t3",
+            "DROP TABLE rbt5 CASCADE"),
     Command('nonFibUDx_fib from t3 10M rows',
             f"CREATE TABLE nt5 AS SELECT nonFibUDx_fib(c1) FROM t3",
             "DROP TABLE nt5 CASCADE"),
+    Command('cFibUDx_fib memo 16384 from t3 10M rows',
+            f"CREATE TABLE cmt5 AS SELECT cFibUDx_fib(c1 USING PARAMETERS memo_entries=16384) FROM t3",
+            "DROP TABLE cmt5 CASCADE"),
+    Command('rustFibUDx_fib memo 16384 from t3 10M rows',
+            f"CREATE TABLE rmt5 AS SELECT rustFibUDx_fib(c1 USING PARAMETERS memo_entries=16384) FROM t3",
+            "DROP TABLE rmt5 CASCADE"),
 ]
 
 epilogue = [
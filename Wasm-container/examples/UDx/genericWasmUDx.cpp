@@ -0,0 +1,250 @@
+/*
+ * One scalar function for any Wasm export with integer and float
+ * parameters and one result: the module and the export are parameters
+ * of the query, not of the build, so a new kernel needs no new library.
+ *
+ *   CREATE FUNCTION wasm_call AS LANGUAGE 'C++' NAME 'genericWasmUDx_callFactory'
+ *       LIBRARY genericwasmudx NOT FENCED;
+ *   SELECT wasm_call(c0, c1 USING PARAMETERS module='/path/sum.c.wasm',
+ *                    function='sum') FROM t3;
+ *
+ * The argument and return types come from the export's type: i32 and
+ * i64 are INT, f32 and f64 are FLOAT.  Every function made from this
+ * factory, with whatever module, shares the process's compiled module
+ * cache (udx_wasm.h), so a module is compiled once per node and engine
+ * however many queries and functions use it.  Engine options are the
+ * usual parameters (see WasmEngineParameters.h).
+ */
+#include "Vertica.h"
+#include <string>
+#include <vector>
+#include "WasmEngineParameters.h"
+#include "WasmStats.h"
+#include "udx_wasm.hpp"
+
+using namespace Vertica;
+
+namespace {
+
+// module and function from the parameters; reports an error without them
+void getWasmFunctionParameters(ServerInterface &srvInterface,
+                               std::string* module,
+                               std::string* function)
+{
+    ParamReader params = srvInterface.getParamReader();
+    if(! params.containsParameter("module") || ! params.containsParameter("function")) {
+        vt_report_error(0, "Give the Wasm module and export: USING PARAMETERS module='/path/file.wasm', "
+                        "function='name'");
+    }
+    *module = params.getStringRef("module").str();
+    *function = params.getStringRef("function").str();
+}
+
+// Set up ws with the module and export the parameters name; reports an
+// error on failure.  Whoever runs the query names the file, so only a
+// Wasm module will do: an ahead-of-time artifact is native code, and
+// would run in the server unchecked.
+void setupWasmFunction(ServerInterface &srvInterface,
+                       void* ws,
+                       const std::string& module,
+                       const std::string& function)
+{
+    struct udx_engine_options options;
+    std::string cpu_features;
+    getWasmEngineOptions(srvInterface, &options, &cpu_features);
+    options.wasm_only = true;
+    char* error_str;
+    if(! udx_setup_with_options(module.c_str(), ws, function.c_str(), &options, &error_str)) {
+        vt_report_error(0, "Cannot initialize wasm from %s; %s", module.c_str(), error_str);
+    }
+}
+
+// The kinds of the set-up export's parameters and results
+void getWasmSignature(void* ws,
+                      std::vector<wasm_valkind_t>* params,
+                      std::vector<wasm_valkind_t>* results)
+{
+    wasm_functype_t* type = wasm_func_type(udx_get_function(ws, UDX_SETUP_FUNCTION));
+    const wasm_valtype_vec_t* param_types = wasm_functype_params(type);
+    const wasm_valtype_vec_t* result_types = wasm_functype_results(type);
+    params->clear();
+    for(size_t i = 0; i < param_types->size; ++i) {
+        params->push_back(wasm_valtype_kind(param_types->data[i]));
+    }
+    results->clear();
+    for(size_t i = 0; i < result_types->size; ++i) {
+        results->push_back(wasm_valtype_kind(result_types->data[i]));
+    }
+    wasm_functype_delete(type);
+}
+
+bool isWasmInt(wasm_valkind_t kind) { return kind == WASM_I32 || kind == WASM_I64; }
+bool isWasmFloat(wasm_valkind_t kind) { return kind == WASM_F32 || kind == WASM_F64; }
+
+// Whether the export can be called with these argument types, and
+// returns a single number; reports an error if not
+void checkWasmSignature(const std::string& function,
+                        const SizedColumnTypes &argTypes,
+                        const std::vector<wasm_valkind_t>& params,
+                        const std::vector<wasm_valkind_t>& results)
+{
+    if(argTypes.getColumnCount() != params.size()) {
+        vt_report_error(0, "%s takes %zu arguments, not %zu",
+                        function.c_str(), params.size(), argTypes.getColumnCount());
+    }
+    for(size_t i = 0; i < params.size(); ++i) {
+        const VerticaType &type = argTypes.getColumnType(i);
+        if(! (isWasmInt(params[i]) && type.isInt()) && ! (isWasmFloat(params[i]) && type.isFloat())) {
+            vt_report_error(0, "Argument %zu of %s is %s, so it must be %s",
+                            i + 1, function.c_str(), udx_wasm::wasm_kind_name(params[i]),
+                            isWasmInt(params[i]) ? "an INT" : isWasmFloat(params[i]) ? "a FLOAT" : "nothing SQL has");
+        }
+    }
+    if(results.size() != 1 || ! (isWasmInt(results[0]) || isWasmFloat(results[0]))) {
+        vt_report_error(0, "%s must return one i32, i64, f32 or f64", function.c_str());
+    }
+}
+
+} // namespace
+
+class genericWasmUDx_call : public WasmCancelable<ScalarFunction>
+{
+    void* ws = NULL;
+    std::string module;
+    std::string function;
+    std::vector<wasm_valkind_t> params;
+    std::vector<wasm_valkind_t> results;
+    // reused from row to row
+    std::vector<wasm_val_t> args;
+    public:
+    virtual void setup(ServerInterface &srvInterface, const SizedColumnTypes &argtypes) {
+        getWasmFunctionParameters(srvInterface, &module, &function);
+        ws = getWasmState();
+        setupWasmFunction(srvInterface, ws, module, function);
+        srvInterface.log("%s: %s on %s", module.c_str(), function.c_str(), udx_describe_engine(ws));
+        // the file may have changed since getReturnType() looked
+        getWasmSignature(ws, &params, &results);
+        checkWasmSignature(function, argtypes, params, results);
+        args.resize(params.size());
+    }
+
+    virtual void destroy(ServerInterface &srvInterface, const SizedColumnTypes &argtypes) {
+        logWasmStats(srvInterface, module.c_str(), ws);
+        udx_cleanup(ws);
+    }
+
+    virtual void processBlock(ServerInterface &srvInterface,
+                              BlockReader &argReader,
+                              BlockWriter &resWriter)
+    {
+        try {
+            do {
+                bool is_null = false;
+                for(size_t i = 0; i < params.size() && ! is_null; ++i) {
+                    is_null = argReader.isNull(i);
+                    args[i].kind = params[i];
+                    switch(params[i]) {
+                    case WASM_I32: args[i].of.i32 = static_cast<int32_t>(argReader.getIntRef(i)); break;
+                    case WASM_I64: args[i].of.i64 = argReader.getIntRef(i); break;
+                    case WASM_F32: args[i].of.f32 = static_cast<float>(argReader.getFloatRef(i)); break;
+                    default: args[i].of.f64 = argReader.getFloatRef(i); break;
+                    }
+                }
+                if(is_null) {
+                    resWriter.setNull();
+                    resWriter.next();
+                    continue;
+                }
+                wasm_val_t result;
+                result.kind = results[0];
+                char *error_str;
+                if(! udx_call_handle_vals(UDX_SETUP_FUNCTION, args.data(), args.size(),
+                                          &result, 1, ws, &error_str)) {
+                    if(isCanceled()) {
+                        return;
+                    }
+                    vt_report_error(0, "wasm_function_call to %s in %s failed: %s",
+                                    function.c_str(), module.c_str(), error_str);
+                }
+                switch(results[0]) {
+                case WASM_I32: resWriter.setInt(result.of.i32); break;
+                case WASM_I64: resWriter.setInt(result.of.i64); break;
+                case WASM_F32: resWriter.setFloat(result.of.f32); break;
+                default: resWriter.setFloat(result.of.f64); break;
+                }
+                resWriter.next();
+            } while (argReader.next());
+        } catch(std::exception& e) {
+            // Standard exception. Quit.
+            vt_report_error(0, "Exception while processing block: [%s]", e.what());
+        }
+    }
+};
+
+class genericWasmUDx_callFactory : public ScalarFunctionFactory
+{
+    virtual ScalarFunction *createScalarFunction(ServerInterface &interface)
+    { return vt_createFuncObject<genericWasmUDx_call>(interface.allocator); }
+
+    // module, function, and compiler, cpu_features, canonicalize_nans,
+    // simd, call_budget, interruptible (see WasmEngineParameters.h)
+    virtual void getParameterType(ServerInterface &interface,
+                                  SizedColumnTypes &parameterTypes)
+    {
+        parameterTypes.addVarchar(1024, "module");
+        parameterTypes.addVarchar(256, "function");
+        addWasmEngineParameters(parameterTypes);
+    }
+
+    // Any arguments: the real types depend on the module, which isn't
+    // known until the query gives it
+    virtual void getPrototype(ServerInterface &interface,
+                              ColumnTypes &argTypes,
+                              ColumnTypes &returnType)
+    {
+        argTypes.addAny();
+        returnType.addAny();
+    }
+
+    // Load the module to read the export's type.  That compiles it (or
+    // finds it compiled) with the query's engine options, so setup()
+    // finds it in the cache.
+    virtual void getReturnType(ServerInterface &interface,
+                               const SizedColumnTypes &inputTypes,
+                               SizedColumnTypes &outputTypes)
+    {
+        std::string module, function;
+        getWasmFunctionParameters(interface, &module, &function);
+        void* ws = udx_get_wasm_state();
+        if(! ws) {
+            vt_report_error(0, "Cannot allocate a wasm state");
+        }
+        std::vector<wasm_valkind_t> params, results;
+        try {
+            setupWasmFunction(interface, ws, module, function);
+            getWasmSignature(ws, &params, &results);
+            checkWasmSignature(function, inputTypes, params, results);
+        } catch(...) {
+            udx_cleanup(ws);
+            throw;
+        }
+        udx_cleanup(ws);
+        if(isWasmInt(results[0])) {
+            outputTypes.addInt();
+        } else {
+            outputTypes.addFloat();
+        }
+    }
+};
+
+RegisterFactory(genericWasmUDx_callFactory);
+
+// genericWasmUDx_stats() OVER (): the counters of this library's functions,
+// and genericWasmUDx_trace() OVER (): its setup trace; see WasmStats.h
+class genericWasmUDx_statsFactory : public WasmStatsFactory {};
+
+RegisterFactory(genericWasmUDx_statsFactory);
+
+class genericWasmUDx_traceFactory : public WasmTraceFactory {};
+
+RegisterFactory(genericWasmUDx_traceFactory);
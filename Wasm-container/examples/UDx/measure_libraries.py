@@ -0,0 +1,124 @@
+#!/usr/bin/env python
+"""
+python measure_libraries.py build/whole-archive build/shared-runtime
+
+What the Wasm runtime costs a node with every UDx library loaded, for
+each build directory given (make measure builds one without and one
+with SHARED_RUNTIME=1, see the Makefile):
+
+ - size --- bytes on disk of each library, and of libudx_wasm_runtime.so
+        once if the directory has one
+ - dlopen --- milliseconds to load each library, in a fresh process, in
+        the order given by its name; the first Wasm library in a
+        shared-runtime build pays for loading the runtime
+ - rss --- how much the process's resident set grew loading it
+ - total --- the same for all of them, and the resident and
+        proportional set of the process's mappings of files in the
+        directory once all are loaded
+
+The libraries are loaded with RTLD_LOCAL, as Vertica loads UDx
+libraries, so in the whole-archive build each one gets its own copy of
+wasmer.
+"""
+
+import argparse
+import ctypes
+import os
+import subprocess
+import sys
+import time
+
+RUNTIME = "libudx_wasm_runtime.so"
+
+
+def libraries(build_dir):
+    """The UDx libraries in build_dir, in load order"""
+    return sorted(f for f in os.listdir(build_dir)
+                  if f.endswith(".so") and f != RUNTIME)
+
+
+def vm_rss_kb():
+    with open("/proc/self/status") as status:
+        for line in status:
+            if line.startswith("VmRSS:"):
+                return int(line.split()[1])
+    return 0
+
+
+def mapped_kb(build_dir):
+    """(Rss, Pss) in kB of this process's mappings of files in build_dir"""
+    rss = pss = 0
+    in_dir = False
+    prefix = os.path.abspath(build_dir) + "/"
+    with open("/proc/self/smaps") as smaps:
+        for line in smaps:
+            fields = line.split()
+            if not fields[0].endswith(":"):
+                # a mapping's header: address perms offset dev inode [path]
+                in_dir = len(fields) > 5 and fields[5].startswith(prefix)
+            elif in_dir and fields[0] == "Rss:":
+                rss += int(fields[1])
+            elif in_dir and fields[0] == "Pss:":
+                pss += int(fields[1])
+    return rss, pss
+
+
+def load(build_dir):
+    """Child: load the libraries, printing one line per library and a
+    last line with the mapped totals"""
+    for lib in libraries(build_dir):
+        before = vm_rss_kb()
+        start = time.perf_counter()
+        try:
+            ctypes.CDLL(os.path.join(os.path.abspath(build_dir), lib),
+                        mode=os.RTLD_LOCAL)
+        except OSError as e:
+            print("error %s %s" % (lib, e))
+            continue
+        elapsed = time.perf_counter() - start
+        print("lib %s %f %d" % (lib, elapsed * 1000, vm_rss_kb() - before))
+    print("mapped %d %d" % mapped_kb(build_dir))
+
+
+def measure(build_dir):
+    out = subprocess.run([sys.executable, __file__, "--load", build_dir],
+                         check=True, stdout=subprocess.PIPE,
+                         universal_newlines=True).stdout
+    print("\n%s" % build_dir)
+    print("%-28s %12s %10s %10s" % ("library", "size", "dlopen ms", "rss kB"))
+    total_size = total_ms = total_rss = 0
+    runtime = os.path.join(build_dir, RUNTIME)
+    if os.path.exists(runtime):
+        total_size = os.path.getsize(runtime)
+        print("%-28s %12d %10s %10s" % (RUNTIME, total_size, "-", "-"))
+    for line in out.splitlines():
+        fields = line.split(None, 2 if line.startswith("error") else 4)
+        if fields[0] == "error":
+            print("%-28s cannot load: %s" % (fields[1], fields[2]))
+        elif fields[0] == "lib":
+            size = os.path.getsize(os.path.join(build_dir, fields[1]))
+            ms, rss = float(fields[2]), int(fields[3])
+            total_size += size
+            total_ms += ms
+            total_rss += rss
+            print("%-28s %12d %10.2f %10d" % (fields[1], size, ms, rss))
+        elif fields[0] == "mapped":
+            print("%-28s %12d %10.2f %10d" % ("total", total_size, total_ms, total_rss))
+            print("mapped from %s: rss %s kB, pss %s kB" % (build_dir, fields[1], fields[2]))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[1],
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--load", help=argparse.SUPPRESS)
+    parser.add_argument("build_dirs", nargs="*", help="directories of built UDx libraries")
+    args = parser.parse_args()
+    if args.load:
+        load(args.load)
+        return
+    for build_dir in args.build_dirs:
+        measure(build_dir)
+
+
+if __name__ == "__main__":
+    main()
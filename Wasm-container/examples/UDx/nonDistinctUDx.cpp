@@ -0,0 +1,127 @@
+/*
+ * aggregate function for benchmarks, int input, int output: the native
+ * counterpart of cDistinctUDx and rustDistinctUDx (see ../distinct.c)
+ */
+#include "Vertica.h"
+#include <algorithm>
+#include <cmath>
+
+#define PRECISION 12
+#define REGISTERS (1 << PRECISION)
+
+static unsigned long long hash(unsigned long long x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+using namespace Vertica;
+class nonDistinctUDx_distinct : public AggregateFunction
+{
+    // The registers an intermediate holds
+    static unsigned char* registers(const VString &state) {
+        if(state.isNull() || state.length() != REGISTERS) {
+            vt_report_error(0, "Intermediate of %zu bytes is not a sketch",
+                            static_cast<size_t>(state.length()));
+        }
+        return reinterpret_cast<unsigned char*>(const_cast<char*>(state.data()));
+    }
+
+    public:
+    virtual void initAggregate(ServerInterface &srvInterface, IntermediateAggs &aggs)
+    {
+        VString &state = aggs.getStringRef(0);
+        std::fill(state.data(), state.data() + REGISTERS, 0);
+        state.setLen(REGISTERS);
+    }
+
+    virtual void aggregate(ServerInterface &srvInterface,
+                           BlockReader &argReader,
+                           IntermediateAggs &aggs)
+    {
+        try {
+            unsigned char *state = registers(aggs.getStringRef(0));
+            do {
+                if (! argReader.isNull(0)) {
+                    const unsigned long long h = hash(static_cast<unsigned long long>(argReader.getIntRef(0)));
+                    const unsigned index = h >> (64 - PRECISION);
+                    const unsigned char rank =
+                        __builtin_clzll((h << PRECISION) | (1ULL << (PRECISION - 1))) + 1;
+                    state[index] = std::max(state[index], rank);
+                }
+            } while (argReader.next());
+        } catch(std::exception& e) {
+            // Standard exception. Quit.
+            vt_report_error(0, "Exception while processing block: [%s]", e.what());
+        }
+    }
+
+    virtual void combine(ServerInterface &srvInterface,
+                         IntermediateAggs &aggs,
+                         MultipleIntermediateAggs &aggsOther)
+    {
+        unsigned char *state = registers(aggs.getStringRef(0));
+        do {
+            const unsigned char *other = registers(aggsOther.getStringRef(0));
+            for(int i = 0; i < REGISTERS; ++i) {
+                state[i] = std::max(state[i], other[i]);
+            }
+        } while (aggsOther.next());
+    }
+
+    virtual void terminate(ServerInterface &srvInterface,
+                           BlockWriter &resWriter,
+                           IntermediateAggs &aggs)
+    {
+        const unsigned char *state = registers(aggs.getStringRef(0));
+        double inverse_sum = 0;
+        int zeros = 0;
+        for(int i = 0; i < REGISTERS; ++i) {
+            inverse_sum += std::ldexp(1.0, -state[i]);
+            zeros += state[i] == 0;
+        }
+        const double m = REGISTERS;
+        double estimate = 0.7213 / (1 + 1.079 / m) * m * m / inverse_sum;
+        if(estimate <= 2.5 * m && zeros > 0) {
+            // linear counting is better while many registers are empty
+            estimate = m * std::log(m / zeros);
+        }
+        resWriter.setInt(static_cast<vint>(estimate + 0.5));
+    }
+
+    InlineAggregate()
+};
+
+class nonDistinctUDx_distinctFactory : public AggregateFunctionFactory
+{
+    virtual AggregateFunction *createAggregateFunction(ServerInterface &interface)
+    { return vt_createFuncObject<nonDistinctUDx_distinct>(interface.allocator); }
+
+    virtual void getPrototype(ServerInterface &interface,
+                              ColumnTypes &argTypes,
+                              ColumnTypes &returnType)
+    {
+        argTypes.addInt();
+        returnType.addInt();
+    }
+
+    virtual void getReturnType(ServerInterface &interface,
+                               const SizedColumnTypes &inputTypes,
+                               SizedColumnTypes &outputTypes)
+    {
+        outputTypes.addInt();
+    }
+
+    // the sketch's registers
+    virtual void getIntermediateTypes(ServerInterface &interface,
+                                      const SizedColumnTypes &inputTypes,
+                                      SizedColumnTypes &intermediateTypeMetaData)
+    {
+        intermediateTypeMetaData.addVarbinary(REGISTERS);
+    }
+};
+
+RegisterFactory(nonDistinctUDx_distinctFactory);
@@ -0,0 +1,80 @@
+/*
+ * scalar function for benchmarks, varchar input, varchar output: the
+ * native counterpart of cNormalizeUDx and rustNormalizeUDx (see
+ * ../normalize.c)
+ */
+#include "Vertica.h"
+
+static bool is_space(char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+// Normalize len bytes at in into out, which is never longer; returns
+// its length
+static size_t normalize(const char* in, size_t len, char* out) {
+    size_t length = 0;
+    bool space = false;
+    for(size_t i = 0; i < len; ++i) {
+        const char c = in[i];
+        if(is_space(c)) {
+            space = length > 0;
+            continue;
+        }
+        if(space) {
+            out[length++] = ' ';
+            space = false;
+        }
+        out[length++] = c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+    }
+    return length;
+}
+
+using namespace Vertica;
+class nonNormalizeUDx_normalize : public ScalarFunction
+{
+    public:
+    virtual void processBlock(ServerInterface &srvInterface,
+                              BlockReader &argReader,
+                              BlockWriter &resWriter)
+    {
+        try {
+            do {
+                const VString &s = argReader.getStringRef(0);
+                if (s.isNull()) {
+                    resWriter.setNull();
+                } else {
+                    VString &result = resWriter.getStringRef();
+                    result.setLen(normalize(s.data(), s.length(), result.data()));
+                }
+                resWriter.next();
+            } while (argReader.next());
+        } catch(std::exception& e) {
+            // Standard exception. Quit.
+            vt_report_error(0, "Exception while processing block: [%s]", e.what());
+        }
+    }
+};
+
+class nonNormalizeUDx_normalizeFactory : public ScalarFunctionFactory
+{
+    virtual ScalarFunction *createScalarFunction(ServerInterface &interface)
+    { return vt_createFuncObject<nonNormalizeUDx_normalize>(interface.allocator); }
+
+    virtual void getPrototype(ServerInterface &interface,
+                              ColumnTypes &argTypes,
+                              ColumnTypes &returnType)
+    {
+        argTypes.addVarchar();
+        returnType.addVarchar();
+    }
+
+    // normalizing never makes a string longer
+    virtual void getReturnType(ServerInterface &interface,
+                               const SizedColumnTypes &inputTypes,
+                               SizedColumnTypes &outputTypes)
+    {
+        outputTypes.addVarchar(inputTypes.getColumnType(0).getStringLength());
+    }
+};
+
+RegisterFactory(nonNormalizeUDx_normalizeFactory);
@@ -0,0 +1,94 @@
+/*
+ * transform function for benchmarks, (int, varchar) input, a row per
+ * token output: the native counterpart of cTokenizeUDx and
+ * rustTokenizeUDx (see ../tokenize.c)
+ */
+#include "Vertica.h"
+
+static bool is_token(unsigned char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')
+        || c == '_' || c >= 0x80;
+}
+
+using namespace Vertica;
+class nonTokenizeUDx_tokenize : public TransformFunction
+{
+    public:
+    virtual void processPartition(ServerInterface &srvInterface,
+                                  PartitionReader &inputReader,
+                                  PartitionWriter &outputWriter)
+    {
+        try {
+            do {
+                const VString &line = inputReader.getStringRef(1);
+                if (line.isNull()) {
+                    continue;
+                }
+                const bool key_null = inputReader.isNull(0);
+                const vint key = key_null ? 0 : inputReader.getIntRef(0);
+                const char* data = line.data();
+                const size_t len = line.length();
+                vint position = 0;
+                for(size_t j = 0; j < len; ) {
+                    if(! is_token(data[j])) {
+                        ++j;
+                        continue;
+                    }
+                    const size_t start = j;
+                    while(j < len && is_token(data[j])) {
+                        ++j;
+                    }
+                    if (key_null) {
+                        outputWriter.setNull(0);
+                    } else {
+                        outputWriter.setInt(0, key);
+                    }
+                    outputWriter.setInt(1, ++position);
+                    outputWriter.setInt(2, static_cast<vint>(start));
+                    VString &token = outputWriter.getStringRef(3);
+                    char* out = token.data();
+                    for(size_t k = start; k < j; ++k) {
+                        const char c = data[k];
+                        out[k - start] = c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+                    }
+                    token.setLen(j - start);
+                    outputWriter.next();
+                }
+            } while (inputReader.next());
+        } catch(std::exception& e) {
+            // Standard exception. Quit.
+            vt_report_error(0, "Exception while processing partition: [%s]", e.what());
+        }
+    }
+};
+
+class nonTokenizeUDx_tokenizeFactory : public TransformFunctionFactory
+{
+    virtual TransformFunction *createTransformFunction(ServerInterface &interface)
+    { return vt_createFuncObject<nonTokenizeUDx_tokenize>(interface.allocator); }
+
+    virtual void getPrototype(ServerInterface &interface,
+                              ColumnTypes &argTypes,
+                              ColumnTypes &returnType)
+    {
+        argTypes.addInt();
+        argTypes.addVarchar();
+        returnType.addInt();
+        returnType.addInt();
+        returnType.addInt();
+        returnType.addVarchar();
+    }
+
+    // a token is never longer than its line
+    virtual void getReturnType(ServerInterface &interface,
+                               const SizedColumnTypes &inputTypes,
+                               SizedColumnTypes &outputTypes)
+    {
+        outputTypes.addInt("id");
+        outputTypes.addInt("token_number");
+        outputTypes.addInt("byte_offset");
+        outputTypes.addVarchar(inputTypes.getColumnType(1).getStringLength(), "token");
+    }
+};
+
+RegisterFactory(nonTokenizeUDx_tokenizeFactory);
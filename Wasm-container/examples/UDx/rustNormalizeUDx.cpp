@@ -0,0 +1,101 @@
+/*
+ * scalar function for benchmarks, varchar input, varchar output:
+ * normalize a log field (lower case, whitespace trimmed and collapsed)
+ * in Wasm, a chunk of rows per call
+ */
+#include "Vertica.h"
+#include "WasmEngineParameters.h"
+#include "WasmStats.h"
+#include "WasmStrings.h"
+
+using namespace Vertica;
+class rustNormalizeUDx_normalize : public WasmCancelable<ScalarFunction>
+{
+    void* ws = NULL;
+    const char* wasm_file;
+    // reused from block to block
+    StringColumn strings;
+    ValidityBitmap valid;
+    public:
+    virtual void setup(ServerInterface &srvInterface, const SizedColumnTypes &argtypes) {
+        // WASMFILE is passed as -DWASMFILE=\"absolute-path-of-normalize.rs.wasm\"
+        // when compiling
+        wasm_file = WASMFILE;
+        ws = getWasmState();
+        setupWasmWithParameters(srvInterface, wasm_file, ws, "normalize_batch");
+    }
+
+    virtual void destroy(ServerInterface &srvInterface, const SizedColumnTypes &argtypes) {
+        logWasmStats(srvInterface, wasm_file, ws);
+        udx_cleanup(ws);
+    }
+
+    virtual void processBlock(ServerInterface &srvInterface,
+                              BlockReader &argReader,
+                              BlockWriter &resWriter)
+    {
+        try {
+            strings.clear();
+            valid.clear();
+            do {
+                gatherString(argReader, 0, strings, valid);
+            } while (argReader.next());
+
+            StringWriter writer(resWriter, valid);
+            char *error_str;
+            if(! udx_call_batch_str_str(UDX_SETUP_FUNCTION, strings.data(), strings.offsets(),
+                                        strings.size(), StringWriter::sink, &writer,
+                                        ws, &error_str)) {
+                if(isCanceled()) {
+                    return;
+                }
+                vt_report_error(0, "wasm batch call to %s failed: %s", wasm_file, error_str);
+            }
+        } catch(std::exception& e) {
+            // Standard exception. Quit.
+            vt_report_error(0, "Exception while processing block: [%s]", e.what());
+        }
+    }
+};
+
+class rustNormalizeUDx_normalizeFactory : public ScalarFunctionFactory
+{
+    virtual ScalarFunction *createScalarFunction(ServerInterface &interface)
+    { return vt_createFuncObject<rustNormalizeUDx_normalize>(interface.allocator); }
+
+    // compiler, cpu_features, canonicalize_nans, simd,
+    // call_budget, interruptible; see WasmEngineParameters.h
+    virtual void getParameterType(ServerInterface &interface,
+                                  SizedColumnTypes &parameterTypes)
+    {
+        addWasmEngineParameters(parameterTypes);
+    }
+
+    virtual void getPrototype(ServerInterface &interface,
+                              ColumnTypes &argTypes,
+                              ColumnTypes &returnType)
+    {
+        argTypes.addVarchar();
+        returnType.addVarchar();
+    }
+
+    // normalizing never makes a string longer
+    virtual void getReturnType(ServerInterface &interface,
+                               const SizedColumnTypes &inputTypes,
+                               SizedColumnTypes &outputTypes)
+    {
+        outputTypes.addVarchar(inputTypes.getColumnType(0).getStringLength());
+    }
+};
+
+RegisterFactory(rustNormalizeUDx_normalizeFactory);
+
+// rustNormalizeUDx_stats() OVER (): the counters of this library's functions,
+// and rustNormalizeUDx_trace() OVER (): its setup trace; see WasmStats.h
+class rustNormalizeUDx_statsFactory : public WasmStatsFactory {};
+
+RegisterFactory(rustNormalizeUDx_statsFactory);
+
+class rustNormalizeUDx_traceFactory : public WasmTraceFactory {};
+
+RegisterFactory(rustNormalizeUDx_traceFactory);
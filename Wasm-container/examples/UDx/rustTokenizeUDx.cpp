@@ -0,0 +1,126 @@
+/*
+ * transform function for benchmarks, (int, varchar) input, a row per
+ * token output: split log lines into tokens and normalize them in Wasm,
+ * every row and column of a batch of lines from one guest pass
+ */
+#include "Vertica.h"
+#include <vector>
+#include "WasmEngineParameters.h"
+#include "WasmStats.h"
+#include "WasmStrings.h"
+
+using namespace Vertica;
+
+// tokenize.rs's int columns: token_number and byte_offset
+static const size_t TOKENIZE_INT_COLUMNS = 2;
+// Lines gathered from the partition per udx_call_batch_str_rows()
+static const size_t TOKENIZE_BATCH_ROWS = 16384;
+
+class rustTokenizeUDx_tokenize : public WasmCancelable<TransformFunction>
+{
+    void* ws = NULL;
+    const char* wasm_file;
+    // reused from batch to batch
+    std::vector<vint> keys;
+    ValidityBitmap keys_valid;
+    StringColumn lines;
+    ValidityBitmap lines_valid;
+    public:
+    virtual void setup(ServerInterface &srvInterface, const SizedColumnTypes &argtypes) {
+        // WASMFILE is passed as -DWASMFILE=\"absolute-path-of-tokenize.rs.wasm\"
+        // when compiling
+        wasm_file = WASMFILE;
+        ws = getWasmState();
+        setupWasmWithParameters(srvInterface, wasm_file, ws, "tokenize_batch");
+    }
+
+    virtual void destroy(ServerInterface &srvInterface, const SizedColumnTypes &argtypes) {
+        logWasmStats(srvInterface, wasm_file, ws);
+        udx_cleanup(ws);
+    }
+
+    virtual void processPartition(ServerInterface &srvInterface,
+                                  PartitionReader &inputReader,
+                                  PartitionWriter &outputWriter)
+    {
+        try {
+            bool more = true;
+            while(more) {
+                keys.clear();
+                keys_valid.clear();
+                lines.clear();
+                lines_valid.clear();
+                do {
+                    const bool key_valid = ! inputReader.isNull(0);
+                    keys_valid.push_back(key_valid);
+                    keys.push_back(key_valid ? inputReader.getIntRef(0) : 0);
+                    gatherString(inputReader, 1, lines, lines_valid);
+                    more = inputReader.next();
+                } while(more && lines.size() < TOKENIZE_BATCH_ROWS);
+
+                RowWriter writer(outputWriter, keys, keys_valid, TOKENIZE_INT_COLUMNS);
+                char *error_str;
+                if(! udx_call_batch_str_rows(UDX_SETUP_FUNCTION, lines.data(), lines.offsets(),
+                                             lines.size(), TOKENIZE_INT_COLUMNS,
+                                             RowWriter::sink, &writer, ws, &error_str)) {
+                    if(isCanceled()) {
+                        return;
+                    }
+                    vt_report_error(0, "wasm batch call to %s failed: %s", wasm_file, error_str);
+                }
+            }
+        } catch(std::exception& e) {
+            // Standard exception. Quit.
+            vt_report_error(0, "Exception while processing partition: [%s]", e.what());
+        }
+    }
+};
+
+class rustTokenizeUDx_tokenizeFactory : public TransformFunctionFactory
+{
+    virtual TransformFunction *createTransformFunction(ServerInterface &interface)
+    { return vt_createFuncObject<rustTokenizeUDx_tokenize>(interface.allocator); }
+
+    // compiler, cpu_features, canonicalize_nans, simd,
+    // call_budget, interruptible; see WasmEngineParameters.h
+    virtual void getParameterType(ServerInterface &interface,
+                                  SizedColumnTypes &parameterTypes)
+    {
+        addWasmEngineParameters(parameterTypes);
+    }
+
+    virtual void getPrototype(ServerInterface &interface,
+                              ColumnTypes &argTypes,
+                              ColumnTypes &returnType)
+    {
+        argTypes.addInt();
+        argTypes.addVarchar();
+        returnType.addInt();
+        returnType.addInt();
+        returnType.addInt();
+        returnType.addVarchar();
+    }
+
+    // a token is never longer than its line
+    virtual void getReturnType(ServerInterface &interface,
+                               const SizedColumnTypes &inputTypes,
+                               SizedColumnTypes &outputTypes)
+    {
+        outputTypes.addInt("id");
+        outputTypes.addInt("token_number");
+        outputTypes.addInt("byte_offset");
+        outputTypes.addVarchar(inputTypes.getColumnType(1).getStringLength(), "token");
+    }
+};
+
+RegisterFactory(rustTokenizeUDx_tokenizeFactory);
+
+// rustTokenizeUDx_stats() OVER (): the counters of this library's functions,
+// and rustTokenizeUDx_trace() OVER (): its setup trace; see WasmStats.h
+class rustTokenizeUDx_statsFactory : public WasmStatsFactory {};
+
+RegisterFactory(rustTokenizeUDx_statsFactory);
+
+class rustTokenizeUDx_traceFactory : public WasmTraceFactory {};
+
+RegisterFactory(rustTokenizeUDx_traceFactory);
@@ -5,32 +5,35 @@
  */
 #include "Vertica.h"
 #include <sstream>
-extern "C" {
-#include "udx_wasm.h"
-}
+#include <vector>
+#include "WasmEngineParameters.h"
+#include "WasmNulls.h"
+#include "WasmStats.h"
+#include "udx_wasm.hpp"
 
 using namespace Vertica;
-class rustWasmUDx_sum : public ScalarFunction
+class rustWasmUDx_sum : public WasmCancelable<ScalarFunction>
 {
-    void* ws;
+    void* ws = NULL;
     const char* wasm_file;
+    // checked against the export once, in setup()
+    udx_wasm::WasmFunction<int(int, int)> sum;
     public:
     virtual void setup(ServerInterface &srvInterface, const SizedColumnTypes &argtypes) {
-        char* error_str;
         // WASMFILE is passed as -DWASMFILE=\"absolute-path-of-sum.c.wsm\"
         // when compiling
         wasm_file = WASMFILE;
-        ws = udx_get_wasm_state();
+        ws = getWasmState();
         // Which function in the wasm module are we going to use?
-        if(! udx_setup(wasm_file, ws, "sum", &error_str)) {
-            vt_report_error(0,
-                            "Cannot initialize wasm from %s; %s",
-                            wasm_file,
-                            error_str);
+        setupWasmWithParameters(srvInterface, wasm_file, ws, "sum");
+        char* error_str;
+        if(! sum.bind(ws, &error_str)) {
+            vt_report_error(0, "Wrong signature for sum in %s; %s", wasm_file, error_str);
         }
     }
 
     virtual void destroy(ServerInterface &srvInterface, const SizedColumnTypes &argtypes) {
+        logWasmStats(srvInterface, wasm_file, ws);
         udx_cleanup(ws);
     }
    /*
@@ -56,7 +59,10 @@ class rustWasmUDx_sum : public ScalarFunction
                     const int a = static_cast<int>(argReader.getIntRef(0));
                     const int b = static_cast<int>(argReader.getIntRef(1));
                     // function takes 2 int args, returns 1 int result
-                    if(! udx_call_func_2i_1i(a, b, &result, ws, &error_str)) {
+                    if(! sum.call(a, b, &result, &error_str)) {
+                        if(isCanceled()) {
+                            return;
+                        }
                         vt_report_error(0,
                                         "wasm_function_call to %s failed: %s",
                                         wasm_file,
@@ -79,6 +85,14 @@ class rustWasmUDx_sumFactory : public ScalarFunctionFactory
     virtual ScalarFunction *createScalarFunction(ServerInterface &interface)
     { return vt_createFuncObject<rustWasmUDx_sum>(interface.allocator); }
 
+    // compiler, cpu_features, canonicalize_nans, simd,
+    // call_budget, interruptible; see WasmEngineParameters.h
+    virtual void getParameterType(ServerInterface &interface,
+                                  SizedColumnTypes &parameterTypes)
+    {
+        addWasmEngineParameters(parameterTypes);
+    }
+
     // This function returns the description of the input and outputs of the
     // Add2Ints class's processBlock function.  It stores this information in
     // two ColumnTypes objects, one for the input parameters, and one for
@@ -96,3 +110,105 @@ class rustWasmUDx_sumFactory : public ScalarFunctionFactory
 };
 
 RegisterFactory(rustWasmUDx_sumFactory);
+
+// The same sum, but processBlock gathers the whole block into columns
+// and crosses into Wasm once (sum_batch) instead of once per row.  Nulls
+// go along as a validity bitmap (see WasmNulls.h).
+class rustWasmUDx_sum_batch : public WasmCancelable<ScalarFunction>
+{
+    void* ws = NULL;
+    const char* wasm_file;
+    // reused from block to block, so they stop allocating once they
+    // have grown to the block size
+    std::vector<int> a_col;
+    std::vector<int> b_col;
+    std::vector<int> result_col;
+    ValidityBitmap valid;
+    // sum_batch_masked, for chunks with nulls; see WasmNulls.h
+    int batch_masked;
+    public:
+    virtual void setup(ServerInterface &srvInterface, const SizedColumnTypes &argtypes) {
+        wasm_file = WASMFILE;
+        ws = getWasmState();
+        setupWasmWithParameters(srvInterface, wasm_file, ws, "sum_batch");
+        char* error_str;
+        if(! udx_lookup_function(ws, "sum_batch_masked", &batch_masked, &error_str)) {
+            // null rows are 0, so the plain kernel can run over them
+            batch_masked = UDX_NO_FUNCTION;
+        }
+    }
+
+    virtual void destroy(ServerInterface &srvInterface, const SizedColumnTypes &argtypes) {
+        logWasmStats(srvInterface, wasm_file, ws);
+        udx_cleanup(ws);
+    }
+
+    virtual void processBlock(ServerInterface &srvInterface,
+                              BlockReader &argReader,
+                              BlockWriter &resWriter)
+    {
+        try {
+            a_col.clear();
+            b_col.clear();
+            valid.clear();
+            // gather every row, nulls as 0, and which rows are null
+            do {
+                const bool row_valid = ! argReader.isNull(0) && ! argReader.isNull(1);
+                valid.push_back(row_valid);
+                a_col.push_back(row_valid ? static_cast<int>(argReader.getIntRef(0)) : 0);
+                b_col.push_back(row_valid ? static_cast<int>(argReader.getIntRef(1)) : 0);
+            } while (argReader.next());
+
+            result_col.resize(a_col.size());
+            char *error_str;
+            if(! udx_call_batch_masked_2i_1i(UDX_SETUP_FUNCTION, batch_masked,
+                                             a_col.data(), b_col.data(), valid.data(),
+                                             result_col.data(), a_col.size(), ws, &error_str)) {
+                if(isCanceled()) {
+                    return;
+                }
+                vt_report_error(0, "wasm batch call to %s failed: %s", wasm_file, error_str);
+            }
+
+            writeIntColumn(resWriter, result_col, valid);
+        } catch(std::exception& e) {
+            // Standard exception. Quit.
+            vt_report_error(0, "Exception while processing block: [%s]", e.what());
+        }
+    }
+};
+
+class rustWasmUDx_sum_batchFactory : public ScalarFunctionFactory
+{
+    virtual ScalarFunction *createScalarFunction(ServerInterface &interface)
+    { return vt_createFuncObject<rustWasmUDx_sum_batch>(interface.allocator); }
+
+    // compiler, cpu_features, canonicalize_nans, simd,
+    // call_budget, interruptible; see WasmEngineParameters.h
+    virtual void getParameterType(ServerInterface &interface,
+                                  SizedColumnTypes &parameterTypes)
+    {
+        addWasmEngineParameters(parameterTypes);
+    }
+
+    virtual void getPrototype(ServerInterface &interface,
+                              ColumnTypes &argTypes,
+                              ColumnTypes &returnType)
+    {
+        argTypes.addInt();
+        argTypes.addInt();
+        returnType.addInt();
+    }
+};
+
+RegisterFactory(rustWasmUDx_sum_batchFactory);
+
+// rustWasmUDx_stats() OVER (): the counters of this library's functions,
+// and rustWasmUDx_trace() OVER (): its setup trace; see WasmStats.h
+class rustWasmUDx_statsFactory : public WasmStatsFactory {};
+
+RegisterFactory(rustWasmUDx_statsFactory);
+
+class rustWasmUDx_traceFactory : public WasmTraceFactory {};
+
+RegisterFactory(rustWasmUDx_traceFactory);
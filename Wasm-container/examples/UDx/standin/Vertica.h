@@ -0,0 +1,477 @@
+/*
+ * A stand-in for the parts of the Vertica SDK's Vertica.h that the
+ * scalar UDxes here use, so that udx_driver.cpp can run their
+ * setup/processBlock/destroy on synthetic blocks with no server (see
+ * the driver targets in the Makefile).  It is only meant to compile
+ * these UDxes unchanged and to run scalar functions: the types, names
+ * and call sequence follow the SDK, but a block here is just columns
+ * in vectors, nothing is allocated from the query's pool, and the
+ * transform classes exist only so that WasmStats.h compiles.
+ *
+ * Members that are not in the SDK --- how the driver fills a block,
+ * sets parameters and reads results --- are marked "stand-in only".
+ */
+#ifndef Vertica_standin_h
+#define Vertica_standin_h
+
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace Vertica {
+
+typedef int64_t vint;
+typedef double vfloat;
+typedef int8_t vbool;
+typedef uint32_t vsize;
+
+const vint vint_null = static_cast<vint>(0x8000000000000000ULL);
+const vbool vbool_false = 0;
+const vbool vbool_true = 1;
+const vbool vbool_null = 2;
+
+// What vt_report_error() throws
+class UdfException : public std::exception
+{
+    int errcode;
+    std::string message;
+    public:
+    UdfException(int errcode, const std::string &message)
+        : errcode(errcode), message(message) {}
+
+    int getErrorCode() const { return errcode; }
+    virtual const char* what() const throw() { return message.c_str(); }
+};
+
+__attribute__((format(printf, 1, 2)))
+inline std::string vt_format(const char* fmt, ...)
+{
+    char buf[1024];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    return buf;
+}
+
+// A string value.  Its buffer is as long as its column allows (the
+// VARCHAR length for a result, the value itself for an argument), and
+// data() may be written up to that before setLen().
+class VString
+{
+    std::string buf;
+    vsize len;
+    bool null;
+    public:
+    VString() : len(0), null(false) {}
+
+    bool isNull() const { return null; }
+    void setNull() { null = true; len = 0; }
+    vsize length() const { return len; }
+    const char* data() const { return buf.data(); }
+    char* data() { return &buf[0]; }
+    std::string str() const { return std::string(buf.data(), len); }
+
+    void setLen(vsize length) {
+        if(length > buf.size()) {
+            throw UdfException(0, vt_format("string of %u bytes in a buffer of %zu",
+                                            length, buf.size()));
+        }
+        len = length;
+        null = false;
+    }
+
+    void copy(const char* s, vsize length) {
+        if(length > buf.size()) {
+            throw UdfException(0, vt_format("string of %u bytes in a buffer of %zu",
+                                            length, buf.size()));
+        }
+        buf.replace(0, length, s, length);
+        len = length;
+        null = false;
+    }
+
+    void copy(const std::string &s) { copy(s.data(), s.size()); }
+
+    // stand-in only: room for length bytes
+    void reserve(vsize length) { buf.resize(length); }
+};
+
+class VerticaType
+{
+    public:
+    enum Kind { Any, Int, Float, Bool, Varchar };
+
+    VerticaType(Kind kind = Any, vsize length = 0) : kind(kind), length(length) {}
+
+    bool isInt() const { return kind == Int; }
+    bool isFloat() const { return kind == Float; }
+    bool isBool() const { return kind == Bool; }
+    bool isStringType() const { return kind == Varchar; }
+    bool isAny() const { return kind == Any; }
+    vsize getStringLength() const { return length; }
+
+    // stand-in only
+    Kind getKind() const { return kind; }
+
+    private:
+    Kind kind;
+    vsize length;
+};
+
+// Column types without lengths, for getPrototype()
+class ColumnTypes
+{
+    std::vector<VerticaType> types;
+    public:
+    void addInt() { types.push_back(VerticaType(VerticaType::Int)); }
+    void addFloat() { types.push_back(VerticaType(VerticaType::Float)); }
+    void addBool() { types.push_back(VerticaType(VerticaType::Bool)); }
+    void addVarchar() { types.push_back(VerticaType(VerticaType::Varchar)); }
+    void addAny() { types.push_back(VerticaType(VerticaType::Any)); }
+
+    size_t getColumnCount() const { return types.size(); }
+    const VerticaType &getColumnType(size_t i) const { return types[i]; }
+};
+
+// Column types with lengths and names, for arguments, results and
+// parameters
+class SizedColumnTypes
+{
+    std::vector<VerticaType> types;
+    std::vector<std::string> names;
+
+    void add(const VerticaType &type, const std::string &name) {
+        types.push_back(type);
+        names.push_back(name);
+    }
+    public:
+    void addInt(const std::string &name = "") { add(VerticaType(VerticaType::Int), name); }
+    void addFloat(const std::string &name = "") { add(VerticaType(VerticaType::Float), name); }
+    void addBool(const std::string &name = "") { add(VerticaType(VerticaType::Bool), name); }
+    void addVarchar(vsize length, const std::string &name = "") {
+        add(VerticaType(VerticaType::Varchar, length), name);
+    }
+
+    size_t getColumnCount() const { return types.size(); }
+    bool isEmpty() const { return types.empty(); }
+    const VerticaType &getColumnType(size_t i) const { return types[i]; }
+    const std::string &getColumnName(size_t i) const { return names[i]; }
+};
+
+// USING PARAMETERS values
+class ParamReader
+{
+    std::map<std::string, vint> ints;
+    std::map<std::string, vfloat> floats;
+    std::map<std::string, vbool> bools;
+    std::map<std::string, VString> strings;
+    public:
+    bool containsParameter(const std::string &name) const {
+        return ints.count(name) || floats.count(name) || bools.count(name) || strings.count(name);
+    }
+    const vint &getIntRef(const std::string &name) const { return ints.at(name); }
+    const vfloat &getFloatRef(const std::string &name) const { return floats.at(name); }
+    const vbool &getBoolRef(const std::string &name) const { return bools.at(name); }
+    const VString &getStringRef(const std::string &name) const { return strings.at(name); }
+
+    // stand-in only
+    void setInt(const std::string &name, vint value) { ints[name] = value; }
+    void setFloat(const std::string &name, vfloat value) { floats[name] = value; }
+    void setBool(const std::string &name, bool value) {
+        bools[name] = value ? vbool_true : vbool_false;
+    }
+    void setString(const std::string &name, const std::string &value) {
+        VString &s = strings[name];
+        s.reserve(value.size());
+        s.copy(value);
+    }
+};
+
+// Where vt_createFuncObject() would allocate; unused here
+class VTAllocator {};
+
+class ServerInterface
+{
+    public:
+    VTAllocator* allocator;
+
+    ServerInterface() : allocator(NULL), logFile(NULL) {}
+
+    ParamReader getParamReader() { return params; }
+
+    __attribute__((format(printf, 2, 3)))
+    void log(const char* fmt, ...) {
+        if(! logFile) {
+            return;
+        }
+        va_list ap;
+        va_start(ap, fmt);
+        vfprintf(logFile, fmt, ap);
+        va_end(ap);
+        fputc('\n', logFile);
+    }
+
+    // stand-in only: the query's parameters, and where log() writes
+    // (nowhere when NULL)
+    ParamReader params;
+    FILE* logFile;
+};
+
+// The arguments of a block of rows, read a row at a time
+class BlockReader
+{
+    struct Column {
+        std::vector<vint> ints;
+        std::vector<vfloat> floats;
+        std::vector<vbool> bools;
+        std::vector<VString> strings;
+        std::vector<char> nulls;
+    };
+    SizedColumnTypes types;
+    std::vector<Column> columns;
+    size_t rows;
+    size_t row;
+    public:
+    BlockReader(const SizedColumnTypes &types, size_t rows)
+        : types(types), columns(types.getColumnCount()), rows(rows), row(0) {
+        for(size_t i = 0; i < columns.size(); ++i) {
+            Column &c = columns[i];
+            c.nulls.resize(rows);
+            switch(types.getColumnType(i).getKind()) {
+            case VerticaType::Int: c.ints.resize(rows); break;
+            case VerticaType::Float: c.floats.resize(rows); break;
+            case VerticaType::Bool: c.bools.resize(rows); break;
+            case VerticaType::Varchar: c.strings.resize(rows); break;
+            case VerticaType::Any: break;
+            }
+        }
+    }
+
+    size_t getNumRows() const { return rows; }
+    size_t getNumCols() const { return columns.size(); }
+    const SizedColumnTypes &getTypeMetaData() const { return types; }
+
+    bool isNull(size_t col) const { return columns[col].nulls[row]; }
+    const vint &getIntRef(size_t col) const { return columns[col].ints[row]; }
+    const vfloat &getFloatRef(size_t col) const { return columns[col].floats[row]; }
+    const vbool &getBoolRef(size_t col) const { return columns[col].bools[row]; }
+    const VString &getStringRef(size_t col) const { return columns[col].strings[row]; }
+
+    bool next() { return ++row < rows; }
+
+    // stand-in only: fill the block, and start reading it again
+    void setInt(size_t r, size_t col, vint value) { columns[col].ints[r] = value; }
+    void setFloat(size_t r, size_t col, vfloat value) { columns[col].floats[r] = value; }
+    void setBool(size_t r, size_t col, bool value) {
+        columns[col].bools[r] = value ? vbool_true : vbool_false;
+    }
+    void setString(size_t r, size_t col, const char* s, vsize length) {
+        VString &v = columns[col].strings[r];
+        v.reserve(length);
+        v.copy(s, length);
+    }
+    void setNull(size_t r, size_t col) {
+        Column &c = columns[col];
+        c.nulls[r] = true;
+        if(! c.ints.empty()) {
+            c.ints[r] = vint_null;
+        } else if(! c.bools.empty()) {
+            c.bools[r] = vbool_null;
+        } else if(! c.strings.empty()) {
+            c.strings[r].setNull();
+        }
+    }
+    void rewind() { row = 0; }
+};
+
+// The results of a block of rows, one column, written a row at a time
+class BlockWriter
+{
+    VerticaType type;
+    std::vector<vint> ints;
+    std::vector<vfloat> floats;
+    std::vector<vbool> bools;
+    std::vector<VString> strings;
+    std::vector<char> nulls;
+    size_t row;
+    public:
+    BlockWriter(const VerticaType &type, size_t capacity)
+        : type(type), nulls(capacity), row(0) {
+        switch(type.getKind()) {
+        case VerticaType::Int: ints.resize(capacity); break;
+        case VerticaType::Float: floats.resize(capacity); break;
+        case VerticaType::Bool: bools.resize(capacity); break;
+        case VerticaType::Varchar:
+            strings.resize(capacity);
+            for(size_t i = 0; i < capacity; ++i) {
+                strings[i].reserve(type.getStringLength());
+            }
+            break;
+        case VerticaType::Any: break;
+        }
+    }
+
+    void setInt(vint value) { ints.at(row) = value; nulls[row] = false; }
+    void setFloat(vfloat value) { floats.at(row) = value; nulls[row] = false; }
+    void setBool(vbool value) { bools.at(row) = value; nulls[row] = false; }
+    VString &getStringRef() { nulls.at(row) = false; return strings.at(row); }
+    void setNull() {
+        nulls.at(row) = true;
+        if(! strings.empty()) {
+            strings[row].setNull();
+        }
+    }
+    void next() { ++row; }
+
+    // stand-in only: read what was written, and start writing again
+    size_t getNumRows() const { return row; }
+    bool isNullAt(size_t r) const { return nulls[r]; }
+    vint intAt(size_t r) const { return ints[r]; }
+    vfloat floatAt(size_t r) const { return floats[r]; }
+    vbool boolAt(size_t r) const { return bools[r]; }
+    const VString &stringAt(size_t r) const { return strings[r]; }
+    const VerticaType &getType() const { return type; }
+    void rewind() { row = 0; }
+};
+
+// Transforms aren't run here; these are enough to compile WasmStats.h
+class PartitionReader : public BlockReader
+{
+    public:
+    PartitionReader(const SizedColumnTypes &types, size_t rows) : BlockReader(types, rows) {}
+};
+
+class PartitionWriter
+{
+    public:
+    void setInt(size_t col, vint value) {}
+    void setNull(size_t col) {}
+    VString &getStringRef(size_t col) { return scratch; }
+    bool next() { return true; }
+    private:
+    VString scratch;
+};
+
+class UDXObject
+{
+    public:
+    UDXObject() : canceled(false) {}
+    virtual ~UDXObject() {}
+
+    virtual void setup(ServerInterface &srvInterface, const SizedColumnTypes &argTypes) {}
+    virtual void destroy(ServerInterface &srvInterface, const SizedColumnTypes &argTypes) {}
+    virtual void cancel(ServerInterface &srvInterface) {}
+
+    bool isCanceled() const { return canceled; }
+
+    // stand-in only: what the server does to cancel a query
+    void requestCancel(ServerInterface &srvInterface) {
+        canceled = true;
+        cancel(srvInterface);
+    }
+
+    private:
+    volatile bool canceled;
+};
+
+class ScalarFunction : public UDXObject
+{
+    public:
+    virtual void processBlock(ServerInterface &srvInterface,
+                              BlockReader &argReader,
+                              BlockWriter &resWriter) = 0;
+};
+
+class TransformFunction : public UDXObject
+{
+    public:
+    virtual void processPartition(ServerInterface &srvInterface,
+                                  PartitionReader &inputReader,
+                                  PartitionWriter &outputWriter) = 0;
+};
+
+class UDXFactory
+{
+    public:
+    virtual ~UDXFactory() {}
+
+    virtual void getParameterType(ServerInterface &srvInterface,
+                                  SizedColumnTypes &parameterTypes) {}
+};
+
+// What a scalar function's result depends on besides its arguments
+enum volatility { DEFAULT_VOLATILITY, VOLATILE, STABLE, IMMUTABLE };
+
+class ScalarFunctionFactory : public UDXFactory
+{
+    public:
+    ScalarFunctionFactory() : vol(DEFAULT_VOLATILITY) {}
+
+    volatility vol;
+
+    virtual ScalarFunction *createScalarFunction(ServerInterface &srvInterface) = 0;
+
+    virtual void getPrototype(ServerInterface &srvInterface,
+                              ColumnTypes &argTypes,
+                              ColumnTypes &returnType) = 0;
+
+    // Left empty, the driver sizes the result from the prototype
+    virtual void getReturnType(ServerInterface &srvInterface,
+                               const SizedColumnTypes &argTypes,
+                               SizedColumnTypes &returnType) {}
+};
+
+class TransformFunctionFactory : public UDXFactory
+{
+    public:
+    virtual TransformFunction *createTransformFunction(ServerInterface &srvInterface) = 0;
+
+    virtual void getPrototype(ServerInterface &srvInterface,
+                              ColumnTypes &argTypes,
+                              ColumnTypes &returnType) = 0;
+
+    virtual void getReturnType(ServerInterface &srvInterface,
+                               const SizedColumnTypes &inputTypes,
+                               SizedColumnTypes &outputTypes) = 0;
+};
+
+template <class T>
+T *vt_createFuncObject(VTAllocator* allocator)
+{
+    return new T();
+}
+
+// stand-in only: the factories RegisterFactory() has registered, by
+// class name, in the order they were
+struct RegisteredFactory {
+    const char* name;
+    UDXFactory* factory;
+};
+
+inline std::vector<RegisteredFactory> &registeredFactories()
+{
+    static std::vector<RegisteredFactory> factories;
+    return factories;
+}
+
+struct FactoryRegistration {
+    FactoryRegistration(const char* name, UDXFactory* factory) {
+        RegisteredFactory entry = { name, factory };
+        registeredFactories().push_back(entry);
+    }
+};
+
+} // namespace Vertica
+
+#define vt_report_error(errcode, ...) \
+    throw Vertica::UdfException(errcode, Vertica::vt_format(__VA_ARGS__))
+
+#define RegisterFactory(factory) \
+    static Vertica::FactoryRegistration factory##_registration(#factory, new factory)
+
+#endif // Vertica_standin_h
@@ -87,10 +87,16 @@ prologue = [
     f"CREATE OR REPLACE FUNCTION nonWasmUDx_sumFactory AS LANGUAGE 'C++' NAME 'nonWasmUDx_sumFactory' LIBRARY nonwasmudx NOT FENCED",
     f"CREATE OR REPLACE FUNCTION rustWasmUDx_sumFactory AS LANGUAGE 'C++' NAME 'rustWasmUDx_sumFactory' LIBRARY rustwasmudx NOT FENCED",
     f"CREATE OR REPLACE FUNCTION cWasmUDx_sumFactory AS LANGUAGE 'C++' NAME 'cWasmUDx_sumFactory' LIBRARY cwasmudx NOT FENCED",
+    f"CREATE OR REPLACE FUNCTION rustWasmUDx_sum_batch AS LANGUAGE 'C++' NAME 'rustWasmUDx_sum_batchFactory' LIBRARY rustwasmudx NOT FENCED",
+    f"CREATE OR REPLACE FUNCTION cWasmUDx_sum_batch AS LANGUAGE 'C++' NAME 'cWasmUDx_sum_batchFactory' LIBRARY cwasmudx NOT FENCED",
+    f"CREATE OR REPLACE TRANSFORM FUNCTION rustWasmUDx_stats AS LANGUAGE 'C++' NAME 'rustWasmUDx_statsFactory' LIBRARY rustwasmudx NOT FENCED",
+    f"CREATE OR REPLACE TRANSFORM FUNCTION cWasmUDx_stats AS LANGUAGE 'C++' NAME 'cWasmUDx_statsFactory' LIBRARY cwasmudx NOT FENCED",
     f'DROP TABLE IF EXISTS ct4', 
     f'DROP TABLE IF EXISTS rt4',
     f'DROP TABLE IF EXISTS nt4',
     f'DROP TABLE IF EXISTS st4',
+    f'DROP TABLE IF EXISTS cbt4',
+    f'DROP TABLE IF EXISTS rbt4',
     f"select start_session_trace('wasm', 1, 10)",
 ]
 
@@ -103,6 +109,12 @@ timed_commands = [
     Command('rustWasmUDx_sum 10M rows',
             f"CREATE TABLE rt4 AS SELECT rustWasmUDx_sum(c0, c1) FROM t3",
             "DROP TABLE rt4 CASCADE"),
+    Command('cWasmUDx_sum_batch 10M rows',
+            f"CREATE TABLE cbt4 AS SELECT cWasmUDx_sum_batch(c0, c1) FROM t3",
+            "DROP TABLE cbt4 CASCADE"),
+    Command('rustWasmUDx_sum_batch 10M rows',
+            f"CREATE TABLE rbt4 AS SELECT rustWasmUDx_sum_batch(c0, c1) FROM t3",
+            "DROP TABLE rbt4 CASCADE"),
     Command('nonWasmUDx_sum 10M rows',
             f"CREATE TABLE nt4 AS SELECT nonWasmUDx_sum(c0, c1) FROM t3",
             "DROP TABLE nt4 CASCADE"),
@@ -115,6 +127,13 @@ epilogue = [
     f'select stop_session_trace()',
 ]
 
+# Where the Wasm UDxes' time went, from their own counters (see
+# WasmStats.h): totals for everything run since the libraries were loaded
+stats_queries = [
+    ('cWasmUDx', "SELECT * FROM (SELECT cWasmUDx_stats() OVER ()) s"),
+    ('rustWasmUDx', "SELECT * FROM (SELECT rustWasmUDx_stats() OVER ()) s"),
+]
+
 loop_count = 30
 
 def report(cmd, timings):
@@ -193,6 +212,15 @@ def main():
             except vertica_python.errors.QueryError as e:
                 print(f"{cmd} got error")
                 print(f"{e}")
+        for label, query in stats_queries:
+            try:
+                cur.execute(query)
+                columns = [d.name for d in cur.description]
+                for row in cur.fetchall():
+                    print(f"{label}: " + ", ".join(f"{c}={v}" for c, v in zip(columns, row)))
+            except vertica_python.errors.QueryError as e:
+                print(f"{query} got error")
+                print(f"{e}")
             
 if __name__ == '__main__':
     main()
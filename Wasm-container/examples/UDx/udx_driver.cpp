@@ -0,0 +1,425 @@
+// Runs the scalar functions of one UDx library the way a query would ---
+// createScalarFunction(), setup(), processBlock() on each block,
+// destroy() --- on synthetic blocks, against the SDK stand-in in
+// standin/ instead of a Vertica server.  The Makefile builds one driver
+// per library (build/cWasmUDx_driver, build/nonFibUDx_driver, ...), from
+// the library's source unchanged.
+//
+//   ./cWasmUDx_driver [--rows N] [--block-rows N] [--null-fraction F]
+//                     [--trials N] [--warmup N] [--seed N]
+//                     [--min-int N] [--max-int N] [--string-length N]
+//                     [--param NAME=VALUE]... [--log] [--list] [FACTORY...]
+//
+// With no FACTORY every scalar function in the library runs.  Each one
+// runs --warmup queries untimed and then --trials timed, over --rows
+// rows in blocks of --block-rows; every argument is null with
+// probability --null-fraction, ints are uniform in [--min-int,
+// --max-int], and strings are up to --string-length bytes of words and
+// runs of blanks.  Parameters are given as USING PARAMETERS would, and
+// --log writes what the functions log to stderr.  The inputs come from
+// a fixed seed, so the checksum of the results of, say, cWasmUDx_sum
+// and nonWasmUDx_sum must agree.  processBlock() time is reported per
+// row, setup() and destroy() per query.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "Vertica.h"
+
+using namespace Vertica;
+
+namespace {
+
+struct Options {
+    unsigned long long rows = 1000000;
+    size_t block_rows = 1024;
+    double null_fraction = 0;
+    int trials = 10;
+    int warmup = 2;
+    unsigned seed = 42;
+    vint min_int = 0;
+    vint max_int = 40;
+    vsize string_length = 32;
+    std::vector<std::string> params;
+    bool log = false;
+    bool list = false;
+    std::vector<std::string> factories;
+};
+
+struct Query {
+    double setup_ns;
+    double process_ns;
+    double destroy_ns;
+};
+
+double elapsed_ns(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+double median(std::vector<double> v)
+{
+    std::sort(v.begin(), v.end());
+    const size_t n = v.size();
+    return n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+// The query's parameters, typed by the factory's getParameterType()
+bool set_parameters(ScalarFunctionFactory* factory, const Options &options,
+                    ServerInterface &srvInterface, std::string* error)
+{
+    SizedColumnTypes parameterTypes;
+    factory->getParameterType(srvInterface, parameterTypes);
+    for(size_t i = 0; i < options.params.size(); ++i) {
+        const std::string &param = options.params[i];
+        const size_t eq = param.find('=');
+        const std::string name = param.substr(0, eq);
+        const std::string value = eq == std::string::npos ? "" : param.substr(eq + 1);
+        size_t col = 0;
+        while(col < parameterTypes.getColumnCount() && parameterTypes.getColumnName(col) != name)
+            ++col;
+        if(eq == std::string::npos || col == parameterTypes.getColumnCount()) {
+            *error = "no parameter " + param;
+            return false;
+        }
+        const VerticaType &type = parameterTypes.getColumnType(col);
+        if(type.isInt())
+            srvInterface.params.setInt(name, strtoll(value.c_str(), NULL, 10));
+        else if(type.isFloat())
+            srvInterface.params.setFloat(name, strtod(value.c_str(), NULL));
+        else if(type.isBool())
+            srvInterface.params.setBool(name, value == "true" || value == "t" || value == "1");
+        else
+            srvInterface.params.setString(name, value);
+    }
+    return true;
+}
+
+// The argument and result types, with the lengths a table's columns
+// would have
+bool sized_types(ScalarFunctionFactory* factory, const Options &options,
+                 ServerInterface &srvInterface, SizedColumnTypes* argTypes,
+                 SizedColumnTypes* returnTypes, std::string* error)
+{
+    ColumnTypes args;
+    ColumnTypes returns;
+    factory->getPrototype(srvInterface, args, returns);
+    for(size_t i = 0; i < args.getColumnCount(); ++i) {
+        const VerticaType &type = args.getColumnType(i);
+        if(type.isInt())
+            argTypes->addInt();
+        else if(type.isFloat())
+            argTypes->addFloat();
+        else if(type.isBool())
+            argTypes->addBool();
+        else if(type.isStringType())
+            argTypes->addVarchar(options.string_length);
+        else {
+            *error = "takes any arguments, so there's nothing to generate";
+            return false;
+        }
+    }
+    factory->getReturnType(srvInterface, *argTypes, *returnTypes);
+    if(returnTypes->isEmpty() && returns.getColumnCount() == 1) {
+        const VerticaType &type = returns.getColumnType(0);
+        if(type.isInt())
+            returnTypes->addInt();
+        else if(type.isFloat())
+            returnTypes->addFloat();
+        else if(type.isBool())
+            returnTypes->addBool();
+        else if(type.isStringType())
+            returnTypes->addVarchar(options.string_length);
+    }
+    if(returnTypes->getColumnCount() != 1) {
+        *error = "has no result type";
+        return false;
+    }
+    return true;
+}
+
+// The same rows for every function, from the seed
+std::vector<BlockReader> make_blocks(const Options &options, const SizedColumnTypes &argTypes)
+{
+    static const char WORDS[] = "Lorem ipsum DOLOR sit amet consectetur adipiscing Elit";
+    std::mt19937_64 rng(options.seed);
+    std::uniform_int_distribution<vint> ints(options.min_int, options.max_int);
+    std::uniform_real_distribution<double> unit(0, 1);
+    std::uniform_int_distribution<vsize> lengths(0, options.string_length);
+    std::uniform_int_distribution<size_t> offsets(0, sizeof(WORDS) - 2);
+    std::string s;
+
+    std::vector<BlockReader> blocks;
+    for(unsigned long long first = 0; first < options.rows; first += options.block_rows) {
+        const size_t rows = std::min<unsigned long long>(options.block_rows, options.rows - first);
+        blocks.push_back(BlockReader(argTypes, rows));
+        BlockReader &block = blocks.back();
+        for(size_t row = 0; row < rows; ++row) {
+            for(size_t col = 0; col < argTypes.getColumnCount(); ++col) {
+                const VerticaType &type = argTypes.getColumnType(col);
+                if(options.null_fraction > 0 && unit(rng) < options.null_fraction) {
+                    block.setNull(row, col);
+                } else if(type.isInt()) {
+                    block.setInt(row, col, ints(rng));
+                } else if(type.isFloat()) {
+                    block.setFloat(row, col, unit(rng) * (options.max_int - options.min_int) + options.min_int);
+                } else if(type.isBool()) {
+                    block.setBool(row, col, unit(rng) < 0.5);
+                } else {
+                    // words from anywhere in WORDS, with runs of blanks
+                    const vsize length = lengths(rng);
+                    s.clear();
+                    while(s.size() < length) {
+                        s += unit(rng) < 0.2 ? " \t " : WORDS + offsets(rng);
+                    }
+                    s.resize(length);
+                    block.setString(row, col, s.data(), length);
+                }
+            }
+        }
+    }
+    return blocks;
+}
+
+// FNV-1a over each row's result, nulls included
+unsigned long long checksum(const BlockWriter &resWriter, unsigned long long h)
+{
+    const VerticaType &type = resWriter.getType();
+    for(size_t row = 0; row < resWriter.getNumRows(); ++row) {
+        unsigned char bytes[sizeof(vint)];
+        const unsigned char* data = bytes;
+        size_t length = 0;
+        if(resWriter.isNullAt(row)) {
+            bytes[0] = 0xff;
+            length = 1;
+        } else if(type.isInt()) {
+            const vint v = resWriter.intAt(row);
+            memcpy(bytes, &v, sizeof(v));
+            length = sizeof(v);
+        } else if(type.isFloat()) {
+            const vfloat v = resWriter.floatAt(row);
+            memcpy(bytes, &v, sizeof(v));
+            length = sizeof(v);
+        } else if(type.isBool()) {
+            bytes[0] = resWriter.boolAt(row);
+            length = 1;
+        } else {
+            const VString &s = resWriter.stringAt(row);
+            data = reinterpret_cast<const unsigned char*>(s.data());
+            length = s.length();
+        }
+        for(size_t i = 0; i < length; ++i) {
+            h = (h ^ data[i]) * 0x100000001b3ULL;
+        }
+        h = (h ^ 0x0a) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+// One query over all the blocks; false (with *error) if the function
+// reports an error or doesn't write a result for every row
+bool run_query(ScalarFunctionFactory* factory, ServerInterface &srvInterface,
+               const SizedColumnTypes &argTypes, std::vector<BlockReader> &blocks,
+               BlockWriter &resWriter, Query* query, unsigned long long* sum,
+               std::string* error)
+{
+    ScalarFunction* function = factory->createScalarFunction(srvInterface);
+    bool ok = true;
+    bool set_up = false;
+    *sum = 0xcbf29ce484222325ULL;
+    query->process_ns = 0;
+    query->destroy_ns = 0;
+    try {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        function->setup(srvInterface, argTypes);
+        query->setup_ns = elapsed_ns(start);
+        set_up = true;
+
+        for(size_t i = 0; i < blocks.size(); ++i) {
+            BlockReader &argReader = blocks[i];
+            argReader.rewind();
+            resWriter.rewind();
+            start = std::chrono::steady_clock::now();
+            function->processBlock(srvInterface, argReader, resWriter);
+            query->process_ns += elapsed_ns(start);
+            if(resWriter.getNumRows() != argReader.getNumRows()) {
+                char buf[128];
+                snprintf(buf, sizeof(buf), "wrote %zu rows for a block of %zu",
+                         resWriter.getNumRows(), argReader.getNumRows());
+                *error = buf;
+                ok = false;
+                break;
+            }
+            *sum = checksum(resWriter, *sum);
+        }
+    } catch(std::exception &e) {
+        *error = e.what();
+        ok = false;
+    }
+    // Vertica calls destroy() after an error in processBlock() too
+    if(set_up) {
+        try {
+            const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            function->destroy(srvInterface, argTypes);
+            query->destroy_ns = elapsed_ns(start);
+        } catch(std::exception &e) {
+            if(ok)
+                *error = e.what();
+            ok = false;
+        }
+    }
+    delete function;
+    return ok;
+}
+
+bool run_factory(const char* name, ScalarFunctionFactory* factory, const Options &options)
+{
+    ServerInterface srvInterface;
+    srvInterface.logFile = options.log ? stderr : NULL;
+    SizedColumnTypes argTypes;
+    SizedColumnTypes returnTypes;
+    std::string error;
+    if(! set_parameters(factory, options, srvInterface, &error) ||
+       ! sized_types(factory, options, srvInterface, &argTypes, &returnTypes, &error)) {
+        fprintf(stderr, "%s %s\n", name, error.c_str());
+        return false;
+    }
+    std::vector<BlockReader> blocks = make_blocks(options, argTypes);
+    BlockWriter resWriter(returnTypes.getColumnType(0), options.block_rows);
+
+    std::vector<double> setup_ns, process_ns, destroy_ns;
+    unsigned long long sum = 0;
+    for(int i = 0; i < options.warmup + options.trials; ++i) {
+        Query query;
+        if(! run_query(factory, srvInterface, argTypes, blocks, resWriter, &query, &sum, &error)) {
+            fprintf(stderr, "%s failed: %s\n", name, error.c_str());
+            return false;
+        }
+        if(i >= options.warmup) {
+            setup_ns.push_back(query.setup_ns);
+            process_ns.push_back(query.process_ns);
+            destroy_ns.push_back(query.destroy_ns);
+        }
+    }
+    const double rows = static_cast<double>(options.rows);
+    const double ns_per_row = median(process_ns) / rows;
+    printf("%-36s %10llu %6zu %6.3f %10.1f %10.1f %8.2f %8.2f %8.2f %016llx\n",
+           name, options.rows, options.block_rows, options.null_fraction,
+           median(setup_ns) / 1e3, median(destroy_ns) / 1e3, ns_per_row,
+           *std::min_element(process_ns.begin(), process_ns.end()) / rows,
+           1e3 / ns_per_row, sum);
+    fflush(stdout);
+    return true;
+}
+
+bool parse_options(int argc, const char* argv[], Options* options) {
+    for(int i = 1; i < argc; ++i) {
+        const std::string flag = argv[i];
+        if(flag == "--log") {
+            options->log = true;
+            continue;
+        }
+        if(flag == "--list") {
+            options->list = true;
+            continue;
+        }
+        if(flag.compare(0, 2, "--") != 0) {
+            options->factories.push_back(flag);
+            continue;
+        }
+        if(i + 1 == argc)
+            return false;
+        const char* value = argv[++i];
+        if(flag == "--rows")
+            options->rows = strtoull(value, NULL, 10);
+        else if(flag == "--block-rows")
+            options->block_rows = strtoull(value, NULL, 10);
+        else if(flag == "--null-fraction")
+            options->null_fraction = strtod(value, NULL);
+        else if(flag == "--trials")
+            options->trials = atoi(value);
+        else if(flag == "--warmup")
+            options->warmup = atoi(value);
+        else if(flag == "--seed")
+            options->seed = strtoul(value, NULL, 10);
+        else if(flag == "--min-int")
+            options->min_int = strtoll(value, NULL, 10);
+        else if(flag == "--max-int")
+            options->max_int = strtoll(value, NULL, 10);
+        else if(flag == "--string-length")
+            options->string_length = strtoul(value, NULL, 10);
+        else if(flag == "--param")
+            options->params.push_back(value);
+        else
+            return false;
+    }
+    return options->rows > 0 && options->block_rows > 0 && options->trials > 0 &&
+        options->warmup >= 0 && options->null_fraction >= 0 && options->null_fraction <= 1 &&
+        options->min_int <= options->max_int;
+}
+
+} // namespace
+
+int main(const int argc, const char* argv[]) {
+    Options options;
+    if(! parse_options(argc, argv, &options)) {
+        fprintf(stderr,
+                "Usage: %s [--rows N] [--block-rows N] [--null-fraction F] [--trials N]\n"
+                "       [--warmup N] [--seed N] [--min-int N] [--max-int N] [--string-length N]\n"
+                "       [--param NAME=VALUE]... [--log] [--list] [FACTORY...]\n",
+                argv[0]);
+        return 2;
+    }
+
+    // The library's scalar functions; the stats and trace transforms
+    // need a server
+    std::vector<RegisteredFactory> scalars;
+    const std::vector<RegisteredFactory> &registered = registeredFactories();
+    for(size_t i = 0; i < registered.size(); ++i) {
+        if(dynamic_cast<ScalarFunctionFactory*>(registered[i].factory)) {
+            scalars.push_back(registered[i]);
+        }
+    }
+    if(options.list) {
+        for(size_t i = 0; i < scalars.size(); ++i) {
+            printf("%s\n", scalars[i].name);
+        }
+        return 0;
+    }
+
+    bool ok = true;
+    std::vector<RegisteredFactory> selected;
+    for(size_t i = 0; i < options.factories.size(); ++i) {
+        size_t j = 0;
+        while(j < scalars.size() && options.factories[i] != scalars[j].name)
+            ++j;
+        if(j == scalars.size()) {
+            fprintf(stderr, "%s: no scalar function %s (see --list)\n", argv[0],
+                    options.factories[i].c_str());
+            ok = false;
+        } else {
+            selected.push_back(scalars[j]);
+        }
+    }
+    if(options.factories.empty()) {
+        selected = scalars;
+    }
+
+    printf("%-36s %10s %6s %6s %10s %10s %8s %8s %8s %16s\n",
+           "function", "rows", "block", "nulls", "setup_us", "destroy_us",
+           "ns/row", "min", "Mrows/s", "checksum");
+    fflush(stdout);
+    for(size_t i = 0; i < selected.size(); ++i) {
+        if(! run_factory(selected[i].name, static_cast<ScalarFunctionFactory*>(selected[i].factory),
+                         options)) {
+            ok = false;
+        }
+    }
+    return ok ? 0 : 1;
+}
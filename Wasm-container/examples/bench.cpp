@@ -0,0 +1,1309 @@
+// Microbenchmarks of the ways to call sum and fib: natively, through
+// udx_call_handle_*, through the typed WasmFunction wrapper, and with
+// the column-batch calls, for each Wasm module (including memory64
+// builds of the C ones, the c.64.wasm rows); of normalizing strings
+// natively and with the string batch calls; and of an aggregate (an
+// approximate distinct count) natively and through udx_aggregate_*; and
+// of setting a state up and cleaning it up again, with and without the
+// instance pool; and of interrupting a runaway call; and of fib over a
+// column of small arguments with a result cache (udx_memo.hpp) of a few
+// sizes, with the hit rate each gets.
+//
+//   ./bench [--trials N] [--warmup N] [--seed N] [--cpu N | --no-pin]
+//           [--sizes 1000,100000,1000000] [--fib-args 3,50,75,4998]
+//           [--fib-calls N] [--json FILE]
+//
+// Each case runs --warmup times untimed and then --trials times timed.
+// The table (and the JSON written to FILE, or to stdout for "-") gives
+// the median, 99th percentile (nearest rank, so with few trials it is
+// the slowest one), mean, standard deviation, and minimum of the time
+// per row or per call in nanoseconds.  The inputs come from a fixed
+// seed, the process is pinned to one CPU (by default the one it starts
+// on), and every result is checked against the native one; bench exits
+// non-zero if any case fails or differs.
+
+#include <sched.h>
+#include <time.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include "udx_wasm.h"
+}
+#include "udx_memo.hpp"
+#include "udx_wasm.hpp"
+
+namespace {
+
+struct Options {
+    int trials = 30;
+    int warmup = 3;
+    unsigned seed = 42;
+    int cpu = -1;               // -1: the CPU bench starts on
+    bool pin = true;
+    std::vector<unsigned long long> sizes = {1000, 100000, 1000000};
+    std::vector<unsigned long long> fib_args = {3, 50, 75, 4998};
+    unsigned long long fib_calls = 100000;
+    const char* json = NULL;
+};
+
+// Large fib arguments get fewer calls per trial, so that a trial is
+// about this many loop iterations at most
+const unsigned long long FIB_STEPS_PER_TRIAL = 20000000;
+
+// The memo cases: fib of MEMO_ROWS arguments drawn uniformly from
+// 0..MEMO_MAX_ARG (like t3's c1), through caches of these sizes; 0 is
+// no cache, which only runs the first FIB_STEPS_PER_TRIAL / (MEMO_MAX_ARG / 2)
+// rows.  Few trials: a trial with a low hit rate is slow.
+const unsigned long long MEMO_ROWS = 100000;
+const unsigned long long MEMO_MAX_ARG = 10000;
+const size_t MEMO_ENTRIES[] = {0, 1024, 4096, 16384, 65536};
+const int MEMO_TRIALS = 5;
+
+// Setup and cleanup cycles in a trial of the setup cases
+const int SETUP_CYCLES = 100;
+
+// Metering points the fib budget rows give each call: plenty, since
+// they measure what setting a budget costs, not running out of one
+const unsigned long long FIB_CALL_BUDGET = 1ULL << 40;
+
+// The cancel cases interrupt a loop of fib calls this long after it
+// starts; each row is fib(CANCEL_FIB_ARG), and each batch call
+// CANCEL_BATCH_ROWS of them
+const int CANCEL_AFTER_MS = 2;
+const unsigned long long CANCEL_FIB_ARG = 1000;
+const size_t CANCEL_BATCH_ROWS = 4096;
+// The -running cancel cases' one call, which would take days
+const unsigned long long CANCEL_RUNAWAY_FIB_ARG = 1ULL << 50;
+
+struct Stats {
+    double median;
+    double p99;
+    double mean;
+    double stddev;
+    double min;
+    double max;
+};
+
+struct Result {
+    std::string benchmark;      // "sum", "fib", "normalize", "tokenize", "distinct", "setup", "cancel", "memo"
+    std::string impl;           // "native", "c.wasm-typed", ...
+    const char* param_name;     // "rows" or "arg"
+    unsigned long long param;
+    const char* unit;
+    bool ok;
+    std::string error;
+    Stats stats;
+    std::string note;           // printed after the unit, e.g. a hit rate
+};
+
+double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+Stats summarize(std::vector<double> samples) {
+    Stats s;
+    std::sort(samples.begin(), samples.end());
+    const size_t n = samples.size();
+    s.min = samples.front();
+    s.max = samples.back();
+    s.median = n % 2 ? samples[n / 2] : (samples[n / 2 - 1] + samples[n / 2]) / 2;
+    s.p99 = samples[(size_t) std::ceil(0.99 * n) - 1];
+    double sum = 0;
+    for(double x : samples)
+        sum += x;
+    s.mean = sum / n;
+    double squares = 0;
+    for(double x : samples)
+        squares += (x - s.mean) * (x - s.mean);
+    s.stddev = n > 1 ? std::sqrt(squares / (n - 1)) : 0;
+    return s;
+}
+
+// One pass of a case: false, with *error set, if it failed
+typedef std::function<bool(std::string* error)> Pass;
+
+class Bench {
+public:
+    // The table goes to stderr when the JSON goes to stdout
+    explicit Bench(const Options& options)
+        : options(options),
+          table(options.json && ! strcmp(options.json, "-") ? stderr : stdout) {}
+
+    // Time pass, which does count rows or calls, and check it with check
+    void run(const char* benchmark,
+             const std::string& impl,
+             const char* param_name,
+             unsigned long long param,
+             const char* unit,
+             double count,
+             const Pass& pass,
+             const Pass& check) {
+        Result result;
+        result.benchmark = benchmark;
+        result.impl = impl;
+        result.param_name = param_name;
+        result.param = param;
+        result.unit = unit;
+        result.ok = true;
+        std::vector<double> samples;
+        for(int i = 0; result.ok && i < options.warmup; ++i)
+            result.ok = pass(&result.error);
+        for(int i = 0; result.ok && i < options.trials; ++i) {
+            const double start = now_ns();
+            result.ok = pass(&result.error);
+            samples.push_back((now_ns() - start) / count);
+        }
+        if(result.ok)
+            result.ok = check(&result.error);
+        if(result.ok)
+            result.stats = summarize(samples);
+        print(result);
+        results.push_back(result);
+    }
+
+    // A case the caller timed itself, one sample per trial; failed if
+    // error isn't empty
+    void record(const char* benchmark,
+                const std::string& impl,
+                const char* param_name,
+                unsigned long long param,
+                const char* unit,
+                const std::vector<double>& samples,
+                const std::string& error,
+                const std::string& note = std::string()) {
+        Result result;
+        result.benchmark = benchmark;
+        result.impl = impl;
+        result.param_name = param_name;
+        result.param = param;
+        result.unit = unit;
+        result.ok = error.empty() && ! samples.empty();
+        result.error = error;
+        result.note = note;
+        if(result.ok)
+            result.stats = summarize(samples);
+        print(result);
+        results.push_back(result);
+    }
+
+    // A case that couldn't be set up
+    void fail(const char* benchmark, const std::string& impl, const std::string& error) {
+        Result result;
+        result.benchmark = benchmark;
+        result.impl = impl;
+        result.param_name = "";
+        result.param = 0;
+        result.unit = "";
+        result.ok = false;
+        result.error = error;
+        print(result);
+        results.push_back(result);
+    }
+
+    bool all_ok() const {
+        for(const Result& result : results)
+            if(! result.ok)
+                return false;
+        return true;
+    }
+
+    void header(const char* engine_config, int cpu) const {
+        fprintf(table, "Wasm engine configuration: %s; %d trials after %d warmup; seed %u; ",
+                engine_config, options.trials, options.warmup, options.seed);
+        if(cpu >= 0)
+            fprintf(table, "pinned to CPU %d\n", cpu);
+        else
+            fprintf(table, "not pinned\n");
+        fprintf(table, "%-9s %-28s %10s %10s %10s %10s %10s %10s\n",
+               "", "", "", "median", "p99", "mean", "stddev", "min");
+    }
+
+    // The engine a module was set up on; they all share one
+    void saw_engine(const char* description) {
+        if(! engine)
+            engine = description;
+    }
+
+    bool write_json(const char* filename, int cpu) const {
+        FILE* out = strcmp(filename, "-") ? fopen(filename, "w") : stdout;
+        if(! out) {
+            perror(filename);
+            return false;
+        }
+        fprintf(out, "{\n  \"engine\": \"%s\",\n  \"trials\": %d,\n  \"warmup\": %d,\n"
+                "  \"seed\": %u,\n  \"cpu\": %d,\n  \"results\": [",
+                engine ? engine : udx_query_wasm_config(),
+                options.trials, options.warmup, options.seed, cpu);
+        const char* separator = "\n";
+        for(const Result& r : results) {
+            fprintf(out, "%s    {\"benchmark\": \"%s\", \"impl\": \"%s\", \"ok\": %s",
+                    separator, r.benchmark.c_str(), r.impl.c_str(), r.ok ? "true" : "false");
+            if(r.ok) {
+                fprintf(out, ", \"%s\": %llu, \"unit\": \"%s\", \"median\": %.3f, \"p99\": %.3f"
+                        ", \"mean\": %.3f, \"stddev\": %.3f, \"min\": %.3f, \"max\": %.3f",
+                        r.param_name, r.param, r.unit, r.stats.median, r.stats.p99,
+                        r.stats.mean, r.stats.stddev, r.stats.min, r.stats.max);
+                if(! r.note.empty())
+                    fprintf(out, ", \"note\": \"%s\"", r.note.c_str());
+                fputc('}', out);
+            } else {
+                fputs(", \"error\": \"", out);
+                for(const char c : r.error) {
+                    if(c == '"' || c == '\\')
+                        fprintf(out, "\\%c", c);
+                    else if((unsigned char) c < ' ')
+                        fprintf(out, "\\u%04x", c);
+                    else
+                        fputc(c, out);
+                }
+                fputs("\"}", out);
+            }
+            separator = ",\n";
+        }
+        fputs("\n  ]\n}\n", out);
+        return out == stdout ? fflush(out) == 0 : fclose(out) == 0;
+    }
+
+private:
+    void print(const Result& r) const {
+        if(! r.ok) {
+            fprintf(table, "%-9s %-28s FAILED: %s\n", r.benchmark.c_str(), r.impl.c_str(), r.error.c_str());
+            return;
+        }
+        fprintf(table, "%-9s %-28s %10llu %10.2f %10.2f %10.2f %10.2f %10.2f %s%s%s\n",
+               r.benchmark.c_str(), r.impl.c_str(), r.param, r.stats.median, r.stats.p99,
+               r.stats.mean, r.stats.stddev, r.stats.min, r.unit,
+               r.note.empty() ? "" : " ", r.note.c_str());
+        fflush(table);
+    }
+
+    const Options& options;
+    FILE* table;
+    const char* engine = NULL;
+    std::vector<Result> results;
+};
+
+__attribute__((noinline)) int native_sum(const int a, const int b) {
+    return a + b;
+}
+
+__attribute__((noinline)) unsigned long long native_fib(unsigned long long a) {
+    unsigned long long i;
+    unsigned long long prev = 1;
+    unsigned long long cur = 1;
+    for(i = 2; i < a; i++) {
+        unsigned long long tmp = cur;
+        cur = cur + prev;
+        prev = tmp;
+    }
+    return cur;
+}
+
+// A module set up once for all of its cases: one state, one handle per
+// export used
+struct Module {
+    const char* label;          // "c.wasm"
+    const char* filename;
+    bool batch_only;            // SIMD builds: only the batch kernel differs
+    void* ws;
+    int call;
+    int batch;
+    std::string error;
+    int masked;                 // the batch kernel for chunks with nulls, if any
+};
+
+// engine_options: NULL for the environment's
+bool open_module(Bench& bench, Module* m, const char* call, const char* batch,
+                 const struct udx_engine_options* engine_options = NULL) {
+    char* errormsg;
+    m->ws = udx_get_wasm_state();
+    if(! m->ws) {
+        m->error = "can't allocate a wasm state";
+        return false;
+    }
+    if(! (engine_options ? udx_setup_with_options(m->filename, m->ws, NULL, engine_options, &errormsg)
+                         : udx_setup(m->filename, m->ws, NULL, &errormsg))
+       || (call && ! udx_lookup_function(m->ws, call, &m->call, &errormsg))
+       || ! udx_lookup_function(m->ws, batch, &m->batch, &errormsg)) {
+        m->error = std::string(m->filename) + ": " + errormsg;
+        return false;
+    }
+    const std::string masked = std::string(batch) + "_masked";
+    if(! udx_lookup_function(m->ws, masked.c_str(), &m->masked, &errormsg))
+        m->masked = UDX_NO_FUNCTION;
+    bench.saw_engine(udx_describe_engine(m->ws));
+    return true;
+}
+
+std::string mismatch(const char* what, size_t i) {
+    return std::string("result differs from native at ") + what + " " + std::to_string(i);
+}
+
+void bench_sum(Bench& bench, const Options& options) {
+    const size_t max_rows = *std::max_element(options.sizes.begin(), options.sizes.end());
+    std::vector<int> a(max_rows), b(max_rows), expected(max_rows), out(max_rows);
+    std::mt19937 generator(options.seed);
+    std::uniform_int_distribution<int> distribution(0, 255); // fits in a byte
+    for(size_t i = 0; i < max_rows; ++i) {
+        a[i] = distribution(generator);
+        b[i] = distribution(generator);
+        expected[i] = a[i] + b[i];
+    }
+    // Validity bitmaps (see udx_call_batch_masked_2i_1i): one with a
+    // null in every 64 rows, so every chunk takes the masked kernel, and
+    // one with none, which only costs the check for nulls
+    std::vector<unsigned char> some_nulls((max_rows + 7) / 8, 0xff), no_nulls(some_nulls);
+    for(size_t i = 0; i < max_rows; i += 64)
+        some_nulls[i / 8] &= ~(1 << (i % 8));
+
+    Module modules[] = {
+        {"c.wasm", "sum.c.wasm", false, NULL, 0, 0, "", UDX_NO_FUNCTION},
+        {"rs.wasm", "sum.rs.wasm", false, NULL, 0, 0, "", UDX_NO_FUNCTION},
+        {"c.simd.wasm", "sum.c.simd.wasm", true, NULL, 0, 0, "", UDX_NO_FUNCTION},
+        {"rs.simd.wasm", "sum.rs.simd.wasm", true, NULL, 0, 0, "", UDX_NO_FUNCTION},
+        // memory64: the batch kernels' loads and stores are bounds
+        // checked, where a 32-bit memory relies on guard pages
+        {"c.64.wasm", "sum.c.64.wasm", false, NULL, 0, 0, "", UDX_NO_FUNCTION},
+    };
+    std::vector<Module*> ready;
+    for(Module& m : modules) {
+        if(open_module(bench, &m, "sum", "sum_batch"))
+            ready.push_back(&m);
+        else
+            bench.fail("sum", m.label, m.error);
+    }
+
+    for(const unsigned long long rows : options.sizes) {
+        const Pass check = [&](std::string* error) {
+            for(size_t i = 0; i < rows; ++i) {
+                if(out[i] != expected[i]) {
+                    *error = mismatch("row", i);
+                    return false;
+                }
+            }
+            return true;
+        };
+        // each case starts from a result column that can't pass
+        const auto run = [&](const std::string& impl, const Pass& pass) {
+            std::fill(out.begin(), out.begin() + rows, -1);
+            bench.run("sum", impl, "rows", rows, "ns/row", rows, pass, check);
+        };
+
+        run("native", [&](std::string*) {
+            for(size_t i = 0; i < rows; ++i)
+                out[i] = native_sum(a[i], b[i]);
+            return true;
+        });
+        for(Module* m : ready) {
+            char* errormsg;
+            if(! m->batch_only) {
+                run(std::string(m->label) + "-call", [&](std::string* error) {
+                    for(size_t i = 0; i < rows; ++i) {
+                        if(! udx_call_handle_2i_1i(m->call, a[i], b[i], &out[i], m->ws, &errormsg)) {
+                            *error = errormsg;
+                            return false;
+                        }
+                    }
+                    return true;
+                });
+                udx_wasm::WasmFunction<int(int, int)> sum;
+                if(! sum.bind(m->ws, m->call, &errormsg)) {
+                    bench.fail("sum", std::string(m->label) + "-typed", errormsg);
+                } else {
+                    run(std::string(m->label) + "-typed", [&](std::string* error) {
+                        for(size_t i = 0; i < rows; ++i) {
+                            if(! sum.call(a[i], b[i], &out[i], &errormsg)) {
+                                *error = errormsg;
+                                return false;
+                            }
+                        }
+                        return true;
+                    });
+                }
+            }
+            run(std::string(m->label) + "-batch", [&](std::string* error) {
+                if(! udx_call_batch_handle_2i_1i(m->batch, a.data(), b.data(), out.data(),
+                                                 rows, m->ws, &errormsg)) {
+                    *error = errormsg;
+                    return false;
+                }
+                return true;
+            });
+            if(m->batch_only || m->masked == UDX_NO_FUNCTION)
+                continue;
+            run(std::string(m->label) + "-nonnull", [&](std::string* error) {
+                if(! udx_call_batch_masked_2i_1i(m->batch, m->masked, a.data(), b.data(),
+                                                 no_nulls.data(), out.data(), rows, m->ws, &errormsg)) {
+                    *error = errormsg;
+                    return false;
+                }
+                return true;
+            });
+            // only the rows that aren't null have to match
+            std::fill(out.begin(), out.begin() + rows, -1);
+            bench.run("sum", std::string(m->label) + "-nulls", "rows", rows, "ns/row", rows,
+                      [&](std::string* error) {
+                          if(! udx_call_batch_masked_2i_1i(m->batch, m->masked, a.data(), b.data(),
+                                                           some_nulls.data(), out.data(), rows,
+                                                           m->ws, &errormsg)) {
+                              *error = errormsg;
+                              return false;
+                          }
+                          return true;
+                      },
+                      [&](std::string* error) {
+                          for(size_t i = 0; i < rows; ++i) {
+                              if(i % 64 && out[i] != expected[i]) {
+                                  *error = mismatch("row", i);
+                                  return false;
+                              }
+                          }
+                          return true;
+                      });
+        }
+    }
+    for(Module& m : modules)
+        udx_cleanup(m.ws);
+}
+
+void bench_fib(Bench& bench, const Options& options) {
+    Module modules[] = {
+        {"c.wasm", "fib.c.wasm", false, NULL, 0, 0, "", UDX_NO_FUNCTION},
+        {"rs.wasm", "fib.rs.wasm", false, NULL, 0, 0, "", UDX_NO_FUNCTION},
+        {"c.simd.wasm", "fib.c.simd.wasm", true, NULL, 0, 0, "", UDX_NO_FUNCTION},
+        {"rs.simd.wasm", "fib.rs.simd.wasm", true, NULL, 0, 0, "", UDX_NO_FUNCTION},
+        {"c.64.wasm", "fib.c.64.wasm", false, NULL, 0, 0, "", UDX_NO_FUNCTION},
+    };
+    // The scalar modules again with a call_budget, so on the metered
+    // engine: what counting points and setting them before every call
+    // cost
+    Module metered[] = {
+        {"c.wasm-budget", "fib.c.wasm", false, NULL, 0, 0, "", UDX_NO_FUNCTION},
+        {"rs.wasm-budget", "fib.rs.wasm", false, NULL, 0, 0, "", UDX_NO_FUNCTION},
+    };
+    // And on an interruptible engine: what polling for interrupts in
+    // every loop iteration and call costs
+    Module interruptible[] = {
+        {"c.wasm-interruptible", "fib.c.wasm", false, NULL, 0, 0, "", UDX_NO_FUNCTION},
+        {"rs.wasm-interruptible", "fib.rs.wasm", false, NULL, 0, 0, "", UDX_NO_FUNCTION},
+    };
+    struct udx_engine_options budget_options, interruptible_options;
+    udx_default_engine_options(&budget_options);
+    budget_options.call_budget = FIB_CALL_BUDGET;
+    udx_default_engine_options(&interruptible_options);
+    interruptible_options.interruptible = true;
+    std::vector<Module*> ready;
+    for(Module& m : modules) {
+        if(open_module(bench, &m, "fib", "fib_batch"))
+            ready.push_back(&m);
+        else
+            bench.fail("fib", m.label, m.error);
+    }
+    for(Module& m : metered) {
+        if(open_module(bench, &m, "fib", "fib_batch", &budget_options))
+            ready.push_back(&m);
+        else
+            bench.fail("fib", m.label, m.error);
+    }
+    for(Module& m : interruptible) {
+        if(open_module(bench, &m, "fib", "fib_batch", &interruptible_options))
+            ready.push_back(&m);
+        else
+            bench.fail("fib", m.label, m.error);
+    }
+
+    for(const unsigned long long arg : options.fib_args) {
+        const unsigned long long calls =
+            std::max(1ULL, std::min(options.fib_calls, FIB_STEPS_PER_TRIAL / std::max(1ULL, arg)));
+        const unsigned long long expected = native_fib(arg);
+        // the argument is read from memory on every call, so the
+        // compiler can't hoist native_fib() out of the loop
+        volatile unsigned long long varg = arg;
+        std::vector<unsigned long long> args(calls, arg), out(calls);
+        unsigned long long result;
+        const Pass check = [&](std::string* error) {
+            if(result != expected) {
+                *error = mismatch("call", 0);
+                return false;
+            }
+            return true;
+        };
+        const Pass check_batch = [&](std::string* error) {
+            for(size_t i = 0; i < calls; ++i) {
+                if(out[i] != expected) {
+                    *error = mismatch("row", i);
+                    return false;
+                }
+            }
+            return true;
+        };
+        // per call checks keep every result live as well
+        const auto run = [&](const std::string& impl, const Pass& pass) {
+            result = ~expected;
+            bench.run("fib", impl, "arg", arg, "ns/call", calls, pass, check);
+        };
+
+        run("native", [&](std::string* error) {
+            for(size_t i = 0; i < calls; ++i) {
+                result = native_fib(varg);
+                if(result != expected) {
+                    *error = mismatch("call", i);
+                    return false;
+                }
+            }
+            return true;
+        });
+        for(Module* m : ready) {
+            char* errormsg;
+            if(! m->batch_only) {
+                run(std::string(m->label) + "-call", [&](std::string* error) {
+                    for(size_t i = 0; i < calls; ++i) {
+                        if(! udx_call_handle_ull_ull(m->call, varg, &result, m->ws, &errormsg)) {
+                            *error = errormsg;
+                            return false;
+                        }
+                        if(result != expected) {
+                            *error = mismatch("call", i);
+                            return false;
+                        }
+                    }
+                    return true;
+                });
+                udx_wasm::WasmFunction<unsigned long long(unsigned long long)> fib;
+                if(! fib.bind(m->ws, m->call, &errormsg)) {
+                    bench.fail("fib", std::string(m->label) + "-typed", errormsg);
+                } else {
+                    run(std::string(m->label) + "-typed", [&](std::string* error) {
+                        for(size_t i = 0; i < calls; ++i) {
+                            if(! fib.call(varg, &result, &errormsg)) {
+                                *error = errormsg;
+                                return false;
+                            }
+                            if(result != expected) {
+                                *error = mismatch("call", i);
+                                return false;
+                            }
+                        }
+                        return true;
+                    });
+                }
+            }
+            std::fill(out.begin(), out.end(), ~expected);
+            bench.run("fib", std::string(m->label) + "-batch", "arg", arg, "ns/call", calls,
+                      [&](std::string* error) {
+                          if(! udx_call_batch_handle_ull_ull(m->batch, args.data(), out.data(),
+                                                             calls, m->ws, &errormsg)) {
+                              *error = errormsg;
+                              return false;
+                          }
+                          return true;
+                      },
+                      check_batch);
+        }
+    }
+    for(Module& m : modules)
+        udx_cleanup(m.ws);
+    for(Module& m : metered)
+        udx_cleanup(m.ws);
+    for(Module& m : interruptible)
+        udx_cleanup(m.ws);
+}
+
+// What normalize.c does, for the native case and the checks
+size_t native_normalize(const char* in, size_t len, char* out) {
+    size_t length = 0;
+    bool space = false;
+    for(size_t i = 0; i < len; ++i) {
+        const char c = in[i];
+        if(c == ' ' || (c >= '\t' && c <= '\r')) {
+            space = length > 0;
+            continue;
+        }
+        if(space) {
+            out[length++] = ' ';
+            space = false;
+        }
+        out[length++] = c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+    }
+    return length;
+}
+
+// A string column as udx_call_batch_str_str() takes it
+struct Strings {
+    std::string data;
+    std::vector<unsigned> offsets{0};
+
+    void clear() {
+        data.clear();
+        offsets.resize(1);
+    }
+    // as a udx_string_sink: results are copied out of linear memory
+    static void append(void* context, const char* data, const unsigned* offsets, size_t rows) {
+        Strings* strings = static_cast<Strings*>(context);
+        for(size_t i = 0; i < rows; ++i) {
+            strings->data.append(data + offsets[i], offsets[i + 1] - offsets[i]);
+            strings->offsets.push_back(strings->data.size());
+        }
+    }
+};
+
+// Log-field-like strings of 1 to 32 characters, as load_column_data.py
+// makes for varchar columns, with runs of spaces
+void bench_normalize(Bench& bench, const Options& options) {
+    static const char alphabet[] = "abcdefghijklmnopqrstuvwxyz   ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+    const size_t max_rows = *std::max_element(options.sizes.begin(), options.sizes.end());
+    std::mt19937 generator(options.seed);
+    std::uniform_int_distribution<int> length(1, 32), letter(0, sizeof(alphabet) - 2);
+    Strings in, expected;
+    std::vector<char> buffer(32);
+    for(size_t i = 0; i < max_rows; ++i) {
+        const size_t start = in.data.size();
+        for(int n = length(generator); n > 0; --n)
+            in.data += alphabet[letter(generator)];
+        in.offsets.push_back(in.data.size());
+        const size_t n = native_normalize(in.data.data() + start, in.data.size() - start, buffer.data());
+        expected.data.append(buffer.data(), n);
+        expected.offsets.push_back(expected.data.size());
+    }
+
+    Module modules[] = {
+        {"c.wasm", "normalize.c.wasm", true, NULL, 0, 0, "", UDX_NO_FUNCTION},
+        {"rs.wasm", "normalize.rs.wasm", true, NULL, 0, 0, "", UDX_NO_FUNCTION},
+    };
+    std::vector<Module*> ready;
+    for(Module& m : modules) {
+        if(open_module(bench, &m, NULL, "normalize_batch"))
+            ready.push_back(&m);
+        else
+            bench.fail("normalize", m.label, m.error);
+    }
+
+    Strings out;
+    for(const unsigned long long rows : options.sizes) {
+        const Pass check = [&](std::string* error) {
+            for(size_t i = 0; i < rows; ++i) {
+                if(out.offsets[i + 1] != expected.offsets[i + 1]
+                   || out.data.compare(out.offsets[i], out.offsets[i + 1] - out.offsets[i],
+                                       expected.data, expected.offsets[i],
+                                       expected.offsets[i + 1] - expected.offsets[i])) {
+                    *error = mismatch("row", i);
+                    return false;
+                }
+            }
+            return true;
+        };
+        // the output column is reused, as a UDx's would be
+        const auto run = [&](const std::string& impl, const Pass& pass) {
+            bench.run("normalize", impl, "rows", rows, "ns/row", rows,
+                      [&](std::string* error) {
+                          out.clear();
+                          return pass(error);
+                      },
+                      check);
+        };
+
+        run("native", [&](std::string*) {
+            for(size_t i = 0; i < rows; ++i) {
+                const size_t length = in.offsets[i + 1] - in.offsets[i];
+                const size_t start = out.data.size();
+                out.data.resize(start + length);
+                out.data.resize(start + native_normalize(in.data.data() + in.offsets[i], length,
+                                                         &out.data[start]));
+                out.offsets.push_back(out.data.size());
+            }
+            return true;
+        });
+        for(Module* m : ready) {
+            char* errormsg;
+            run(std::string(m->label) + "-batch", [&](std::string* error) {
+                if(! udx_call_batch_str_str(m->batch, in.data.data(), in.offsets.data(), rows,
+                                            Strings::append, &out, m->ws, &errormsg)) {
+                    *error = errormsg;
+                    return false;
+                }
+                return true;
+            });
+        }
+    }
+    for(Module& m : modules)
+        udx_cleanup(m.ws);
+}
+
+// The rows tokenize.c makes from a column of lines: for each token, its
+// line, its number in the line and byte offset (int columns), and the
+// lower-cased token
+struct Tokens {
+    static const size_t INT_COLUMNS = 2;
+    std::vector<unsigned> source;
+    std::vector<long long> ints;
+    Strings tokens;
+
+    void clear() {
+        source.clear();
+        ints.clear();
+        tokens.clear();
+    }
+    // what tokenize.c does, for the native case and the checks
+    void add_line(unsigned row, const char* line, size_t len) {
+        const auto is_token = [](unsigned char c) {
+            return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')
+                || c == '_' || c >= 0x80;
+        };
+        long long position = 0;
+        for(size_t j = 0; j < len; ) {
+            if(! is_token(line[j])) {
+                ++j;
+                continue;
+            }
+            const size_t start = j;
+            for(; j < len && is_token(line[j]); ++j)
+                tokens.data += line[j] >= 'A' && line[j] <= 'Z' ? line[j] + ('a' - 'A') : line[j];
+            tokens.offsets.push_back(tokens.data.size());
+            source.push_back(row);
+            ints.push_back(++position);
+            ints.push_back(start);
+        }
+    }
+    // as a udx_rows_sink
+    static void append(void* context, size_t first_row, const unsigned* source,
+                       const long long* ints, const char* data, const unsigned* offsets,
+                       size_t rows) {
+        Tokens* t = static_cast<Tokens*>(context);
+        for(size_t i = 0; i < rows; ++i)
+            t->source.push_back(first_row + source[i]);
+        t->ints.insert(t->ints.end(), ints, ints + rows * INT_COLUMNS);
+        Strings::append(&t->tokens, data, offsets, rows);
+    }
+};
+
+// Log lines of up to 12 words, split by spaces and punctuation: split
+// and normalize in one pass, a row out per token
+void bench_tokenize(Bench& bench, const Options& options) {
+    static const char letters[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_";
+    static const char separators[] = " ,.:=/[]- ";
+    const size_t max_rows = *std::max_element(options.sizes.begin(), options.sizes.end());
+    std::mt19937 generator(options.seed);
+    std::uniform_int_distribution<int> words(0, 12), length(1, 10),
+        letter(0, sizeof(letters) - 2), separator(0, sizeof(separators) - 2);
+    Strings in;
+    for(size_t i = 0; i < max_rows; ++i) {
+        for(int w = words(generator); w > 0; --w) {
+            for(int n = length(generator); n > 0; --n)
+                in.data += letters[letter(generator)];
+            in.data += separators[separator(generator)];
+        }
+        in.offsets.push_back(in.data.size());
+    }
+
+    Module modules[] = {
+        {"c.wasm", "tokenize.c.wasm", true, NULL, 0, 0, "", UDX_NO_FUNCTION},
+        {"rs.wasm", "tokenize.rs.wasm", true, NULL, 0, 0, "", UDX_NO_FUNCTION},
+    };
+    std::vector<Module*> ready;
+    for(Module& m : modules) {
+        if(open_module(bench, &m, NULL, "tokenize_batch"))
+            ready.push_back(&m);
+        else
+            bench.fail("tokenize", m.label, m.error);
+    }
+
+    Tokens expected, out;
+    for(const unsigned long long rows : options.sizes) {
+        expected.clear();
+        for(size_t i = 0; i < rows; ++i)
+            expected.add_line(i, in.data.data() + in.offsets[i], in.offsets[i + 1] - in.offsets[i]);
+        const Pass check = [&](std::string* error) {
+            if(out.source.size() != expected.source.size()) {
+                *error = mismatch("row count", out.source.size());
+                return false;
+            }
+            for(size_t i = 0; i < expected.source.size(); ++i) {
+                if(out.source[i] != expected.source[i]
+                   || out.ints[2 * i] != expected.ints[2 * i]
+                   || out.ints[2 * i + 1] != expected.ints[2 * i + 1]
+                   || out.tokens.offsets[i + 1] != expected.tokens.offsets[i + 1]
+                   || out.tokens.data.compare(out.tokens.offsets[i],
+                                              out.tokens.offsets[i + 1] - out.tokens.offsets[i],
+                                              expected.tokens.data, expected.tokens.offsets[i],
+                                              expected.tokens.offsets[i + 1] - expected.tokens.offsets[i])) {
+                    *error = mismatch("output row", i);
+                    return false;
+                }
+            }
+            return true;
+        };
+        // the output columns are reused, as a UDx's would be
+        const auto run = [&](const std::string& impl, const Pass& pass) {
+            bench.run("tokenize", impl, "rows", rows, "ns/row", rows,
+                      [&](std::string* error) {
+                          out.clear();
+                          return pass(error);
+                      },
+                      check);
+        };
+
+        run("native", [&](std::string*) {
+            for(size_t i = 0; i < rows; ++i)
+                out.add_line(i, in.data.data() + in.offsets[i], in.offsets[i + 1] - in.offsets[i]);
+            return true;
+        });
+        for(Module* m : ready) {
+            char* errormsg;
+            run(std::string(m->label) + "-batch", [&](std::string* error) {
+                if(! udx_call_batch_str_rows(m->batch, in.data.data(), in.offsets.data(), rows,
+                                             Tokens::INT_COLUMNS, Tokens::append, &out,
+                                             m->ws, &errormsg)) {
+                    *error = errormsg;
+                    return false;
+                }
+                return true;
+            });
+        }
+    }
+    for(Module& m : modules)
+        udx_cleanup(m.ws);
+}
+
+// What distinct.c does, for the native case and the checks: a
+// HyperLogLog sketch of 4096 registers
+class NativeDistinct {
+public:
+    static const int PRECISION = 12;
+    static const size_t REGISTERS = 1 << PRECISION;
+
+    void init() { std::fill(registers, registers + REGISTERS, 0); }
+
+    void update(const long long* values, size_t n) {
+        for(size_t i = 0; i < n; ++i) {
+            unsigned long long h = values[i];
+            h ^= h >> 30;
+            h *= 0xbf58476d1ce4e5b9ULL;
+            h ^= h >> 27;
+            h *= 0x94d049bb133111ebULL;
+            h ^= h >> 31;
+            const size_t index = h >> (64 - PRECISION);
+            const unsigned char rank = __builtin_clzll((h << PRECISION) | (1ULL << (PRECISION - 1))) + 1;
+            registers[index] = std::max(registers[index], rank);
+        }
+    }
+
+    long long terminate() const {
+        double inverse_sum = 0;
+        int zeros = 0;
+        for(size_t i = 0; i < REGISTERS; ++i) {
+            inverse_sum += std::ldexp(1.0, -registers[i]);
+            zeros += registers[i] == 0;
+        }
+        const double m = REGISTERS;
+        double estimate = 0.7213 / (1 + 1.079 / m) * m * m / inverse_sum;
+        if(estimate <= 2.5 * m && zeros > 0)
+            estimate = m * std::log(m / zeros);
+        return (long long) (estimate + 0.5);
+    }
+
+private:
+    unsigned char registers[REGISTERS];
+};
+
+// Values with about half of them repeated, as a column of ids would
+// have.  The Wasm cases fold the two halves into two accumulators and
+// combine them, as Vertica does with the partial aggregates of
+// different threads or nodes.
+void bench_distinct(Bench& bench, const Options& options) {
+    const size_t max_rows = *std::max_element(options.sizes.begin(), options.sizes.end());
+    std::vector<long long> values(max_rows);
+    std::mt19937_64 generator(options.seed);
+    std::uniform_int_distribution<long long> distribution(0, max_rows / 2);
+    for(long long& value : values)
+        value = distribution(generator);
+
+    Module modules[] = {
+        {"c.wasm", "distinct.c.wasm", true, NULL, 0, 0, "", UDX_NO_FUNCTION},
+        {"rs.wasm", "distinct.rs.wasm", true, NULL, 0, 0, "", UDX_NO_FUNCTION},
+    };
+    std::vector<Module*> ready;
+    std::vector<udx_aggregate> aggregates(sizeof(modules) / sizeof(modules[0]));
+    for(size_t i = 0; i < aggregates.size(); ++i) {
+        Module& m = modules[i];
+        char* errormsg;
+        m.ws = udx_get_wasm_state();
+        if(! m.ws || ! udx_setup(m.filename, m.ws, NULL, &errormsg)
+           || ! udx_aggregate_lookup(m.ws, "distinct", &aggregates[i], &errormsg)) {
+            bench.fail("distinct", m.label, m.ws ? std::string(m.filename) + ": " + errormsg
+                                                 : "can't allocate a wasm state");
+            continue;
+        }
+        bench.saw_engine(udx_describe_engine(m.ws));
+        ready.push_back(&m);
+    }
+
+    NativeDistinct native;
+    for(const unsigned long long rows : options.sizes) {
+        native.init();
+        native.update(values.data(), rows);
+        const long long expected = native.terminate();
+        long long result;
+        const Pass check = [&](std::string* error) {
+            if(result != expected) {
+                *error = "estimate " + std::to_string(result) + " differs from native "
+                    + std::to_string(expected);
+                return false;
+            }
+            return true;
+        };
+        const auto run = [&](const std::string& impl, const Pass& pass) {
+            result = -1;
+            bench.run("distinct", impl, "rows", rows, "ns/row", rows, pass, check);
+        };
+
+        run("native", [&](std::string*) {
+            native.init();
+            native.update(values.data(), rows);
+            result = native.terminate();
+            return true;
+        });
+        for(Module* m : ready) {
+            const udx_aggregate& aggregate = aggregates[m - modules];
+            std::vector<unsigned char> state(aggregate.state_size), other(aggregate.state_size);
+            const void* others[] = { other.data() };
+            run(std::string(m->label) + "-aggregate", [&](std::string* error) {
+                char* errormsg;
+                const size_t half = rows / 2;
+                if(! udx_aggregate_init(&aggregate, state.data(), m->ws, &errormsg)
+                   || ! udx_aggregate_init(&aggregate, other.data(), m->ws, &errormsg)
+                   || ! udx_aggregate_update_i64(&aggregate, state.data(), values.data(), NULL,
+                                                 half, m->ws, &errormsg)
+                   || ! udx_aggregate_update_i64(&aggregate, other.data(), values.data() + half, NULL,
+                                                 rows - half, m->ws, &errormsg)
+                   || ! udx_aggregate_combine(&aggregate, state.data(), others, 1, m->ws, &errormsg)
+                   || ! udx_aggregate_terminate_i64(&aggregate, state.data(), &result, m->ws, &errormsg)) {
+                    *error = errormsg;
+                    return false;
+                }
+                return true;
+            });
+        }
+    }
+    for(Module& m : modules)
+        udx_cleanup(m.ws);
+}
+
+// What a UDx pays per query when the module is already compiled: a
+// whole setup, one call and cleanup, over and over, as Vertica does
+// with setup() and destroy().  "fresh" runs with the instance pool off
+// (UDX_WASM_POOL_INSTANCES=0), so every setup instantiates; "pooled"
+// with it on, so after the first cycle each setup gets the previous
+// one's instance back, reset.
+void bench_setup(Bench& bench, const Options&) {
+    const char* const modules[][2] = {
+        {"c.wasm", "sum.c.wasm"},
+        {"rs.wasm", "sum.rs.wasm"},
+    };
+    const char* pool_setting = getenv("UDX_WASM_POOL_INSTANCES");
+    const std::string saved = pool_setting ? pool_setting : "";
+    for(const auto& module : modules) {
+        // keeps the module compiled between cycles
+        void* holder = udx_get_wasm_state();
+        char* errormsg;
+        if(! holder || ! udx_setup(module[1], holder, NULL, &errormsg)) {
+            bench.fail("setup", module[0], holder ? std::string(module[1]) + ": " + errormsg
+                                                  : "can't allocate a wasm state");
+            udx_cleanup(holder);
+            continue;
+        }
+        for(const bool pooled : {false, true}) {
+            setenv("UDX_WASM_POOL_INSTANCES", pooled ? "4" : "0", 1);
+            struct udx_wasm_stats before, after;
+            udx_get_process_stats(&before);
+            int result = 0;
+            bench.run("setup", std::string(module[0]) + (pooled ? "-pooled" : "-fresh"),
+                      "cycles", SETUP_CYCLES, "ns/setup", SETUP_CYCLES,
+                      [&](std::string* error) {
+                          for(int i = 0; i < SETUP_CYCLES; ++i) {
+                              void* ws = udx_get_wasm_state();
+                              const bool ok = ws && udx_setup(module[1], ws, "sum", &errormsg)
+                                  && udx_call_func_2i_1i(i, 1, &result, ws, &errormsg);
+                              if(! ok)
+                                  *error = ws ? errormsg : "can't allocate a wasm state";
+                              udx_cleanup(ws);
+                              if(! ok)
+                                  return false;
+                              if(result != i + 1) {
+                                  *error = mismatch("cycle", i);
+                                  return false;
+                              }
+                          }
+                          return true;
+                      },
+                      [&](std::string* error) {
+                          udx_get_process_stats(&after);
+                          const bool reused = after.instance_pool_hits > before.instance_pool_hits;
+                          if(reused != pooled) {
+                              *error = pooled ? "no setup reused a pooled instance"
+                                              : "a setup reused an instance with pooling off";
+                              return false;
+                          }
+                          return true;
+                      });
+        }
+        udx_cleanup(holder);
+    }
+    if(pool_setting)
+        setenv("UDX_WASM_POOL_INSTANCES", saved.c_str(), 1);
+    else
+        unsetenv("UDX_WASM_POOL_INSTANCES");
+}
+
+// How long a cancelled query keeps a core busy: a loop of fib calls,
+// as processBlock() would make, that would never end is interrupted
+// (as the UDxes' cancel() does) from this thread while another runs
+// it, and each sample is the time from udx_interrupt() until the loop
+// returns.  The call running at the time finishes, so per-row calls
+// stop after at most one row, and batch calls after one chunk.  The
+// -running cases make a single call that would never finish, on an
+// interruptible engine, where the guest notices the interrupt itself.
+void bench_cancel(Bench& bench, const Options& options) {
+    const char* const modules[][2] = {
+        {"c.wasm", "fib.c.wasm"},
+        {"rs.wasm", "fib.rs.wasm"},
+    };
+    struct Case {
+        const char* suffix;
+        bool batch;
+        bool interruptible;
+    };
+    const Case cases[] = {
+        {"-call", false, false},
+        {"-batch", true, false},
+        {"-running", false, true},
+    };
+    const std::vector<unsigned long long> args(CANCEL_BATCH_ROWS, CANCEL_FIB_ARG);
+    for(const auto& module : modules) {
+        for(const Case& c : cases) {
+            const bool batch = c.batch;
+            const unsigned long long arg = c.interruptible ? CANCEL_RUNAWAY_FIB_ARG : CANCEL_FIB_ARG;
+            struct udx_engine_options engine_options;
+            udx_default_engine_options(&engine_options);
+            engine_options.interruptible = c.interruptible;
+            std::vector<double> samples;
+            std::string error;
+            void* ws = udx_get_wasm_state();
+            for(int i = 0; error.empty() && i < options.warmup + options.trials; ++i) {
+                // raised stays raised, so a new one each time
+                struct udx_interrupt interrupt = UDX_INTERRUPT_INIT;
+                char* errormsg;
+                udx_watch_interrupt(ws, &interrupt);
+                if(! ws || ! udx_setup_with_options(module[1], ws, batch ? "fib_batch" : "fib",
+                                                    &engine_options, &errormsg)) {
+                    error = ws ? std::string(module[1]) + ": " + errormsg : "can't allocate a wasm state";
+                    break;
+                }
+                std::atomic<bool> started(false);
+                std::string call_error;
+                double returned_at = 0;
+                std::thread caller([&]() {
+                    std::vector<unsigned long long> out(args.size());
+                    unsigned long long result;
+                    char* call_errormsg;
+                    started = true;
+                    while(batch ? udx_call_batch_ull_ull(args.data(), out.data(), args.size(), ws, &call_errormsg)
+                                : udx_call_func_ull_ull(arg, &result, ws, &call_errormsg))
+                        ;
+                    returned_at = now_ns();
+                    call_error = call_errormsg;
+                });
+                while(! started)
+                    std::this_thread::yield();
+                std::this_thread::sleep_for(std::chrono::milliseconds(CANCEL_AFTER_MS));
+                const double interrupted_at = now_ns();
+                udx_interrupt(&interrupt);
+                caller.join();
+                if(call_error.find("interrupted") == std::string::npos)
+                    error = "the calls failed otherwise: " + call_error;
+                else if(i >= options.warmup)
+                    samples.push_back(returned_at - interrupted_at);
+                udx_watch_interrupt(ws, NULL);
+            }
+            udx_cleanup(ws);
+            bench.record("cancel", std::string(module[0]) + c.suffix,
+                         "after_ms", CANCEL_AFTER_MS, "ns/cancel", samples, error);
+        }
+    }
+}
+
+bool parse_list(const char* arg, std::vector<unsigned long long>* list) {
+    list->clear();
+    const char* p = arg;
+    while(*p) {
+        char* end;
+        const unsigned long long value = strtoull(p, &end, 10);
+        if(end == p || (*end && *end != ','))
+            return false;
+        list->push_back(value);
+        p = *end ? end + 1 : end;
+    }
+    return ! list->empty();
+}
+
+bool parse_options(int argc, const char* argv[], Options* options) {
+    for(int i = 1; i < argc; ++i) {
+        const std::string flag = argv[i];
+        if(flag == "--no-pin") {
+            options->pin = false;
+            continue;
+        }
+        if(i + 1 == argc)
+            return false;
+        const char* value = argv[++i];
+        if(flag == "--trials")
+            options->trials = atoi(value);
+        else if(flag == "--warmup")
+            options->warmup = atoi(value);
+        else if(flag == "--seed")
+            options->seed = strtoul(value, NULL, 10);
+        else if(flag == "--cpu")
+            options->cpu = atoi(value);
+        else if(flag == "--fib-calls")
+            options->fib_calls = strtoull(value, NULL, 10);
+        else if(flag == "--json")
+            options->json = value;
+        else if(flag == "--sizes") {
+            if(! parse_list(value, &options->sizes))
+                return false;
+        } else if(flag == "--fib-args") {
+            if(! parse_list(value, &options->fib_args))
+                return false;
+        } else
+            return false;
+    }
+    return options->trials > 0 && options->warmup >= 0 && options->fib_calls > 0;
+}
+
+
+// What a result cache buys the per-row fib UDxes (see UDx/WasmMemo.h)
+// on a column like t3's: the time per row against the hit rate, which
+// depends on how much of the domain fits in the cache
+void bench_memo(Bench& bench, const Options& options) {
+    Module modules[] = {
+        {"c.wasm", "fib.c.wasm", false, NULL, 0, 0, "", UDX_NO_FUNCTION},
+        {"rs.wasm", "fib.rs.wasm", false, NULL, 0, 0, "", UDX_NO_FUNCTION},
+    };
+    std::vector<unsigned long long> args(MEMO_ROWS), expected(MEMO_MAX_ARG + 1);
+    std::mt19937 generator(options.seed);
+    std::uniform_int_distribution<unsigned long long> distribution(0, MEMO_MAX_ARG);
+    for(unsigned long long& arg : args)
+        arg = distribution(generator);
+    for(unsigned long long arg = 0; arg <= MEMO_MAX_ARG; ++arg)
+        expected[arg] = native_fib(arg);
+    const int trials = std::min(options.trials, MEMO_TRIALS);
+    const int warmup = std::min(options.warmup, 1);
+
+    for(Module& m : modules) {
+        char* errormsg;
+        udx_wasm::WasmFunction<unsigned long long(unsigned long long)> fib;
+        if(! open_module(bench, &m, "fib", "fib_batch")) {
+            bench.fail("memo", m.label, m.error);
+            continue;
+        }
+        if(! fib.bind(m.ws, m.call, &errormsg)) {
+            bench.fail("memo", m.label, errormsg);
+            continue;
+        }
+        for(const size_t entries : MEMO_ENTRIES) {
+            const size_t rows = entries ? MEMO_ROWS
+                                        : std::min(MEMO_ROWS, FIB_STEPS_PER_TRIAL / (MEMO_MAX_ARG / 2));
+            udx_wasm::MemoCache<unsigned long long, unsigned long long> memo;
+            std::vector<double> samples;
+            std::string error;
+            // every trial starts cold, as every query does
+            for(int i = 0; error.empty() && i < warmup + trials; ++i) {
+                memo.reset(entries);
+                const double start = now_ns();
+                for(size_t row = 0; row < rows; ++row) {
+                    unsigned long long result;
+                    if(! memo.find(args[row], &result)) {
+                        if(! fib.call(args[row], &result, &errormsg)) {
+                            error = errormsg;
+                            break;
+                        }
+                        memo.insert(args[row], result);
+                    }
+                    if(result != expected[args[row]]) {
+                        error = mismatch("row", row);
+                        break;
+                    }
+                }
+                if(i >= warmup)
+                    samples.push_back((now_ns() - start) / rows);
+            }
+            char note[64] = "no cache";
+            if(memo.enabled())
+                snprintf(note, sizeof(note), "%.1f%% hits", 100.0 * memo.hits() / memo.lookups());
+            bench.record("memo", std::string(m.label) + "-typed", "entries", entries, "ns/row",
+                         samples, error, note);
+        }
+    }
+    for(Module& m : modules)
+        udx_cleanup(m.ws);
+}
+} // namespace
+
+int main(const int argc, const char* argv[]) {
+    Options options;
+    if(! parse_options(argc, argv, &options)) {
+        fprintf(stderr,
+                "Usage: %s [--trials N] [--warmup N] [--seed N] [--cpu N | --no-pin]\n"
+                "       [--sizes N,...] [--fib-args N,...] [--fib-calls N] [--json FILE]\n",
+                argv[0]);
+        return 2;
+    }
+
+    int cpu = -1;
+    if(options.pin) {
+        cpu = options.cpu >= 0 ? options.cpu : sched_getcpu();
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if(cpu < 0 || sched_setaffinity(0, sizeof(set), &set) != 0) {
+            fprintf(stderr, "%s: can't pin to CPU %d: %s\n", argv[0], cpu, strerror(errno));
+            return 1;
+        }
+    }
+
+    // Pick the compiler with UDX_WASM_COMPILER=singlepass|cranelift|llvm
+    struct udx_engine_options engine_options;
+    if(! udx_default_engine_options(&engine_options)) {
+        fprintf(stderr, "%s: UDX_WASM_COMPILER or UDX_WASM_SIMD is set to an unknown value\n", argv[0]);
+        return 1;
+    }
+    Bench bench(options);
+    bench.header(udx_query_wasm_config(), cpu);
+    bench_sum(bench, options);
+    bench_fib(bench, options);
+    bench_normalize(bench, options);
+    bench_tokenize(bench, options);
+    bench_distinct(bench, options);
+    bench_setup(bench, options);
+    bench_cancel(bench, options);
+    bench_memo(bench, options);
+
+    bool ok = bench.all_ok();
+    if(options.json && ! bench.write_json(options.json, cpu))
+        ok = false;
+    return ok ? 0 : 1;
+}
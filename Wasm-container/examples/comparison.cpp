@@ -7,6 +7,7 @@
 extern "C" {
 #include "udx_wasm.h"
 };
+#include "udx_wasm.hpp"
 
 #define ARRAY_SIZE 1'000'000
 
@@ -14,8 +15,9 @@ int subroutine_sum(const int a, const int b) {
     return a + b;
 }
 
-void populate(int data[], int size) {
-    unsigned seed = std::chrono::high_resolution_clock::now().time_since_epoch().count();
+// A fixed seed, so that runs are comparable; see bench.cpp for
+// repeated trials and statistics
+void populate(int data[], int size, unsigned seed) {
     std::default_random_engine generator(seed);
     std::uniform_int_distribution<int> distribution(0, 255); // fits in a byte
     for (int i = 0; i < size; ++i) {
@@ -29,7 +31,7 @@ void check_results(const int a_result[],
                    const char* a_label,
                    const char* b_label) {
     for(int i = 0; i < size; ++i) {
-        if(a_result[i] != a_result[i]) {
+        if(a_result[i] != b_result[i]) {
             std::cerr << "Surprise! "
                       << a_label
                       << " and "
@@ -48,16 +50,18 @@ int direct_result[ARRAY_SIZE];
 int subroutine_result[ARRAY_SIZE];
 int c_result[ARRAY_SIZE];
 int rust_result[ARRAY_SIZE];
+int c_batch_result[ARRAY_SIZE];
+int rust_batch_result[ARRAY_SIZE];
 int a_data[ARRAY_SIZE];
 int b_data[ARRAY_SIZE];
 
 int main(const int argc, const char* argv[]) {
     char* errormsg;
 
-    populate(a_data, sizeof(a_data)/sizeof(a_data[0]));
-    populate(b_data, sizeof(b_data)/sizeof(b_data[0]));
+    populate(a_data, sizeof(a_data)/sizeof(a_data[0]), 1);
+    populate(b_data, sizeof(b_data)/sizeof(b_data[0]), 2);
 
-    // I've learned about wasm_config.  Does it help?
+    // Pick the compiler with UDX_WASM_COMPILER=singlepass|cranelift|llvm
     std::cout << "Wasm engine configuration: " << udx_query_wasm_config() << std::endl << std::flush;
 
     // direct time
@@ -89,6 +93,7 @@ int main(const int argc, const char* argv[]) {
     if(! udx_setup("sum.c.wasm", ws, "sum", &errormsg))
         std::cerr << "Can't load sum.c.wasm; " << errormsg << std::endl << std::flush;
     else {
+        std::cout << "Wasm engine: " << udx_describe_engine(ws) << std::endl << std::flush;
         // c_wasm time
         start = std::chrono::high_resolution_clock::now();
         for(int i = 0; i < ARRAY_SIZE; ++i) {
@@ -110,6 +115,32 @@ int main(const int argc, const char* argv[]) {
                       sizeof(b_data)/sizeof(b_data[0]),
                       "direct",
                       "cwasm");
+
+        // the same calls through the typed C++ wrapper
+        udx_wasm::WasmFunction<int(int, int)> sum;
+        if(! sum.bind(ws, &errormsg)) {
+            std::cerr << "Can't bind sum; " << errormsg << std::endl << std::flush;
+        } else {
+            start = std::chrono::high_resolution_clock::now();
+            for(int i = 0; i < ARRAY_SIZE; ++i) {
+                if(! sum.call(a_data[i], b_data[i], &c_result[i], &errormsg)) {
+                    std::cerr << "Can't execute typed sum function on "
+                              << i
+                              << "th entry; "
+                              << errormsg
+                              << std::endl << std::flush;
+                    break;
+                }
+            }
+            stop = std::chrono::high_resolution_clock::now();
+            duration = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
+            std::cout << "CWasm typed time: " << duration.count() << std::endl << std::flush;
+            check_results(direct_result,
+                          c_result,
+                          sizeof(b_data)/sizeof(b_data[0]),
+                          "direct",
+                          "cwasm typed");
+        }
     }
     udx_cleanup(ws);
     // set up rust wasm engine
@@ -139,4 +170,48 @@ int main(const int argc, const char* argv[]) {
                       "direct",
                       "rustwasm");
     }
+    udx_cleanup(ws);
+
+    // The same modules, but crossing into Wasm once per batch buffer
+    // full of rows instead of once per row
+    ws = udx_get_wasm_state();
+    if(! udx_setup("sum.c.wasm", ws, "sum_batch", &errormsg))
+        std::cerr << "Can't load sum.c.wasm; " << errormsg << std::endl << std::flush;
+    else {
+        start = std::chrono::high_resolution_clock::now();
+        if(! udx_call_batch_2i_1i(a_data, b_data, c_batch_result, ARRAY_SIZE, ws, &errormsg)) {
+            std::cerr << "Can't execute cwasm sum_batch function; "
+                      << errormsg
+                      << std::endl << std::flush;
+        }
+        stop = std::chrono::high_resolution_clock::now();
+        duration = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
+        std::cout << "CWasm batch time: " << duration.count() << std::endl << std::flush;
+        check_results(direct_result,
+                      c_batch_result,
+                      sizeof(b_data)/sizeof(b_data[0]),
+                      "direct",
+                      "cwasm batch");
+    }
+    udx_cleanup(ws);
+    ws = udx_get_wasm_state();
+    if(! udx_setup("sum.rs.wasm", ws, "sum_batch", &errormsg))
+        std::cerr << "Can't load sum.rs.wasm; " << errormsg << std::endl << std::flush;
+    else {
+        start = std::chrono::high_resolution_clock::now();
+        if(! udx_call_batch_2i_1i(a_data, b_data, rust_batch_result, ARRAY_SIZE, ws, &errormsg)) {
+            std::cerr << "Can't execute rustwasm sum_batch function; "
+                      << errormsg
+                      << std::endl << std::flush;
+        }
+        stop = std::chrono::high_resolution_clock::now();
+        duration = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
+        std::cout << "Rustwasm batch time: " << duration.count() << std::endl << std::flush;
+        check_results(direct_result,
+                      rust_batch_result,
+                      sizeof(b_data)/sizeof(b_data[0]),
+                      "direct",
+                      "rustwasm batch");
+    }
+    udx_cleanup(ws);
 }
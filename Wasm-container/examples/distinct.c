@@ -0,0 +1,115 @@
+// Approximate count of distinct values: a HyperLogLog sketch with 4096
+// one-byte registers (about 1.6% standard error).  The accumulator is
+// the registers; the host keeps it between calls and places it in
+// udx_batch for each one (see udx_aggregate_* in udx_wasm.h), so
+// distinct_update folds in a whole column of values at a time.
+#define UDX_BATCH_BYTES (256 * 1024)
+static char udx_batch[UDX_BATCH_BYTES] __attribute__((aligned(16)));
+
+char* udx_batch_buffer() {
+    return udx_batch;
+}
+
+int udx_batch_capacity() {
+    return UDX_BATCH_BYTES;
+}
+
+#define PRECISION 12
+#define REGISTERS (1 << PRECISION)
+
+int distinct_state_size() {
+    return REGISTERS;
+}
+
+void distinct_init(unsigned char* registers) {
+    for(int i = 0; i < REGISTERS; ++i) {
+        registers[i] = 0;
+    }
+}
+
+// splitmix64's finalizer: every bit of value moves about half the bits
+static unsigned long long hash(unsigned long long x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+static void add(unsigned char* registers, long long value) {
+    const unsigned long long h = hash((unsigned long long) value);
+    // the top bits pick the register; it keeps the longest run of
+    // leading zeros (plus one) seen in the rest
+    const unsigned index = h >> (64 - PRECISION);
+    const unsigned char rank = __builtin_clzll((h << PRECISION) | (1ULL << (PRECISION - 1))) + 1;
+    if(rank > registers[index]) {
+        registers[index] = rank;
+    }
+}
+
+void distinct_update(unsigned char* registers, const long long* values,
+                     const unsigned char* valid, int n) {
+    if(! valid) {
+        for(int i = 0; i < n; ++i) {
+            add(registers, values[i]);
+        }
+        return;
+    }
+    for(int i = 0; i < n; ++i) {
+        if((valid[i / 8] >> (i % 8)) & 1) {
+            add(registers, values[i]);
+        }
+    }
+}
+
+void distinct_combine(unsigned char* registers, const unsigned char* other) {
+    for(int i = 0; i < REGISTERS; ++i) {
+        if(other[i] > registers[i]) {
+            registers[i] = other[i];
+        }
+    }
+}
+
+// Natural log, for the small-range estimate; there's no libm here.
+// x = 2^e * m with m in [1, 2), and log(m) = 2 atanh((m - 1) / (m + 1)),
+// whose series converges quickly for s <= 1/3.
+static double ln(double x) {
+    int e = 0;
+    while(x >= 2) {
+        x /= 2;
+        ++e;
+    }
+    while(x < 1) {
+        x *= 2;
+        --e;
+    }
+    const double s = (x - 1) / (x + 1);
+    const double s2 = s * s;
+    double term = s;
+    double sum = 0;
+    for(int k = 1; k < 40; k += 2) {
+        sum += term / k;
+        term *= s2;
+    }
+    return 2 * sum + e * 0.69314718055994530942;
+}
+
+long long distinct_terminate(const unsigned char* registers) {
+    double inverse_sum = 0;
+    int zeros = 0;
+    for(int i = 0; i < REGISTERS; ++i) {
+        // 2^-rank
+        union { unsigned long long bits; double d; } power;
+        power.bits = (unsigned long long) (1023 - registers[i]) << 52;
+        inverse_sum += power.d;
+        zeros += registers[i] == 0;
+    }
+    const double m = REGISTERS;
+    double estimate = 0.7213 / (1 + 1.079 / m) * m * m / inverse_sum;
+    if(estimate <= 2.5 * m && zeros > 0) {
+        // linear counting is better while many registers are empty
+        estimate = m * ln(m / zeros);
+    }
+    return (long long) (estimate + 0.5);
+}
@@ -0,0 +1,101 @@
+// rustc +stable --target wasm32-unknown-unknown -O --crate-type=cdylib distinct.rs -o distinct.rs.wasm
+//
+// Approximate count of distinct values: a HyperLogLog sketch with 4096
+// one-byte registers (about 1.6% standard error).  The accumulator is
+// the registers; the host keeps it between calls and places it in
+// UDX_BATCH for each one (see udx_aggregate_* in udx_wasm.h), so
+// distinct_update folds in a whole column of values at a time.
+const UDX_BATCH_BYTES: usize = 256 * 1024;
+// u64 elements so the buffer is aligned for the values
+static mut UDX_BATCH: [u64; UDX_BATCH_BYTES / 8] = [0; UDX_BATCH_BYTES / 8];
+
+#[no_mangle]
+#[allow(unused_unsafe)] // addr_of_mut! on a static mut needs unsafe before Rust 1.72
+pub extern "C" fn udx_batch_buffer() -> *mut u8 {
+    unsafe { core::ptr::addr_of_mut!(UDX_BATCH) as *mut u8 }
+}
+
+#[no_mangle]
+pub extern "C" fn udx_batch_capacity() -> u32 {
+    UDX_BATCH_BYTES as u32
+}
+
+const PRECISION: u32 = 12;
+const REGISTERS: usize = 1 << PRECISION;
+
+#[no_mangle]
+pub extern "C" fn distinct_state_size() -> i32 {
+    REGISTERS as i32
+}
+
+#[no_mangle]
+pub extern "C" fn distinct_init(registers: *mut u8) {
+    let registers = unsafe { std::slice::from_raw_parts_mut(registers, REGISTERS) };
+    registers.fill(0);
+}
+
+// splitmix64's finalizer: every bit of value moves about half the bits
+fn hash(mut x: u64) -> u64 {
+    x ^= x >> 30;
+    x = x.wrapping_mul(0xbf58476d1ce4e5b9);
+    x ^= x >> 27;
+    x = x.wrapping_mul(0x94d049bb133111eb);
+    x ^= x >> 31;
+    x
+}
+
+fn add(registers: &mut [u8], value: i64) {
+    let h = hash(value as u64);
+    // the top bits pick the register; it keeps the longest run of
+    // leading zeros (plus one) seen in the rest
+    let index = (h >> (64 - PRECISION)) as usize;
+    let rank = (((h << PRECISION) | (1 << (PRECISION - 1))).leading_zeros() + 1) as u8;
+    if rank > registers[index] {
+        registers[index] = rank;
+    }
+}
+
+#[no_mangle]
+pub extern "C" fn distinct_update(registers: *mut u8, values: *const i64, valid: *const u8, n: i32) {
+    let registers = unsafe { std::slice::from_raw_parts_mut(registers, REGISTERS) };
+    let values = unsafe { std::slice::from_raw_parts(values, n as usize) };
+    if valid.is_null() {
+        for &value in values {
+            add(registers, value);
+        }
+        return;
+    }
+    let valid = unsafe { std::slice::from_raw_parts(valid, (values.len() + 7) / 8) };
+    for (i, &value) in values.iter().enumerate() {
+        if (valid[i / 8] >> (i % 8)) & 1 != 0 {
+            add(registers, value);
+        }
+    }
+}
+
+#[no_mangle]
+pub extern "C" fn distinct_combine(registers: *mut u8, other: *const u8) {
+    let registers = unsafe { std::slice::from_raw_parts_mut(registers, REGISTERS) };
+    let other = unsafe { std::slice::from_raw_parts(other, REGISTERS) };
+    for (register, &o) in registers.iter_mut().zip(other) {
+        *register = (*register).max(o);
+    }
+}
+
+#[no_mangle]
+pub extern "C" fn distinct_terminate(registers: *const u8) -> i64 {
+    let registers = unsafe { std::slice::from_raw_parts(registers, REGISTERS) };
+    let mut inverse_sum = 0.0;
+    let mut zeros = 0;
+    for &rank in registers {
+        inverse_sum += f64::from_bits((1023 - rank as u64) << 52);
+        zeros += (rank == 0) as u32;
+    }
+    let m = REGISTERS as f64;
+    let mut estimate = 0.7213 / (1.0 + 1.079 / m) * m * m / inverse_sum;
+    if estimate <= 2.5 * m && zeros > 0 {
+        // linear counting is better while many registers are empty
+        estimate = m * (m / zeros as f64).ln();
+    }
+    (estimate + 0.5) as i64
+}
@@ -9,3 +9,61 @@ unsigned long long fib(unsigned long long a) {
     }
     return cur;
 }
+
+// Column-batch entry points (see udx_call_batch_ull_ull in udx_wasm.h)
+#define UDX_BATCH_BYTES (256 * 1024)
+static char udx_batch[UDX_BATCH_BYTES] __attribute__((aligned(16)));
+
+char* udx_batch_buffer() {
+    return udx_batch;
+}
+
+int udx_batch_capacity() {
+    return UDX_BATCH_BYTES;
+}
+
+#ifdef __wasm_simd128__
+#include <wasm_simd128.h>
+
+// Built with -msimd128 (fib.c.simd.wasm): two rows at a time, one in
+// each i64x2 lane.  A lane whose row is done stops changing while the
+// other one runs on.  (The lane comparison is signed, which only
+// matters for arguments of 2^63 and up.)
+void fib_batch(const unsigned long long* a, unsigned long long* result, int n) {
+    const v128_t one = wasm_i64x2_splat(1);
+    int i = 0;
+    for(; i + 2 <= n; i += 2) {
+        const v128_t limit = wasm_v128_load(a + i);
+        const unsigned long long steps = a[i] > a[i + 1] ? a[i] : a[i + 1];
+        v128_t index = wasm_i64x2_splat(2);
+        v128_t prev = one;
+        v128_t cur = one;
+        for(unsigned long long k = 2; k < steps; k++) {
+            const v128_t going = wasm_i64x2_lt(index, limit);
+            const v128_t next = wasm_i64x2_add(cur, prev);
+            prev = wasm_v128_bitselect(cur, prev, going);
+            cur = wasm_v128_bitselect(next, cur, going);
+            index = wasm_i64x2_add(index, one);
+        }
+        wasm_v128_store(result + i, cur);
+    }
+    for(; i < n; ++i) {
+        result[i] = fib(a[i]);
+    }
+}
+#else
+void fib_batch(const unsigned long long* a, unsigned long long* result, int n) {
+    for(int i = 0; i < n; ++i) {
+        result[i] = fib(a[i]);
+    }
+}
+#endif
+
+// Chunks with nulls (see udx_call_batch_masked_ull_ull): null rows are
+// skipped and come out 0
+void fib_batch_masked(const unsigned long long* a, const unsigned char* valid,
+                      unsigned long long* result, int n) {
+    for(int i = 0; i < n; ++i) {
+        result[i] = (valid[i / 8] >> (i % 8)) & 1 ? fib(a[i]) : 0;
+    }
+}
@@ -12,3 +12,83 @@ pub extern "C" fn fib(a: u64) -> u64 {
     }
     return cur;
 }
+
+// Column-batch entry points (see udx_call_batch_ull_ull in udx_wasm.h)
+const UDX_BATCH_BYTES: usize = 256 * 1024;
+static mut UDX_BATCH: [u64; UDX_BATCH_BYTES / 8] = [0; UDX_BATCH_BYTES / 8];
+
+#[no_mangle]
+#[allow(unused_unsafe)] // addr_of_mut! on a static mut needs unsafe before Rust 1.72
+pub extern "C" fn udx_batch_buffer() -> *mut u8 {
+    unsafe { core::ptr::addr_of_mut!(UDX_BATCH) as *mut u8 }
+}
+
+#[no_mangle]
+pub extern "C" fn udx_batch_capacity() -> u32 {
+    UDX_BATCH_BYTES as u32
+}
+
+// Built with -C target-feature=+simd128 (fib.rs.simd.wasm): two rows at
+// a time, one in each i64x2 lane; a lane whose row is done stops
+// changing while the other runs on.  (The lane comparison is signed,
+// which only matters for arguments of 2^63 and up.)
+#[cfg(target_feature = "simd128")]
+#[no_mangle]
+pub extern "C" fn fib_batch(a: *const u64, result: *mut u64, n: u32) {
+    use core::arch::wasm32::{i64x2_add, i64x2_lt, i64x2_splat, v128, v128_bitselect,
+                             v128_load, v128_store};
+    let n = n as usize;
+    let pairs = n / 2;
+    let one = i64x2_splat(1);
+    unsafe {
+        for p in 0..pairs {
+            let i = p * 2;
+            let limit = v128_load(a.add(i) as *const v128);
+            let steps = core::cmp::max(*a.add(i), *a.add(i + 1));
+            let mut index = i64x2_splat(2);
+            let mut prev = one;
+            let mut cur = one;
+            let mut k: u64 = 2;
+            while k < steps {
+                let going = i64x2_lt(index, limit);
+                let next = i64x2_add(cur, prev);
+                prev = v128_bitselect(cur, prev, going);
+                cur = v128_bitselect(next, cur, going);
+                index = i64x2_add(index, one);
+                k += 1;
+            }
+            v128_store(result.add(i) as *mut v128, cur);
+        }
+        for i in pairs * 2..n {
+            *result.add(i) = fib(*a.add(i));
+        }
+    }
+}
+
+#[cfg(not(target_feature = "simd128"))]
+#[no_mangle]
+pub extern "C" fn fib_batch(a: *const u64, result: *mut u64, n: u32) {
+    let n = n as usize;
+    let (a, result) = unsafe {
+        (core::slice::from_raw_parts(a, n),
+         core::slice::from_raw_parts_mut(result, n))
+    };
+    for i in 0..n {
+        result[i] = fib(a[i]);
+    }
+}
+
+// Chunks with nulls (see udx_call_batch_masked_ull_ull in udx_wasm.h):
+// null rows are skipped and come out 0
+#[no_mangle]
+pub extern "C" fn fib_batch_masked(a: *const u64, valid: *const u8, result: *mut u64, n: u32) {
+    let n = n as usize;
+    let (a, valid, result) = unsafe {
+        (core::slice::from_raw_parts(a, n),
+         core::slice::from_raw_parts(valid, (n + 7) / 8),
+         core::slice::from_raw_parts_mut(result, n))
+    };
+    for i in 0..n {
+        result[i] = if (valid[i / 8] >> (i % 8)) & 1 != 0 { fib(a[i]) } else { 0 };
+    }
+}
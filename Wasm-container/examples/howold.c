@@ -1,7 +1,9 @@
 /* just the howold function --- no need for stdlib
  *
  * compile with:
- *   clang --target=wasm64 -nostdlib -Wl,--no-entry -Wl,--export-all howold.c -o howold.wasm
+ *   clang --target=wasm64-unknown-unknown -nostdlib -Wl,--no-entry -Wl,--export-all howold.c -o howold.64.wasm
+ * (make howold.64.wasm), or --target=wasm32-unknown-unknown for a
+ * 32-bit module; udx_wasm loads either
  */
 
 int howOld(int currentYear, int yearBorn) {
@@ -0,0 +1,49 @@
+// Call several functions of one module through a single state: set
+// up without naming a function, look each one up once, and call them
+// by handle.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "udx_wasm.h"
+
+const char* progname;
+
+int main(int argc, const char* argv[]) {
+    char* errormsg;
+    progname = argv[0];
+
+    if(argc != 2) {
+        fprintf(stderr, "%s: Usage: %s wasm-file\n", progname, progname);
+        return 1;
+    }
+    const char* filename = argv[1];
+    void* ws = udx_get_wasm_state();
+    if(! udx_setup(filename, ws, NULL, &errormsg)) {
+        fprintf(stderr, "%s: %s\n", progname, errormsg);
+        return 1;
+    }
+
+    int sum_handle, fib_handle;
+    if(! udx_lookup_function(ws, "sum", &sum_handle, &errormsg)
+       || ! udx_lookup_function(ws, "fib", &fib_handle, &errormsg)) {
+        fprintf(stderr, "%s: %s\n", progname, errormsg);
+        return 1;
+    }
+
+    int sum;
+    unsigned long long fib;
+    if(! udx_call_handle_2i_1i(sum_handle, 10, 34, &sum, ws, &errormsg)
+       || ! udx_call_handle_ull_ull(fib_handle, 50, &fib, ws, &errormsg)) {
+        fprintf(stderr, "%s: %s\n", progname, errormsg);
+        return 1;
+    }
+    printf("%s: sum(10, 34) = %d, fib(50) = %llu\n", progname, sum, fib);
+    udx_cleanup(ws);
+    if(sum != 44 || fib != 12586269025ULL) {
+        fprintf(stderr, "%s: ****ERROR**** expected 44 and 12586269025\n", progname);
+        return 1;
+    }
+    printf("%s: Happy, happy, joy, joy\n", progname);
+    return 0;
+}
@@ -0,0 +1,51 @@
+// Normalize log fields: ASCII letters to lower case, leading and
+// trailing whitespace dropped, and each run of whitespace inside turned
+// into one space.  There is only a batch entry point: the host copies a
+// chunk of strings into udx_batch and calls normalize_batch once for
+// the chunk (see udx_call_batch_str_str in udx_wasm.h).
+#define UDX_BATCH_BYTES (256 * 1024)
+static char udx_batch[UDX_BATCH_BYTES] __attribute__((aligned(16)));
+
+char* udx_batch_buffer() {
+    return udx_batch;
+}
+
+int udx_batch_capacity() {
+    return UDX_BATCH_BYTES;
+}
+
+static int is_space(char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+// Normalize len bytes at in into out, which is never longer; returns
+// its length
+static unsigned normalize(const char* in, unsigned len, char* out) {
+    unsigned length = 0;
+    int space = 0;
+    for(unsigned i = 0; i < len; ++i) {
+        const char c = in[i];
+        if(is_space(c)) {
+            space = length > 0;
+            continue;
+        }
+        if(space) {
+            out[length++] = ' ';
+            space = 0;
+        }
+        out[length++] = c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+    }
+    return length;
+}
+
+int normalize_batch(const char* data, const unsigned* offsets, int n,
+                    char* out, unsigned out_capacity, unsigned* out_offsets) {
+    for(int i = 0; i < n; ++i) {
+        const unsigned len = offsets[i + 1] - offsets[i];
+        if(out_offsets[i] + len > out_capacity) {
+            return i;
+        }
+        out_offsets[i + 1] = out_offsets[i] + normalize(data + offsets[i], len, out + out_offsets[i]);
+    }
+    return n;
+}
@@ -0,0 +1,63 @@
+// rustc +stable --target wasm32-unknown-unknown -O --crate-type=cdylib normalize.rs -o normalize.rs.wasm
+//
+// Normalize log fields: ASCII letters to lower case, leading and
+// trailing whitespace dropped, and each run of whitespace inside turned
+// into one space.  There is only a batch entry point: the host copies a
+// chunk of strings into UDX_BATCH and calls normalize_batch once for the
+// chunk (see udx_call_batch_str_str in udx_wasm.h).
+const UDX_BATCH_BYTES: usize = 256 * 1024;
+// u64 elements so the buffer is aligned for the offsets
+static mut UDX_BATCH: [u64; UDX_BATCH_BYTES / 8] = [0; UDX_BATCH_BYTES / 8];
+
+#[no_mangle]
+#[allow(unused_unsafe)] // addr_of_mut! on a static mut needs unsafe before Rust 1.72
+pub extern "C" fn udx_batch_buffer() -> *mut u8 {
+    unsafe { core::ptr::addr_of_mut!(UDX_BATCH) as *mut u8 }
+}
+
+#[no_mangle]
+pub extern "C" fn udx_batch_capacity() -> u32 {
+    UDX_BATCH_BYTES as u32
+}
+
+// Normalize input into out, which is never longer; returns its length
+fn normalize(input: &[u8], out: &mut [u8]) -> usize {
+    let mut length = 0;
+    let mut space = false;
+    for &c in input {
+        if c == b' ' || (b'\t'..=b'\r').contains(&c) {
+            space = length > 0;
+            continue;
+        }
+        if space {
+            out[length] = b' ';
+            length += 1;
+            space = false;
+        }
+        out[length] = c.to_ascii_lowercase();
+        length += 1;
+    }
+    length
+}
+
+#[no_mangle]
+pub extern "C" fn normalize_batch(data: *const u8, offsets: *const u32, n: u32,
+                                  out: *mut u8, out_capacity: u32, out_offsets: *mut u32) -> u32 {
+    let n = n as usize;
+    let (offsets, out_offsets) = unsafe {
+        (core::slice::from_raw_parts(offsets, n + 1),
+         core::slice::from_raw_parts_mut(out_offsets, n + 1))
+    };
+    let data = unsafe { core::slice::from_raw_parts(data, offsets[n] as usize) };
+    let out = unsafe { core::slice::from_raw_parts_mut(out, out_capacity as usize) };
+    for i in 0..n {
+        let input = &data[offsets[i] as usize..offsets[i + 1] as usize];
+        let start = out_offsets[i] as usize;
+        if start + input.len() > out.len() {
+            return i as u32;
+        }
+        let length = normalize(input, &mut out[start..start + input.len()]);
+        out_offsets[i + 1] = (start + length) as u32;
+    }
+    n as u32
+}
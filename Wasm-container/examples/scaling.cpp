@@ -0,0 +1,433 @@
+// How the Wasm call path scales with threads: N threads, each with its
+// own state (store and instance), as Vertica gives each of a query's
+// threads its own UDx object, run the sum and fib workloads at the same
+// time, and the table gives the total throughput and the efficiency
+// against one thread, T(N) / (N * T(1)).  Each case runs with all the
+// states on the one shared engine (and compiled module), as udx_setup()
+// always does, and with an engine (and compile) per thread (see
+// engine_group in udx_wasm.h), so contention on anything the states
+// share shows up as the difference between the two.
+//
+//   ./scaling [--threads 1,2,4,...] [--trials N] [--warmup N] [--calls N]
+//             [--rows N] [--fib-arg N] [--fib-calls N] [--pin] [--json FILE]
+//
+// --threads defaults to the powers of two up to the number of CPUs,
+// and that number.  Setup runs in every thread before the timed trials
+// (its slowest time is the "setup ms" column); a trial starts all the
+// threads together and ends when the last one is done.  --pin pins
+// thread i to CPU i (modulo the CPU count).  Results are checked, and
+// scaling exits non-zero if any case fails.
+
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include "udx_wasm.h"
+}
+
+namespace {
+
+struct Options {
+    std::vector<unsigned long long> threads;
+    int trials = 5;
+    int warmup = 1;
+    unsigned long long calls = 1000000;
+    unsigned long long rows = 1000000;
+    unsigned long long fib_arg = 50;
+    unsigned long long fib_calls = 200000;
+    bool pin = false;
+    const char* json = NULL;
+};
+
+double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+unsigned long long native_fib(unsigned long long a) {
+    unsigned long long prev = 1;
+    unsigned long long cur = 1;
+    for(unsigned long long i = 2; i < a; i++) {
+        const unsigned long long tmp = cur;
+        cur = cur + prev;
+        prev = tmp;
+    }
+    return cur;
+}
+
+enum Kind { SUM, SUM_BATCH, FIB };
+
+struct Workload {
+    const char* name;           // "sum", "sum-batch" or "fib"
+    Kind kind;
+    const char* label;          // "c.wasm"
+    const char* filename;
+    const char* function;       // the export udx_setup() binds
+    unsigned long long ops;     // calls or rows per thread per trial
+};
+
+// One case: a workload on some number of threads, on the shared engine
+// or an engine per thread
+struct Case {
+    const Workload* workload;
+    const Options* options;
+    bool private_engines;
+    struct udx_engine_options engine_options;
+    unsigned threads;
+    pthread_barrier_t start;
+    pthread_barrier_t done;
+};
+
+struct Worker {
+    Case* c;
+    unsigned index;
+    double setup_ns = 0;
+    std::string error;
+};
+
+// One trial's share of the work for one thread, with every result
+// checked
+bool run_once(const Workload& w, const Options& options, unsigned index, void* ws,
+              std::vector<int>* a, std::vector<int>* b, std::vector<int>* out,
+              std::string* error) {
+    char* errormsg;
+    switch(w.kind) {
+    case SUM:
+        for(unsigned long long i = 0; i < w.ops; ++i) {
+            // every thread adds different numbers
+            const int x = (int) (i & 0xffff);
+            const int y = (int) index;
+            int result;
+            if(! udx_call_func_2i_1i(x, y, &result, ws, &errormsg)) {
+                *error = errormsg;
+                return false;
+            }
+            if(result != x + y) {
+                *error = "sum returned the wrong answer";
+                return false;
+            }
+        }
+        return true;
+    case SUM_BATCH:
+        if(! udx_call_batch_2i_1i(a->data(), b->data(), out->data(), w.ops, ws, &errormsg)) {
+            *error = errormsg;
+            return false;
+        }
+        for(unsigned long long i = 0; i < w.ops; ++i) {
+            if((*out)[i] != (*a)[i] + (*b)[i]) {
+                *error = "sum_batch returned the wrong answer at row " + std::to_string(i);
+                return false;
+            }
+        }
+        return true;
+    case FIB: {
+        const unsigned long long expected = native_fib(options.fib_arg);
+        for(unsigned long long i = 0; i < w.ops; ++i) {
+            unsigned long long result;
+            if(! udx_call_func_ull_ull(options.fib_arg, &result, ws, &errormsg)) {
+                *error = errormsg;
+                return false;
+            }
+            if(result != expected) {
+                *error = "fib returned the wrong answer";
+                return false;
+            }
+        }
+        return true;
+    }
+    }
+    return false;
+}
+
+void* work(void* arg) {
+    Worker* worker = static_cast<Worker*>(arg);
+    Case* c = worker->c;
+    const Workload& w = *c->workload;
+    if(c->options->pin) {
+        const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(worker->index % cpus, &set);
+        if(sched_setaffinity(0, sizeof(set), &set) != 0)
+            worker->error = "can't pin to CPU " + std::to_string(worker->index % cpus);
+    }
+
+    std::vector<int> a, b, out;
+    if(w.kind == SUM_BATCH) {
+        a.resize(w.ops);
+        b.resize(w.ops, (int) worker->index);
+        out.resize(w.ops);
+        for(unsigned long long i = 0; i < w.ops; ++i)
+            a[i] = (int) (i & 0xffff);
+    }
+
+    struct udx_engine_options options = c->engine_options;
+    options.engine_group = c->private_engines ? (int) worker->index + 1 : 0;
+    void* ws = udx_get_wasm_state();
+    char* errormsg;
+    const double start = now_ns();
+    if(! ws)
+        worker->error = "can't allocate a wasm state";
+    else if(worker->error.empty()
+            && ! udx_setup_with_options(w.filename, ws, w.function, &options, &errormsg))
+        worker->error = std::string(w.filename) + ": " + errormsg;
+    worker->setup_ns = now_ns() - start;
+
+    // a thread that failed still waits at every barrier, so the others
+    // (and the timing thread) don't hang
+    for(int trial = 0; trial < c->options->warmup + c->options->trials; ++trial) {
+        pthread_barrier_wait(&c->start);
+        if(worker->error.empty())
+            run_once(w, *c->options, worker->index, ws, &a, &b, &out, &worker->error);
+        pthread_barrier_wait(&c->done);
+    }
+    udx_cleanup(ws);
+    return NULL;
+}
+
+struct Result {
+    std::string workload;
+    std::string module;
+    bool private_engines;
+    unsigned threads;
+    bool ok;
+    std::string error;
+    double setup_ms;            // the slowest thread's
+    double ops_per_s;           // all threads together, median trial
+    double best_ops_per_s;
+    double ns_per_op;           // per thread, median trial
+    double efficiency;
+};
+
+// Run one case: its threads set up, then trials of all of them at once
+Result run_case(Case* c) {
+    const Workload& w = *c->workload;
+    Result result;
+    result.workload = w.name;
+    result.module = w.label;
+    result.private_engines = c->private_engines;
+    result.threads = c->threads;
+    result.ok = true;
+    result.setup_ms = 0;
+
+    pthread_barrier_init(&c->start, NULL, c->threads + 1);
+    pthread_barrier_init(&c->done, NULL, c->threads + 1);
+    std::vector<Worker> workers(c->threads);
+    std::vector<pthread_t> ids(c->threads);
+    for(unsigned i = 0; i < c->threads; ++i) {
+        workers[i].c = c;
+        workers[i].index = i;
+        pthread_create(&ids[i], NULL, work, &workers[i]);
+    }
+    std::vector<double> trial_ns;
+    for(int trial = 0; trial < c->options->warmup + c->options->trials; ++trial) {
+        pthread_barrier_wait(&c->start);
+        const double start = now_ns();
+        pthread_barrier_wait(&c->done);
+        if(trial >= c->options->warmup)
+            trial_ns.push_back(now_ns() - start);
+    }
+    for(unsigned i = 0; i < c->threads; ++i)
+        pthread_join(ids[i], NULL);
+    pthread_barrier_destroy(&c->start);
+    pthread_barrier_destroy(&c->done);
+
+    for(const Worker& worker : workers) {
+        result.setup_ms = std::max(result.setup_ms, worker.setup_ns / 1e6);
+        if(result.ok && ! worker.error.empty()) {
+            result.ok = false;
+            result.error = "thread " + std::to_string(worker.index) + ": " + worker.error;
+        }
+    }
+    std::sort(trial_ns.begin(), trial_ns.end());
+    const size_t n = trial_ns.size();
+    const double median = n % 2 ? trial_ns[n / 2] : (trial_ns[n / 2 - 1] + trial_ns[n / 2]) / 2;
+    const double ops = (double) w.ops * c->threads;
+    result.ops_per_s = ops / median * 1e9;
+    result.best_ops_per_s = ops / trial_ns.front() * 1e9;
+    result.ns_per_op = median / w.ops;
+    result.efficiency = 0;
+    return result;
+}
+
+void print_header(const Options& options) {
+    fprintf(stdout, "Wasm engine configuration: %s; %d trials after %d warmup; %ld CPUs; %s\n",
+            udx_query_wasm_config(), options.trials, options.warmup,
+            sysconf(_SC_NPROCESSORS_ONLN), options.pin ? "threads pinned" : "not pinned");
+    fprintf(stdout, "%-10s %-8s %-8s %7s %10s %10s %10s %10s %10s\n",
+            "", "", "engine", "threads", "setup ms", "Mops/s", "best", "ns/op", "efficiency");
+}
+
+void print(const Result& r) {
+    if(! r.ok) {
+        fprintf(stdout, "%-10s %-8s %-8s %7u FAILED: %s\n", r.workload.c_str(), r.module.c_str(),
+                r.private_engines ? "private" : "shared", r.threads, r.error.c_str());
+    } else {
+        fprintf(stdout, "%-10s %-8s %-8s %7u %10.2f %10.2f %10.2f %10.2f %10.2f\n",
+                r.workload.c_str(), r.module.c_str(), r.private_engines ? "private" : "shared",
+                r.threads, r.setup_ms, r.ops_per_s / 1e6, r.best_ops_per_s / 1e6, r.ns_per_op,
+                r.efficiency);
+    }
+    fflush(stdout);
+}
+
+bool write_json(const char* filename, const Options& options, const std::vector<Result>& results) {
+    FILE* out = strcmp(filename, "-") ? fopen(filename, "w") : stdout;
+    if(! out) {
+        perror(filename);
+        return false;
+    }
+    fprintf(out, "{\n  \"engine\": \"%s\",\n  \"trials\": %d,\n  \"warmup\": %d,\n"
+            "  \"cpus\": %ld,\n  \"pinned\": %s,\n  \"results\": [",
+            udx_query_wasm_config(), options.trials, options.warmup,
+            sysconf(_SC_NPROCESSORS_ONLN), options.pin ? "true" : "false");
+    const char* separator = "\n";
+    for(const Result& r : results) {
+        fprintf(out, "%s    {\"workload\": \"%s\", \"module\": \"%s\", \"engine\": \"%s\""
+                ", \"threads\": %u, \"ok\": %s",
+                separator, r.workload.c_str(), r.module.c_str(),
+                r.private_engines ? "private" : "shared", r.threads, r.ok ? "true" : "false");
+        if(r.ok) {
+            fprintf(out, ", \"setup_ms\": %.3f, \"ops_per_s\": %.0f, \"best_ops_per_s\": %.0f"
+                    ", \"ns_per_op\": %.3f, \"efficiency\": %.3f}",
+                    r.setup_ms, r.ops_per_s, r.best_ops_per_s, r.ns_per_op, r.efficiency);
+        } else {
+            fputs(", \"error\": \"", out);
+            for(const char c : r.error) {
+                if(c == '"' || c == '\\')
+                    fprintf(out, "\\%c", c);
+                else if((unsigned char) c < ' ')
+                    fprintf(out, "\\u%04x", c);
+                else
+                    fputc(c, out);
+            }
+            fputs("\"}", out);
+        }
+        separator = ",\n";
+    }
+    fputs("\n  ]\n}\n", out);
+    return out == stdout ? fflush(out) == 0 : fclose(out) == 0;
+}
+
+bool parse_list(const char* arg, std::vector<unsigned long long>* list) {
+    list->clear();
+    const char* p = arg;
+    while(*p) {
+        char* end;
+        const unsigned long long value = strtoull(p, &end, 10);
+        if(end == p || (*end && *end != ',') || value == 0)
+            return false;
+        list->push_back(value);
+        p = *end ? end + 1 : end;
+    }
+    return ! list->empty();
+}
+
+bool parse_options(int argc, const char* argv[], Options* options) {
+    for(int i = 1; i < argc; ++i) {
+        const std::string flag = argv[i];
+        if(flag == "--pin") {
+            options->pin = true;
+            continue;
+        }
+        if(i + 1 == argc)
+            return false;
+        const char* value = argv[++i];
+        if(flag == "--threads") {
+            if(! parse_list(value, &options->threads))
+                return false;
+        } else if(flag == "--trials")
+            options->trials = atoi(value);
+        else if(flag == "--warmup")
+            options->warmup = atoi(value);
+        else if(flag == "--calls")
+            options->calls = strtoull(value, NULL, 10);
+        else if(flag == "--rows")
+            options->rows = strtoull(value, NULL, 10);
+        else if(flag == "--fib-arg")
+            options->fib_arg = strtoull(value, NULL, 10);
+        else if(flag == "--fib-calls")
+            options->fib_calls = strtoull(value, NULL, 10);
+        else if(flag == "--json")
+            options->json = value;
+        else
+            return false;
+    }
+    if(options->threads.empty()) {
+        const unsigned long long cpus = std::max(1u, std::thread::hardware_concurrency());
+        for(unsigned long long n = 1; n < cpus; n *= 2)
+            options->threads.push_back(n);
+        options->threads.push_back(cpus);
+    }
+    return options->trials > 0 && options->warmup >= 0 && options->calls > 0
+        && options->rows > 0 && options->fib_calls > 0;
+}
+
+} // namespace
+
+int main(const int argc, const char* argv[]) {
+    Options options;
+    if(! parse_options(argc, argv, &options)) {
+        fprintf(stderr,
+                "Usage: %s [--threads 1,2,4,...] [--trials N] [--warmup N] [--calls N]\n"
+                "          [--rows N] [--fib-arg N] [--fib-calls N] [--pin] [--json FILE]\n",
+                argv[0]);
+        return 2;
+    }
+    // Pick the compiler with UDX_WASM_COMPILER=singlepass|cranelift|llvm
+    struct udx_engine_options engine_options;
+    if(! udx_default_engine_options(&engine_options)) {
+        fprintf(stderr, "%s: UDX_WASM_COMPILER or UDX_WASM_SIMD is set to an unknown value\n", argv[0]);
+        return 1;
+    }
+
+    const Workload workloads[] = {
+        {"sum", SUM, "c.wasm", "sum.c.wasm", "sum", options.calls},
+        {"sum", SUM, "rs.wasm", "sum.rs.wasm", "sum", options.calls},
+        {"sum-batch", SUM_BATCH, "c.wasm", "sum.c.wasm", "sum_batch", options.rows},
+        {"sum-batch", SUM_BATCH, "rs.wasm", "sum.rs.wasm", "sum_batch", options.rows},
+        {"fib", FIB, "c.wasm", "fib.c.wasm", "fib", options.fib_calls},
+        {"fib", FIB, "rs.wasm", "fib.rs.wasm", "fib", options.fib_calls},
+    };
+    print_header(options);
+    std::vector<Result> results;
+    bool ok = true;
+    for(const Workload& w : workloads) {
+        for(const bool private_engines : {false, true}) {
+            // efficiency is against the fewest threads run
+            double base_per_thread = 0;
+            for(const unsigned long long threads : options.threads) {
+                Case c;
+                c.workload = &w;
+                c.options = &options;
+                c.private_engines = private_engines;
+                c.engine_options = engine_options;
+                c.threads = (unsigned) threads;
+                Result result = run_case(&c);
+                if(result.ok) {
+                    const double per_thread = result.ops_per_s / threads;
+                    if(base_per_thread == 0)
+                        base_per_thread = per_thread;
+                    result.efficiency = per_thread / base_per_thread;
+                }
+                ok = ok && result.ok;
+                print(result);
+                results.push_back(result);
+            }
+        }
+    }
+    if(options.json && ! write_json(options.json, options, results))
+        ok = false;
+    return ok ? 0 : 1;
+}
@@ -1,3 +1,49 @@
 int sum(int a, int b) {
     return a + b;
 }
+
+// Column-batch entry points (see udx_call_batch_2i_1i in udx_wasm.h):
+// the host copies a chunk of rows into udx_batch and calls sum_batch
+// once for the whole chunk.
+#define UDX_BATCH_BYTES (256 * 1024)
+static char udx_batch[UDX_BATCH_BYTES] __attribute__((aligned(16)));
+
+char* udx_batch_buffer() {
+    return udx_batch;
+}
+
+int udx_batch_capacity() {
+    return UDX_BATCH_BYTES;
+}
+
+#ifdef __wasm_simd128__
+#include <wasm_simd128.h>
+
+// Built with -msimd128 (sum.c.simd.wasm): four rows per i32x4 add
+void sum_batch(const int* a, const int* b, int* result, int n) {
+    int i = 0;
+    for(; i + 4 <= n; i += 4) {
+        const v128_t a4 = wasm_v128_load(a + i);
+        const v128_t b4 = wasm_v128_load(b + i);
+        wasm_v128_store(result + i, wasm_i32x4_add(a4, b4));
+    }
+    for(; i < n; ++i) {
+        result[i] = a[i] + b[i];
+    }
+}
+#else
+void sum_batch(const int* a, const int* b, int* result, int n) {
+    for(int i = 0; i < n; ++i) {
+        result[i] = a[i] + b[i];
+    }
+}
+#endif
+
+// Chunks with nulls (see udx_call_batch_masked_2i_1i): null rows come
+// out 0.  Adding costs less than testing, so there is no branch.
+void sum_batch_masked(const int* a, const int* b, const unsigned char* valid, int* result, int n) {
+    for(int i = 0; i < n; ++i) {
+        const int keep = -((valid[i / 8] >> (i % 8)) & 1);
+        result[i] = (a[i] + b[i]) & keep;
+    }
+}
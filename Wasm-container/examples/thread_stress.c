@@ -0,0 +1,173 @@
+// Multi-threaded stress test for udx_wasm: every thread repeatedly gets
+// its own state, sets it up, calls into it (one row at a time and in
+// batches), checks the results, and cleans up, and has a helper thread
+// interrupt it the way Vertica's cancel() would.  Built with
+// -fsanitize=thread by the thread_stress make target, so sharing
+// anything between states shows up as a data race report.
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "udx_wasm.h"
+
+#define ROWS 10000
+
+const char* progname;
+const char* filename;
+int iterations;
+
+struct thread_args {
+    int thread_index;
+    int failures;
+};
+
+static void fail(struct thread_args *t, const char* what, const char* errormsg) {
+    fprintf(stderr, "%s: thread %d: %s; %s\n",
+            progname,
+            t->thread_index,
+            what,
+            errormsg ? errormsg : "(no message)");
+    t->failures++;
+}
+
+static void one_row_at_a_time(struct thread_args *t) {
+    char* errormsg;
+    void* ws = udx_get_wasm_state();
+    if(! udx_setup(filename, ws, "sum", &errormsg)) {
+        fail(t, "setup of sum failed", errormsg);
+        udx_cleanup(ws);
+        return;
+    }
+    for(int i = 0; i < ROWS; ++i) {
+        int result;
+        // every thread adds different numbers
+        const int a = i;
+        const int b = t->thread_index * ROWS;
+        if(! udx_call_func_2i_1i(a, b, &result, ws, &errormsg)) {
+            fail(t, "call of sum failed", errormsg);
+            break;
+        }
+        if(result != a + b) {
+            fail(t, "sum returned the wrong answer", NULL);
+            break;
+        }
+    }
+    udx_cleanup(ws);
+}
+
+static void in_batches(struct thread_args *t) {
+    static __thread int a[ROWS], b[ROWS], result[ROWS];
+    char* errormsg;
+    void* ws = udx_get_wasm_state();
+    if(! udx_setup(filename, ws, "sum_batch", &errormsg)) {
+        fail(t, "setup of sum_batch failed", errormsg);
+        udx_cleanup(ws);
+        return;
+    }
+    for(int i = 0; i < ROWS; ++i) {
+        a[i] = i;
+        b[i] = t->thread_index * ROWS;
+    }
+    if(! udx_call_batch_2i_1i(a, b, result, ROWS, ws, &errormsg)) {
+        fail(t, "call of sum_batch failed", errormsg);
+    } else {
+        for(int i = 0; i < ROWS; ++i) {
+            if(result[i] != a[i] + b[i]) {
+                fail(t, "sum_batch returned the wrong answer", NULL);
+                break;
+            }
+        }
+    }
+    udx_cleanup(ws);
+}
+
+// Error messages live in the state: make sure each thread sees its own
+static void private_errors(struct thread_args *t) {
+    char* errormsg;
+    char missing[64];
+    snprintf(missing, sizeof(missing), "no_such_function_%d", t->thread_index);
+    void* ws = udx_get_wasm_state();
+    if(udx_setup(filename, ws, missing, &errormsg)) {
+        fail(t, "setup of a missing function succeeded", NULL);
+    } else if(! strstr(errormsg, missing)) {
+        fail(t, "got somebody else's error message", errormsg);
+    }
+    udx_cleanup(ws);
+}
+
+static void* raise_interrupt(void* v_interrupt) {
+    udx_interrupt((struct udx_interrupt*) v_interrupt);
+    return NULL;
+}
+
+// A helper thread raises the flag while this one sets the state up and
+// calls into it, and again while it cleans up, as cancel() may; only
+// the flag is shared.  Once the helper is done, calls must fail.
+static void interrupted(struct thread_args *t) {
+    struct udx_interrupt interrupt = UDX_INTERRUPT_INIT;
+    pthread_t helper;
+    char* errormsg;
+    int result;
+    void* ws = udx_get_wasm_state();
+    udx_watch_interrupt(ws, &interrupt);
+    pthread_create(&helper, NULL, raise_interrupt, &interrupt);
+    const bool set_up = udx_setup(filename, ws, "sum", &errormsg);
+    if(! set_up)
+        fail(t, "setup of sum failed", errormsg);
+    for(int i = 0; set_up && i < ROWS && udx_call_func_2i_1i(i, i, &result, ws, &errormsg); ++i)
+        ;
+    pthread_join(helper, NULL);
+    if(set_up && udx_call_func_2i_1i(1, 2, &result, ws, &errormsg))
+        fail(t, "call after an interrupt succeeded", NULL);
+    else if(set_up && ! strstr(errormsg, "interrupted"))
+        fail(t, "call after an interrupt failed otherwise", errormsg);
+    pthread_create(&helper, NULL, raise_interrupt, &interrupt);
+    udx_cleanup(ws);
+    pthread_join(helper, NULL);
+}
+
+static void* stress(void* v_args) {
+    struct thread_args *t = (struct thread_args*) v_args;
+    for(int i = 0; i < iterations; ++i) {
+        one_row_at_a_time(t);
+        in_batches(t);
+        private_errors(t);
+        interrupted(t);
+    }
+    return NULL;
+}
+
+int main(int argc, const char* argv[]) {
+    progname = argv[0];
+
+    if(argc != 4) {
+        fprintf(stderr,
+                "%s: Usage: %s wasm-file thread-count iterations\n",
+                progname,
+                progname);
+        return 1;
+    }
+    filename = argv[1];
+    const int thread_count = atoi(argv[2]);
+    iterations = atoi(argv[3]);
+
+    pthread_t *threads = calloc(thread_count, sizeof(pthread_t));
+    struct thread_args *args = calloc(thread_count, sizeof(struct thread_args));
+    for(int i = 0; i < thread_count; ++i) {
+        args[i].thread_index = i;
+        pthread_create(&threads[i], NULL, stress, &args[i]);
+    }
+    int failures = 0;
+    for(int i = 0; i < thread_count; ++i) {
+        pthread_join(threads[i], NULL);
+        failures += args[i].failures;
+    }
+    free(threads);
+    free(args);
+
+    printf("%s: %d threads x %d iterations on %s: %d failures\n",
+           progname, thread_count, iterations, filename, failures);
+    return failures == 0 ? 0 : 1;
+}
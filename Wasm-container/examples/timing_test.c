@@ -11,6 +11,13 @@
 
 const char* progname;
 
+// Monotonic wall-clock time; clock() ticks are too coarse for short runs
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
 unsigned long long fib(unsigned long long a) {
     unsigned long long i;
     unsigned long long prev = 1;
@@ -50,10 +57,10 @@ int main(int argc, const char* argv[]) {
         fprintf(stderr, "%s: %s\n", progname, errormsg);
         return 1;
     }
+    printf("Wasm engine: %s\n", udx_describe_engine(ws));
 
-    clock_t start, end;
-    printf("%ld ticks per second\n", CLOCKS_PER_SEC);
-    start = clock();
+    double start, end;
+    start = now_seconds();
     unsigned long long a;
     for(int i = 0; i < loop_count; ++i) {
         if(arg > 2*loop_count) {
@@ -67,13 +74,19 @@ int main(int argc, const char* argv[]) {
             return 1;
         }
     }
-    end = clock();
-    printf("%d passes of %s(%s) took %ld ticks\n",
+    end = now_seconds();
+    printf("%d passes of %s(%s) took %.6f seconds (%.1f ns per call)\n",
            loop_count,
            filename,
            function,
-           end - start);
+           end - start,
+           (end - start) * 1e9 / loop_count);
     double wasm_time = end - start;
+    struct udx_wasm_stats stats;
+    char stats_line[512];
+    udx_get_stats(ws, &stats);
+    udx_format_stats(&stats, stats_line, sizeof(stats_line));
+    printf("udx_wasm counters: %s\n", stats_line);
 
     // recalculate the arg value because I want to compare results with C
     a = arg;
@@ -83,15 +96,16 @@ int main(int argc, const char* argv[]) {
     }
     wasm_result = result;
 
-    start = clock();
+    start = now_seconds();
     for(int i = 0; i < loop_count; ++i) {
         unsigned long long a = arg;
         result = fib(a);
     }
-    end = clock();
-    printf("%d passes of fib() took %ld ticks\n",
+    end = now_seconds();
+    printf("%d passes of fib() took %.6f seconds (%.1f ns per call)\n",
            loop_count,
-           end - start);
+           end - start,
+           (end - start) * 1e9 / loop_count);
 
     double c_time = end - start;
     // just to be sure the optimizer doesn't optimize out the loop
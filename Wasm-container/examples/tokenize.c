@@ -0,0 +1,67 @@
+// Split log lines into tokens and normalize them: a token is a run of
+// ASCII letters, digits and underscores (and any non-ASCII bytes, so
+// UTF-8 stays whole), lower-cased.  Each line makes a row per token,
+// with two integer columns, the token's number in the line (from 1) and
+// its byte offset, and the token.  There is only a batch entry point:
+// the host copies a chunk of lines into udx_batch and calls
+// tokenize_batch once for the chunk, which writes every token of every
+// line in one pass (see udx_call_batch_str_rows in udx_wasm.h).
+#define UDX_BATCH_BYTES (256 * 1024)
+static char udx_batch[UDX_BATCH_BYTES] __attribute__((aligned(16)));
+
+char* udx_batch_buffer() {
+    return udx_batch;
+}
+
+int udx_batch_capacity() {
+    return UDX_BATCH_BYTES;
+}
+
+#define INT_COLUMNS 2
+
+static int is_token(unsigned char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')
+        || c == '_' || c >= 0x80;
+}
+
+int tokenize_batch(const char* data, const unsigned* offsets, int n,
+                   unsigned* source, long long* ints, unsigned max_rows,
+                   char* out, unsigned out_capacity, unsigned* out_offsets,
+                   unsigned* out_rows) {
+    unsigned rows = 0;
+    for(int i = 0; i < n; ++i) {
+        // a line's rows go in whole or not at all
+        unsigned row = rows;
+        unsigned position = 0;
+        const char* line = data + offsets[i];
+        const unsigned len = offsets[i + 1] - offsets[i];
+        unsigned j = 0;
+        while(j < len) {
+            if(! is_token(line[j])) {
+                ++j;
+                continue;
+            }
+            const unsigned start = j;
+            while(j < len && is_token(line[j])) {
+                ++j;
+            }
+            if(row == max_rows || out_offsets[row] + (j - start) > out_capacity) {
+                *out_rows = rows;
+                return i;
+            }
+            char* token = out + out_offsets[row];
+            for(unsigned k = start; k < j; ++k) {
+                const char c = line[k];
+                *token++ = c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+            }
+            source[row] = i;
+            ints[row * INT_COLUMNS] = ++position;
+            ints[row * INT_COLUMNS + 1] = start;
+            out_offsets[row + 1] = out_offsets[row] + (j - start);
+            ++row;
+        }
+        rows = row;
+    }
+    *out_rows = rows;
+    return n;
+}
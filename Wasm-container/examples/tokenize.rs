@@ -0,0 +1,80 @@
+// rustc +stable --target wasm32-unknown-unknown -O --crate-type=cdylib tokenize.rs -o tokenize.rs.wasm
+//
+// Split log lines into tokens and normalize them: a token is a run of
+// ASCII letters, digits and underscores (and any non-ASCII bytes, so
+// UTF-8 stays whole), lower-cased.  Each line makes a row per token,
+// with two integer columns, the token's number in the line (from 1) and
+// its byte offset, and the token.  There is only a batch entry point:
+// the host copies a chunk of lines into UDX_BATCH and calls
+// tokenize_batch once for the chunk, which writes every token of every
+// line in one pass (see udx_call_batch_str_rows in udx_wasm.h).
+const UDX_BATCH_BYTES: usize = 256 * 1024;
+// u64 elements so the buffer is aligned for the integer columns
+static mut UDX_BATCH: [u64; UDX_BATCH_BYTES / 8] = [0; UDX_BATCH_BYTES / 8];
+
+#[no_mangle]
+#[allow(unused_unsafe)] // addr_of_mut! on a static mut needs unsafe before Rust 1.72
+pub extern "C" fn udx_batch_buffer() -> *mut u8 {
+    unsafe { core::ptr::addr_of_mut!(UDX_BATCH) as *mut u8 }
+}
+
+#[no_mangle]
+pub extern "C" fn udx_batch_capacity() -> u32 {
+    UDX_BATCH_BYTES as u32
+}
+
+const INT_COLUMNS: usize = 2;
+
+fn is_token(c: u8) -> bool {
+    c.is_ascii_alphanumeric() || c == b'_' || c >= 0x80
+}
+
+#[no_mangle]
+pub extern "C" fn tokenize_batch(data: *const u8, offsets: *const u32, n: u32,
+                                 source: *mut u32, ints: *mut i64, max_rows: u32,
+                                 out: *mut u8, out_capacity: u32, out_offsets: *mut u32,
+                                 out_rows: *mut u32) -> u32 {
+    let n = n as usize;
+    let max_rows = max_rows as usize;
+    let (offsets, source, ints, out_offsets) = unsafe {
+        (core::slice::from_raw_parts(offsets, n + 1),
+         core::slice::from_raw_parts_mut(source, max_rows),
+         core::slice::from_raw_parts_mut(ints, max_rows * INT_COLUMNS),
+         core::slice::from_raw_parts_mut(out_offsets, max_rows + 1))
+    };
+    let data = unsafe { core::slice::from_raw_parts(data, offsets[n] as usize) };
+    let out = unsafe { core::slice::from_raw_parts_mut(out, out_capacity as usize) };
+    let mut rows = 0;
+    for i in 0..n {
+        // a line's rows go in whole or not at all
+        let mut row = rows;
+        let line = &data[offsets[i] as usize..offsets[i + 1] as usize];
+        let mut j = 0;
+        while j < line.len() {
+            if !is_token(line[j]) {
+                j += 1;
+                continue;
+            }
+            let start = j;
+            while j < line.len() && is_token(line[j]) {
+                j += 1;
+            }
+            let at = out_offsets[row] as usize;
+            if row == max_rows || at + (j - start) > out.len() {
+                unsafe { *out_rows = rows as u32 };
+                return i as u32;
+            }
+            for (o, &c) in out[at..at + (j - start)].iter_mut().zip(&line[start..j]) {
+                *o = c.to_ascii_lowercase();
+            }
+            source[row] = i as u32;
+            ints[row * INT_COLUMNS] = (row - rows + 1) as i64;
+            ints[row * INT_COLUMNS + 1] = start as i64;
+            out_offsets[row + 1] = (at + (j - start)) as u32;
+            row += 1;
+        }
+        rows = row;
+    }
+    unsafe { *out_rows = rows as u32 };
+    n as u32
+}
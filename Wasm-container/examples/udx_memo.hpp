@@ -0,0 +1,126 @@
+#ifndef udx_memo_hpp
+#define udx_memo_hpp
+// A result cache for Wasm functions of one integer argument that are
+// pure: the same argument always gives the same result, and a call
+// changes nothing the next call can see.  It is looked up before
+// calling into Wasm:
+//
+//     MemoCache<unsigned long long, unsigned long long> memo;
+//     memo.reset(16384);
+//     ...
+//     if(! memo.find(a, &result)) {
+//         if(! fib.call(a, &result, &error))
+//             ...
+//         memo.insert(a, result);
+//     }
+//
+// Each function object (so each thread) has its own, so there is no
+// locking.  The table is open addressing with linear probing over a
+// fixed number of slots, set by reset() and never grown: a lookup or
+// insert looks at no more than PROBES slots from the key's home slot,
+// and an insert that finds them all taken replaces the home slot.  So
+// memory is bounded, a lookup costs a few cache lines at most, and a
+// working set bigger than the table shows up as a falling hit rate
+// (see hits() and evictions()) rather than as growth.
+
+#include <cstddef>
+#include <type_traits>
+#include <vector>
+
+namespace udx_wasm {
+
+template <typename K, typename V>
+class MemoCache {
+    static_assert(std::is_integral<K>::value, "MemoCache keys are integers");
+
+    struct Slot {
+        K key;
+        V value;
+        bool used;
+    };
+
+    std::vector<Slot> slots;
+    unsigned shift;
+    unsigned long long lookups_;
+    unsigned long long hits_;
+    unsigned long long evictions_;
+
+    // Fibonacci hashing: the top bits of the key times 2^64 / phi, so
+    // runs of consecutive keys spread over the table
+    size_t home(K key) const {
+        return static_cast<size_t>((static_cast<unsigned long long>(key) * 0x9e3779b97f4a7c15ULL) >> shift);
+    }
+
+public:
+    static const size_t PROBES = 8;
+
+    MemoCache() : shift(64), lookups_(0), hits_(0), evictions_(0) {}
+
+    // Empty the cache, and make room for entries results (rounded up to
+    // a power of two); 0 turns it off, so find() is always a miss and
+    // insert() does nothing.  Counters start again from 0.
+    void reset(size_t entries) {
+        size_t capacity = 0;
+        shift = 64;
+        if(entries > 0) {
+            capacity = PROBES;
+            shift = 61;
+            while(capacity < entries) {
+                capacity *= 2;
+                --shift;
+            }
+        }
+        slots.assign(capacity, Slot());
+        lookups_ = hits_ = evictions_ = 0;
+    }
+
+    bool enabled() const { return ! slots.empty(); }
+
+    bool find(K key, V* value) {
+        if(slots.empty())
+            return false;
+        ++lookups_;
+        const size_t mask = slots.size() - 1;
+        for(size_t i = home(key), n = 0; n < PROBES; i = (i + 1) & mask, ++n) {
+            const Slot &slot = slots[i];
+            if(! slot.used)
+                return false;
+            if(slot.key == key) {
+                *value = slot.value;
+                ++hits_;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void insert(K key, V value) {
+        if(slots.empty())
+            return;
+        const size_t mask = slots.size() - 1;
+        const size_t first = home(key);
+        for(size_t i = first, n = 0; n < PROBES; i = (i + 1) & mask, ++n) {
+            Slot &slot = slots[i];
+            if(! slot.used || slot.key == key) {
+                slot.key = key;
+                slot.value = value;
+                slot.used = true;
+                return;
+            }
+        }
+        Slot &slot = slots[first];
+        slot.key = key;
+        slot.value = value;
+        ++evictions_;
+    }
+
+    unsigned long long lookups() const { return lookups_; }
+    unsigned long long hits() const { return hits_; }
+    unsigned long long evictions() const { return evictions_; }
+    size_t capacity() const { return slots.size(); }
+    size_t bytes() const { return slots.size() * sizeof(Slot); }
+};
+
+} // namespace udx_wasm
+
+#endif // udx_memo_hpp
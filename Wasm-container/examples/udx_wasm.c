@@ -2,33 +2,229 @@
 // https://docs.rs/wasmer-c-api/latest/wasmer/wasm_c_api/instance/index.html
 
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "wasmer.h"
 #include "udx_wasm.h"
 
 #define EBUF_SIZE 256
-static char ebuf[EBUF_SIZE+1];
+#define ENGINE_DESCRIPTION_SIZE 128
 
-// Having this static simplifies the C interface, but complicates things
-// if you want to have more than one Wasm function in your program
-static struct wasm_state {
-    wasm_byte_vec_t wasm;
+// One engine per distinct set of udx_engine_options, created on first
+// use and kept for the life of the process
+struct shared_engine {
+    struct shared_engine* next;
+    // e.g. "cranelift cpu=avx2,bmi2 canonical-nans"; with the group,
+    // the key
+    char description[ENGINE_DESCRIPTION_SIZE];
+    int group;
+    // modules are rewritten to poll for interrupts before compiling
+    bool interruptible;
     wasm_engine_t* engine;
+    // modules are compiled in a store of their own, not in whichever
+    // state happened to load them first
+    wasm_store_t* compile_store;
+};
+
+// The module's exports, hashed by name once when it is compiled (or
+// loaded), so setup doesn't scan and compare every export name.
+// Wasm export names are unique.
+struct export_slot {
+    // NULL for an empty slot; points into export_index.names
+    const char* name;
+    size_t name_len;
+    uint64_t hash;
+    wasm_externkind_t kind;
+    // where the export is in wasm_instance_exports() order
+    uint32_t position;
+};
+
+struct export_index {
+    // a power of two, at least twice the number of exports, so
+    // linear probing stays short
+    size_t slot_count;
+    struct export_slot* slots;
+    char* names;
+    size_t export_count;
+};
+
+// Where a module's bytes are.  Cached modules keep them to compare
+// with the next setup's, so they are never copied to the heap: files
+// are mapped, and memory the caller passes in (e.g., a .wasm linked
+// into the UDx library) is borrowed.
+struct module_bytes {
+    const char* data;
+    size_t size;
+    // non-zero when data is our mmap() of a file
+    size_t mapped_size;
+    // the caller's memory, only valid during the udx_setup_from_memory()
+    // call: the library it is in may be unloaded while the module is
+    // still cached, so cached borrowed bytes are never read
+    bool borrowed;
+};
+
+// What an interruptible instance's poll import checks: the state using
+// the instance, which changes as the instance goes through the pool.
+// Only the thread using that state reads or writes it.
+struct poll_env {
+    struct wasm_state* ws;
+};
+
+// A set-up instance a state gave back in udx_cleanup(), reset to how
+// instantiation left it, for the next setup of the same module.  The
+// store is only ever used by one state at a time, like any state's.
+struct pooled_instance {
+    struct pooled_instance* next;
+    wasm_store_t* store;
+    wasm_instance_t* instance;
+    wasm_extern_vec_t exports;
+    // an interruptible instance's poll import (see struct poll_env)
+    wasm_extern_vec_t imports;
+    struct poll_env* poll;
+    // vwasm_now_ns() when it was returned, for idle eviction
+    uint64_t returned_at;
+};
+
+// A fresh instance's linear memory, kept sparsely: only the snapshot
+// pages with a non-zero byte are stored, as runs of consecutive pages
+// (a Rust module's 1 MiB stack, say, is all zeroes).
+struct memory_extent {
+    size_t offset;
+    size_t size;
+};
+
+struct memory_snapshot {
+    size_t size;
+    size_t extent_count;
+    struct memory_extent* extents;
+    // the extents' bytes, back to back
+    byte_t* data;
+};
+
+// A compiled module, shared by every state that loaded the same bytes.
+// Entries are found by engine and a hash of the .wasm contents (and
+// then compared byte for byte, so a hash collision can't hand out the
+// wrong code).
+struct cached_module {
+    struct cached_module* next;
+    struct shared_engine* engine;
+    uint64_t hash;
+    struct module_bytes bytes;
+    // the .wasm the module was compiled from (the bytes may be an
+    // ahead-of-time artifact instead), for udx_save_aot()
+    uint64_t wasm_hash;
+    uint64_t wasm_size;
+    wasm_module_t* module;
+    struct export_index exports;
+    // states currently using the module
+    int refcount;
+    // when the last state let go, for evicting the oldest idle module
+    unsigned long released_at;
+    // What a fresh instance looks like, taken from the first one and
+    // restored before an instance goes back to the pool: its exported
+    // linear memory and exported mutable globals (by export position).
+    // Not poolable when there is something to reset that can't be
+    // (no exported memory, or a mutable global that isn't a number).
+    bool snapshot_taken;
+    bool poolable;
+    struct memory_snapshot memory;
+    uint32_t* global_positions;
+    wasm_val_t* global_values;
+    size_t global_count;
+    // most recently returned first
+    struct pooled_instance* pool;
+    int pool_size;
+};
+
+// Idle (refcount zero) modules kept around so that the next query's
+// setup() doesn't recompile; override with UDX_WASM_IDLE_MODULES
+#define DEFAULT_IDLE_MODULES 8
+// Reset instances kept per module, and how long they may sit unused;
+// override with UDX_WASM_POOL_INSTANCES and UDX_WASM_POOL_IDLE_MS
+#define DEFAULT_POOL_INSTANCES 4
+#define DEFAULT_POOL_IDLE_MS 60000
+// Time one call in this many, unless UDX_WASM_SAMPLE_CALLS says otherwise
+#define DEFAULT_SAMPLE_CALLS 64
+// Granularity of memory snapshots, and the fewest zero pages a reset
+// hands back to the kernel rather than clearing
+#define SNAPSHOT_PAGE 4096
+#define MADVISE_MIN_PAGES 16
+// Setup phases the trace ring buffer holds before it wraps
+#define TRACE_EVENTS 4096
+#define TRACE_DETAIL_SIZE 96
+
+// Everything below is shared by all states and guarded by cache_lock.
+// Wasmer engines and compiled modules may be used from any thread;
+// stores and instances may not, so those stay in the wasm_state.
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct shared_engine* engines;
+static struct cached_module* module_cache;
+static unsigned long release_count;
+
+// Counters of the states udx_cleanup() has released
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct udx_wasm_stats process_stats;
+
+// One of these per udx_get_wasm_state() caller.  Apart from the
+// (read-only) compiled module, nothing in here is shared with any
+// other state, so different states may be used from different threads
+// at the same time (see udx_wasm.h).
+struct wasm_state {
+    struct cached_module* cached;
     wasm_store_t* store;
     wasm_module_t* module;
     wasm_extern_vec_t imports;
+    // set for an interruptible module's instance; freed after the store
+    struct poll_env* poll;
     wasm_trap_t* trap;
     wasm_instance_t* instance;
     wasm_extern_vec_t exports;
+    // the function named in udx_setup()
     wasm_func_t* func;
-} STATIC_WASM_STATE;
-
-#define MAX_NAME_SIZE 256
+    // functions resolved by udx_lookup_function(), indexed by handle
+    // (the export's position); NULL until looked up
+    wasm_func_t** funcs;
+    // column-batch scratch area in the guest's linear memory; zero
+    // capacity means the module doesn't support batch calls
+    wasm_memory_t* memory;
+    uint64_t batch_offset;
+    uint64_t batch_capacity;
+    // the guest's addresses are i64s (a memory64 module), so pointer
+    // arguments of batch calls are too
+    bool memory64;
+    // set up, and nothing has trapped since: the instance can go back
+    // to the module's pool
+    bool reusable;
+    // metering points each call gets, on the metered engine; 0 for no
+    // limit, and an engine without metering
+    unsigned long long call_budget;
+    // the caller's flag (see udx_watch_interrupt), which any thread may
+    // raise; NULL for none.  Kept when the state is set up again.
+    struct udx_interrupt* interrupt;
+    // survive setting the state up again; call_ns is only filled in by
+    // udx_get_stats()
+    struct udx_wasm_stats stats;
+    // time a call when until_sample counts down to 0, then start over
+    // from sample_period (0: never)
+    unsigned sample_period;
+    unsigned until_sample;
+    // error messages handed back to the caller point in here, so they
+    // stay valid until the next call using this state
+    char ebuf[EBUF_SIZE+1];
+};
 
 #define min(a,b)             \
 ({                           \
@@ -37,251 +233,3301 @@ static struct wasm_state {
     _a < _b ? _a : _b;       \
 })
 
-// this is one way to turn a wasm_name_t into a C string
-// I don't export it because of the use of a static buffer and
-// silence about occurances of the wasm_name being too long for the static
-static char* vwasm_name_to_static_string(const wasm_name_t *name) {
-    static char buffer[MAX_NAME_SIZE];
-    for(int i = 0; i < name->size && i < sizeof(buffer)-2; ++i) {
-        buffer[i] = name->data[i];
-    }
-    buffer[min(sizeof(buffer)-1, name->size)] = '\0';
-    return buffer;
-}
-
-// This is annoying --- other languages have accessors to find the
-// function we want.  This is a little dicey, since it is derived
-// from dimensional analysis of the function prototypes, not from
-// any specification.
-wasm_func_t *vwasm_find_exported_function(const char* name,
-                                          wasm_exporttype_vec_t *exporttypes,
-                                          wasm_extern_vec_t *exports) {
-
-    if(exporttypes->size != 0) {
-        for(int export_index = 0; export_index < exporttypes->size; ++export_index) {
-            const wasm_externtype_t *etp = wasm_exporttype_type(exporttypes->data[export_index]);
-            if(wasm_externtype_kind(etp) == WASM_EXTERN_FUNC) {
-                // does the wasm_name_t match the function name?
-                const wasm_name_t *namebytes = wasm_exporttype_name(exporttypes->data[export_index]);
-                // No need to check for string equality if the lengths are different
-                if(namebytes->size == strlen(name)) {
-                    bool found_it = true;
-                    // All characters match?
-                    for(size_t ch_idx = 0; ch_idx < namebytes->size && found_it; ++ch_idx) {
-                        if(namebytes->data[ch_idx] != name[ch_idx]) {
-                            found_it = false;
-                        }
-                    }
-                    if(found_it)
-                        return wasm_extern_as_func(exports->data[export_index]);
-                }
-            }
+static uint64_t vwasm_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Setup tracing (see udx_trace_dump): each phase is an event with a
+// start and duration, kept in a ring buffer until it is dumped.  While
+// tracing is off, vwasm_trace_begin() returns 0 and nothing is recorded.
+struct trace_event {
+    const char* phase;
+    char detail[TRACE_DETAIL_SIZE];
+    uint64_t start_ns;
+    uint64_t duration_ns;
+    pid_t tid;
+};
+
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t trace_once = PTHREAD_ONCE_INIT;
+static bool trace_on;
+static struct trace_event trace_events[TRACE_EVENTS];
+static unsigned long long trace_count;   // ever recorded; the ring holds the last TRACE_EVENTS
+
+static bool vwasm_tracing() {
+    return __atomic_load_n(&trace_on, __ATOMIC_RELAXED);
+}
+
+static uint64_t vwasm_trace_begin() {
+    return vwasm_tracing() ? vwasm_now_ns() : 0;
+}
+
+// Record the phase that began at start (from vwasm_trace_begin());
+// detail is usually the module name, and may be NULL
+static void vwasm_trace_end(const char* phase, const char* detail, uint64_t start) {
+    if(! start)
+        return;
+    const uint64_t end = vwasm_now_ns();
+    pthread_mutex_lock(&trace_lock);
+    struct trace_event *event = &trace_events[trace_count++ % TRACE_EVENTS];
+    event->phase = phase;
+    snprintf(event->detail, sizeof(event->detail), "%s", detail ? detail : "");
+    event->start_ns = start;
+    event->duration_ns = end - start;
+    event->tid = (pid_t) syscall(SYS_gettid);
+    pthread_mutex_unlock(&trace_lock);
+}
+
+// JSON string contents; file names are the only outside text
+static void vwasm_json_string(FILE* out, const char* s) {
+    for(; *s; ++s) {
+        if(*s == '"' || *s == '\\')
+            fprintf(out, "\\%c", *s);
+        else if((unsigned char) *s < ' ')
+            fprintf(out, "\\u%04x", *s);
+        else
+            fputc(*s, out);
+    }
+}
+
+int udx_trace_dump(const char* filename) {
+    FILE* out = fopen(filename, "w");
+    if(! out)
+        return -1;
+    pthread_mutex_lock(&trace_lock);
+    const unsigned long long first = trace_count > TRACE_EVENTS ? trace_count - TRACE_EVENTS : 0;
+    const int written = (int) (trace_count - first);
+    const int pid = (int) getpid();
+    fprintf(out, "{\"displayTimeUnit\": \"ms\",\n \"otherData\": {\"dropped\": %llu},\n"
+            " \"traceEvents\": [", first);
+    for(unsigned long long i = first; i < trace_count; ++i) {
+        const struct trace_event *event = &trace_events[i % TRACE_EVENTS];
+        fprintf(out, "%s\n  {\"name\": \"%s\", \"cat\": \"udx_wasm\", \"ph\": \"X\", "
+                "\"ts\": %.3f, \"dur\": %.3f, \"pid\": %d, \"tid\": %d, \"args\": {\"detail\": \"",
+                i == first ? "" : ",", event->phase, event->start_ns / 1e3,
+                event->duration_ns / 1e3, pid, (int) event->tid);
+        vwasm_json_string(out, event->detail);
+        fputs("\"}}", out);
+    }
+    pthread_mutex_unlock(&trace_lock);
+    fputs("\n]}\n", out);
+    if(fclose(out) != 0)
+        return -1;
+    return written;
+}
+
+// UDX_WASM_TRACE=prefix: trace from the start, and write
+// prefix.<pid>.json when the process exits
+static char trace_exit_filename[PATH_MAX];
+
+static void vwasm_trace_at_exit() {
+    udx_trace_dump(trace_exit_filename);
+}
+
+static void vwasm_trace_from_env() {
+    const char* prefix = getenv("UDX_WASM_TRACE");
+    if(! prefix || ! *prefix)
+        return;
+    snprintf(trace_exit_filename, sizeof(trace_exit_filename), "%s.%d.json",
+             prefix, (int) getpid());
+    __atomic_store_n(&trace_on, true, __ATOMIC_RELAXED);
+    atexit(vwasm_trace_at_exit);
+}
+
+void udx_trace_enable(bool on) {
+    // later states mustn't undo this from the environment
+    pthread_once(&trace_once, vwasm_trace_from_env);
+    __atomic_store_n(&trace_on, on, __ATOMIC_RELAXED);
+}
+
+// Perf map (UDX_WASM_PERF_MAP=1): the executable anonymous mappings
+// that loading or compiling a module brings in are named after it in
+// /tmp/perf-<pid>.map.  The C API doesn't say where the code goes, so
+// the mappings are read from /proc/self/maps before and after;
+// modules are loaded with cache_lock held, so another load can't add
+// mappings in between.
+struct exec_ranges {
+    uintptr_t *bounds;  // start, end, start, end, ... in address order
+    size_t count;
+};
+
+static pthread_once_t perf_map_once = PTHREAD_ONCE_INIT;
+static FILE* perf_map;
+
+static void vwasm_perf_map_from_env() {
+    const char* setting = getenv("UDX_WASM_PERF_MAP");
+    if(! setting || atoi(setting) == 0)
+        return;
+    char filename[PATH_MAX];
+    snprintf(filename, sizeof(filename), "/tmp/perf-%d.map", (int) getpid());
+    perf_map = fopen(filename, "a");
+}
+
+// The executable mappings with no file behind them, as /proc/self/maps
+// lists them (in address order).  Empty if perf maps are off.
+static void vwasm_exec_ranges(struct exec_ranges *ranges) {
+    ranges->bounds = NULL;
+    ranges->count = 0;
+    pthread_once(&perf_map_once, vwasm_perf_map_from_env);
+    if(! perf_map)
+        return;
+    FILE* maps = fopen("/proc/self/maps", "r");
+    if(! maps)
+        return;
+    char line[PATH_MAX + 128];
+    size_t allocated = 0;
+    while(fgets(line, sizeof(line), maps)) {
+        unsigned long start, end, inode;
+        char perms[5];
+        int path = 0;
+        if(sscanf(line, "%lx-%lx %4s %*s %*s %lu %n", &start, &end, perms, &inode, &path) < 4)
+            continue;
+        const char* pathname = line + path;
+        if(perms[2] != 'x' || inode != 0
+           || (*pathname && *pathname != '\n' && strncmp(pathname, "[anon", 5) != 0))
+            continue;
+        if(ranges->count == allocated) {
+            allocated = allocated ? 2 * allocated : 64;
+            uintptr_t *bounds = (uintptr_t*) realloc(ranges->bounds, 2 * allocated * sizeof(uintptr_t));
+            if(! bounds)
+                break;
+            ranges->bounds = bounds;
         }
+        ranges->bounds[2 * ranges->count] = start;
+        ranges->bounds[2 * ranges->count + 1] = end;
+        ranges->count++;
     }
-    return NULL;
+    fclose(maps);
 }
 
-static void zero_wasm_state(struct wasm_state *ws) {
-    bzero(ws, sizeof(struct wasm_state));
+// Name what is executable now but wasn't in before (from
+// vwasm_exec_ranges()) after the module, and free before.  Nothing is
+// written for a module that failed to load.
+static void vwasm_perf_map_module(struct exec_ranges *before,
+                                  const wasm_module_t *module,
+                                  const char* name,
+                                  const char* engine_description) {
+    if(! perf_map || ! module) {
+        free(before->bounds);
+        return;
+    }
+    struct exec_ranges after;
+    vwasm_exec_ranges(&after);
+    size_t j = 0;
+    for(size_t i = 0; i < after.count; ++i) {
+        uintptr_t start = after.bounds[2 * i];
+        const uintptr_t end = after.bounds[2 * i + 1];
+        // subtract the old ranges that overlap this one
+        while(j < before->count && before->bounds[2 * j + 1] <= start)
+            ++j;
+        for(size_t k = j; start < end && k < before->count && before->bounds[2 * k] < end; ++k) {
+            if(before->bounds[2 * k] > start)
+                fprintf(perf_map, "%lx %lx wasm:%s (%s)\n", (unsigned long) start,
+                        (unsigned long) (before->bounds[2 * k] - start), name, engine_description);
+            start = before->bounds[2 * k + 1];
+        }
+        if(start < end)
+            fprintf(perf_map, "%lx %lx wasm:%s (%s)\n", (unsigned long) start,
+                    (unsigned long) (end - start), name, engine_description);
+    }
+    fflush(perf_map);
+    free(after.bounds);
+    free(before->bounds);
 }
 
-static void initialize_wasm_state(struct wasm_state *ws) {
-    if(ws->wasm.data) free(ws->wasm.data);
-    ws->wasm.data = NULL;
-    if(ws->engine)
-        wasm_engine_delete(ws->engine);
-    ws->engine = NULL;
-    if(ws->store)
-        wasm_store_delete(ws->store);
-    ws->store = NULL;
-    if(ws->module)
-        wasm_module_delete(ws->module);
-    ws->module = NULL;
-    if(ws->imports.data != NULL) {
-        wasm_extern_vec_delete(&ws->imports);
-        ws->imports.data = NULL;
-        ws->imports.size = 0;
+// Give the instance this many metering points.  Like everything else
+// that touches the instance, only ever from the thread using the state.
+static void vwasm_arm_metering(struct wasm_state *ws, uint64_t points) {
+    wasmer_metering_set_remaining_points(ws->instance, points);
+}
+
+// Whether the caller's interrupt flag is up; the only thing another
+// thread changes under a state
+static bool vwasm_interrupted(const struct wasm_state *ws) {
+    return ws->interrupt && __atomic_load_n(&ws->interrupt->raised, __ATOMIC_ACQUIRE);
+}
+
+static wasm_trap_t* vwasm_new_interrupted_trap(wasm_store_t *store) {
+    static const char message[] = "interrupted";
+    wasm_message_t trap_message;
+    wasm_byte_vec_new(&trap_message, sizeof(message), message);
+    wasm_trap_t *trap = wasm_trap_new(store, &trap_message);
+    wasm_byte_vec_delete(&trap_message);
+    return trap;
+}
+
+// What a call on an interrupted state returns instead of running.  The
+// guest never ran, so the instance can still go back to the pool.
+static wasm_trap_t* vwasm_interrupted_trap(struct wasm_state *ws) {
+    ws->stats.traps++;
+    return vwasm_new_interrupted_trap(ws->store);
+}
+
+// udx.poll_interrupt, which an interruptible module's code calls every
+// so often (see vwasm_add_interrupt_polls), on the thread running the
+// call.  Its trap stops the call; like any trap, it keeps the instance
+// out of the pool.
+static wasm_trap_t* vwasm_poll_interrupt(void* env,
+                                         const wasm_val_vec_t* args,
+                                         wasm_val_vec_t* results) {
+    (void) args;
+    (void) results;
+    struct wasm_state *ws = ((struct poll_env*) env)->ws;
+    return vwasm_interrupted(ws) ? vwasm_new_interrupted_trap(ws->store) : NULL;
+}
+
+// Every call into the guest after setup goes through here, for the
+// counters.  The clock is only read for sampled calls.
+static inline wasm_trap_t* vwasm_func_call(struct wasm_state *ws,
+                                           const wasm_func_t *func,
+                                           const wasm_val_vec_t *args,
+                                           wasm_val_vec_t *results,
+                                           size_t rows) {
+    wasm_trap_t *trap;
+    if(vwasm_interrupted(ws))
+        return vwasm_interrupted_trap(ws);
+    if(ws->call_budget)
+        vwasm_arm_metering(ws, ws->call_budget);
+    ws->stats.calls++;
+    ws->stats.rows += rows;
+    if(ws->sample_period && --ws->until_sample == 0) {
+        ws->until_sample = ws->sample_period;
+        const uint64_t start = vwasm_now_ns();
+        trap = wasm_func_call(func, args, results);
+        ws->stats.sampled_call_ns += vwasm_now_ns() - start;
+        ws->stats.sampled_calls++;
+    } else {
+        trap = wasm_func_call(func, args, results);
     }
-    ws->trap = NULL;
-    if(ws->instance)
-        wasm_instance_delete(ws->instance);
-    ws->instance = NULL;
-    if(ws->exports.data) {
-        wasm_extern_vec_delete(&ws->exports);
-        ws->exports.data = NULL;
-        ws->exports.size = 0;
+    if(trap) {
+        ws->stats.traps++;
+        ws->reusable = false;
     }
-    ws->func = NULL;
+    return trap;
 }
 
-const char* udx_query_wasm_config() {
-    // I've learned about config --- does that help?
+// FNV-1a; only used to pick the bucket to compare bytes against
+static uint64_t vwasm_hash_name(const char* data, size_t size) {
+    uint64_t hash = 14695981039346656037ULL;
+    for(size_t i = 0; i < size; ++i) {
+        hash ^= (unsigned char) data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
 
-    wasm_config_t* config = wasm_config_new();
+static uint64_t vwasm_hash_bytes(const wasm_byte_vec_t *bytes) {
+    return vwasm_hash_name(bytes->data, bytes->size);
+}
 
-    // Use the Cranelift compiler, if available.
-    /* if (wasmer_is_compiler_available(CRANELIFT)) { */
-    /*     wasm_config_set_compiler(config, CRANELIFT); */
-    /*     return "CRANELIFT"; */
-    /* } */
-    /* // Or maybe LLVM? */
-    /* if (wasmer_is_compiler_available(LLVM)) { */
-    /*     wasm_config_set_compiler(config, LLVM); */
-    /*     return "LLVM"; */
-    /* } */
-    // Or maybe Singlepass?
-    if (wasmer_is_compiler_available(SINGLEPASS)) {
-        wasm_config_set_compiler(config, SINGLEPASS);
-        return "SINGLEPASS";
+static const struct export_slot* vwasm_index_lookup(const struct export_index *index,
+                                                    const char* name,
+                                                    size_t name_len) {
+    if(index->slot_count == 0)
+        return NULL;
+    const uint64_t hash = vwasm_hash_name(name, name_len);
+    const size_t mask = index->slot_count - 1;
+    for(size_t i = hash & mask; index->slots[i].name; i = (i + 1) & mask) {
+        const struct export_slot *slot = &index->slots[i];
+        if(slot->hash == hash
+           && slot->name_len == name_len
+           && memcmp(slot->name, name, name_len) == 0)
+            return slot;
     }
-    return "Unknown";
+    return NULL;
+}
+
+static void vwasm_free_export_index(struct export_index *index) {
+    free(index->slots);
+    free(index->names);
+    memset(index, 0, sizeof(*index));
 }
 
+// Names are copied out of the export types, which are freed here
+static bool vwasm_build_export_index(const wasm_module_t *module,
+                                     struct export_index *index) {
+    memset(index, 0, sizeof(*index));
+    wasm_exporttype_vec_t exporttypes;
+    wasm_module_exports(module, &exporttypes);
+    size_t names_size = 0;
+    for(size_t i = 0; i < exporttypes.size; ++i)
+        names_size += wasm_exporttype_name(exporttypes.data[i])->size + 1;
+    size_t slot_count = 8;
+    while(slot_count < 2 * exporttypes.size)
+        slot_count *= 2;
 
-void* udx_get_wasm_state() {
-    zero_wasm_state(&STATIC_WASM_STATE);
-    initialize_wasm_state(&STATIC_WASM_STATE);
-    return &STATIC_WASM_STATE;
+    index->slots = (struct export_slot*) calloc(slot_count, sizeof(struct export_slot));
+    index->names = (char*) malloc(names_size ? names_size : 1);
+    if(! index->slots || ! index->names) {
+        wasm_exporttype_vec_delete(&exporttypes);
+        vwasm_free_export_index(index);
+        return false;
+    }
+    index->slot_count = slot_count;
+    index->export_count = exporttypes.size;
+
+    char* next_name = index->names;
+    for(size_t i = 0; i < exporttypes.size; ++i) {
+        const wasm_name_t *name = wasm_exporttype_name(exporttypes.data[i]);
+        memcpy(next_name, name->data, name->size);
+        next_name[name->size] = '\0';
+        const uint64_t hash = vwasm_hash_name(next_name, name->size);
+        size_t slot = hash & (slot_count - 1);
+        while(index->slots[slot].name)
+            slot = (slot + 1) & (slot_count - 1);
+        index->slots[slot].name = next_name;
+        index->slots[slot].name_len = name->size;
+        index->slots[slot].hash = hash;
+        index->slots[slot].kind = wasm_externtype_kind(wasm_exporttype_type(exporttypes.data[i]));
+        index->slots[slot].position = (uint32_t) i;
+        next_name += name->size + 1;
+    }
+    wasm_exporttype_vec_delete(&exporttypes);
+    return true;
 }
 
-void udx_cleanup(void* v_ws) {
-    struct wasm_state* ws = (struct wasm_state*) v_ws;
-    initialize_wasm_state(ws);
+// The export called name, if it is of the given kind
+static wasm_extern_t *vwasm_find_export(const struct wasm_state *ws,
+                                        const char* name,
+                                        wasm_externkind_t kind,
+                                        int *position) {
+    const struct export_slot *slot = vwasm_index_lookup(&ws->cached->exports,
+                                                        name,
+                                                        strlen(name));
+    if(! slot || slot->kind != kind || slot->position >= ws->exports.size)
+        return NULL;
+    if(position)
+        *position = (int) slot->position;
+    return ws->exports.data[slot->position];
 }
 
-bool udx_setup(const char* filename,
-               void *v_ws,
-               const char* func_name,
-               char** error_str) {
-    struct wasm_state* ws = (struct wasm_state*) v_ws;
-    zero_wasm_state(ws);
+static wasm_func_t *vwasm_find_func(const struct wasm_state *ws, const char* name) {
+    wasm_extern_t *ext = vwasm_find_export(ws, name, WASM_EXTERN_FUNC, NULL);
+    return ext ? wasm_extern_as_func(ext) : NULL;
+}
 
-    struct stat st;
-    if(stat(filename, &st) < 0) {
-        snprintf(ebuf,
-                 EBUF_SIZE,
-                 "Can't stat %s; %s",
-                filename,
-                strerror(errno));
-        *error_str = ebuf;
+static wasm_memory_t *vwasm_find_memory(const struct wasm_state *ws, const char* name) {
+    wasm_extern_t *ext = vwasm_find_export(ws, name, WASM_EXTERN_MEMORY, NULL);
+    return ext ? wasm_extern_as_memory(ext) : NULL;
+}
+
+// Whether a function's one result is an i64.  A memory64 module's
+// udx_batch_buffer() returns one, since its addresses are 64 bits.
+static bool vwasm_returns_i64(const wasm_func_t *func) {
+    wasm_functype_t *type = wasm_func_type(func);
+    const wasm_valtype_vec_t *results = wasm_functype_results(type);
+    const bool i64 = results->size == 1 && wasm_valtype_kind(results->data[0]) == WASM_I64;
+    wasm_functype_delete(type);
+    return i64;
+}
+
+// Call a no-argument function returning an unsigned i32 or i64, as the
+// batch buffer accessors and state sizes are
+static bool vwasm_call_void_int(wasm_func_t *func, uint64_t *result) {
+    const bool i64 = vwasm_returns_i64(func);
+    wasm_val_t results_val[1] = { WASM_INIT_VAL };
+    wasm_val_vec_t args = WASM_EMPTY_VEC;
+    wasm_val_vec_t results = WASM_ARRAY_VEC(results_val);
+    wasm_trap_t *trap = wasm_func_call(func, &args, &results);
+    if(trap) {
+        wasm_trap_delete(trap);
         return false;
     }
-    size_t code_len = st.st_size;
-    char * code_buffer;
+    *result = i64 ? (uint64_t) results_val[0].of.i64 : (uint32_t) results_val[0].of.i32;
+    return true;
+}
 
-    if((code_buffer = (wasm_byte_t*) malloc(code_len)) == NULL) {
-        snprintf(ebuf,
-                 EBUF_SIZE,
-                 "Can't malloc %ld bytes to hold %s; %s\n",
-                code_len,
-                filename,
-                strerror(errno));
-        *error_str = ebuf;
+// Look for the column-batch scratch area.  Modules without one are
+// fine (they just can't use udx_call_batch_*), but a module that
+// advertises one which doesn't fit in its memory is broken.
+static bool vwasm_find_batch_buffer(struct wasm_state *ws, char **error_str) {
+    wasm_memory_t *mem = vwasm_find_memory(ws, "memory");
+    wasm_func_t *buffer_func = vwasm_find_func(ws, "udx_batch_buffer");
+    wasm_func_t *capacity_func = vwasm_find_func(ws, "udx_batch_capacity");
+    if(! mem || ! buffer_func || ! capacity_func)
+        return true;
+
+    ws->memory = mem;
+    ws->memory64 = vwasm_returns_i64(buffer_func);
+    if(! vwasm_call_void_int(buffer_func, &ws->batch_offset)
+       || ! vwasm_call_void_int(capacity_func, &ws->batch_capacity)) {
+        snprintf(ws->ebuf, EBUF_SIZE, "Can't query the udx batch buffer");
+        *error_str = ws->ebuf;
         return false;
     }
-    FILE* file = fopen(filename, "r");
-    if(fread(code_buffer, 1, code_len, file) != code_len) {
-        free(code_buffer);
-        snprintf(ebuf,
+    if(ws->batch_offset > wasm_memory_data_size(ws->memory)
+       || ws->batch_capacity > wasm_memory_data_size(ws->memory) - ws->batch_offset) {
+        snprintf(ws->ebuf,
                  EBUF_SIZE,
-                 "Can't read code from %s; %s",
-                filename,
-                strerror(errno));
-        *error_str = ebuf;
+                 "udx batch buffer (%llu bytes at %llu) is outside linear memory",
+                 (unsigned long long) ws->batch_capacity,
+                 (unsigned long long) ws->batch_offset);
+        *error_str = ws->ebuf;
         return false;
     }
-    fclose(file);
-    ws->wasm.size = code_len;
-    ws->wasm.data = code_buffer;
-    ws->engine = wasm_engine_new();
-    ws->store = wasm_store_new(ws->engine);
-    ws->module = wasm_module_new(ws->store, &ws->wasm);
-    if(! ws->module) {
-        initialize_wasm_state(ws);
+    return true;
+}
+
+static const char* const COMPILER_NAMES[] = {
+    [UDX_COMPILER_DEFAULT] = "default",
+    [UDX_COMPILER_SINGLEPASS] = "singlepass",
+    [UDX_COMPILER_CRANELIFT] = "cranelift",
+    [UDX_COMPILER_LLVM] = "llvm",
+};
+
+static const char* const SIMD_NAMES[] = {
+    [UDX_SIMD_AUTO] = "auto",
+    [UDX_SIMD_ON] = "on",
+    [UDX_SIMD_OFF] = "off",
+};
+
+bool udx_parse_simd(const char* name, enum udx_simd* simd) {
+    for(size_t i = 0; i < sizeof(SIMD_NAMES)/sizeof(SIMD_NAMES[0]); ++i) {
+        if(strcasecmp(name, SIMD_NAMES[i]) == 0) {
+            *simd = (enum udx_simd) i;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Cranelift and LLVM lower SIMD128 to SSE4.1 (or better) on x86-64 and
+// to NEON, which every aarch64 has
+bool udx_host_supports_simd() {
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.1");
+#elif defined(__aarch64__)
+    return true;
+#else
+    return false;
+#endif
+}
+
+static bool vwasm_simd_enabled(const struct udx_engine_options* options) {
+    return options->simd == UDX_SIMD_ON
+        || (options->simd == UDX_SIMD_AUTO && udx_host_supports_simd());
+}
+
+bool udx_parse_compiler(const char* name, enum udx_compiler* compiler) {
+    for(size_t i = 0; i < sizeof(COMPILER_NAMES)/sizeof(COMPILER_NAMES[0]); ++i) {
+        if(strcasecmp(name, COMPILER_NAMES[i]) == 0) {
+            *compiler = (enum udx_compiler) i;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool vwasm_options_from_env(struct udx_engine_options* options,
+                                   char ebuf[EBUF_SIZE+1]) {
+    memset(options, 0, sizeof(*options));
+    const char* compiler = getenv("UDX_WASM_COMPILER");
+    if(compiler && *compiler && ! udx_parse_compiler(compiler, &options->compiler)) {
         snprintf(ebuf,
                  EBUF_SIZE,
-                 "Can't read code from %s; %s",
-                filename,
-                strerror(errno));
-        *error_str = ebuf;
+                 "UDX_WASM_COMPILER=%s is not one of default, singlepass, cranelift, llvm",
+                 compiler);
         return false;
     }
-    ws->imports.data = NULL;
-    ws->imports.size = 0;
-    ws->trap = NULL;
-    ws->instance = wasm_instance_new(ws->store,
-                                     ws->module,
-                                     &ws->imports,
-                                     &ws->trap);
-    if(! ws->instance) {
-        initialize_wasm_state(ws);
-        snprintf(ebuf, EBUF_SIZE, "Can't create wasm instance");
-        *error_str = ebuf;
+    options->cpu_features = getenv("UDX_WASM_CPU_FEATURES");
+    const char* nans = getenv("UDX_WASM_CANONICALIZE_NANS");
+    options->canonicalize_nans = nans && atoi(nans) != 0;
+    const char* simd = getenv("UDX_WASM_SIMD");
+    if(simd && *simd && ! udx_parse_simd(simd, &options->simd)) {
+        snprintf(ebuf, EBUF_SIZE, "UDX_WASM_SIMD=%s is not one of auto, on, off", simd);
         return false;
     }
+    const char* budget = getenv("UDX_WASM_CALL_BUDGET");
+    options->call_budget = budget && *budget ? strtoull(budget, NULL, 10) : 0;
+    const char* interruptible = getenv("UDX_WASM_INTERRUPTIBLE");
+    options->interruptible = interruptible && atoi(interruptible) != 0;
+    return true;
+}
 
-    wasm_instance_exports(ws->instance, &ws->exports);
-    if(ws->exports.size <= 0) {
-        initialize_wasm_state(ws);
-        snprintf(ebuf, EBUF_SIZE, "Can't find any wasm exports");
-        *error_str = ebuf;
+bool udx_default_engine_options(struct udx_engine_options* options) {
+    char ebuf[EBUF_SIZE+1];
+    return vwasm_options_from_env(options, ebuf);
+}
+
+static bool vwasm_metering_enabled(const struct udx_engine_options* options) {
+    return options->call_budget != 0;
+}
+
+static void vwasm_describe_options(const struct udx_engine_options* options,
+                                   char description[ENGINE_DESCRIPTION_SIZE]) {
+    // SIMD is on in wasmer by default, so only saying when it's off
+    // keeps the descriptions (and artifacts) from before the option
+    snprintf(description, ENGINE_DESCRIPTION_SIZE, "%s%s%s%s%s%s%s",
+             COMPILER_NAMES[options->compiler],
+             options->cpu_features && *options->cpu_features ? " cpu=" : "",
+             options->cpu_features ? options->cpu_features : "",
+             options->canonicalize_nans ? " canonical-nans" : "",
+             vwasm_simd_enabled(options) ? "" : " no-simd",
+             vwasm_metering_enabled(options) ? " metered" : "",
+             options->interruptible ? " interruptible" : "");
+}
+
+// Every Wasm operator costs one metering point: the budget is roughly
+// a count of instructions
+static uint64_t vwasm_operator_cost(wasmer_parser_operator_t op) {
+    (void) op;
+    return 1;
+}
+
+static const wasmer_compiler_t WASMER_COMPILERS[] = {
+    [UDX_COMPILER_SINGLEPASS] = SINGLEPASS,
+    [UDX_COMPILER_CRANELIFT] = CRANELIFT,
+    [UDX_COMPILER_LLVM] = LLVM,
+};
+
+// Compile for the host, with extra CPU features (comma separated, in
+// wasmer's spelling: "avx2,bmi2") the generated code may use
+static bool vwasm_set_target(wasm_config_t* config,
+                             const char* cpu_features,
+                             char ebuf[EBUF_SIZE+1]) {
+    wasmer_cpu_features_t* features = wasmer_cpu_features_new();
+    char feature_list[ENGINE_DESCRIPTION_SIZE];
+    snprintf(feature_list, sizeof(feature_list), "%s", cpu_features);
+    char* save;
+    for(char* feature = strtok_r(feature_list, ",", &save);
+        feature;
+        feature = strtok_r(NULL, ",", &save)) {
+        wasm_name_t name;
+        wasm_name_new_from_string(&name, feature);
+        const bool added = wasmer_cpu_features_add(features, &name);
+        wasm_name_delete(&name);
+        if(! added) {
+            snprintf(ebuf, EBUF_SIZE, "Unknown CPU feature '%s'", feature);
+            wasmer_cpu_features_delete(features);
+            return false;
+        }
+    }
+    wasm_config_set_target(config, wasmer_target_new(wasmer_triple_new_from_host(), features));
+    return true;
+}
+
+// Caller holds cache_lock.  Find the engine for these options, or
+// create it.
+static struct shared_engine* vwasm_get_engine(const struct udx_engine_options* options,
+                                              char ebuf[EBUF_SIZE+1]) {
+    char description[ENGINE_DESCRIPTION_SIZE];
+    vwasm_describe_options(options, description);
+    for(struct shared_engine* e = engines; e; e = e->next) {
+        if(strcmp(e->description, description) == 0 && e->group == options->engine_group)
+            return e;
+    }
+    const uint64_t start = vwasm_trace_begin();
+
+    wasm_config_t* config = wasm_config_new();
+    if(options->compiler != UDX_COMPILER_DEFAULT) {
+        const wasmer_compiler_t compiler = WASMER_COMPILERS[options->compiler];
+        if(! wasmer_is_compiler_available(compiler)) {
+            wasm_config_delete(config);
+            snprintf(ebuf,
+                     EBUF_SIZE,
+                     "The %s compiler is not available in this wasmer",
+                     COMPILER_NAMES[options->compiler]);
+            return NULL;
+        }
+        wasm_config_set_compiler(config, compiler);
+    }
+    if(options->canonicalize_nans)
+        wasm_config_canonicalize_nans(config, true);
+    // wasm_config_set_features takes ownership of features
+    wasmer_features_t* features = wasmer_features_new();
+    wasmer_features_simd(features, vwasm_simd_enabled(options));
+    // Only lets memory64 modules validate; 32-bit ones compile as before
+    wasmer_features_memory64(features, true);
+    wasm_config_set_features(config, features);
+    // Every call sets its own points (vwasm_arm_metering)
+    if(vwasm_metering_enabled(options)) {
+        wasmer_metering_t* metering = wasmer_metering_new(UINT64_MAX, vwasm_operator_cost);
+        wasm_config_push_middleware(config, wasmer_metering_as_middleware(metering));
+    }
+    if(options->cpu_features && *options->cpu_features
+       && ! vwasm_set_target(config, options->cpu_features, ebuf)) {
+        wasm_config_delete(config);
+        return NULL;
+    }
+
+    struct shared_engine* e = (struct shared_engine*) calloc(1, sizeof(struct shared_engine));
+    if(! e) {
+        wasm_config_delete(config);
+        snprintf(ebuf, EBUF_SIZE, "Can't allocate a wasm engine for '%s'", description);
+        return NULL;
+    }
+    // wasm_engine_new_with_config takes ownership of config
+    wasm_engine_t* engine = wasm_engine_new_with_config(config);
+    if(! engine) {
+        free(e);
+        snprintf(ebuf, EBUF_SIZE, "Can't create a wasm engine for '%s'", description);
+        return NULL;
+    }
+    e->compile_store = wasm_store_new(engine);
+    if(! e->compile_store) {
+        wasm_engine_delete(engine);
+        free(e);
+        snprintf(ebuf, EBUF_SIZE, "Can't create a store for compiling with '%s'", description);
+        return NULL;
+    }
+    strcpy(e->description, description);
+    e->group = options->engine_group;
+    e->interruptible = options->interruptible;
+    e->engine = engine;
+    e->next = engines;
+    engines = e;
+    vwasm_trace_end("create engine", description, start);
+    return e;
+}
+
+static void vwasm_release_bytes(struct module_bytes *bytes) {
+    if(bytes->mapped_size)
+        munmap((void*) bytes->data, bytes->mapped_size);
+    memset(bytes, 0, sizeof(*bytes));
+}
+
+static int vwasm_idle_module_limit() {
+    const char* limit = getenv("UDX_WASM_IDLE_MODULES");
+    return limit ? atoi(limit) : DEFAULT_IDLE_MODULES;
+}
+
+static int vwasm_pool_limit() {
+    const char* limit = getenv("UDX_WASM_POOL_INSTANCES");
+    return limit && *limit ? atoi(limit) : DEFAULT_POOL_INSTANCES;
+}
+
+static uint64_t vwasm_pool_idle_ns() {
+    const char* idle = getenv("UDX_WASM_POOL_IDLE_MS");
+    return (uint64_t) (idle && *idle ? atoll(idle) : DEFAULT_POOL_IDLE_MS) * 1000000;
+}
+
+static void vwasm_free_memory_snapshot(struct memory_snapshot *snapshot) {
+    free(snapshot->extents);
+    free(snapshot->data);
+    memset(snapshot, 0, sizeof(*snapshot));
+}
+
+// memcmp() is vectorized, so compare the page with itself one byte on
+static bool vwasm_page_is_zero(const byte_t *page, size_t size) {
+    return size == 0 || (page[0] == 0 && memcmp(page, page + 1, size - 1) == 0);
+}
+
+static bool vwasm_snapshot_memory(const byte_t *memory,
+                                  size_t size,
+                                  struct memory_snapshot *snapshot) {
+    memset(snapshot, 0, sizeof(*snapshot));
+    snapshot->size = size;
+    size_t capacity = 0, data_size = 0;
+    for(size_t offset = 0; offset < size; offset += SNAPSHOT_PAGE) {
+        const size_t page = min(size - offset, (size_t) SNAPSHOT_PAGE);
+        if(vwasm_page_is_zero(memory + offset, page))
+            continue;
+        struct memory_extent *last = snapshot->extent_count
+            ? &snapshot->extents[snapshot->extent_count - 1]
+            : NULL;
+        if(last && last->offset + last->size == offset) {
+            last->size += page;
+        } else {
+            if(snapshot->extent_count == capacity) {
+                capacity = capacity ? 2 * capacity : 8;
+                struct memory_extent *grown = (struct memory_extent*)
+                    realloc(snapshot->extents, capacity * sizeof(struct memory_extent));
+                if(! grown) {
+                    vwasm_free_memory_snapshot(snapshot);
+                    return false;
+                }
+                snapshot->extents = grown;
+            }
+            snapshot->extents[snapshot->extent_count].offset = offset;
+            snapshot->extents[snapshot->extent_count].size = page;
+            snapshot->extent_count++;
+        }
+        data_size += page;
+    }
+    snapshot->data = (byte_t*) malloc(data_size ? data_size : 1);
+    if(! snapshot->data) {
+        vwasm_free_memory_snapshot(snapshot);
         return false;
     }
-    // This is annoying --- other languages have accessors to find the
-    // function we want, but all I can do is run wasm2wat on the wasm
-    // and see which export is reported as (export "sum" (func $sum))
-    wasm_exporttype_vec_t exporttypes;
-    wasm_module_exports(ws->module, &exporttypes);
-    if(exporttypes.size == 0) {
-        snprintf(ebuf, EBUF_SIZE, "Can't find wasm exporttypes");
-        *error_str = ebuf;
+    byte_t *out = snapshot->data;
+    for(size_t i = 0; i < snapshot->extent_count; ++i) {
+        memcpy(out, memory + snapshot->extents[i].offset, snapshot->extents[i].size);
+        out += snapshot->extents[i].size;
+    }
+    return true;
+}
+
+// Zero memory[from, to).  Long runs of whole pages are dropped with
+// madvise() instead, which costs nothing for pages the guest never
+// touched (wasmer's linear memories are private anonymous mappings,
+// which read back as zeroes).
+static void vwasm_zero_memory(byte_t *memory, size_t from, size_t to) {
+    if(from >= to)
+        return;
+    const uintptr_t page = (uintptr_t) sysconf(_SC_PAGESIZE);
+    const uintptr_t start = (uintptr_t) (memory + from);
+    const uintptr_t end = (uintptr_t) (memory + to);
+    const uintptr_t inner_start = (start + page - 1) & ~(page - 1);
+    const uintptr_t inner_end = end & ~(page - 1);
+    if(inner_end <= inner_start
+       || (inner_end - inner_start) / page < MADVISE_MIN_PAGES
+       || madvise((void*) inner_start, inner_end - inner_start, MADV_DONTNEED) != 0) {
+        memset(memory + from, 0, to - from);
+        return;
+    }
+    memset((void*) start, 0, inner_start - start);
+    memset((void*) inner_end, 0, end - inner_end);
+}
+
+static void vwasm_restore_memory(byte_t *memory, const struct memory_snapshot *snapshot) {
+    const byte_t *in = snapshot->data;
+    size_t done = 0;
+    for(size_t i = 0; i < snapshot->extent_count; ++i) {
+        const struct memory_extent *extent = &snapshot->extents[i];
+        vwasm_zero_memory(memory, done, extent->offset);
+        memcpy(memory + extent->offset, in, extent->size);
+        in += extent->size;
+        done = extent->offset + extent->size;
+    }
+    vwasm_zero_memory(memory, done, snapshot->size);
+}
+
+static void vwasm_free_pooled(struct pooled_instance *pooled) {
+    while(pooled) {
+        struct pooled_instance *next = pooled->next;
+        wasm_extern_vec_delete(&pooled->exports);
+        wasm_instance_delete(pooled->instance);
+        if(pooled->imports.data)
+            wasm_extern_vec_delete(&pooled->imports);
+        wasm_store_delete(pooled->store);
+        free(pooled->poll);
+        free(pooled);
+        pooled = next;
+    }
+}
+
+static void vwasm_free_cached_module(struct cached_module *entry) {
+    vwasm_free_pooled(entry->pool);
+    vwasm_free_memory_snapshot(&entry->memory);
+    free(entry->global_positions);
+    free(entry->global_values);
+    vwasm_free_export_index(&entry->exports);
+    wasm_module_delete(entry->module);
+    vwasm_release_bytes(&entry->bytes);
+    free(entry);
+}
+
+// Map a whole file read-only.  The pages come from (and stay in) the
+// page cache, so the bytes are never copied.
+static bool vwasm_map_file(const char* filename,
+                           struct module_bytes *contents,
+                           char ebuf[EBUF_SIZE+1]) {
+    memset(contents, 0, sizeof(*contents));
+    const int fd = open(filename, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if(fd < 0 || fstat(fd, &st) < 0) {
+        snprintf(ebuf,
+                 EBUF_SIZE,
+                 "Can't open %s; %s",
+                filename,
+                strerror(errno));
+        if(fd >= 0)
+            close(fd);
         return false;
     }
-    ws->func = vwasm_find_exported_function(func_name, &exporttypes, &ws->exports);
-    if(! ws->func) {
-        initialize_wasm_state(ws);
-        snprintf(ebuf, EBUF_SIZE, "Can't find exported function '%s'", func_name);
-        *error_str = ebuf;
+    if(st.st_size == 0) {
+        close(fd);
+        snprintf(ebuf, EBUF_SIZE, "%s is empty", filename);
+        return false;
+    }
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // the mapping keeps the file open
+    close(fd);
+    if(data == MAP_FAILED) {
+        snprintf(ebuf,
+                 EBUF_SIZE,
+                 "Can't map %s; %s",
+                filename,
+                strerror(errno));
         return false;
     }
+    contents->data = (const char*) data;
+    contents->size = st.st_size;
+    contents->mapped_size = st.st_size;
     return true;
 }
 
-// This is a specialized function for wasm functions that take two ints and return an int
-bool udx_call_func_2i_1i(int a, int b, int *result, void* v_ws, char** error) {
-    struct wasm_state* ws = (struct wasm_state*) v_ws;
-    wasm_val_t args_val[2] = { WASM_I32_VAL(a), WASM_I32_VAL(b) };
-    wasm_val_t results_val[1] = { WASM_INIT_VAL };
-    wasm_val_vec_t args = WASM_ARRAY_VEC(args_val);
-    wasm_val_vec_t results = WASM_ARRAY_VEC(results_val);
+// Ahead-of-time compiled artifacts.
+//
+// An artifact is a header followed by wasm_module_serialize() output.
+// The header records what the code was compiled from and for, and an
+// artifact is only used if all of that matches this process: it must
+// come from the same .wasm bytes, the same wasmer version and engine,
+// and must not need CPU features this host lacks.  Deserializing
+// trusts the artifact completely, so only load artifacts you built.
+//
+// udx_setup() looks for an artifact next to the .wasm file
+// (sum.c.wasm.aot for sum.c.wasm, built by "make aot") and then in
+// $UDX_WASM_CACHE_DIR, if set.  When it has to compile, it saves the
+// result in $UDX_WASM_CACHE_DIR for the next process.
+
+#define AOT_MAGIC "UDXWAOT"
+#define AOT_FORMAT_VERSION 2
+
+struct aot_header {
+    char magic[8];
+    uint32_t format_version;
+    uint32_t header_size;
+    char wasmer_version[32];
+    char engine[ENGINE_DESCRIPTION_SIZE];
+    uint64_t cpu_features;
+    uint64_t wasm_hash;
+    uint64_t wasm_size;
+    uint64_t payload_size;
+};
+
+// The x86 features compiled code may depend on, as a bitmask
+static uint64_t vwasm_host_cpu_features() {
+    uint64_t features = 0;
+#if defined(__x86_64__) || defined(__i386__)
+    int bit = 0;
+    __builtin_cpu_init();
+#define CPU_FEATURE(name) \
+    if(__builtin_cpu_supports(name)) features |= 1ULL << bit; \
+    ++bit;
+    CPU_FEATURE("sse3")
+    CPU_FEATURE("ssse3")
+    CPU_FEATURE("sse4.1")
+    CPU_FEATURE("sse4.2")
+    CPU_FEATURE("popcnt")
+    CPU_FEATURE("avx")
+    CPU_FEATURE("avx2")
+    CPU_FEATURE("fma")
+    CPU_FEATURE("bmi")
+    CPU_FEATURE("bmi2")
+    CPU_FEATURE("avx512f")
+#undef CPU_FEATURE
+#endif
+    return features;
+}
+
+static void vwasm_fill_aot_header(struct aot_header *header,
+                                  const struct shared_engine *engine,
+                                  uint64_t wasm_hash,
+                                  uint64_t wasm_size,
+                                  uint64_t payload_size) {
+    memset(header, 0, sizeof(*header));
+    strncpy(header->magic, AOT_MAGIC, sizeof(header->magic));
+    header->format_version = AOT_FORMAT_VERSION;
+    header->header_size = sizeof(*header);
+    strncpy(header->wasmer_version, wasmer_version(), sizeof(header->wasmer_version) - 1);
+    strncpy(header->engine, engine->description, sizeof(header->engine) - 1);
+    header->cpu_features = vwasm_host_cpu_features();
+    header->wasm_hash = wasm_hash;
+    header->wasm_size = wasm_size;
+    header->payload_size = payload_size;
+}
+
+// Would an artifact with this header run correctly here?
+static bool vwasm_aot_header_matches(const struct aot_header *header,
+                                     const struct aot_header *expected) {
+    return memcmp(header->magic, expected->magic, sizeof(header->magic)) == 0
+        && header->format_version == expected->format_version
+        && header->header_size == expected->header_size
+        && strncmp(header->wasmer_version, expected->wasmer_version,
+                   sizeof(header->wasmer_version)) == 0
+        && strncmp(header->engine, expected->engine, sizeof(header->engine)) == 0
+        && (header->cpu_features & ~expected->cpu_features) == 0
+        && header->wasm_hash == expected->wasm_hash
+        && header->wasm_size == expected->wasm_size
+        && header->payload_size == expected->payload_size;
+}
+
+static bool vwasm_is_artifact(const struct module_bytes *bytes) {
+    return bytes->size >= sizeof(struct aot_header)
+        && memcmp(bytes->data, AOT_MAGIC, sizeof(AOT_MAGIC)) == 0;
+}
+
+// Deserialize an artifact if its header matches.  With a zero
+// *wasm_hash and *wasm_size, any source .wasm will do (the caller
+// handed us the artifact itself); the source's hash and size are
+// returned there.
+static wasm_module_t* vwasm_load_artifact(const struct module_bytes *artifact,
+                                          const struct shared_engine *engine,
+                                          uint64_t *wasm_hash,
+                                          uint64_t *wasm_size) {
+    if(! vwasm_is_artifact(artifact))
+        return NULL;
+    const struct aot_header *header = (const struct aot_header*) artifact->data;
+    struct aot_header expected;
+    vwasm_fill_aot_header(&expected, engine,
+                          *wasm_hash ? *wasm_hash : header->wasm_hash,
+                          *wasm_size ? *wasm_size : header->wasm_size,
+                          artifact->size - sizeof(struct aot_header));
+    if(! vwasm_aot_header_matches(header, &expected))
+        return NULL;
+    *wasm_hash = header->wasm_hash;
+    *wasm_size = header->wasm_size;
+    const wasm_byte_vec_t payload = { expected.payload_size,
+                                      (wasm_byte_t*) artifact->data + sizeof(struct aot_header) };
+    return wasm_module_deserialize(engine->compile_store, &payload);
+}
+
+// Load the artifact in aot_filename if it exists and matches; any
+// problem just means "compile instead", so there is no error message
+static wasm_module_t* vwasm_load_aot(const char* aot_filename,
+                                     const struct shared_engine *engine,
+                                     uint64_t wasm_hash,
+                                     uint64_t wasm_size) {
+    char ebuf[EBUF_SIZE+1];
+    struct module_bytes artifact;
+    if(access(aot_filename, R_OK) != 0
+       || ! vwasm_map_file(aot_filename, &artifact, ebuf))
+        return NULL;
+    wasm_module_t *module = vwasm_load_artifact(&artifact, engine, &wasm_hash, &wasm_size);
+    vwasm_release_bytes(&artifact);
+    return module;
+}
 
-    if (wasm_func_call(ws->func, &args, &results)) {
-        *error = "> Error calling the `sum` function!";
+// Write the artifact to a temporary file and rename it into place, so
+// other processes never see a partial artifact
+static bool vwasm_save_aot(const wasm_module_t *module,
+                           const struct shared_engine *engine,
+                           const char* aot_filename,
+                           uint64_t wasm_hash,
+                           uint64_t wasm_size,
+                           char ebuf[EBUF_SIZE+1]) {
+    wasm_byte_vec_t payload;
+    wasm_module_serialize(module, &payload);
+    if(payload.size == 0) {
+        snprintf(ebuf, EBUF_SIZE, "Can't serialize the compiled module");
         return false;
     }
+    struct aot_header header;
+    vwasm_fill_aot_header(&header, engine, wasm_hash, wasm_size, payload.size);
 
-    *error = NULL;
-    *result = results_val[0].of.i32;
+    char tmp_filename[PATH_MAX];
+    snprintf(tmp_filename, sizeof(tmp_filename), "%s.%d.tmp", aot_filename, (int) getpid());
+    FILE* file = fopen(tmp_filename, "w");
+    bool ok = file
+        && fwrite(&header, sizeof(header), 1, file) == 1
+        && fwrite(payload.data, 1, payload.size, file) == payload.size;
+    if(file && fclose(file) != 0)
+        ok = false;
+    if(ok && rename(tmp_filename, aot_filename) != 0)
+        ok = false;
+    if(! ok) {
+        snprintf(ebuf, EBUF_SIZE, "Can't write %s; %s", aot_filename, strerror(errno));
+        unlink(tmp_filename);
+    }
+    wasm_byte_vec_delete(&payload);
+    return ok;
+}
+
+// Where the on-disk cache keeps the artifact for these bytes; false
+// if there is no cache directory
+static bool vwasm_cache_filename(const struct shared_engine *engine,
+                                 uint64_t wasm_hash,
+                                 uint64_t wasm_size,
+                                 char aot_filename[PATH_MAX]) {
+    const char* cache_dir = getenv("UDX_WASM_CACHE_DIR");
+    if(! cache_dir || ! *cache_dir)
+        return false;
+    // one file per engine, so different settings don't keep
+    // overwriting each other's artifacts
+    const wasm_byte_vec_t description = { strlen(engine->description),
+                                          (wasm_byte_t*) engine->description };
+    snprintf(aot_filename, PATH_MAX, "%s/%016llx-%llu-%08llx.aot",
+             cache_dir,
+             (unsigned long long) wasm_hash,
+             (unsigned long long) wasm_size,
+             (unsigned long long) (vwasm_hash_bytes(&description) & 0xffffffff));
     return true;
 }
 
-// This is a specialized function for wasm functions that take one
-// unsigned long long argument and return an unsigned long long
-bool udx_call_func_ull_ull(const unsigned long long a,
+// Interruptible modules.  Wasmer's C API can't stop a call from another
+// thread, so an interruptible engine has the guest stop itself: each
+// module is rewritten before it is compiled so that every function
+// entry and every loop iteration counts down a global the rewrite adds,
+// and each time that reaches zero (every POLL_INTERVAL counts) calls
+// udx.poll_interrupt, a host function that traps once the state's
+// interrupt is up.  The import goes after the module's own function
+// imports, so the functions the module defines move up one index: calls,
+// ref.func, exports, the start function and element segments are
+// renumbered, and the "name" section, which only debuggers read, is
+// dropped rather than renumbered.  Modules using Wasm GC aren't
+// rewritten.
+#define POLL_MODULE "udx"
+#define POLL_NAME "poll_interrupt"
+#define POLL_INTERVAL 65536
+
+// Reads past the end, or anything the rewrite can't handle, set error
+// and move p to the end, so every loop over the rest stops
+struct wasm_reader {
+    const uint8_t* p;
+    const uint8_t* end;
+    const char* error;
+};
+
+struct wasm_writer {
+    uint8_t* data;
+    size_t size;
+    size_t capacity;
+    bool failed;
+};
+
+// What the rewrite has learned so far about the module
+struct poll_rewrite {
+    // the module's function and global imports; the poll function's
+    // index is imported_funcs
+    uint32_t imported_funcs;
+    uint32_t imported_globals;
+    // the poll function's type ([] -> []) and the countdown global
+    uint32_t poll_type;
+    uint32_t countdown;
+    // sections written so far, whether rewritten or added
+    bool have_types;
+    bool have_imports;
+    bool have_globals;
+};
+
+static void vwasm_reader_fail(struct wasm_reader *r, const char* why) {
+    if(! r->error)
+        r->error = why;
+    r->p = r->end;
+}
+
+static uint8_t vwasm_read_byte(struct wasm_reader *r) {
+    if(r->p >= r->end) {
+        vwasm_reader_fail(r, "it is truncated");
+        return 0;
+    }
+    return *r->p++;
+}
+
+static void vwasm_skip_bytes(struct wasm_reader *r, size_t size) {
+    if((size_t) (r->end - r->p) < size)
+        vwasm_reader_fail(r, "it is truncated");
+    else
+        r->p += size;
+}
+
+// An unsigned or signed LEB128 number of up to 64 bits
+static uint64_t vwasm_read_leb(struct wasm_reader *r, bool is_signed) {
+    uint64_t value = 0;
+    for(unsigned shift = 0; shift < 70; shift += 7) {
+        const uint8_t byte = vwasm_read_byte(r);
+        if(shift < 64)
+            value |= (uint64_t) (byte & 0x7f) << shift;
+        if(! (byte & 0x80)) {
+            if(is_signed && shift + 7 < 64 && (byte & 0x40))
+                value |= ~(uint64_t) 0 << (shift + 7);
+            return value;
+        }
+    }
+    vwasm_reader_fail(r, "it has a malformed number");
+    return 0;
+}
+
+static uint32_t vwasm_read_u32(struct wasm_reader *r) {
+    const uint64_t value = vwasm_read_leb(r, false);
+    if(value > UINT32_MAX)
+        vwasm_reader_fail(r, "it has a malformed number");
+    return (uint32_t) value;
+}
+
+static void vwasm_put(struct wasm_writer *w, const void* data, size_t size) {
+    if(w->failed || size == 0)
+        return;
+    if(w->size + size > w->capacity) {
+        size_t capacity = w->capacity ? w->capacity : 4096;
+        while(capacity < w->size + size)
+            capacity *= 2;
+        uint8_t* grown = (uint8_t*) realloc(w->data, capacity);
+        if(! grown) {
+            w->failed = true;
+            return;
+        }
+        w->data = grown;
+        w->capacity = capacity;
+    }
+    memcpy(w->data + w->size, data, size);
+    w->size += size;
+}
+
+static void vwasm_put_byte(struct wasm_writer *w, uint8_t byte) {
+    vwasm_put(w, &byte, 1);
+}
+
+static void vwasm_put_leb(struct wasm_writer *w, uint64_t value) {
+    do {
+        const uint8_t byte = value & 0x7f;
+        value >>= 7;
+        vwasm_put_byte(w, value ? byte | 0x80 : byte);
+    } while(value);
+}
+
+static void vwasm_put_sleb(struct wasm_writer *w, int64_t value) {
+    for(;;) {
+        const uint8_t byte = value & 0x7f;
+        value >>= 7;
+        if((value == 0 && ! (byte & 0x40)) || (value == -1 && (byte & 0x40))) {
+            vwasm_put_byte(w, byte);
+            return;
+        }
+        vwasm_put_byte(w, byte | 0x80);
+    }
+}
+
+static void vwasm_put_name(struct wasm_writer *w, const char* name) {
+    vwasm_put_leb(w, strlen(name));
+    vwasm_put(w, name, strlen(name));
+}
+
+// Copy what r has read since start
+static void vwasm_copy_since(struct wasm_writer *w,
+                             const struct wasm_reader *r,
+                             const uint8_t* start) {
+    vwasm_put(w, start, r->p - start);
+}
+
+static uint32_t vwasm_moved_func(const struct poll_rewrite *rw, uint32_t index) {
+    return index >= rw->imported_funcs ? index + 1 : index;
+}
+
+static void vwasm_rewrite_func_index(struct wasm_reader *r,
+                                     struct wasm_writer *w,
+                                     const struct poll_rewrite *rw) {
+    vwasm_put_leb(w, vwasm_moved_func(rw, vwasm_read_u32(r)));
+}
+
+// A value type; typed function references add a heap type
+static void vwasm_skip_valtype(struct wasm_reader *r) {
+    const uint8_t type = vwasm_read_byte(r);
+    if(type == 0x63 || type == 0x64)
+        vwasm_read_leb(r, true);
+}
+
+// Empty, a value type, or a type index, all as one signed number
+static void vwasm_skip_blocktype(struct wasm_reader *r) {
+    const int64_t type = (int64_t) vwasm_read_leb(r, true);
+    if(type == 0x63 - 0x80 || type == 0x64 - 0x80)
+        vwasm_read_leb(r, true);
+}
+
+static void vwasm_skip_limits(struct wasm_reader *r) {
+    const uint8_t flags = vwasm_read_byte(r);
+    vwasm_read_leb(r, false);
+    if(flags & 0x01)
+        vwasm_read_leb(r, false);
+    // a custom page size
+    if(flags & 0x08)
+        vwasm_read_u32(r);
+}
+
+static void vwasm_skip_memarg(struct wasm_reader *r) {
+    // with multiple memories, the memory index follows the alignment
+    if(vwasm_read_u32(r) & 0x40)
+        vwasm_read_u32(r);
+    vwasm_read_leb(r, false);
+}
+
+// The 0xfc prefix: saturating truncation, bulk memory and tables
+static void vwasm_skip_misc_op(struct wasm_reader *r) {
+    const uint32_t op = vwasm_read_u32(r);
+    if(op == 8 || op == 10 || op == 12 || op == 14) {
+        vwasm_read_u32(r);
+        vwasm_read_u32(r);
+    } else if(op == 9 || op == 11 || op == 13 || (op >= 15 && op <= 17)) {
+        vwasm_read_u32(r);
+    } else if(op > 7) {
+        vwasm_reader_fail(r, "it has an unknown instruction");
+    }
+}
+
+// The 0xfd prefix: SIMD128 and relaxed SIMD
+static void vwasm_skip_simd_op(struct wasm_reader *r) {
+    const uint32_t op = vwasm_read_u32(r);
+    if(op <= 11 || op == 92 || op == 93) {
+        vwasm_skip_memarg(r);
+    } else if(op == 12 || op == 13) {
+        vwasm_skip_bytes(r, 16);
+    } else if(op >= 21 && op <= 34) {
+        vwasm_skip_bytes(r, 1);
+    } else if(op >= 84 && op <= 91) {
+        vwasm_skip_memarg(r);
+        vwasm_skip_bytes(r, 1);
+    } else if(op > 0x113) {
+        vwasm_reader_fail(r, "it has an unknown instruction");
+    }
+}
+
+// The 0xfe prefix: threads
+static void vwasm_skip_atomic_op(struct wasm_reader *r) {
+    const uint32_t op = vwasm_read_u32(r);
+    if(op == 0x03)
+        vwasm_skip_bytes(r, 1);
+    else if(op <= 0x02 || (op >= 0x10 && op <= 0x4e))
+        vwasm_skip_memarg(r);
+    else
+        vwasm_reader_fail(r, "it has an unknown instruction");
+}
+
+// global.get, subtract one, global.set, and when it reaches zero, start
+// over and call the poll function
+static void vwasm_put_poll(struct wasm_writer *w, const struct poll_rewrite *rw) {
+    vwasm_put_byte(w, 0x23);
+    vwasm_put_leb(w, rw->countdown);
+    vwasm_put_byte(w, 0x41);
+    vwasm_put_sleb(w, 1);
+    vwasm_put_byte(w, 0x6b);
+    vwasm_put_byte(w, 0x24);
+    vwasm_put_leb(w, rw->countdown);
+    vwasm_put_byte(w, 0x23);
+    vwasm_put_leb(w, rw->countdown);
+    vwasm_put_byte(w, 0x45);
+    vwasm_put_byte(w, 0x04);
+    vwasm_put_byte(w, 0x40);
+    vwasm_put_byte(w, 0x41);
+    vwasm_put_sleb(w, POLL_INTERVAL);
+    vwasm_put_byte(w, 0x24);
+    vwasm_put_leb(w, rw->countdown);
+    vwasm_put_byte(w, 0x10);
+    vwasm_put_leb(w, rw->imported_funcs);
+    vwasm_put_byte(w, 0x0b);
+}
+
+// Copy one instruction, renumbering the function it names, and poll at
+// the top of every loop.  Returns the opcode.
+static uint8_t vwasm_rewrite_instruction(struct wasm_reader *r,
+                                         struct wasm_writer *w,
+                                         const struct poll_rewrite *rw) {
+    const uint8_t* start = r->p;
+    const uint8_t op = vwasm_read_byte(r);
+    switch(op) {
+    case 0x10: case 0x12: case 0xd2:    // call, return_call, ref.func
+        vwasm_put_byte(w, op);
+        vwasm_rewrite_func_index(r, w, rw);
+        return op;
+    case 0x02: case 0x03: case 0x04: case 0x06:    // block, loop, if, try
+        vwasm_skip_blocktype(r);
+        break;
+    case 0x1f: {    // try_table
+        vwasm_skip_blocktype(r);
+        const uint32_t catches = vwasm_read_u32(r);
+        for(uint32_t i = 0; i < catches && ! r->error; ++i) {
+            // catch and catch_ref name a tag before the label
+            if(vwasm_read_byte(r) < 2)
+                vwasm_read_u32(r);
+            vwasm_read_u32(r);
+        }
+        break;
+    }
+    case 0x07: case 0x08: case 0x09: case 0x0c: case 0x0d:
+    case 0x14: case 0x15: case 0x18: case 0x20 ... 0x26:
+    case 0x3f: case 0x40: case 0xd5: case 0xd6:
+        vwasm_read_u32(r);
+        break;
+    case 0x0e: {    // br_table
+        const uint32_t labels = vwasm_read_u32(r);
+        for(uint32_t i = 0; i <= labels && ! r->error; ++i)
+            vwasm_read_u32(r);
+        break;
+    }
+    case 0x11: case 0x13:    // call_indirect, return_call_indirect
+        vwasm_read_u32(r);
+        vwasm_read_u32(r);
+        break;
+    case 0x1c: {    // select with types
+        const uint32_t types = vwasm_read_u32(r);
+        for(uint32_t i = 0; i < types && ! r->error; ++i)
+            vwasm_skip_valtype(r);
+        break;
+    }
+    case 0x28 ... 0x3e:
+        vwasm_skip_memarg(r);
+        break;
+    case 0x41: case 0x42: case 0xd0:
+        vwasm_read_leb(r, true);
+        break;
+    case 0x43:
+        vwasm_skip_bytes(r, 4);
+        break;
+    case 0x44:
+        vwasm_skip_bytes(r, 8);
+        break;
+    case 0xfc:
+        vwasm_skip_misc_op(r);
+        break;
+    case 0xfd:
+        vwasm_skip_simd_op(r);
+        break;
+    case 0xfe:
+        vwasm_skip_atomic_op(r);
+        break;
+    case 0x00: case 0x01: case 0x05: case 0x0a: case 0x0b: case 0x0f:
+    case 0x19: case 0x1a: case 0x1b: case 0x45 ... 0xc4:
+    case 0xd1: case 0xd3: case 0xd4:
+        break;
+    default:
+        vwasm_reader_fail(r, op == 0xfb ? "it uses Wasm GC" : "it has an unknown instruction");
+        return op;
+    }
+    vwasm_copy_since(w, r, start);
+    if(op == 0x03)
+        vwasm_put_poll(w, rw);
+    return op;
+}
+
+// An initializer or offset, through its end
+static void vwasm_rewrite_const_expr(struct wasm_reader *r,
+                                     struct wasm_writer *w,
+                                     const struct poll_rewrite *rw) {
+    while(! r->error && vwasm_rewrite_instruction(r, w, rw) != 0x0b)
+        ;
+}
+
+// The index of a [] -> [] type, appending one if there isn't one
+static void vwasm_rewrite_types(struct wasm_reader *r,
+                                struct wasm_writer *w,
+                                struct poll_rewrite *rw) {
+    const uint32_t count = vwasm_read_u32(r);
+    const uint8_t* types = r->p;
+    bool found = false;
+    for(uint32_t i = 0; i < count && ! r->error; ++i) {
+        if(vwasm_read_byte(r) != 0x60) {
+            vwasm_reader_fail(r, "it uses Wasm GC");
+            return;
+        }
+        const uint32_t params = vwasm_read_u32(r);
+        for(uint32_t j = 0; j < params && ! r->error; ++j)
+            vwasm_skip_valtype(r);
+        const uint32_t results = vwasm_read_u32(r);
+        for(uint32_t j = 0; j < results && ! r->error; ++j)
+            vwasm_skip_valtype(r);
+        if(! found && params == 0 && results == 0) {
+            found = true;
+            rw->poll_type = i;
+        }
+    }
+    vwasm_put_leb(w, count + ! found);
+    vwasm_copy_since(w, r, types);
+    if(! found) {
+        rw->poll_type = count;
+        vwasm_put(w, "\x60\x00\x00", 3);
+    }
+    rw->have_types = true;
+}
+
+static void vwasm_put_poll_import(struct wasm_writer *w, struct poll_rewrite *rw) {
+    vwasm_put_name(w, POLL_MODULE);
+    vwasm_put_name(w, POLL_NAME);
+    vwasm_put_byte(w, 0x00);
+    vwasm_put_leb(w, rw->poll_type);
+    rw->have_imports = true;
+}
+
+// The module's imports, then the poll function
+static void vwasm_rewrite_imports(struct wasm_reader *r,
+                                  struct wasm_writer *w,
+                                  struct poll_rewrite *rw) {
+    const uint32_t count = vwasm_read_u32(r);
+    const uint8_t* imports = r->p;
+    for(uint32_t i = 0; i < count && ! r->error; ++i) {
+        vwasm_skip_bytes(r, vwasm_read_u32(r));
+        vwasm_skip_bytes(r, vwasm_read_u32(r));
+        switch(vwasm_read_byte(r)) {
+        case 0x00:
+            vwasm_read_u32(r);
+            rw->imported_funcs++;
+            break;
+        case 0x01:
+            vwasm_skip_valtype(r);
+            vwasm_skip_limits(r);
+            break;
+        case 0x02:
+            vwasm_skip_limits(r);
+            break;
+        case 0x03:
+            vwasm_skip_valtype(r);
+            vwasm_skip_bytes(r, 1);
+            rw->imported_globals++;
+            break;
+        case 0x04:
+            vwasm_skip_bytes(r, 1);
+            vwasm_read_u32(r);
+            break;
+        default:
+            vwasm_reader_fail(r, "it has an unknown kind of import");
+        }
+    }
+    vwasm_put_leb(w, count + 1);
+    vwasm_copy_since(w, r, imports);
+    vwasm_put_poll_import(w, rw);
+}
+
+static void vwasm_put_countdown(struct wasm_writer *w) {
+    // a mutable i32
+    vwasm_put(w, "\x7f\x01\x41", 3);
+    vwasm_put_sleb(w, POLL_INTERVAL);
+    vwasm_put_byte(w, 0x0b);
+}
+
+// The module's globals, then the countdown
+static void vwasm_rewrite_globals(struct wasm_reader *r,
+                                  struct wasm_writer *w,
+                                  struct poll_rewrite *rw) {
+    const uint32_t count = vwasm_read_u32(r);
+    vwasm_put_leb(w, count + 1);
+    for(uint32_t i = 0; i < count && ! r->error; ++i) {
+        const uint8_t* start = r->p;
+        vwasm_skip_valtype(r);
+        vwasm_skip_bytes(r, 1);
+        vwasm_copy_since(w, r, start);
+        vwasm_rewrite_const_expr(r, w, rw);
+    }
+    rw->countdown = rw->imported_globals + count;
+    vwasm_put_countdown(w);
+    rw->have_globals = true;
+}
+
+static void vwasm_rewrite_tables(struct wasm_reader *r,
+                                 struct wasm_writer *w,
+                                 const struct poll_rewrite *rw) {
+    const uint32_t count = vwasm_read_u32(r);
+    vwasm_put_leb(w, count);
+    for(uint32_t i = 0; i < count && ! r->error; ++i) {
+        const uint8_t* start = r->p;
+        // 0x40 0x00: the table type has an initializer
+        const bool initialized = r->p < r->end && *r->p == 0x40;
+        if(initialized)
+            vwasm_skip_bytes(r, 2);
+        vwasm_skip_valtype(r);
+        vwasm_skip_limits(r);
+        vwasm_copy_since(w, r, start);
+        if(initialized)
+            vwasm_rewrite_const_expr(r, w, rw);
+    }
+}
+
+static void vwasm_rewrite_exports(struct wasm_reader *r,
+                                  struct wasm_writer *w,
+                                  const struct poll_rewrite *rw) {
+    const uint32_t count = vwasm_read_u32(r);
+    vwasm_put_leb(w, count);
+    for(uint32_t i = 0; i < count && ! r->error; ++i) {
+        const uint8_t* start = r->p;
+        vwasm_skip_bytes(r, vwasm_read_u32(r));
+        const uint8_t kind = vwasm_read_byte(r);
+        vwasm_copy_since(w, r, start);
+        if(kind == 0x00)
+            vwasm_rewrite_func_index(r, w, rw);
+        else
+            vwasm_put_leb(w, vwasm_read_u32(r));
+    }
+}
+
+// Element segments come in eight forms: bit 0 says passive or
+// declarative, bit 1 an explicit table (when active) or declarative,
+// bit 2 expressions rather than function indices
+static void vwasm_rewrite_elements(struct wasm_reader *r,
+                                   struct wasm_writer *w,
+                                   const struct poll_rewrite *rw) {
+    const uint32_t count = vwasm_read_u32(r);
+    vwasm_put_leb(w, count);
+    for(uint32_t i = 0; i < count && ! r->error; ++i) {
+        const uint32_t flags = vwasm_read_u32(r);
+        if(flags > 7) {
+            vwasm_reader_fail(r, "it has an unknown kind of element segment");
+            return;
+        }
+        vwasm_put_leb(w, flags);
+        const bool active = ! (flags & 0x01);
+        if(active && (flags & 0x02))
+            vwasm_put_leb(w, vwasm_read_u32(r));
+        if(active)
+            vwasm_rewrite_const_expr(r, w, rw);
+        // the element kind or reference type, unless form 0 or 4
+        // implies it
+        if(flags & 0x03) {
+            const uint8_t* start = r->p;
+            if(flags & 0x04)
+                vwasm_skip_valtype(r);
+            else
+                vwasm_skip_bytes(r, 1);
+            vwasm_copy_since(w, r, start);
+        }
+        const uint32_t elements = vwasm_read_u32(r);
+        vwasm_put_leb(w, elements);
+        for(uint32_t j = 0; j < elements && ! r->error; ++j) {
+            if(flags & 0x04)
+                vwasm_rewrite_const_expr(r, w, rw);
+            else
+                vwasm_rewrite_func_index(r, w, rw);
+        }
+    }
+}
+
+// Each function body polls first thing, and at the top of its loops
+static void vwasm_rewrite_code(struct wasm_reader *r,
+                               struct wasm_writer *w,
+                               const struct poll_rewrite *rw) {
+    struct wasm_writer body;
+    memset(&body, 0, sizeof(body));
+    const uint32_t count = vwasm_read_u32(r);
+    vwasm_put_leb(w, count);
+    for(uint32_t i = 0; i < count && ! r->error; ++i) {
+        const uint32_t size = vwasm_read_u32(r);
+        struct wasm_reader code = { r->p, r->p, NULL };
+        vwasm_skip_bytes(r, size);
+        if(r->error)
+            break;
+        code.end = r->p;
+        body.size = 0;
+        const uint32_t locals = vwasm_read_u32(&code);
+        for(uint32_t j = 0; j < locals && ! code.error; ++j) {
+            vwasm_read_u32(&code);
+            vwasm_skip_valtype(&code);
+        }
+        vwasm_copy_since(&body, &code, code.end - size);
+        vwasm_put_poll(&body, rw);
+        while(code.p < code.end)
+            vwasm_rewrite_instruction(&code, &body, rw);
+        if(code.error)
+            vwasm_reader_fail(r, code.error);
+        if(body.failed)
+            w->failed = true;
+        vwasm_put_leb(w, body.size);
+        vwasm_put(w, body.data, body.size);
+    }
+    free(body.data);
+}
+
+// Where each kind of section goes in a module; tags come between
+// memories and globals, and the data count before the code
+static int vwasm_section_rank(uint8_t id) {
+    static const int ranks[] = {
+        [1] = 1, [2] = 2, [3] = 3, [4] = 4, [5] = 5, [13] = 6, [6] = 7,
+        [7] = 8, [8] = 9, [9] = 10, [12] = 11, [10] = 12, [11] = 13,
+    };
+    return id < sizeof(ranks) / sizeof(ranks[0]) ? ranks[id] : 0;
+}
+
+// Move the section built up in section to out
+static void vwasm_put_section(struct wasm_writer *out, uint8_t id, struct wasm_writer *section) {
+    if(section->failed)
+        out->failed = true;
+    vwasm_put_byte(out, id);
+    vwasm_put_leb(out, section->size);
+    vwasm_put(out, section->data, section->size);
+    section->size = 0;
+}
+
+// Write the type, import and global sections the module doesn't have,
+// and the rewrite needs, that go before a section of this rank
+static void vwasm_add_missing_sections(struct wasm_writer *out,
+                                       struct wasm_writer *section,
+                                       struct poll_rewrite *rw,
+                                       int rank) {
+    if(! rw->have_types && rank > vwasm_section_rank(1)) {
+        vwasm_put(section, "\x01\x60\x00\x00", 4);
+        vwasm_put_section(out, 1, section);
+        rw->poll_type = 0;
+        rw->have_types = true;
+    }
+    if(! rw->have_imports && rank > vwasm_section_rank(2)) {
+        vwasm_put_leb(section, 1);
+        vwasm_put_poll_import(section, rw);
+        vwasm_put_section(out, 2, section);
+    }
+    if(! rw->have_globals && rank > vwasm_section_rank(6)) {
+        vwasm_put_leb(section, 1);
+        vwasm_put_countdown(section);
+        vwasm_put_section(out, 6, section);
+        rw->countdown = rw->imported_globals;
+        rw->have_globals = true;
+    }
+}
+
+// Rewrite the module in wasm into out (which the caller frees) to poll
+// for interrupts.  Returns false, with a message in ebuf, if the module
+// is malformed or uses something the rewrite doesn't know.
+static bool vwasm_add_interrupt_polls(const wasm_byte_vec_t *wasm,
+                                      const char* name,
+                                      struct wasm_writer *out,
+                                      char ebuf[EBUF_SIZE+1]) {
+    static const uint8_t header[8] = { 0x00, 'a', 's', 'm', 0x01, 0x00, 0x00, 0x00 };
+    struct wasm_reader r = { (const uint8_t*) wasm->data,
+                             (const uint8_t*) wasm->data + wasm->size,
+                             NULL };
+    struct poll_rewrite rw;
+    memset(&rw, 0, sizeof(rw));
+    struct wasm_writer section;
+    memset(&section, 0, sizeof(section));
+    memset(out, 0, sizeof(*out));
+    if(wasm->size < sizeof(header) || memcmp(r.p, header, sizeof(header)) != 0)
+        vwasm_reader_fail(&r, "it isn't a version 1 Wasm module");
+    else
+        vwasm_skip_bytes(&r, sizeof(header));
+    vwasm_put(out, header, sizeof(header));
+    while(r.p < r.end) {
+        const uint8_t* start = r.p;
+        const uint8_t id = vwasm_read_byte(&r);
+        const uint32_t size = vwasm_read_u32(&r);
+        struct wasm_reader content = { r.p, r.p, NULL };
+        vwasm_skip_bytes(&r, size);
+        if(r.error)
+            break;
+        content.end = r.p;
+        if(id == 0) {
+            struct wasm_reader custom = content;
+            const uint32_t name_size = vwasm_read_u32(&custom);
+            const bool names = name_size == 4 && custom.end - custom.p >= 4
+                && memcmp(custom.p, "name", 4) == 0;
+            if(! names)
+                vwasm_copy_since(out, &r, start);
+            continue;
+        }
+        const int rank = vwasm_section_rank(id);
+        if(! rank) {
+            vwasm_reader_fail(&r, "it has an unknown section");
+            break;
+        }
+        vwasm_add_missing_sections(out, &section, &rw, rank);
+        switch(id) {
+        case 1: vwasm_rewrite_types(&content, &section, &rw); break;
+        case 2: vwasm_rewrite_imports(&content, &section, &rw); break;
+        case 4: vwasm_rewrite_tables(&content, &section, &rw); break;
+        case 6: vwasm_rewrite_globals(&content, &section, &rw); break;
+        case 7: vwasm_rewrite_exports(&content, &section, &rw); break;
+        case 8: vwasm_rewrite_func_index(&content, &section, &rw); break;
+        case 9: vwasm_rewrite_elements(&content, &section, &rw); break;
+        case 10: vwasm_rewrite_code(&content, &section, &rw); break;
+        default:
+            vwasm_put(&section, content.p, content.end - content.p);
+            content.p = content.end;
+        }
+        if(! content.error && content.p != content.end)
+            vwasm_reader_fail(&content, "it has a malformed section");
+        if(content.error) {
+            vwasm_reader_fail(&r, content.error);
+            break;
+        }
+        vwasm_put_section(out, id, &section);
+    }
+    vwasm_add_missing_sections(out, &section, &rw, INT_MAX);
+    if(section.failed)
+        out->failed = true;
+    free(section.data);
+    if(r.error || out->failed) {
+        snprintf(ebuf,
+                 EBUF_SIZE,
+                 "Can't make %s interruptible: %s",
+                 name,
+                 r.error ? r.error : "out of memory");
+        free(out->data);
+        memset(out, 0, sizeof(*out));
+        return false;
+    }
+    return true;
+}
+
+// Caller holds cache_lock.  Bytes that are an artifact are
+// deserialized.  Otherwise try the artifact next to the .wasm file,
+// then the cache directory, and only then compile (rewriting the module
+// first on an interruptible engine; a rewrite that fails says why in
+// ebuf).  Modules from memory (filename NULL), and wasm_only ones (which
+// the caller has checked aren't artifacts), never touch the file system.
+static wasm_module_t* vwasm_load_or_compile(const struct module_bytes *bytes,
+                                            const struct shared_engine *engine,
+                                            uint64_t hash,
+                                            const char* name,
+                                            const char* filename,
+                                            bool wasm_only,
+                                            uint64_t *wasm_hash,
+                                            uint64_t *wasm_size,
+                                            char ebuf[EBUF_SIZE+1]) {
+    char aot_filename[PATH_MAX];
+    wasm_module_t *module;
+    uint64_t start = vwasm_trace_begin();
+
+    *wasm_hash = 0;
+    *wasm_size = 0;
+    if(vwasm_is_artifact(bytes)) {
+        module = vwasm_load_artifact(bytes, engine, wasm_hash, wasm_size);
+        vwasm_trace_end("deserialize", name, start);
+        return module;
+    }
+    *wasm_hash = hash;
+    *wasm_size = bytes->size;
+    const wasm_byte_vec_t wasm_vec = { bytes->size, (wasm_byte_t*) bytes->data };
+    const wasm_byte_vec_t *wasm = &wasm_vec;
+    if(wasm_only)
+        filename = NULL;
+    if(filename) {
+        // each try is traced, hit or miss: looking costs something too
+        snprintf(aot_filename, sizeof(aot_filename), "%s.aot", filename);
+        module = vwasm_load_aot(aot_filename, engine, hash, wasm->size);
+        vwasm_trace_end("load artifact", aot_filename, start);
+        if(module)
+            return module;
+    }
+    const bool have_cache = filename
+        && vwasm_cache_filename(engine, hash, wasm->size, aot_filename);
+    if(have_cache) {
+        start = vwasm_trace_begin();
+        module = vwasm_load_aot(aot_filename, engine, hash, wasm->size);
+        vwasm_trace_end("load artifact", aot_filename, start);
+        if(module)
+            return module;
+    }
+
+    struct wasm_writer rewritten;
+    memset(&rewritten, 0, sizeof(rewritten));
+    if(engine->interruptible) {
+        start = vwasm_trace_begin();
+        const bool polling = vwasm_add_interrupt_polls(wasm, name, &rewritten, ebuf);
+        vwasm_trace_end("add interrupt polls", name, start);
+        if(! polling)
+            return NULL;
+    }
+    const wasm_byte_vec_t rewritten_vec = { rewritten.size, (wasm_byte_t*) rewritten.data };
+    start = vwasm_trace_begin();
+    module = wasm_module_new(engine->compile_store, engine->interruptible ? &rewritten_vec : wasm);
+    vwasm_trace_end("compile", name, start);
+    free(rewritten.data);
+    if(module && have_cache) {
+        // failing to save only costs the next process a compile
+        char ebuf[EBUF_SIZE+1];
+        start = vwasm_trace_begin();
+        vwasm_save_aot(module, engine, aot_filename, hash, wasm->size, ebuf);
+        vwasm_trace_end("save artifact", aot_filename, start);
+    }
+    return module;
+}
+
+// Find (or load or compile, and add) the module for these bytes and
+// take a reference on it.  The cache takes ownership of the bytes:
+// they are either kept in the new entry or released.  name is only
+// for messages; modules from files also have a filename.  *cache_hit
+// says whether the module was already there.
+static struct cached_module* vwasm_acquire_module(struct module_bytes *bytes,
+                                                  const char* name,
+                                                  const char* filename,
+                                                  const struct udx_engine_options *options,
+                                                  bool *cache_hit,
+                                                  char ebuf[EBUF_SIZE+1]) {
+    if(options->wasm_only && vwasm_is_artifact(bytes)) {
+        snprintf(ebuf,
+                 EBUF_SIZE,
+                 "%s is an ahead-of-time artifact, and only Wasm modules are allowed",
+                 name);
+        vwasm_release_bytes(bytes);
+        return NULL;
+    }
+    const wasm_byte_vec_t hashed = { bytes->size, (wasm_byte_t*) bytes->data };
+    uint64_t start = vwasm_trace_begin();
+    const uint64_t hash = vwasm_hash_bytes(&hashed);
+    vwasm_trace_end("hash", name, start);
+    *cache_hit = false;
+    start = vwasm_trace_begin();
+    pthread_mutex_lock(&cache_lock);
+    vwasm_trace_end("wait for cache lock", name, start);
+    struct shared_engine *engine = vwasm_get_engine(options, ebuf);
+    if(! engine) {
+        pthread_mutex_unlock(&cache_lock);
+        vwasm_release_bytes(bytes);
+        return NULL;
+    }
+    struct cached_module *entry;
+    for(entry = module_cache; entry; entry = entry->next) {
+        if(entry->engine != engine
+           || entry->hash != hash
+           || entry->bytes.size != bytes->size
+           || entry->bytes.borrowed != bytes->borrowed)
+            continue;
+        // borrowed bytes may be gone, so those are matched by address
+        // (and hash): the same library's embedded module
+        const bool same = bytes->borrowed
+            ? entry->bytes.data == bytes->data
+            : memcmp(entry->bytes.data, bytes->data, bytes->size) == 0;
+        if(same) {
+            entry->refcount++;
+            *cache_hit = true;
+            pthread_mutex_unlock(&cache_lock);
+            vwasm_release_bytes(bytes);
+            return entry;
+        }
+    }
+
+    // Compiling with the lock held means two states loading the same
+    // new module wait for one compile rather than doing two
+    uint64_t wasm_hash, wasm_size;
+    struct exec_ranges exec_before;
+    vwasm_exec_ranges(&exec_before);
+    *ebuf = '\0';
+    wasm_module_t *module = vwasm_load_or_compile(bytes, engine, hash, name, filename,
+                                                  options->wasm_only, &wasm_hash, &wasm_size, ebuf);
+    vwasm_perf_map_module(&exec_before, module, name, engine->description);
+    if(! module) {
+        pthread_mutex_unlock(&cache_lock);
+        // the rewrite for interruptible engines says why it failed
+        if(! *ebuf)
+            snprintf(ebuf,
+                     EBUF_SIZE,
+                     vwasm_is_artifact(bytes)
+                     ? "Can't load %s; it was compiled by a different wasmer, engine or CPU"
+                     : "Can't compile wasm code from %s",
+                     name);
+        vwasm_release_bytes(bytes);
+        return NULL;
+    }
+    start = vwasm_trace_begin();
+    entry = (struct cached_module*) calloc(1, sizeof(struct cached_module));
+    const bool indexed = entry && vwasm_build_export_index(module, &entry->exports);
+    vwasm_trace_end("index exports", name, start);
+    if(! indexed) {
+        pthread_mutex_unlock(&cache_lock);
+        free(entry);
+        wasm_module_delete(module);
+        vwasm_release_bytes(bytes);
+        snprintf(ebuf, EBUF_SIZE, "Can't allocate a module cache entry");
+        return NULL;
+    }
+    entry->engine = engine;
+    entry->hash = hash;
+    entry->bytes = *bytes;
+    entry->wasm_hash = wasm_hash;
+    entry->wasm_size = wasm_size;
+    entry->module = module;
+    entry->refcount = 1;
+    entry->next = module_cache;
+    module_cache = entry;
+    pthread_mutex_unlock(&cache_lock);
+    memset(bytes, 0, sizeof(*bytes));
+    return entry;
+}
+
+// Caller holds cache_lock.  Unlink the pooled instances past the
+// first limit, and any idle longer than UDX_WASM_POOL_IDLE_MS, and
+// return them to be freed after the lock is let go.  The pool is in
+// order of return, so everything after the first one cut goes too.
+static struct pooled_instance* vwasm_trim_pool(struct cached_module *cached,
+                                               int limit,
+                                               uint64_t now) {
+    const uint64_t idle_ns = vwasm_pool_idle_ns();
+    struct pooled_instance **link = &cached->pool;
+    int kept = 0;
+    while(*link && kept < limit && now - (*link)->returned_at <= idle_ns) {
+        link = &(*link)->next;
+        ++kept;
+    }
+    struct pooled_instance *cut = *link;
+    *link = NULL;
+    cached->pool_size = kept;
+    return cut;
+}
+
+// Record the state's freshly made instance as the module's snapshot,
+// unless another state got there first.  Runs before anything calls
+// into the instance.
+static void vwasm_snapshot_module(struct wasm_state *ws) {
+    struct cached_module *cached = ws->cached;
+    if(vwasm_pool_limit() <= 0)
+        return;
+    pthread_mutex_lock(&cache_lock);
+    const bool taken = cached->snapshot_taken;
+    pthread_mutex_unlock(&cache_lock);
+    if(taken)
+        return;
+
+    const uint64_t phase = vwasm_trace_begin();
+    bool poolable = true;
+    struct memory_snapshot memory_snapshot;
+    memset(&memory_snapshot, 0, sizeof(memory_snapshot));
+    wasm_memory_t *memory = vwasm_find_memory(ws, "memory");
+    if(! memory || ! vwasm_snapshot_memory(wasm_memory_data(memory),
+                                           wasm_memory_data_size(memory),
+                                           &memory_snapshot))
+        poolable = false;
+    uint32_t *global_positions = (uint32_t*) calloc(ws->exports.size, sizeof(uint32_t));
+    wasm_val_t *global_values = (wasm_val_t*) calloc(ws->exports.size, sizeof(wasm_val_t));
+    size_t global_count = 0;
+    if(! global_positions || ! global_values)
+        poolable = false;
+    for(size_t i = 0; poolable && i < ws->exports.size; ++i) {
+        wasm_global_t *global = wasm_extern_kind(ws->exports.data[i]) == WASM_EXTERN_GLOBAL
+            ? wasm_extern_as_global(ws->exports.data[i])
+            : NULL;
+        if(! global)
+            continue;
+        wasm_globaltype_t *type = wasm_global_type(global);
+        const bool mutable_global = wasm_globaltype_mutability(type) == WASM_VAR;
+        wasm_globaltype_delete(type);
+        if(! mutable_global)
+            continue;
+        wasm_val_t value;
+        wasm_global_get(global, &value);
+        if(value.kind != WASM_I32 && value.kind != WASM_I64
+           && value.kind != WASM_F32 && value.kind != WASM_F64) {
+            poolable = false;
+            break;
+        }
+        global_positions[global_count] = (uint32_t) i;
+        global_values[global_count] = value;
+        ++global_count;
+    }
+    vwasm_trace_end("snapshot instance", poolable ? "poolable" : "not poolable", phase);
+
+    pthread_mutex_lock(&cache_lock);
+    const bool install = ! cached->snapshot_taken;
+    if(install) {
+        cached->snapshot_taken = true;
+        cached->poolable = poolable;
+        if(poolable) {
+            cached->memory = memory_snapshot;
+            cached->global_positions = global_positions;
+            cached->global_values = global_values;
+            cached->global_count = global_count;
+        }
+    }
+    pthread_mutex_unlock(&cache_lock);
+    if(! install || ! poolable) {
+        vwasm_free_memory_snapshot(&memory_snapshot);
+        free(global_positions);
+        free(global_values);
+    }
+}
+
+// Take a reset instance of the state's module from the pool, if there
+// is one
+static bool vwasm_take_instance(struct wasm_state *ws) {
+    struct cached_module *cached = ws->cached;
+    const int limit = vwasm_pool_limit();
+    if(limit <= 0)
+        return false;
+    pthread_mutex_lock(&cache_lock);
+    struct pooled_instance *cut = vwasm_trim_pool(cached, limit, vwasm_now_ns());
+    struct pooled_instance *taken = cached->pool;
+    if(taken) {
+        cached->pool = taken->next;
+        cached->pool_size--;
+    }
+    pthread_mutex_unlock(&cache_lock);
+    vwasm_free_pooled(cut);
+    if(! taken)
+        return false;
+    ws->store = taken->store;
+    ws->instance = taken->instance;
+    ws->exports = taken->exports;
+    ws->imports = taken->imports;
+    ws->poll = taken->poll;
+    if(ws->poll)
+        ws->poll->ws = ws;
+    free(taken);
+    return true;
+}
+
+// Reset the state's instance to the module's snapshot and give it to
+// the pool instead of deleting it.  Globals that aren't exported (such
+// as the C and Rust stack pointer) are back where they started after
+// every call that returns; a trap may have left them anywhere, so an
+// instance that trapped is never pooled.  Neither is one whose memory
+// grew, since memory can't shrink.  Returns whether the instance was
+// taken.
+static bool vwasm_return_instance(struct wasm_state *ws) {
+    struct cached_module *cached = ws->cached;
+    if(! cached || ! ws->instance || ! ws->reusable)
+        return false;
+    const int limit = vwasm_pool_limit();
+    if(limit <= 0)
+        return false;
+    pthread_mutex_lock(&cache_lock);
+    const bool poolable = cached->snapshot_taken && cached->poolable;
+    pthread_mutex_unlock(&cache_lock);
+    // the snapshot never changes once it is taken, and the state's
+    // reference keeps it alive
+    wasm_memory_t *memory = poolable ? vwasm_find_memory(ws, "memory") : NULL;
+    if(! memory || wasm_memory_data_size(memory) != cached->memory.size)
+        return false;
+    struct pooled_instance *pooled =
+        (struct pooled_instance*) malloc(sizeof(struct pooled_instance));
+    if(! pooled)
+        return false;
+
+    const uint64_t phase = vwasm_trace_begin();
+    vwasm_restore_memory(wasm_memory_data(memory), &cached->memory);
+    for(size_t i = 0; i < cached->global_count; ++i) {
+        wasm_global_t *global = wasm_extern_as_global(ws->exports.data[cached->global_positions[i]]);
+        wasm_global_set(global, &cached->global_values[i]);
+    }
+    vwasm_trace_end("reset instance", NULL, phase);
+    pooled->store = ws->store;
+    pooled->instance = ws->instance;
+    pooled->exports = ws->exports;
+    pooled->imports = ws->imports;
+    pooled->poll = ws->poll;
+    pooled->returned_at = vwasm_now_ns();
+    pthread_mutex_lock(&cache_lock);
+    pooled->next = cached->pool;
+    cached->pool = pooled;
+    cached->pool_size++;
+    struct pooled_instance *cut = vwasm_trim_pool(cached, limit, pooled->returned_at);
+    pthread_mutex_unlock(&cache_lock);
+    vwasm_free_pooled(cut);
+    ws->store = NULL;
+    ws->instance = NULL;
+    ws->exports.data = NULL;
+    ws->exports.size = 0;
+    ws->imports.data = NULL;
+    ws->imports.size = 0;
+    ws->poll = NULL;
+    return true;
+}
+
+// Drop a reference.  Modules nobody is using stay cached until there
+// are more idle ones than UDX_WASM_IDLE_MODULES; then the one idle the
+// longest is evicted.  Pooled instances idle too long are freed on the
+// way, whichever module they belong to.
+static void vwasm_release_module(struct cached_module *released) {
+    struct pooled_instance *expired = NULL;
+    const int pool_limit = vwasm_pool_limit();
+    const uint64_t now = vwasm_now_ns();
+    pthread_mutex_lock(&cache_lock);
+    for(struct cached_module *entry = module_cache; entry; entry = entry->next) {
+        struct pooled_instance *cut = vwasm_trim_pool(entry, pool_limit > 0 ? pool_limit : 0, now);
+        while(cut) {
+            struct pooled_instance *next = cut->next;
+            cut->next = expired;
+            expired = cut;
+            cut = next;
+        }
+    }
+    if(--released->refcount == 0) {
+        released->released_at = ++release_count;
+        const int limit = vwasm_idle_module_limit();
+        for(;;) {
+            int idle = 0;
+            struct cached_module **oldest = NULL;
+            for(struct cached_module **link = &module_cache; *link; link = &(*link)->next) {
+                if((*link)->refcount == 0) {
+                    ++idle;
+                    if(! oldest || (*link)->released_at < (*oldest)->released_at)
+                        oldest = link;
+                }
+            }
+            if(idle <= limit)
+                break;
+            struct cached_module *evicted = *oldest;
+            *oldest = evicted->next;
+            vwasm_free_cached_module(evicted);
+        }
+    }
+    pthread_mutex_unlock(&cache_lock);
+    vwasm_free_pooled(expired);
+}
+
+static void zero_wasm_state(struct wasm_state *ws) {
+    bzero(ws, sizeof(struct wasm_state));
+}
+
+// Release everything the state holds, in reverse order of creation
+static void initialize_wasm_state(struct wasm_state *ws) {
+    vwasm_return_instance(ws);
+    ws->reusable = false;
+    ws->call_budget = 0;
+    if(ws->exports.data) {
+        wasm_extern_vec_delete(&ws->exports);
+        ws->exports.data = NULL;
+        ws->exports.size = 0;
+    }
+    ws->func = NULL;
+    free(ws->funcs);
+    ws->funcs = NULL;
+    ws->memory = NULL;
+    ws->batch_offset = 0;
+    ws->batch_capacity = 0;
+    ws->memory64 = false;
+    if(ws->instance)
+        wasm_instance_delete(ws->instance);
+    ws->instance = NULL;
+    ws->trap = NULL;
+    if(ws->imports.data != NULL) {
+        wasm_extern_vec_delete(&ws->imports);
+        ws->imports.data = NULL;
+        ws->imports.size = 0;
+    }
+    if(ws->store)
+        wasm_store_delete(ws->store);
+    ws->store = NULL;
+    free(ws->poll);
+    ws->poll = NULL;
+    if(ws->cached)
+        vwasm_release_module(ws->cached);
+    ws->cached = NULL;
+    ws->module = NULL;
+}
+
+// The compiler udx_setup() will use, given the environment
+const char* udx_query_wasm_config() {
+    static const char* const UPPER_NAMES[] = {
+        [UDX_COMPILER_DEFAULT] = "DEFAULT",
+        [UDX_COMPILER_SINGLEPASS] = "SINGLEPASS",
+        [UDX_COMPILER_CRANELIFT] = "CRANELIFT",
+        [UDX_COMPILER_LLVM] = "LLVM",
+    };
+    struct udx_engine_options options;
+    char ebuf[EBUF_SIZE+1];
+    if(! vwasm_options_from_env(&options, ebuf))
+        return "Unknown";
+    return UPPER_NAMES[options.compiler];
+}
+
+const char* udx_describe_engine(void* v_ws) {
+    struct wasm_state* ws = (struct wasm_state*) v_ws;
+    // engine descriptions never change once the engine exists
+    return ws && ws->cached ? ws->cached->engine->description : "(not set up)";
+}
+
+static unsigned vwasm_sample_period() {
+    const char* setting = getenv("UDX_WASM_SAMPLE_CALLS");
+    return setting && *setting ? (unsigned) atoi(setting) : DEFAULT_SAMPLE_CALLS;
+}
+
+void* udx_get_wasm_state() {
+    pthread_once(&trace_once, vwasm_trace_from_env);
+    struct wasm_state* ws = (struct wasm_state*) malloc(sizeof(struct wasm_state));
+    if(ws) {
+        zero_wasm_state(ws);
+        ws->sample_period = vwasm_sample_period();
+        ws->until_sample = ws->sample_period;
+    }
+    return ws;
+}
+
+static void vwasm_add_stats(struct udx_wasm_stats *total, const struct udx_wasm_stats *stats) {
+    total->setups += stats->setups;
+    total->module_cache_hits += stats->module_cache_hits;
+    total->instance_pool_hits += stats->instance_pool_hits;
+    total->load_ns += stats->load_ns;
+    total->compile_ns += stats->compile_ns;
+    total->instantiate_ns += stats->instantiate_ns;
+    total->calls += stats->calls;
+    total->rows += stats->rows;
+    total->traps += stats->traps;
+    total->sampled_calls += stats->sampled_calls;
+    total->sampled_call_ns += stats->sampled_call_ns;
+}
+
+// Scale the sampled call time up to all the calls
+static void vwasm_estimate_call_ns(struct udx_wasm_stats *stats) {
+    stats->call_ns = stats->sampled_calls
+        ? (unsigned long long) ((double) stats->sampled_call_ns * stats->calls / stats->sampled_calls)
+        : 0;
+}
+
+void udx_get_stats(void* v_ws, struct udx_wasm_stats* stats) {
+    struct wasm_state* ws = (struct wasm_state*) v_ws;
+    memset(stats, 0, sizeof(*stats));
+    if(! ws)
+        return;
+    *stats = ws->stats;
+    vwasm_estimate_call_ns(stats);
+}
+
+void udx_get_process_stats(struct udx_wasm_stats* stats) {
+    pthread_mutex_lock(&stats_lock);
+    *stats = process_stats;
+    pthread_mutex_unlock(&stats_lock);
+    vwasm_estimate_call_ns(stats);
+}
+
+void udx_format_stats(const struct udx_wasm_stats* stats, char* buffer, size_t size) {
+    snprintf(buffer, size,
+             "%llu calls, %llu rows, %llu traps, ~%.3f ms in calls; "
+             "%llu setups (%llu cached, %llu pooled): load %.3f ms, compile %.3f ms, "
+             "instantiate %.3f ms",
+             stats->calls, stats->rows, stats->traps, stats->call_ns / 1e6,
+             stats->setups, stats->module_cache_hits, stats->instance_pool_hits,
+             stats->load_ns / 1e6,
+             stats->compile_ns / 1e6, stats->instantiate_ns / 1e6);
+}
+
+void udx_cleanup(void* v_ws) {
+    struct wasm_state* ws = (struct wasm_state*) v_ws;
+    if(! ws)
+        return;
+    initialize_wasm_state(ws);
+    pthread_mutex_lock(&stats_lock);
+    vwasm_add_stats(&process_stats, &ws->stats);
+    pthread_mutex_unlock(&stats_lock);
+    free(ws);
+}
+
+bool udx_setup(const char* filename,
+               void *v_ws,
+               const char* func_name,
+               char** error_str) {
+    struct wasm_state* ws = (struct wasm_state*) v_ws;
+    struct udx_engine_options options;
+    if(ws && ! vwasm_options_from_env(&options, ws->ebuf)) {
+        *error_str = ws->ebuf;
+        return false;
+    }
+    return udx_setup_with_options(filename, v_ws, func_name, &options, error_str);
+}
+
+// Everything before the bytes are in hand
+static bool vwasm_begin_setup(struct wasm_state *ws,
+                              const struct udx_engine_options* options,
+                              char** error_str) {
+    if(! ws) {
+        *error_str = "No wasm state (udx_get_wasm_state() out of memory?)";
+        return false;
+    }
+    // setting up a state twice releases whatever it held before
+    initialize_wasm_state(ws);
+    if(options->compiler < UDX_COMPILER_DEFAULT || options->compiler > UDX_COMPILER_LLVM) {
+        snprintf(ws->ebuf, EBUF_SIZE, "Unknown compiler %d", (int) options->compiler);
+        *error_str = ws->ebuf;
+        return false;
+    }
+    if(options->simd < UDX_SIMD_AUTO || options->simd > UDX_SIMD_OFF) {
+        snprintf(ws->ebuf, EBUF_SIZE, "Unknown SIMD setting %d", (int) options->simd);
+        *error_str = ws->ebuf;
+        return false;
+    }
+    return true;
+}
+
+static bool vwasm_setup(struct wasm_state *ws,
+                        struct module_bytes *bytes,
+                        const char* name,
+                        const char* filename,
+                        const char* func_name,
+                        const struct udx_engine_options* options,
+                        char** error_str);
+
+bool udx_setup_with_options(const char* filename,
+                            void *v_ws,
+                            const char* func_name,
+                            const struct udx_engine_options* options,
+                            char** error_str) {
+    struct wasm_state* ws = (struct wasm_state*) v_ws;
+    const uint64_t setup_start = vwasm_trace_begin();
+    if(! vwasm_begin_setup(ws, options, error_str))
+        return false;
+    struct module_bytes bytes;
+    const uint64_t start = vwasm_now_ns();
+    if(! vwasm_map_file(filename, &bytes, ws->ebuf)) {
+        *error_str = ws->ebuf;
+        return false;
+    }
+    ws->stats.load_ns += vwasm_now_ns() - start;
+    if(setup_start)
+        vwasm_trace_end("map file", filename, start);
+    const bool ok = vwasm_setup(ws, &bytes, filename, filename, func_name, options, error_str);
+    vwasm_trace_end("udx_setup", filename, setup_start);
+    return ok;
+}
+
+bool udx_setup_from_memory(const char* name,
+                           const void* data,
+                           size_t size,
+                           void* v_ws,
+                           const char* func_name,
+                           char** error_str) {
+    struct wasm_state* ws = (struct wasm_state*) v_ws;
+    struct udx_engine_options options;
+    if(ws && ! vwasm_options_from_env(&options, ws->ebuf)) {
+        *error_str = ws->ebuf;
+        return false;
+    }
+    return udx_setup_from_memory_with_options(name, data, size, v_ws, func_name,
+                                              &options, error_str);
+}
+
+bool udx_setup_from_memory_with_options(const char* name,
+                                        const void* data,
+                                        size_t size,
+                                        void* v_ws,
+                                        const char* func_name,
+                                        const struct udx_engine_options* options,
+                                        char** error_str) {
+    struct wasm_state* ws = (struct wasm_state*) v_ws;
+    const uint64_t setup_start = vwasm_trace_begin();
+    if(! vwasm_begin_setup(ws, options, error_str))
+        return false;
+    struct module_bytes bytes = { (const char*) data, size, 0, true };
+    const bool ok = vwasm_setup(ws, &bytes, name, NULL, func_name, options, error_str);
+    vwasm_trace_end("udx_setup_from_memory", name, setup_start);
+    return ok;
+}
+
+// The import an interruptible module's instance needs: udx.poll_interrupt,
+// checking this state's interrupt
+static bool vwasm_make_poll_import(struct wasm_state *ws) {
+    ws->poll = (struct poll_env*) malloc(sizeof(struct poll_env));
+    if(! ws->poll)
+        return false;
+    ws->poll->ws = ws;
+    wasm_functype_t *type = wasm_functype_new_0_0();
+    wasm_func_t *poll = wasm_func_new_with_env(ws->store, type, vwasm_poll_interrupt, ws->poll, NULL);
+    wasm_functype_delete(type);
+    if(! poll)
+        return false;
+    wasm_extern_t *import = wasm_func_as_extern(poll);
+    wasm_extern_vec_new(&ws->imports, 1, &import);
+    return true;
+}
+
+// Takes ownership of the bytes
+static bool vwasm_setup(struct wasm_state *ws,
+                        struct module_bytes *bytes,
+                        const char* name,
+                        const char* filename,
+                        const char* func_name,
+                        const struct udx_engine_options* options,
+                        char** error_str) {
+    bool cache_hit;
+    const uint64_t start = vwasm_now_ns();
+    ws->cached = vwasm_acquire_module(bytes, name, filename, options, &cache_hit, ws->ebuf);
+    const uint64_t acquired = vwasm_now_ns();
+    ws->stats.compile_ns += acquired - start;
+    if(vwasm_tracing())
+        vwasm_trace_end(cache_hit ? "acquire module (cached)" : "acquire module", name, start);
+    if(! ws->cached) {
+        *error_str = ws->ebuf;
+        return false;
+    }
+    ws->module = ws->cached->module;
+    ws->imports.data = NULL;
+    ws->imports.size = 0;
+    ws->trap = NULL;
+    uint64_t phase = vwasm_trace_begin();
+    const bool pooled = vwasm_take_instance(ws);
+    if(pooled) {
+        vwasm_trace_end("take pooled instance", name, phase);
+        phase = vwasm_trace_begin();
+    } else {
+        ws->store = wasm_store_new(ws->cached->engine->engine);
+        vwasm_trace_end("create store", name, phase);
+        if(ws->cached->engine->interruptible && ! vwasm_make_poll_import(ws)) {
+            initialize_wasm_state(ws);
+            snprintf(ws->ebuf, EBUF_SIZE, "Can't create the interrupt poll function");
+            *error_str = ws->ebuf;
+            return false;
+        }
+        phase = vwasm_trace_begin();
+        ws->instance = wasm_instance_new(ws->store,
+                                         ws->module,
+                                         &ws->imports,
+                                         &ws->trap);
+        vwasm_trace_end("instantiate", name, phase);
+        if(! ws->instance) {
+            initialize_wasm_state(ws);
+            snprintf(ws->ebuf, EBUF_SIZE, "Can't create wasm instance");
+            *error_str = ws->ebuf;
+            return false;
+        }
+
+        phase = vwasm_trace_begin();
+        wasm_instance_exports(ws->instance, &ws->exports);
+        if(ws->exports.size <= 0) {
+            initialize_wasm_state(ws);
+            snprintf(ws->ebuf, EBUF_SIZE, "Can't find any wasm exports");
+            *error_str = ws->ebuf;
+            return false;
+        }
+        vwasm_snapshot_module(ws);
+    }
+    ws->funcs = (wasm_func_t**) calloc(ws->exports.size, sizeof(wasm_func_t*));
+    if(! ws->funcs) {
+        initialize_wasm_state(ws);
+        snprintf(ws->ebuf, EBUF_SIZE, "Can't allocate function handles");
+        *error_str = ws->ebuf;
+        return false;
+    }
+    // no function name: the caller only wants the module (e.g., to
+    // save an artifact with udx_save_aot, or to look functions up
+    // with udx_lookup_function)
+    if(func_name)
+        ws->func = vwasm_find_func(ws, func_name);
+    if(func_name && ! ws->func) {
+        initialize_wasm_state(ws);
+        snprintf(ws->ebuf, EBUF_SIZE, "Can't find exported function '%s'", func_name);
+        *error_str = ws->ebuf;
+        return false;
+    }
+    if(! vwasm_find_batch_buffer(ws, error_str)) {
+        initialize_wasm_state(ws);
+        return false;
+    }
+    vwasm_trace_end("resolve exports", name, phase);
+    ws->stats.instantiate_ns += vwasm_now_ns() - acquired;
+    ws->stats.setups++;
+    ws->stats.module_cache_hits += cache_hit;
+    ws->stats.instance_pool_hits += pooled;
+    ws->reusable = true;
+    ws->call_budget = options->call_budget;
+    return true;
+}
+
+// Format the trap message into the state's error buffer.  Running out
+// of metering points traps like anything else, so those traps are told
+// apart by the flag and the points.
+static bool vwasm_call_failed(struct wasm_state *ws, wasm_trap_t *trap, char **error) {
+    if(vwasm_interrupted(ws)) {
+        snprintf(ws->ebuf, EBUF_SIZE, "> The wasm function was interrupted");
+    } else if(ws->call_budget && wasmer_metering_points_are_exhausted(ws->instance)) {
+        snprintf(ws->ebuf,
+                 EBUF_SIZE,
+                 "> The wasm function used up its budget of %llu points",
+                 ws->call_budget);
+    } else {
+        wasm_message_t message;
+        wasm_trap_message(trap, &message);
+        snprintf(ws->ebuf,
+                 EBUF_SIZE,
+                 "> Error calling the wasm function: %.*s",
+                 (int) message.size,
+                 message.data);
+        wasm_byte_vec_delete(&message);
+    }
+    wasm_trap_delete(trap);
+    *error = ws->ebuf;
+    return false;
+}
+
+void udx_watch_interrupt(void* v_ws, struct udx_interrupt* interrupt) {
+    struct wasm_state* ws = (struct wasm_state*) v_ws;
+    if(ws)
+        ws->interrupt = interrupt;
+}
+
+void udx_interrupt(struct udx_interrupt* interrupt) {
+    __atomic_store_n(&interrupt->raised, 1, __ATOMIC_RELEASE);
+}
+
+bool udx_lookup_function(void* v_ws, const char* name, int* handle, char** error) {
+    struct wasm_state* ws = (struct wasm_state*) v_ws;
+    if(! ws->instance) {
+        *error = "> udx_lookup_function needs a state set up by udx_setup";
+        return false;
+    }
+    int position;
+    wasm_extern_t *ext = vwasm_find_export(ws, name, WASM_EXTERN_FUNC, &position);
+    if(! ext) {
+        snprintf(ws->ebuf, EBUF_SIZE, "Can't find exported function '%s'", name);
+        *error = ws->ebuf;
+        return false;
+    }
+    if(! ws->funcs[position])
+        ws->funcs[position] = wasm_extern_as_func(ext);
+    *handle = position;
+    *error = NULL;
+    return true;
+}
+
+// The function a handle stands for, or NULL (with the message in
+// *error) if it isn't one
+static wasm_func_t* vwasm_handle_func(struct wasm_state *ws, int handle, char** error) {
+    if(handle == UDX_SETUP_FUNCTION && ws->func)
+        return ws->func;
+    if(handle >= 0 && handle < (int) ws->exports.size && ws->funcs[handle])
+        return ws->funcs[handle];
+    snprintf(ws->ebuf, EBUF_SIZE, "> %d is not a function handle of this state", handle);
+    *error = ws->ebuf;
+    return NULL;
+}
+
+const wasm_func_t* udx_get_function(void* v_ws, int handle) {
+    struct wasm_state* ws = (struct wasm_state*) v_ws;
+    char* error;
+    return vwasm_handle_func(ws, handle, &error);
+}
+
+// This is a specialized function for wasm functions that take two ints and return an int
+static bool vwasm_call_2i_1i(struct wasm_state *ws,
+                             wasm_func_t *func,
+                             int a,
+                             int b,
+                             int *result,
+                             char** error) {
+    wasm_val_t args_val[2] = { WASM_I32_VAL(a), WASM_I32_VAL(b) };
+    wasm_val_t results_val[1] = { WASM_INIT_VAL };
+    wasm_val_vec_t args = WASM_ARRAY_VEC(args_val);
+    wasm_val_vec_t results = WASM_ARRAY_VEC(results_val);
+
+    wasm_trap_t *trap = vwasm_func_call(ws, func, &args, &results, 1);
+    if (trap)
+        return vwasm_call_failed(ws, trap, error);
+
+    *error = NULL;
+    *result = results_val[0].of.i32;
+    return true;
+}
+
+bool udx_call_func_2i_1i(int a, int b, int *result, void* v_ws, char** error) {
+    struct wasm_state* ws = (struct wasm_state*) v_ws;
+    return vwasm_call_2i_1i(ws, ws->func, a, b, result, error);
+}
+
+bool udx_call_handle_2i_1i(int handle, int a, int b, int *result, void* v_ws, char** error) {
+    struct wasm_state* ws = (struct wasm_state*) v_ws;
+    wasm_func_t *func = vwasm_handle_func(ws, handle, error);
+    return func && vwasm_call_2i_1i(ws, func, a, b, result, error);
+}
+
+// This is a specialized function for wasm functions that take one
+// unsigned long long argument and return an unsigned long long
+static bool vwasm_call_ull_ull(struct wasm_state *ws,
+                               wasm_func_t *func,
+                               const unsigned long long a,
+                               unsigned long long *result,
+                               char** error) {
+    wasm_val_t args_val[1] = { WASM_I64_VAL(a) };
+    wasm_val_t results_val[1] = { WASM_INIT_VAL };
+    wasm_val_vec_t args = WASM_ARRAY_VEC(args_val);
+    wasm_val_vec_t results = WASM_ARRAY_VEC(results_val);
+
+    wasm_trap_t *trap = vwasm_func_call(ws, func, &args, &results, 1);
+    if (trap)
+        return vwasm_call_failed(ws, trap, error);
+    *error = NULL;
+    *result = results_val[0].of.i64;
+    return true;
+}
+
+bool udx_call_func_ull_ull(const unsigned long long a,
                            unsigned long long *result,
                            void* v_ws,
                            char** error) {
     struct wasm_state* ws = (struct wasm_state*) v_ws;
-    wasm_val_t args_val[1] = { WASM_I64_VAL(a) };
+    return vwasm_call_ull_ull(ws, ws->func, a, result, error);
+}
+
+bool udx_call_handle_ull_ull(int handle,
+                             const unsigned long long a,
+                             unsigned long long *result,
+                             void* v_ws,
+                             char** error) {
+    struct wasm_state* ws = (struct wasm_state*) v_ws;
+    wasm_func_t *func = vwasm_handle_func(ws, handle, error);
+    return func && vwasm_call_ull_ull(ws, func, a, result, error);
+}
+
+// Any signature; the caller has checked the types (see udx_wasm.hpp)
+bool udx_call_handle_vals(int handle,
+                          const wasm_val_t *args,
+                          size_t arg_count,
+                          wasm_val_t *results,
+                          size_t result_count,
+                          void* v_ws,
+                          char** error) {
+    struct wasm_state* ws = (struct wasm_state*) v_ws;
+    wasm_func_t *func = vwasm_handle_func(ws, handle, error);
+    if(! func)
+        return false;
+    // wasm_func_call only reads the arguments
+    const wasm_val_vec_t args_vec = { arg_count, (wasm_val_t*) args };
+    wasm_val_vec_t results_vec = { result_count, results };
+
+    wasm_trap_t *trap = vwasm_func_call(ws, func, &args_vec, &results_vec, 1);
+    if (trap)
+        return vwasm_call_failed(ws, trap, error);
+    *error = NULL;
+    return true;
+}
+
+static bool vwasm_has_batch_buffer(const struct wasm_state *ws, char **error) {
+    if(ws->batch_capacity == 0) {
+        *error = "> Module does not export a udx batch buffer";
+        return false;
+    }
+    return true;
+}
+
+// A guest address as a pointer argument: an i64 in a memory64 module,
+// an i32 otherwise.  Counts and sizes stay i32 either way (they are
+// ints and unsigneds in the guest).
+static wasm_val_t vwasm_address(const struct wasm_state *ws, uint64_t offset) {
+    wasm_val_t val;
+    if(ws->memory64) {
+        val.kind = WASM_I64;
+        val.of.i64 = (int64_t) offset;
+    } else {
+        val.kind = WASM_I32;
+        val.of.i32 = (int32_t) offset;
+    }
+    return val;
+}
+
+// How many rows of row_bytes each, plus their validity bits when there
+// may be nulls, fit in capacity bytes of the scratch area.  With a
+// bitmap, chunks are a multiple of 8 rows so that each starts on a byte
+// of it.
+static size_t vwasm_batch_chunk(struct wasm_state *ws,
+                                size_t capacity,
+                                size_t row_bytes,
+                                bool bitmap,
+                                char** error) {
+    size_t chunk = bitmap
+        ? (capacity * 8 / (row_bytes * 8 + 1)) & ~(size_t) 7
+        : capacity / row_bytes;
+    // the guest gets the row count as an int, even in memory64 modules
+    chunk = min(chunk, (size_t) INT_MAX & ~(size_t) 7);
+    if(chunk == 0) {
+        snprintf(ws->ebuf, EBUF_SIZE, "udx batch buffer (%llu bytes) is too small",
+                 (unsigned long long) ws->batch_capacity);
+        *error = ws->ebuf;
+    }
+    return chunk;
+}
+
+// Whether the first rows bits of valid are all set; no branches per
+// byte, so it costs next to nothing next to copying the columns
+static bool vwasm_all_valid(const unsigned char *valid, size_t rows) {
+    unsigned char all = 0xff;
+    const size_t bytes = rows / 8;
+    for(size_t i = 0; i < bytes; i++)
+        all &= valid[i];
+    if(rows % 8)
+        all &= valid[bytes] | (unsigned char) (0xff << (rows % 8));
+    return all == 0xff;
+}
+
+// Two int columns in, one int column out.  The scratch area is split
+// into three equal slices: a, b, result, and then the chunk's validity
+// bitmap if there is one.  masked may be NULL (see udx_wasm.h).
+static bool vwasm_call_batch_2i_1i(struct wasm_state *ws,
+                                   wasm_func_t *func,
+                                   wasm_func_t *masked,
+                                   const int *a,
+                                   const int *b,
+                                   const unsigned char *valid,
+                                   int *result,
+                                   size_t n,
+                                   char** error) {
+    if(! vwasm_has_batch_buffer(ws, error))
+        return false;
+    const size_t chunk = vwasm_batch_chunk(ws, ws->batch_capacity, 3 * sizeof(int), valid != NULL, error);
+    if(chunk == 0)
+        return false;
+    const uint64_t a_offset = ws->batch_offset;
+    const uint64_t b_offset = a_offset + chunk * sizeof(int);
+    const uint64_t result_offset = b_offset + chunk * sizeof(int);
+    const uint64_t valid_offset = result_offset + chunk * sizeof(int);
+
+    for(size_t done = 0; done < n; done += chunk) {
+        const size_t rows = min(chunk, n - done);
+        byte_t *mem = wasm_memory_data(ws->memory);
+        memcpy(mem + a_offset, a + done, rows * sizeof(int));
+        memcpy(mem + b_offset, b + done, rows * sizeof(int));
+
+        wasm_trap_t *trap;
+        if(! valid || ! masked || vwasm_all_valid(valid + done / 8, rows)) {
+            wasm_val_t args_val[4] = { vwasm_address(ws, a_offset),
+                                       vwasm_address(ws, b_offset),
+                                       vwasm_address(ws, result_offset),
+                                       WASM_I32_VAL((int32_t) rows) };
+            wasm_val_vec_t args = WASM_ARRAY_VEC(args_val);
+            wasm_val_vec_t results = WASM_EMPTY_VEC;
+            trap = vwasm_func_call(ws, func, &args, &results, rows);
+        } else {
+            memcpy(mem + valid_offset, valid + done / 8, (rows + 7) / 8);
+            wasm_val_t args_val[5] = { vwasm_address(ws, a_offset),
+                                       vwasm_address(ws, b_offset),
+                                       vwasm_address(ws, valid_offset),
+                                       vwasm_address(ws, result_offset),
+                                       WASM_I32_VAL((int32_t) rows) };
+            wasm_val_vec_t args = WASM_ARRAY_VEC(args_val);
+            wasm_val_vec_t results = WASM_EMPTY_VEC;
+            trap = vwasm_func_call(ws, masked, &args, &results, rows);
+        }
+        if(trap)
+            return vwasm_call_failed(ws, trap, error);
+
+        // re-fetch: the guest may have grown (and so moved) its memory
+        mem = wasm_memory_data(ws->memory);
+        memcpy(result + done, mem + result_offset, rows * sizeof(int));
+    }
+    *error = NULL;
+    return true;
+}
+
+bool udx_call_batch_2i_1i(const int *a,
+                          const int *b,
+                          int *result,
+                          size_t n,
+                          void* v_ws,
+                          char** error) {
+    struct wasm_state* ws = (struct wasm_state*) v_ws;
+    return vwasm_call_batch_2i_1i(ws, ws->func, NULL, a, b, NULL, result, n, error);
+}
+
+bool udx_call_batch_handle_2i_1i(int handle,
+                                 const int *a,
+                                 const int *b,
+                                 int *result,
+                                 size_t n,
+                                 void* v_ws,
+                                 char** error) {
+    struct wasm_state* ws = (struct wasm_state*) v_ws;
+    wasm_func_t *func = vwasm_handle_func(ws, handle, error);
+    return func && vwasm_call_batch_2i_1i(ws, func, NULL, a, b, NULL, result, n, error);
+}
+
+// The masked function of udx_call_batch_masked_*; *masked is NULL for
+// UDX_NO_FUNCTION
+static bool vwasm_masked_func(struct wasm_state *ws,
+                              int handle,
+                              wasm_func_t **masked,
+                              char** error) {
+    if(handle == UDX_NO_FUNCTION) {
+        *masked = NULL;
+        return true;
+    }
+    *masked = vwasm_handle_func(ws, handle, error);
+    return *masked != NULL;
+}
+
+bool udx_call_batch_masked_2i_1i(int handle,
+                                 int masked_handle,
+                                 const int *a,
+                                 const int *b,
+                                 const unsigned char *valid,
+                                 int *result,
+                                 size_t n,
+                                 void* v_ws,
+                                 char** error) {
+    struct wasm_state* ws = (struct wasm_state*) v_ws;
+    wasm_func_t *func = vwasm_handle_func(ws, handle, error);
+    wasm_func_t *masked;
+    return func && vwasm_masked_func(ws, masked_handle, &masked, error)
+        && vwasm_call_batch_2i_1i(ws, func, masked, a, b, valid, result, n, error);
+}
+
+// One unsigned long long column in, one out.  The scratch area is
+// split into two equal slices: a, result, and then the chunk's
+// validity bitmap if there is one.
+static bool vwasm_call_batch_ull_ull(struct wasm_state *ws,
+                                     wasm_func_t *func,
+                                     wasm_func_t *masked,
+                                     const unsigned long long *a,
+                                     const unsigned char *valid,
+                                     unsigned long long *result,
+                                     size_t n,
+                                     char** error) {
+    if(! vwasm_has_batch_buffer(ws, error))
+        return false;
+    const size_t chunk = vwasm_batch_chunk(ws, ws->batch_capacity, 2 * sizeof(unsigned long long), valid != NULL, error);
+    if(chunk == 0)
+        return false;
+    const uint64_t a_offset = ws->batch_offset;
+    const uint64_t result_offset = a_offset + chunk * sizeof(unsigned long long);
+    const uint64_t valid_offset = result_offset + chunk * sizeof(unsigned long long);
+
+    for(size_t done = 0; done < n; done += chunk) {
+        const size_t rows = min(chunk, n - done);
+        byte_t *mem = wasm_memory_data(ws->memory);
+        memcpy(mem + a_offset, a + done, rows * sizeof(unsigned long long));
+
+        wasm_trap_t *trap;
+        if(! valid || ! masked || vwasm_all_valid(valid + done / 8, rows)) {
+            wasm_val_t args_val[3] = { vwasm_address(ws, a_offset),
+                                       vwasm_address(ws, result_offset),
+                                       WASM_I32_VAL((int32_t) rows) };
+            wasm_val_vec_t args = WASM_ARRAY_VEC(args_val);
+            wasm_val_vec_t results = WASM_EMPTY_VEC;
+            trap = vwasm_func_call(ws, func, &args, &results, rows);
+        } else {
+            memcpy(mem + valid_offset, valid + done / 8, (rows + 7) / 8);
+            wasm_val_t args_val[4] = { vwasm_address(ws, a_offset),
+                                       vwasm_address(ws, valid_offset),
+                                       vwasm_address(ws, result_offset),
+                                       WASM_I32_VAL((int32_t) rows) };
+            wasm_val_vec_t args = WASM_ARRAY_VEC(args_val);
+            wasm_val_vec_t results = WASM_EMPTY_VEC;
+            trap = vwasm_func_call(ws, masked, &args, &results, rows);
+        }
+        if(trap)
+            return vwasm_call_failed(ws, trap, error);
+
+        mem = wasm_memory_data(ws->memory);
+        memcpy(result + done, mem + result_offset, rows * sizeof(unsigned long long));
+    }
+    *error = NULL;
+    return true;
+}
+
+bool udx_call_batch_ull_ull(const unsigned long long *a,
+                            unsigned long long *result,
+                            size_t n,
+                            void* v_ws,
+                            char** error) {
+    struct wasm_state* ws = (struct wasm_state*) v_ws;
+    return vwasm_call_batch_ull_ull(ws, ws->func, NULL, a, NULL, result, n, error);
+}
+
+bool udx_call_batch_handle_ull_ull(int handle,
+                                   const unsigned long long *a,
+                                   unsigned long long *result,
+                                   size_t n,
+                                   void* v_ws,
+                                   char** error) {
+    struct wasm_state* ws = (struct wasm_state*) v_ws;
+    wasm_func_t *func = vwasm_handle_func(ws, handle, error);
+    return func && vwasm_call_batch_ull_ull(ws, func, NULL, a, NULL, result, n, error);
+}
+
+bool udx_call_batch_masked_ull_ull(int handle,
+                                   int masked_handle,
+                                   const unsigned long long *a,
+                                   const unsigned char *valid,
+                                   unsigned long long *result,
+                                   size_t n,
+                                   void* v_ws,
+                                   char** error) {
+    struct wasm_state* ws = (struct wasm_state*) v_ws;
+    wasm_func_t *func = vwasm_handle_func(ws, handle, error);
+    wasm_func_t *masked;
+    return func && vwasm_masked_func(ws, masked_handle, &masked, error)
+        && vwasm_call_batch_ull_ull(ws, func, masked, a, valid, result, n, error);
+}
+
+// Copy as many rows of a string column, from row done on, as fit in
+// capacity bytes at in_offset: their offsets, counted from the first
+// one's, and then their strings.  Returns the number of rows, and where
+// the strings went in *data_offset; 0 (with the message in *error) if
+// not even row done fits.
+static size_t vwasm_put_strings(struct wasm_state *ws,
+                                uint64_t in_offset,
+                                uint32_t capacity,
+                                const char *data,
+                                const unsigned *offsets,
+                                size_t done,
+                                size_t n,
+                                uint64_t *data_offset,
+                                char** error) {
+    size_t rows = 0;
+    while(done + rows < n
+          && (rows + 2) * sizeof(unsigned) + (offsets[done + rows + 1] - offsets[done]) <= capacity)
+        rows++;
+    if(rows == 0) {
+        snprintf(ws->ebuf, EBUF_SIZE, "row %zu (%u bytes) doesn't fit in the udx batch buffer",
+                 done, offsets[done + 1] - offsets[done]);
+        *error = ws->ebuf;
+        return 0;
+    }
+    *data_offset = in_offset + (rows + 1) * sizeof(unsigned);
+    byte_t *mem = wasm_memory_data(ws->memory);
+    unsigned *in_offsets = (unsigned *) (mem + in_offset);
+    for(size_t i = 0; i <= rows; i++)
+        in_offsets[i] = offsets[done + i] - offsets[done];
+    memcpy(mem + *data_offset, data + offsets[done], offsets[done + rows] - offsets[done]);
+    return rows;
+}
+
+// Check the string results the guest says it wrote: rows offsets after
+// out_offsets[0], none going backwards or past capacity
+static bool vwasm_check_out_offsets(struct wasm_state *ws,
+                                    const unsigned *out_offsets,
+                                    uint32_t rows,
+                                    uint32_t capacity,
+                                    size_t done,
+                                    char** error) {
+    for(uint32_t i = 1; i <= rows; i++) {
+        if(out_offsets[i] < out_offsets[i - 1] || out_offsets[i] > capacity) {
+            snprintf(ws->ebuf, EBUF_SIZE, "string function wrote a bad offset for row %zu",
+                     done + i - 1);
+            *error = ws->ebuf;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Both string calls split the scratch area in halves, the first for
+// the input and the second for the output, and need it aligned for
+// their offsets (align is a power of 2).  The offsets and sizes the
+// guest sees are unsigneds, so the calls use at most the first 4 GiB
+// of the area, *window bytes.
+static bool vwasm_string_buffer(struct wasm_state *ws,
+                                uint32_t align,
+                                uint32_t *window,
+                                uint32_t *half,
+                                char** error) {
+    if(! vwasm_has_batch_buffer(ws, error))
+        return false;
+    if(ws->batch_offset % align) {
+        snprintf(ws->ebuf, EBUF_SIZE, "udx batch buffer at %llu isn't aligned for string offsets",
+                 (unsigned long long) ws->batch_offset);
+        *error = ws->ebuf;
+        return false;
+    }
+    *window = (uint32_t) min(ws->batch_capacity, (uint64_t) UINT32_MAX);
+    *half = (*window / 2) & ~(align - 1);
+    return true;
+}
+
+// One string column in, one out (see udx_wasm.h).  The first half of
+// the scratch area holds a chunk's offsets and then its strings; the
+// second half the result offsets and then the results.
+bool udx_call_batch_str_str(int handle,
+                            const char *data,
+                            const unsigned *offsets,
+                            size_t n,
+                            udx_string_sink sink,
+                            void *sink_context,
+                            void* v_ws,
+                            char** error) {
+    struct wasm_state* ws = (struct wasm_state*) v_ws;
+    wasm_func_t *func = vwasm_handle_func(ws, handle, error);
+    uint32_t window, half;
+    if(! func || ! vwasm_string_buffer(ws, sizeof(unsigned), &window, &half, error))
+        return false;
+    const uint64_t in_offset = ws->batch_offset;
+    const uint64_t out_offsets_offset = in_offset + half;
+    const uint32_t out_area = window - half;
+
+    size_t done = 0;
+    while(done < n) {
+        uint64_t data_offset;
+        const size_t rows = vwasm_put_strings(ws, in_offset, half, data, offsets, done, n,
+                                              &data_offset, error);
+        if(rows == 0)
+            return false;
+        const uint64_t out_offset = out_offsets_offset + (rows + 1) * sizeof(unsigned);
+        const uint32_t out_capacity = out_area - (rows + 1) * sizeof(unsigned);
+        byte_t *mem = wasm_memory_data(ws->memory);
+        ((unsigned *) (mem + out_offsets_offset))[0] = 0;
+
+        wasm_val_t args_val[6] = { vwasm_address(ws, data_offset),
+                                   vwasm_address(ws, in_offset),
+                                   WASM_I32_VAL((int32_t) rows),
+                                   vwasm_address(ws, out_offset),
+                                   WASM_I32_VAL((int32_t) out_capacity),
+                                   vwasm_address(ws, out_offsets_offset) };
+        wasm_val_t results_val[1] = { WASM_INIT_VAL };
+        wasm_val_vec_t args = WASM_ARRAY_VEC(args_val);
+        wasm_val_vec_t results = WASM_ARRAY_VEC(results_val);
+        wasm_trap_t *trap = vwasm_func_call(ws, func, &args, &results, rows);
+        if(trap)
+            return vwasm_call_failed(ws, trap, error);
+
+        // The guest's word on where its results are is checked before
+        // the host reads them
+        const uint32_t finished = (uint32_t) results_val[0].of.i32;
+        if(finished == 0) {
+            snprintf(ws->ebuf, EBUF_SIZE, "the result of row %zu doesn't fit in the udx batch buffer",
+                     done);
+            *error = ws->ebuf;
+            return false;
+        }
+        if(finished > rows) {
+            snprintf(ws->ebuf, EBUF_SIZE, "string function finished %u of %zu rows", finished, rows);
+            *error = ws->ebuf;
+            return false;
+        }
+        mem = wasm_memory_data(ws->memory);
+        const unsigned *out_offsets = (const unsigned *) (mem + out_offsets_offset);
+        if(! vwasm_check_out_offsets(ws, out_offsets, finished, out_capacity, done, error))
+            return false;
+        sink(sink_context, (const char *) mem + out_offset, out_offsets, finished);
+        done += finished;
+    }
+    *error = NULL;
+    return true;
+}
+
+// One string column in, any number of rows out per row in (see
+// udx_wasm.h).  The first half of the scratch area holds the input as
+// for udx_call_batch_str_str(); the second half the output row count,
+// then the int columns, the source rows and the string offsets, which
+// take about half of it between them, and then the strings.
+bool udx_call_batch_str_rows(int handle,
+                             const char *data,
+                             const unsigned *offsets,
+                             size_t n,
+                             size_t int_columns,
+                             udx_rows_sink sink,
+                             void *sink_context,
+                             void* v_ws,
+                             char** error) {
+    struct wasm_state* ws = (struct wasm_state*) v_ws;
+    wasm_func_t *func = vwasm_handle_func(ws, handle, error);
+    uint32_t window, half;
+    if(! func || ! vwasm_string_buffer(ws, sizeof(long long), &window, &half, error))
+        return false;
+    const uint32_t out_area = window - half;
+    const size_t row_bytes = int_columns * sizeof(long long) + 2 * sizeof(unsigned);
+    const uint32_t max_rows = (out_area / 2 - 2 * sizeof(unsigned)) / row_bytes;
+    if(max_rows == 0) {
+        snprintf(ws->ebuf, EBUF_SIZE, "udx batch buffer (%u bytes) is too small for %zu int columns",
+                 window, int_columns);
+        *error = ws->ebuf;
+        return false;
+    }
+    const uint64_t in_offset = ws->batch_offset;
+    const uint64_t count_offset = in_offset + half;
+    const uint64_t ints_offset = count_offset + sizeof(long long);
+    const uint64_t source_offset = ints_offset + max_rows * int_columns * sizeof(long long);
+    const uint64_t out_offsets_offset = source_offset + max_rows * sizeof(unsigned);
+    const uint64_t out_offset = out_offsets_offset + (max_rows + 1) * sizeof(unsigned);
+    const uint32_t out_capacity = (uint32_t) (ws->batch_offset + window - out_offset);
+
+    size_t done = 0;
+    while(done < n) {
+        uint64_t data_offset;
+        const size_t rows = vwasm_put_strings(ws, in_offset, half, data, offsets, done, n,
+                                              &data_offset, error);
+        if(rows == 0)
+            return false;
+        byte_t *mem = wasm_memory_data(ws->memory);
+        *(unsigned *) (mem + count_offset) = 0;
+        ((unsigned *) (mem + out_offsets_offset))[0] = 0;
+
+        wasm_val_t args_val[10] = { vwasm_address(ws, data_offset),
+                                    vwasm_address(ws, in_offset),
+                                    WASM_I32_VAL((int32_t) rows),
+                                    vwasm_address(ws, source_offset),
+                                    vwasm_address(ws, ints_offset),
+                                    WASM_I32_VAL((int32_t) max_rows),
+                                    vwasm_address(ws, out_offset),
+                                    WASM_I32_VAL((int32_t) out_capacity),
+                                    vwasm_address(ws, out_offsets_offset),
+                                    vwasm_address(ws, count_offset) };
+        wasm_val_t results_val[1] = { WASM_INIT_VAL };
+        wasm_val_vec_t args = WASM_ARRAY_VEC(args_val);
+        wasm_val_vec_t results = WASM_ARRAY_VEC(results_val);
+        wasm_trap_t *trap = vwasm_func_call(ws, func, &args, &results, rows);
+        if(trap)
+            return vwasm_call_failed(ws, trap, error);
+
+        const uint32_t finished = (uint32_t) results_val[0].of.i32;
+        if(finished == 0) {
+            snprintf(ws->ebuf, EBUF_SIZE, "the rows from row %zu don't fit in the udx batch buffer",
+                     done);
+            *error = ws->ebuf;
+            return false;
+        }
+        if(finished > rows) {
+            snprintf(ws->ebuf, EBUF_SIZE, "row function finished %u of %zu rows", finished, rows);
+            *error = ws->ebuf;
+            return false;
+        }
+        mem = wasm_memory_data(ws->memory);
+        const uint32_t out_rows = *(const unsigned *) (mem + count_offset);
+        if(out_rows > max_rows) {
+            snprintf(ws->ebuf, EBUF_SIZE, "row function wrote %u rows, with room for %u",
+                     out_rows, max_rows);
+            *error = ws->ebuf;
+            return false;
+        }
+        const unsigned *source = (const unsigned *) (mem + source_offset);
+        for(uint32_t i = 0; i < out_rows; i++) {
+            if(source[i] >= finished || (i > 0 && source[i] < source[i - 1])) {
+                snprintf(ws->ebuf, EBUF_SIZE, "row function wrote a bad source row for output row %u", i);
+                *error = ws->ebuf;
+                return false;
+            }
+        }
+        const unsigned *out_offsets = (const unsigned *) (mem + out_offsets_offset);
+        if(! vwasm_check_out_offsets(ws, out_offsets, out_rows, out_capacity, done, error))
+            return false;
+        sink(sink_context, done, source, (const long long *) (mem + ints_offset),
+             (const char *) mem + out_offset, out_offsets, out_rows);
+        done += finished;
+    }
+    *error = NULL;
+    return true;
+}
+
+// Aggregates (see udx_wasm.h).  The accumulator sits at the start of
+// the scratch area, rounded up to 8 bytes; after it come another
+// accumulator to combine, or a chunk of values and its bitmap.
+#define AGGREGATE_NAME_SIZE 128
+
+static size_t vwasm_state_bytes(const struct udx_aggregate *aggregate) {
+    return (aggregate->state_size + 7) & ~(size_t) 7;
+}
+
+bool udx_aggregate_lookup(void* v_ws,
+                          const char* name,
+                          struct udx_aggregate* aggregate,
+                          char** error) {
+    struct wasm_state* ws = (struct wasm_state*) v_ws;
+    static const char* const SUFFIXES[] = { "_init", "_update", "_combine", "_terminate" };
+    int* const handles[] = { &aggregate->init, &aggregate->update,
+                             &aggregate->combine, &aggregate->terminate };
+    char export_name[AGGREGATE_NAME_SIZE];
+    for(size_t i = 0; i < sizeof(SUFFIXES) / sizeof(SUFFIXES[0]); i++) {
+        if(snprintf(export_name, sizeof(export_name), "%s%s", name, SUFFIXES[i])
+           >= (int) sizeof(export_name)) {
+            *error = "> aggregate name is too long";
+            return false;
+        }
+        if(! udx_lookup_function(ws, export_name, handles[i], error))
+            return false;
+    }
+    if(! vwasm_has_batch_buffer(ws, error))
+        return false;
+    snprintf(export_name, sizeof(export_name), "%s_state_size", name);
+    wasm_func_t *size_func = vwasm_find_func(ws, export_name);
+    uint64_t state_size;
+    if(! size_func || ! vwasm_call_void_int(size_func, &state_size)) {
+        snprintf(ws->ebuf, EBUF_SIZE, "Can't get the state size from '%s'", export_name);
+        *error = ws->ebuf;
+        return false;
+    }
+    aggregate->state_size = state_size;
+    const size_t state_bytes = vwasm_state_bytes(aggregate);
+    if(state_size == 0 || 2 * state_bytes >= ws->batch_capacity
+       || vwasm_batch_chunk(ws, ws->batch_capacity - state_bytes, sizeof(long long), true, error) == 0) {
+        snprintf(ws->ebuf, EBUF_SIZE, "%s state of %llu bytes doesn't fit in the udx batch buffer (%llu bytes)",
+                 name, (unsigned long long) state_size, (unsigned long long) ws->batch_capacity);
+        *error = ws->ebuf;
+        return false;
+    }
+    *error = NULL;
+    return true;
+}
+
+bool udx_aggregate_init(const struct udx_aggregate* aggregate,
+                        void* state,
+                        void* v_ws,
+                        char** error) {
+    struct wasm_state* ws = (struct wasm_state*) v_ws;
+    wasm_func_t *func = vwasm_handle_func(ws, aggregate->init, error);
+    if(! func)
+        return false;
+    wasm_val_t args_val[1] = { vwasm_address(ws, ws->batch_offset) };
+    wasm_val_vec_t args = WASM_ARRAY_VEC(args_val);
+    wasm_val_vec_t results = WASM_EMPTY_VEC;
+    wasm_trap_t *trap = vwasm_func_call(ws, func, &args, &results, 0);
+    if(trap)
+        return vwasm_call_failed(ws, trap, error);
+    memcpy(state, wasm_memory_data(ws->memory) + ws->batch_offset, aggregate->state_size);
+    *error = NULL;
+    return true;
+}
+
+// state is only written when every chunk went in, so after an error it
+// still holds the accumulator as it was
+bool udx_aggregate_update_i64(const struct udx_aggregate* aggregate,
+                              void* state,
+                              const long long* values,
+                              const unsigned char* valid,
+                              size_t n,
+                              void* v_ws,
+                              char** error) {
+    struct wasm_state* ws = (struct wasm_state*) v_ws;
+    wasm_func_t *func = vwasm_handle_func(ws, aggregate->update, error);
+    if(! func)
+        return false;
+    const size_t state_bytes = vwasm_state_bytes(aggregate);
+    const size_t chunk = vwasm_batch_chunk(ws, ws->batch_capacity - state_bytes, sizeof(long long),
+                                           valid != NULL, error);
+    if(chunk == 0)
+        return false;
+    const uint64_t state_offset = ws->batch_offset;
+    const uint64_t values_offset = state_offset + state_bytes;
+    const uint64_t valid_offset = values_offset + chunk * sizeof(long long);
+
+    memcpy(wasm_memory_data(ws->memory) + state_offset, state, aggregate->state_size);
+    for(size_t done = 0; done < n; done += chunk) {
+        const size_t rows = min(chunk, n - done);
+        byte_t *mem = wasm_memory_data(ws->memory);
+        memcpy(mem + values_offset, values + done, rows * sizeof(long long));
+        const bool nulls = valid && ! vwasm_all_valid(valid + done / 8, rows);
+        if(nulls)
+            memcpy(mem + valid_offset, valid + done / 8, (rows + 7) / 8);
+
+        wasm_val_t args_val[4] = { vwasm_address(ws, state_offset),
+                                   vwasm_address(ws, values_offset),
+                                   vwasm_address(ws, nulls ? valid_offset : 0),
+                                   WASM_I32_VAL((int32_t) rows) };
+        wasm_val_vec_t args = WASM_ARRAY_VEC(args_val);
+        wasm_val_vec_t results = WASM_EMPTY_VEC;
+        wasm_trap_t *trap = vwasm_func_call(ws, func, &args, &results, rows);
+        if(trap)
+            return vwasm_call_failed(ws, trap, error);
+    }
+    memcpy(state, wasm_memory_data(ws->memory) + state_offset, aggregate->state_size);
+    *error = NULL;
+    return true;
+}
+
+bool udx_aggregate_combine(const struct udx_aggregate* aggregate,
+                           void* state,
+                           const void* const* others,
+                           size_t count,
+                           void* v_ws,
+                           char** error) {
+    struct wasm_state* ws = (struct wasm_state*) v_ws;
+    wasm_func_t *func = vwasm_handle_func(ws, aggregate->combine, error);
+    if(! func)
+        return false;
+    const uint64_t state_offset = ws->batch_offset;
+    const uint64_t other_offset = state_offset + vwasm_state_bytes(aggregate);
+
+    memcpy(wasm_memory_data(ws->memory) + state_offset, state, aggregate->state_size);
+    for(size_t i = 0; i < count; i++) {
+        memcpy(wasm_memory_data(ws->memory) + other_offset, others[i], aggregate->state_size);
+        wasm_val_t args_val[2] = { vwasm_address(ws, state_offset),
+                                   vwasm_address(ws, other_offset) };
+        wasm_val_vec_t args = WASM_ARRAY_VEC(args_val);
+        wasm_val_vec_t results = WASM_EMPTY_VEC;
+        wasm_trap_t *trap = vwasm_func_call(ws, func, &args, &results, 0);
+        if(trap)
+            return vwasm_call_failed(ws, trap, error);
+    }
+    memcpy(state, wasm_memory_data(ws->memory) + state_offset, aggregate->state_size);
+    *error = NULL;
+    return true;
+}
+
+bool udx_aggregate_terminate_i64(const struct udx_aggregate* aggregate,
+                                 const void* state,
+                                 long long* result,
+                                 void* v_ws,
+                                 char** error) {
+    struct wasm_state* ws = (struct wasm_state*) v_ws;
+    wasm_func_t *func = vwasm_handle_func(ws, aggregate->terminate, error);
+    if(! func)
+        return false;
+    memcpy(wasm_memory_data(ws->memory) + ws->batch_offset, state, aggregate->state_size);
+    wasm_val_t args_val[1] = { vwasm_address(ws, ws->batch_offset) };
     wasm_val_t results_val[1] = { WASM_INIT_VAL };
     wasm_val_vec_t args = WASM_ARRAY_VEC(args_val);
     wasm_val_vec_t results = WASM_ARRAY_VEC(results_val);
+    wasm_trap_t *trap = vwasm_func_call(ws, func, &args, &results, 0);
+    if(trap)
+        return vwasm_call_failed(ws, trap, error);
+    *result = results_val[0].of.i64;
+    *error = NULL;
+    return true;
+}
 
-    if (wasm_func_call(ws->func, &args, &results)) {
-        *error = "> Error calling the `sum` function!";
+bool udx_save_aot(void* v_ws, const char* aot_filename, char** error) {
+    struct wasm_state* ws = (struct wasm_state*) v_ws;
+    if(! ws->cached) {
+        *error = "> udx_save_aot needs a state set up by udx_setup";
+        return false;
+    }
+    if(! vwasm_save_aot(ws->cached->module,
+                        ws->cached->engine,
+                        aot_filename,
+                        ws->cached->wasm_hash,
+                        ws->cached->wasm_size,
+                        ws->ebuf)) {
+        *error = ws->ebuf;
         return false;
     }
     *error = NULL;
-    *result = results_val[0].of.i64;
     return true;
 }
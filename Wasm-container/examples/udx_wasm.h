@@ -1,15 +1,192 @@
 #ifndef udx_wasm_h
 #define udx_wasm_h
 #include <stdbool.h>
+#include <stddef.h>
 
+// Threading contract:
+//
+// Each udx_get_wasm_state() call allocates a new, independent state
+// (store, instance and error buffer).  Different states may be used
+// from different threads at the same time; a single state must only
+// be used by one thread at a time.  The one thing another thread may do
+// is raise an interrupt the state watches (udx_interrupt()), which
+// touches the caller's flag and not the state.
+// That matches Vertica, which gives every thread its own ScalarFunction
+// object --- get the state in setup() and release it in destroy().
+//
+// Error messages returned through place_to_put_errormsg_ptr point
+// into the state and remain valid until the next call on that state
+// (or udx_cleanup()).
+//
+// There is one Wasm engine per process for each set of engine options,
+// and compiled modules are cached by engine and the contents of the
+// .wasm file, so only the first udx_setup() of a module compiles it.
+// Modules stay cached while any state uses them; up to
+// UDX_WASM_IDLE_MODULES (default 8) unused modules are kept for the
+// next query before the oldest are evicted.
+//
+// udx_cleanup() doesn't delete the state's instance either: unless a
+// call trapped or grew its memory, the instance's linear memory and
+// exported mutable globals are put back as instantiation left them and
+// it goes into a pool for the next setup of the same module, which then
+// skips creating a store and instantiating.  Up to
+// UDX_WASM_POOL_INSTANCES (default 4; 0 turns pooling off) instances
+// are kept per module, and those unused for UDX_WASM_POOL_IDLE_MS
+// (default 60000) are freed.  Guests must keep their state in linear
+// memory or exported globals (as C and Rust do) for a pooled instance
+// to look fresh; a module exporting no memory is never pooled.
+
+// Which wasmer compiler translates Wasm to machine code.  DEFAULT is
+// whatever this wasmer build prefers (cranelift, when it's there).
+// SINGLEPASS compiles fastest and generates the slowest code, LLVM is
+// the other way around; not every wasmer build has every compiler.
+enum udx_compiler {
+    UDX_COMPILER_DEFAULT,
+    UDX_COMPILER_SINGLEPASS,
+    UDX_COMPILER_CRANELIFT,
+    UDX_COMPILER_LLVM
+};
+
+// Wasm SIMD128 (v128) instructions.  AUTO turns them on when the host
+// CPU can run the compiled vector code (SSE4.1 on x86-64, any aarch64);
+// with them off, modules that use them don't compile.
+enum udx_simd {
+    UDX_SIMD_AUTO,
+    UDX_SIMD_ON,
+    UDX_SIMD_OFF
+};
+
+struct udx_engine_options {
+    enum udx_compiler compiler;
+    // Host CPU features the generated code may use in addition to the
+    // baseline, comma separated in wasmer's spelling ("avx2,bmi2").
+    // NULL or "" for the baseline.  Artifacts compiled with features
+    // are only loaded on CPUs that have them.
+    const char* cpu_features;
+    // Make NaN results bit-for-bit deterministic, at some cost on
+    // floating point code
+    bool canonicalize_nans;
+    enum udx_simd simd;
+    // States whose options differ only here get different engines, and
+    // compile their modules separately; 0 (the default) is the engine
+    // everything else shares.  For measuring what sharing one engine
+    // costs (see scaling.cpp); artifacts are the same either way.
+    int engine_group;
+    // Points each crossing into Wasm may use (a batch call crosses
+    // once per chunk) before it traps; 0 for no limit.  This is the
+    // only thing that bounds how long a call runs by itself: otherwise
+    // a runaway guest runs until an interrupt stops it, and only on an
+    // interruptible engine does an interrupt stop a call already
+    // running (see udx_interrupt()).  A budget compiles modules with
+    // wasmer's metering middleware, which counts down points (one per
+    // Wasm operator) and traps when they run out.  Metered code runs
+    // somewhat slower (bench's fib -budget rows measure by how much) and
+    // gets an engine and artifacts of its own, which states with
+    // different budgets share.
+    unsigned long long call_budget;
+    // Rewrite modules before compiling them so that their code polls the
+    // state's interrupt: every 65536 function calls and loop iterations,
+    // it calls a host function the rewrite imports (udx.poll_interrupt),
+    // which traps once the interrupt is raised.  That is what stops a
+    // call that is already running when udx_interrupt() is called.  The
+    // countdown costs something on every call and loop iteration
+    // (bench's fib -interruptible rows measure how much); modules get an
+    // engine and artifacts of their own.  Modules using Wasm GC can't be
+    // rewritten, and fail to set up.
+    bool interruptible;
+    // Only take Wasm modules: bytes that are an ahead-of-time artifact
+    // are an error, and no artifact is looked for next to the file or
+    // in $UDX_WASM_CACHE_DIR (nor saved there).  Artifacts are native
+    // code that runs unchecked, so set this when whoever names the
+    // module isn't trusted with the process.  Not part of the engine.
+    bool wasm_only;
+};
+
+// Case-insensitive "default", "singlepass", "cranelift", or "llvm"
+bool udx_parse_compiler(const char* name, enum udx_compiler* compiler);
+
+// Case-insensitive "auto", "on", or "off"
+bool udx_parse_simd(const char* name, enum udx_simd* simd);
+
+// Whether UDX_SIMD_AUTO turns SIMD128 on for this CPU
+bool udx_host_supports_simd();
+
+// The options udx_setup() uses: UDX_WASM_COMPILER (a compiler name),
+// UDX_WASM_CPU_FEATURES, UDX_WASM_CANONICALIZE_NANS (non-zero to turn
+// it on), UDX_WASM_SIMD (auto, on, or off), UDX_WASM_CALL_BUDGET
+// (points) and UDX_WASM_INTERRUPTIBLE (non-zero to turn it on) from the
+// environment, defaults for the rest.  Returns false if
+// UDX_WASM_COMPILER or UDX_WASM_SIMD isn't one of its choices.
+bool udx_default_engine_options(struct udx_engine_options* options);
+
+// The compiler udx_setup() will use, upper case ("CRANELIFT")
 const char* udx_query_wasm_config();
 
+// Returns NULL if the state can't be allocated
 void* udx_get_wasm_state();
 
+// Load (from the cache, an ahead-of-time artifact, or by compiling)
+// and instantiate filename, and bind ws to its export func_name.  The
+// file is mapped, not read into a copy on the heap.  func_name may be
+// NULL to just load the module (and then use
+// udx_lookup_function).
+//
+// Ahead-of-time artifacts: udx_setup uses filename.aot (see
+// udx_save_aot) if it exists, then looks in the directory named by
+// $UDX_WASM_CACHE_DIR, if set, and saves what it compiles there.  An
+// artifact is only used if it was made from the same .wasm bytes by
+// the same wasmer version and engine settings, for a CPU with no
+// features this one lacks.  Artifacts are trusted --- only point
+// udx_setup at ones you built yourself, and set wasm_only in the
+// options when the file name comes from someone else.
 bool udx_setup(const char* filename,
                void* ws,
                const char* func_name,
                char **place_to_put_errormsg_ptr);
+
+// udx_setup() on bytes already in memory instead of a file: a .wasm
+// module, or an artifact written by udx_save_aot() (recognized by its
+// header).  Nothing is read from the file system and the bytes aren't
+// copied; they need only stay valid during the call.  The cache knows
+// a module by the address as well as the contents of its bytes, so
+// pass the same (e.g., linked-in) bytes each time.  name is only used
+// in error messages.  An artifact built for a different wasmer, engine
+// or CPU is an error, since there is nothing to compile instead.
+bool udx_setup_from_memory(const char* name,
+                           const void* bytes,
+                           size_t size,
+                           void* ws,
+                           const char* func_name,
+                           char **place_to_put_errormsg_ptr);
+
+// udx_setup() and udx_setup_from_memory() with explicit engine options
+// instead of the environment's.  Fail if the requested compiler isn't
+// in this wasmer build or a CPU feature name isn't recognized.
+bool udx_setup_with_options(const char* filename,
+                            void* ws,
+                            const char* func_name,
+                            const struct udx_engine_options* options,
+                            char **place_to_put_errormsg_ptr);
+
+bool udx_setup_from_memory_with_options(const char* name,
+                                        const void* bytes,
+                                        size_t size,
+                                        void* ws,
+                                        const char* func_name,
+                                        const struct udx_engine_options* options,
+                                        char **place_to_put_errormsg_ptr);
+
+// The engine a set-up state runs on, e.g. "cranelift cpu=avx2
+// canonical-nans" ("no-simd" when SIMD128 is off); for logging and
+// benchmark output
+const char* udx_describe_engine(void* ws);
+
+// Save the compiled module of a set-up state as an ahead-of-time
+// artifact (written to a temporary file and renamed into place)
+bool udx_save_aot(void* ws,
+                  const char* aot_filename,
+                  char **place_to_put_errormsg_ptr);
+// Releases the state and everything it holds; ws is invalid afterwards
 void udx_cleanup(void* ws);
 
 // 2 int args, returns 1 int
@@ -24,4 +201,344 @@ bool udx_call_func_ull_ull(const unsigned long long a,
                          unsigned long long *place_to_put_result,
                          void* ws,
                          char** place_to_put_errormsg_ptr);
+
+// Function handles: one set-up state (one instance) can call any of
+// the module's exported functions, not just the one named in
+// udx_setup().  Look each up once, by name, and call it by handle
+// with the udx_call_handle_* and udx_call_batch_handle_* variants.
+// Handles belong to the state and stay valid until it is set up
+// again or cleaned up.  UDX_SETUP_FUNCTION stands for the function
+// named in udx_setup().
+#define UDX_SETUP_FUNCTION (-1)
+
+bool udx_lookup_function(void* ws,
+                         const char* name,
+                         int* place_to_put_handle,
+                         char** place_to_put_errormsg_ptr);
+
+bool udx_call_handle_2i_1i(int handle,
+                           const int a,
+                           const int b,
+                           int *place_to_put_result,
+                           void* ws,
+                           char** place_to_put_errormsg_ptr);
+
+bool udx_call_handle_ull_ull(int handle,
+                             const unsigned long long a,
+                             unsigned long long *place_to_put_result,
+                             void* ws,
+                             char** place_to_put_errormsg_ptr);
+
+// Any signature: arg_count arguments in, result_count results out.
+// Nothing checks the values' kinds against the function's type; C++
+// callers get that (and the marshaling) from WasmFunction in
+// udx_wasm.hpp.
+struct wasm_val_t;
+struct wasm_func_t;
+bool udx_call_handle_vals(int handle,
+                          const struct wasm_val_t *args,
+                          size_t arg_count,
+                          struct wasm_val_t *results,
+                          size_t result_count,
+                          void* ws,
+                          char** place_to_put_errormsg_ptr);
+
+// The function a handle stands for; NULL if it isn't one
+const struct wasm_func_t* udx_get_function(void* ws, int handle);
+
+// Column-batch calls cross into Wasm once per chunk of rows instead of
+// once per row.  The module must export its linear memory as "memory"
+// and a scratch area described by
+//     udx_batch_buffer()   --- guest address of the area
+//     udx_batch_capacity() --- size of the area in bytes
+// The host copies the input columns into the scratch area, calls the
+// function named in udx_setup() once, and copies the output column
+// back out.  Blocks bigger than the scratch area are split into chunks.
+//
+// Memory64 modules (clang --target=wasm64-unknown-unknown) work too: a
+// module whose udx_batch_buffer() returns an i64 gets every pointer
+// argument below as an i64, so its scratch area and the rest of its
+// memory may lie past 4 GiB.  Counts and sizes (the ints and unsigneds
+// in the signatures) stay i32s, so a call takes at most INT_MAX rows
+// per chunk, and the string calls use at most the first 4 GiB of the
+// scratch area.  udx_batch_capacity() and name_state_size() may return
+// either an i32 or an i64.
+
+// 2 int columns in, 1 int column out; the Wasm function is
+//     void f(const int *a, const int *b, int *result, int n)
+bool udx_call_batch_2i_1i(const int *a,
+                          const int *b,
+                          int *place_to_put_results,
+                          size_t n,
+                          void* ws,
+                          char** place_to_put_errormsg_ptr);
+
+// 1 ull column in, 1 ull column out; the Wasm function is
+//     void f(const unsigned long long *a, unsigned long long *result, int n)
+bool udx_call_batch_ull_ull(const unsigned long long *a,
+                            unsigned long long *place_to_put_results,
+                            size_t n,
+                            void* ws,
+                            char** place_to_put_errormsg_ptr);
+
+// The same, calling a function found with udx_lookup_function()
+bool udx_call_batch_handle_2i_1i(int handle,
+                                 const int *a,
+                                 const int *b,
+                                 int *place_to_put_results,
+                                 size_t n,
+                                 void* ws,
+                                 char** place_to_put_errormsg_ptr);
+
+bool udx_call_batch_handle_ull_ull(int handle,
+                                   const unsigned long long *a,
+                                   unsigned long long *place_to_put_results,
+                                   size_t n,
+                                   void* ws,
+                                   char** place_to_put_errormsg_ptr);
+
+// Column batches with nulls.  valid is a validity bitmap, one bit per
+// row: row i is not null when bit i % 8 of valid[i / 8] is set (NULL
+// means no row is null).  Chunks without nulls run the plain batch
+// function, handle, as above; nothing about nulls crosses into Wasm.
+// Chunks with nulls run masked_handle, which also gets the chunk's
+// bitmap (copied into the scratch area after the columns) and need
+// not compute the null rows:
+//     void f(const int *a, const int *b, const unsigned char *valid, int *result, int n)
+//     void f(const unsigned long long *a, const unsigned char *valid,
+//            unsigned long long *result, int n)
+// With masked_handle UDX_NO_FUNCTION they run the plain function over
+// every row instead, so null rows must hold harmless values (0, say).
+// Either way the results in null rows are unspecified: the output's
+// bitmap is valid.
+#define UDX_NO_FUNCTION (-2)
+
+bool udx_call_batch_masked_2i_1i(int handle,
+                                 int masked_handle,
+                                 const int *a,
+                                 const int *b,
+                                 const unsigned char *valid,
+                                 int *place_to_put_results,
+                                 size_t n,
+                                 void* ws,
+                                 char** place_to_put_errormsg_ptr);
+
+bool udx_call_batch_masked_ull_ull(int handle,
+                                   int masked_handle,
+                                   const unsigned long long *a,
+                                   const unsigned char *valid,
+                                   unsigned long long *place_to_put_results,
+                                   size_t n,
+                                   void* ws,
+                                   char** place_to_put_errormsg_ptr);
+
+// String columns (VARCHAR or VARBINARY: just bytes, no terminating
+// NULs).  Row i of a column is data + offsets[i] up to data +
+// offsets[i + 1], so n rows have n + 1 offsets, and the strings lie
+// back to back.
+//
+// One string column in, one out; the Wasm function is
+//     int f(const char *data, const unsigned *offsets, int n,
+//           char *out, unsigned out_capacity, unsigned *out_offsets)
+// The host copies a chunk's strings into the scratch area in one go,
+// with its offsets counted from the chunk's first string.  The guest
+// writes the result of row i to out + out_offsets[i] up to out +
+// out_offsets[i + 1] (out_offsets[0] is 0), all within out_capacity
+// bytes, and returns how many rows it finished: fewer than n when the
+// next result wouldn't fit.  Finished rows go to sink, which gets
+// pointers into linear memory --- copy the strings out (e.g. into
+// BlockWriter's) before returning --- and the rest are sent again.  A
+// row whose string or result doesn't fit in half the scratch area on
+// its own is an error.
+typedef void (*udx_string_sink)(void *context,
+                                const char *data,
+                                const unsigned *offsets,
+                                size_t rows);
+
+bool udx_call_batch_str_str(int handle,
+                            const char *data,
+                            const unsigned *offsets,
+                            size_t n,
+                            udx_string_sink sink,
+                            void *sink_context,
+                            void* ws,
+                            char** place_to_put_errormsg_ptr);
+
+// One string column in, any number of rows out for each row in, each
+// with int_columns integer columns and a string; the Wasm function is
+//     int f(const char *data, const unsigned *offsets, int n,
+//           unsigned *source, long long *ints, unsigned max_rows,
+//           char *out, unsigned out_capacity, unsigned *out_offsets,
+//           unsigned *out_rows)
+// The input goes in as for udx_call_batch_str_str().  The guest writes
+// output row r's input row (within the chunk) to source[r], its
+// integers to ints[r * int_columns] on, and its string as out_offsets
+// describes, for at most max_rows rows; it sets *out_rows and returns
+// how many input rows it finished, leaving out a row whose output
+// doesn't all fit.  The rows come out in input order, so one pass over
+// the input makes all of a pipeline's columns and rows.  sink gets each
+// chunk's output rows, with first_row, the chunk's first input row, to
+// add to source; the pointers are into linear memory, as for
+// udx_string_sink.
+typedef void (*udx_rows_sink)(void *context,
+                              size_t first_row,
+                              const unsigned *source,
+                              const long long *ints,
+                              const char *data,
+                              const unsigned *offsets,
+                              size_t rows);
+
+bool udx_call_batch_str_rows(int handle,
+                             const char *data,
+                             const unsigned *offsets,
+                             size_t n,
+                             size_t int_columns,
+                             udx_rows_sink sink,
+                             void *sink_context,
+                             void* ws,
+                             char** place_to_put_errormsg_ptr);
+
+// Aggregates.  The guest's accumulator is state_size bytes that the
+// host keeps (in Vertica's intermediate storage, say) between calls
+// and places at the start of the scratch area for each one; the guest
+// exports, for an aggregate called name,
+//     int name_state_size()
+//     void name_init(void *state)
+//     void name_update(void *state, const long long *values,
+//                      const unsigned char *valid, int n)
+//     void name_combine(void *state, const void *other)
+//     long long name_terminate(const void *state)
+// update gets a whole column, and valid (0 when no row is null) is a
+// validity bitmap as for udx_call_batch_masked_*.
+struct udx_aggregate {
+    int init;
+    int update;
+    int combine;
+    int terminate;
+    size_t state_size;
+};
+
+// Look up name's exports and its state size, which must leave room in
+// the scratch area for two states and some rows
+bool udx_aggregate_lookup(void* ws,
+                          const char* name,
+                          struct udx_aggregate* aggregate,
+                          char** place_to_put_errormsg_ptr);
+
+// A new accumulator into state
+bool udx_aggregate_init(const struct udx_aggregate* aggregate,
+                        void* state,
+                        void* ws,
+                        char** place_to_put_errormsg_ptr);
+
+// Fold n values into state.  The state goes into linear memory once,
+// the values in as few chunks as fit, and the state comes back out
+// once.
+bool udx_aggregate_update_i64(const struct udx_aggregate* aggregate,
+                              void* state,
+                              const long long* values,
+                              const unsigned char* valid,
+                              size_t n,
+                              void* ws,
+                              char** place_to_put_errormsg_ptr);
+
+// Fold count other accumulators into state
+bool udx_aggregate_combine(const struct udx_aggregate* aggregate,
+                           void* state,
+                           const void* const* others,
+                           size_t count,
+                           void* ws,
+                           char** place_to_put_errormsg_ptr);
+
+bool udx_aggregate_terminate_i64(const struct udx_aggregate* aggregate,
+                                 const void* state,
+                                 long long* place_to_put_result,
+                                 void* ws,
+                                 char** place_to_put_errormsg_ptr);
+
+// Counters each state keeps, to tell whether a slow query's time goes
+// to setup, to calls into Wasm, or elsewhere.  Times are nanoseconds.
+// Setup is always timed.  Only one call in UDX_WASM_SAMPLE_CALLS
+// (default 64; 1 times every call, 0 none) is timed, so call_ns is an
+// estimate: the sampled time scaled up to all the calls.
+struct udx_wasm_stats {
+    unsigned long long setups;          // successful udx_setup*() calls
+    unsigned long long module_cache_hits; // setups that found the module compiled
+    unsigned long long instance_pool_hits; // setups that reused a pooled instance
+    unsigned long long load_ns;         // mapping .wasm files
+    unsigned long long compile_ns;      // finding, loading or compiling modules
+    unsigned long long instantiate_ns;  // instantiating and resolving exports
+    unsigned long long calls;           // crossings into Wasm (one per batch chunk)
+    unsigned long long rows;            // rows those calls handled
+    unsigned long long traps;
+    unsigned long long sampled_calls;
+    unsigned long long sampled_call_ns;
+    unsigned long long call_ns;         // estimated time in all calls
+};
+
+// The counters of one state, since udx_get_wasm_state()
+void udx_get_stats(void* ws, struct udx_wasm_stats* stats);
+
+// The totals of every state udx_cleanup() has released in this process
+void udx_get_process_stats(struct udx_wasm_stats* stats);
+
+// One line for a log, e.g. "1000 calls, 1000 rows, 0 traps, ~0.012 ms
+// in calls; 1 setup (0 cached, 0 pooled): load 0.005 ms, compile 3.1 ms,
+// instantiate 0.02 ms"
+void udx_format_stats(const struct udx_wasm_stats* stats, char* buffer, size_t size);
+
+// Cancelling a query.  An interrupt is a flag the caller owns and keeps
+// for as long as any state watches it --- in a UDx, a member of the
+// function object, so that cancel() never touches a state that setup()
+// or destroy() may be creating or freeing at the same moment.
+struct udx_interrupt {
+    int raised;
+};
+#define UDX_INTERRUPT_INIT { 0 }
+
+// Have a state watch interrupt (NULL: none), from the thread using the
+// state.  Every crossing into Wasm --- each per-row call, each chunk of
+// a batch call --- first checks the flag, and once it is raised fails
+// with a message saying it was interrupted, without entering the
+// guest.  The state keeps watching the flag when it is set up again,
+// so an interrupt raised before or during setup is not lost.  Wasmer's
+// C API has no way to stop a running call from another thread, so
+// unless the state was set up with the interruptible engine option, an
+// interrupt only takes effect between calls: a call already running
+// when the flag goes up runs to its end (or to its call_budget).  With
+// interruptible, the guest itself checks the flag every so often and
+// the running call fails with the same message.
+void udx_watch_interrupt(void* ws, struct udx_interrupt* interrupt);
+
+// Raise interrupt.  Safe from any thread at any time, since it touches
+// nothing but the flag; raised stays raised.
+void udx_interrupt(struct udx_interrupt* interrupt);
+
+// Setup tracing: with tracing on, every phase of udx_setup*() (mapping
+// the file, hashing, creating the engine, waiting for the cache lock,
+// loading artifacts, compiling, indexing exports, creating the store,
+// instantiating, resolving exports) is recorded with monotonic
+// timestamps in a process-wide ring buffer of the last 4096 phases.
+//
+// UDX_WASM_TRACE=prefix in the environment turns tracing on from the
+// first udx_get_wasm_state() and writes prefix.<pid>.json when the
+// process exits (or the library is unloaded).  Otherwise turn it on
+// and off with udx_trace_enable().
+void udx_trace_enable(bool on);
+
+// Write the ring buffer as Chrome trace-event JSON (for chrome://tracing
+// or ui.perfetto.dev).  Returns the number of events written, or -1
+// (with errno set) if the file can't be written.
+int udx_trace_dump(const char* filename);
+
+// Profiling: with UDX_WASM_PERF_MAP=1 in the environment, every module
+// a process loads or compiles adds lines to /tmp/perf-<pid>.map naming
+// its code "wasm:<module> (<engine>)", so perf report and perf top put
+// samples in compiled Wasm code under the module instead of showing
+// bare addresses.  Wasmer's C API doesn't say where each function's
+// code is, so a module's code --- its functions and the trampolines
+// wasmer compiled for it --- is one symbol; time in libwasmer and in
+// udx_wasm has the usual symbols.  The map is only appended to, so a
+// module unloaded and another loaded at the same address keep both
+// names.
 #endif // udx_wasm_h
@@ -0,0 +1,218 @@
+#ifndef udx_wasm_hpp
+#define udx_wasm_hpp
+// Typed calls into Wasm for C++ callers, on top of udx_wasm.h:
+//
+//     WasmFunction<unsigned long long(unsigned long long)> fib;
+//     if(! udx_setup(file, ws, NULL, &error) || ! fib.bind(ws, "fib", &error))
+//         ...
+//     unsigned long long result;
+//     if(! fib.call(50, &result, &error))
+//         ...
+//
+// bind() checks the export's wasm_functype against the C++ signature
+// once; after that call() only packs the arguments into an array on
+// the stack and unpacks the result.  The mapping from C++ types to
+// Wasm types is done at compile time, so a signature with a type Wasm
+// can't carry doesn't compile.
+//
+// Integers of 4 bytes or less are i32, 8-byte integers are i64,
+// float is f32 and double is f64.  Wasm doesn't know about signedness;
+// the bits are passed through unchanged.  A void return type means
+// the function returns nothing.
+
+#include <cstddef>
+#include <cstdio>
+#include <type_traits>
+extern "C" {
+#include "wasmer.h"
+#include "udx_wasm.h"
+}
+
+namespace udx_wasm {
+
+template <typename T, typename Enable = void>
+struct WasmType;
+
+template <typename T>
+struct WasmType<T, typename std::enable_if<std::is_integral<T>::value
+                                           && sizeof(T) <= 4>::type> {
+    static const wasm_valkind_t kind = WASM_I32;
+    static wasm_val_t to(T v) {
+        wasm_val_t val;
+        val.kind = kind;
+        val.of.i32 = static_cast<int32_t>(v);
+        return val;
+    }
+    static T from(const wasm_val_t &val) { return static_cast<T>(val.of.i32); }
+};
+
+template <typename T>
+struct WasmType<T, typename std::enable_if<std::is_integral<T>::value
+                                           && sizeof(T) == 8>::type> {
+    static const wasm_valkind_t kind = WASM_I64;
+    static wasm_val_t to(T v) {
+        wasm_val_t val;
+        val.kind = kind;
+        val.of.i64 = static_cast<int64_t>(v);
+        return val;
+    }
+    static T from(const wasm_val_t &val) { return static_cast<T>(val.of.i64); }
+};
+
+template <>
+struct WasmType<float> {
+    static const wasm_valkind_t kind = WASM_F32;
+    static wasm_val_t to(float v) {
+        wasm_val_t val;
+        val.kind = kind;
+        val.of.f32 = v;
+        return val;
+    }
+    static float from(const wasm_val_t &val) { return val.of.f32; }
+};
+
+template <>
+struct WasmType<double> {
+    static const wasm_valkind_t kind = WASM_F64;
+    static wasm_val_t to(double v) {
+        wasm_val_t val;
+        val.kind = kind;
+        val.of.f64 = v;
+        return val;
+    }
+    static double from(const wasm_val_t &val) { return val.of.f64; }
+};
+
+inline const char* wasm_kind_name(wasm_valkind_t kind) {
+    switch(kind) {
+    case WASM_I32: return "i32";
+    case WASM_I64: return "i64";
+    case WASM_F32: return "f32";
+    case WASM_F64: return "f64";
+    default: return "ref";
+    }
+}
+
+// What is common to every signature: binding and checking the type
+template <typename R, typename... Args>
+class WasmFunctionBase {
+protected:
+    static const size_t arg_count = sizeof...(Args);
+    static const size_t result_count = std::is_void<R>::value ? 0 : 1;
+
+    void* ws;
+    int handle;
+    char ebuf[256];
+
+    WasmFunctionBase() : ws(NULL), handle(UDX_SETUP_FUNCTION) { ebuf[0] = '\0'; }
+
+    bool fail(char** error) {
+        *error = ebuf;
+        return false;
+    }
+
+    bool check_kinds(const wasm_valtype_vec_t *types,
+                     const wasm_valkind_t *expected,
+                     size_t count,
+                     const char* what,
+                     char** error) {
+        if(types->size != count) {
+            snprintf(ebuf, sizeof(ebuf), "Wasm function has %zu %ss, the C++ signature %zu",
+                     types->size, what, count);
+            return fail(error);
+        }
+        for(size_t i = 0; i < count; ++i) {
+            const wasm_valkind_t kind = wasm_valtype_kind(types->data[i]);
+            if(kind != expected[i]) {
+                snprintf(ebuf, sizeof(ebuf), "Wasm function %s %zu is %s, in the C++ signature %s",
+                         what, i, wasm_kind_name(kind), wasm_kind_name(expected[i]));
+                return fail(error);
+            }
+        }
+        return true;
+    }
+
+public:
+    // Use the exported function called name, after checking its type.
+    // Several WasmFunctions may share one state.  The message in
+    // *error stays valid until the next call on this object.
+    bool bind(void* v_ws, const char* name, char** error) {
+        int name_handle;
+        if(! udx_lookup_function(v_ws, name, &name_handle, error))
+            return false;
+        return bind(v_ws, name_handle, error);
+    }
+
+    // Use the function ws was set up with (by udx_setup())
+    bool bind(void* v_ws, char** error) {
+        return bind(v_ws, UDX_SETUP_FUNCTION, error);
+    }
+
+    bool bind(void* v_ws, int func_handle, char** error) {
+        ws = NULL;
+        const wasm_func_t* func = udx_get_function(v_ws, func_handle);
+        if(! func) {
+            snprintf(ebuf, sizeof(ebuf), "No such wasm function");
+            return fail(error);
+        }
+        // one more element than needed, so neither array is empty
+        const wasm_valkind_t arg_kinds[arg_count + 1] = { WasmType<Args>::kind... };
+        const wasm_valkind_t result_kinds[2] = { result_kind<R>() };
+        wasm_functype_t* type = wasm_func_type(func);
+        const bool ok = check_kinds(wasm_functype_params(type), arg_kinds, arg_count,
+                                    "parameter", error)
+            && check_kinds(wasm_functype_results(type), result_kinds, result_count,
+                           "result", error);
+        wasm_functype_delete(type);
+        if(! ok)
+            return false;
+        ws = v_ws;
+        handle = func_handle;
+        *error = NULL;
+        return true;
+    }
+
+private:
+    template <typename T>
+    static typename std::enable_if<std::is_void<T>::value, wasm_valkind_t>::type result_kind() {
+        return 0;
+    }
+    template <typename T>
+    static typename std::enable_if<! std::is_void<T>::value, wasm_valkind_t>::type result_kind() {
+        return WasmType<T>::kind;
+    }
+};
+
+template <typename Signature>
+class WasmFunction;
+
+template <typename R, typename... Args>
+class WasmFunction<R(Args...)> : public WasmFunctionBase<R, Args...> {
+    typedef WasmFunctionBase<R, Args...> Base;
+public:
+    bool call(Args... args, R* result, char** error) {
+        wasm_val_t arg_vals[Base::arg_count + 1] = { WasmType<Args>::to(args)... };
+        // the right kind, in case the runtime looks
+        wasm_val_t result_val = WasmType<R>::to(R());
+        if(! udx_call_handle_vals(this->handle, arg_vals, Base::arg_count,
+                                  &result_val, 1, this->ws, error))
+            return false;
+        *result = WasmType<R>::from(result_val);
+        return true;
+    }
+};
+
+template <typename... Args>
+class WasmFunction<void(Args...)> : public WasmFunctionBase<void, Args...> {
+    typedef WasmFunctionBase<void, Args...> Base;
+public:
+    bool call(Args... args, char** error) {
+        wasm_val_t arg_vals[Base::arg_count + 1] = { WasmType<Args>::to(args)... };
+        return udx_call_handle_vals(this->handle, arg_vals, Base::arg_count,
+                                    NULL, 0, this->ws, error);
+    }
+};
+
+} // namespace udx_wasm
+
+#endif // udx_wasm_hpp
@@ -0,0 +1,36 @@
+// Compile a .wasm file ahead of time into the artifact udx_setup()
+// looks for next to it:
+//     udx_wasm_aot fib.c.wasm fib.c.wasm.aot
+
+#include <stdio.h>
+
+#include "udx_wasm.h"
+
+const char* progname;
+
+int main(int argc, const char* argv[]) {
+    char* errormsg;
+    progname = argv[0];
+
+    if(argc != 3) {
+        fprintf(stderr, "%s: Usage: %s wasm-file aot-file\n", progname, progname);
+        return 1;
+    }
+    const char* filename = argv[1];
+    const char* aot_filename = argv[2];
+
+    void* ws = udx_get_wasm_state();
+    if(! udx_setup(filename, ws, NULL, &errormsg)) {
+        fprintf(stderr, "%s: %s\n", progname, errormsg);
+        udx_cleanup(ws);
+        return 1;
+    }
+    if(! udx_save_aot(ws, aot_filename, &errormsg)) {
+        fprintf(stderr, "%s: %s\n", progname, errormsg);
+        udx_cleanup(ws);
+        return 1;
+    }
+    printf("%s: compiled %s into %s\n", progname, filename, aot_filename);
+    udx_cleanup(ws);
+    return 0;
+}